@@ -2,6 +2,11 @@
 #include <Elementary.h>
 #include "termpty.h"
 #include "backlog.h"
+#include <sys/mman.h>
+
+#ifndef MAP_ANON
+# define MAP_ANON MAP_ANONYMOUS
+#endif
 
 
 static int ts_comp = 0;
@@ -10,6 +15,33 @@ static int ts_freeops = 0;
 static Eina_List *ptys = NULL;
 
 static int64_t _mem_used = 0;
+/* the backlogs of threaded ptys are changed from their own thread */
+static Eina_Spinlock _stats_lock;
+static Eina_Bool _stats_lock_ready = EINA_FALSE;
+static Eina_Bool _compact_requested = EINA_FALSE; /* protected by it */
+
+/* The compactor compresses, from a timer, the backlog lines that are
+ * neither among the most recent ones nor recently used */
+#define COMPACT_INTERVAL 0.5
+#define COMPACT_BATCH    4096 /* entries looked at per pty and run */
+#define COMPACT_RECENT   128 /* most recent entries left uncompressed */
+static Ecore_Timer *_compact_timer = NULL;
+static unsigned char _compact_gen = 0;
+/* scratch space of _save_compress(), given back when it got big or once
+ * the compactor has nothing left to do */
+#define COMPRESS_BUF_KEEP (16 * 1024)
+static unsigned char *_compress_buf = NULL;
+static size_t _compress_buf_size = 0;
+
+static Eina_Bool _compact_cb(void *data);
+
+static void
+_compress_buf_free(void)
+{
+   free(_compress_buf);
+   _compress_buf = NULL;
+   _compress_buf_size = 0;
+}
 
 static void
 _accounting_change(int64_t diff)
@@ -22,49 +54,988 @@ _accounting_change(int64_t diff)
      {
         diff = ((-1 * diff + 16-1) / 16) * -16;
      }
+   if (_stats_lock_ready)
+     eina_spinlock_take(&_stats_lock);
    _mem_used += diff;
+   if (_stats_lock_ready)
+     eina_spinlock_release(&_stats_lock);
+}
+
+static void
+_counts_change(int comp, int uncomp, int freeops)
+{
+   if (_stats_lock_ready)
+     eina_spinlock_take(&_stats_lock);
+   ts_comp += comp;
+   ts_uncomp += uncomp;
+   ts_freeops += freeops;
+   if (_stats_lock_ready)
+     eina_spinlock_release(&_stats_lock);
+}
+
+/* {{{ Slab */
+
+/* The backlog lines, compressed or not, are stored in slots of a few size
+ * classes, carved out of chunks aligned on their size so that the chunk of
+ * a slot is found by masking its address.  Sustained output then reuses
+ * the same slots instead of doing a malloc()/free() pair per line, and the
+ * accounting is that of the chunks, slack included.  Bigger lines are
+ * left to malloc() */
+#define SLAB_CHUNK_SIZE (64 * 1024)
+#define SLAB_SLOT_MAX   8192
+static const unsigned short _slab_classes[] = {
+     16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768,
+     1024, 1536, 2048, 3072, 4096, 6144, SLAB_SLOT_MAX
+};
+#define SLAB_CLASSES (int)(sizeof(_slab_classes) / sizeof(_slab_classes[0]))
+
+typedef struct _Slab_Chunk Slab_Chunk;
+struct _Slab_Chunk
+{
+   Slab_Chunk *next, *prev;
+   void *free; /* slots given back, linked through their first bytes */
+   unsigned int used; /* slots handed out */
+   unsigned int fresh; /* slots never handed out */
+};
+/* the slots start after the header, 16-byte aligned */
+#define SLAB_CHUNK_HEADER ((sizeof(Slab_Chunk) + 15) & ~(size_t)15)
+
+#define SLAB_CHUNK_SLOTS(Cls) \
+   ((SLAB_CHUNK_SIZE - SLAB_CHUNK_HEADER) / _slab_classes[Cls])
+
+#define SLAB_CHUNK_GET(Ptr) \
+   ((Slab_Chunk *)((uintptr_t)(Ptr) & ~(uintptr_t)(SLAB_CHUNK_SIZE - 1)))
+
+struct _Backlog_Slab
+{
+   Slab_Chunk *partial[SLAB_CLASSES]; /* chunks with free slots */
+   Slab_Chunk *full[SLAB_CLASSES];
+};
+
+static void
+_slab_chunk_link(Slab_Chunk **list, Slab_Chunk *chunk)
+{
+   chunk->prev = NULL;
+   chunk->next = *list;
+   if (*list)
+     (*list)->prev = chunk;
+   *list = chunk;
+}
+
+static void
+_slab_chunk_unlink(Slab_Chunk **list, Slab_Chunk *chunk)
+{
+   if (chunk->prev)
+     chunk->prev->next = chunk->next;
+   else
+     *list = chunk->next;
+   if (chunk->next)
+     chunk->next->prev = chunk->prev;
+}
+
+/* Chunks are mapped on their own rather than taken from the heap, where
+ * aligning them would leave up to a chunk of slack around each one.  A
+ * mapping twice their size is trimmed to the aligned chunk inside */
+static Slab_Chunk *
+_slab_chunk_map(void)
+{
+   char *p, *aligned;
+   size_t head;
+
+   p = mmap(NULL, 2 * SLAB_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANON, -1, 0);
+   if (p == MAP_FAILED)
+     {
+        ERR("could not map a backlog chunk: %s", strerror(errno));
+        return NULL;
+     }
+   aligned = (char *)(((uintptr_t)p + SLAB_CHUNK_SIZE - 1) &
+                      ~(uintptr_t)(SLAB_CHUNK_SIZE - 1));
+   head = aligned - p;
+   if (head)
+     munmap(p, head);
+   munmap(aligned + SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE - head);
+   _accounting_change(SLAB_CHUNK_SIZE);
+   return (Slab_Chunk *)aligned;
+}
+
+static void
+_slab_chunk_unmap(Slab_Chunk *chunk)
+{
+   munmap(chunk, SLAB_CHUNK_SIZE);
+   _accounting_change((-1) * (int64_t)SLAB_CHUNK_SIZE);
+}
+
+static int
+_slab_class_get(size_t size)
+{
+   int cls;
+
+   if (size > SLAB_SLOT_MAX)
+     return -1;
+   for (cls = 0; _slab_classes[cls] < size; cls++)
+     ;
+   return cls;
+}
+
+static void *
+_slab_alloc(Termpty *ty, size_t size)
+{
+   Backlog_Slab *slab = ty->backlog_slab;
+   Slab_Chunk *chunk;
+   int cls = _slab_class_get(size);
+   void *p;
+
+   if (cls < 0)
+     {
+        p = malloc(size);
+        if (p)
+          _accounting_change(size);
+        return p;
+     }
+   if (!slab)
+     {
+        slab = ty->backlog_slab = calloc(1, sizeof(Backlog_Slab));
+        if (!slab)
+          return NULL;
+     }
+   chunk = slab->partial[cls];
+   if (!chunk)
+     {
+        chunk = _slab_chunk_map();
+        if (!chunk)
+          return NULL;
+        chunk->free = NULL;
+        chunk->used = 0;
+        chunk->fresh = SLAB_CHUNK_SLOTS(cls);
+        _slab_chunk_link(&slab->partial[cls], chunk);
+     }
+   if (chunk->free)
+     {
+        p = chunk->free;
+        chunk->free = *(void **)p;
+     }
+   else
+     {
+        chunk->fresh--;
+        p = (char *)chunk + SLAB_CHUNK_HEADER +
+           (SLAB_CHUNK_SLOTS(cls) - 1 - chunk->fresh) * _slab_classes[cls];
+     }
+   chunk->used++;
+   if ((!chunk->free) && (!chunk->fresh))
+     {
+        _slab_chunk_unlink(&slab->partial[cls], chunk);
+        _slab_chunk_link(&slab->full[cls], chunk);
+     }
+   return p;
 }
 
+/* @size is the one @p was allocated or last reallocated with */
+static void
+_slab_free(Termpty *ty, void *p, size_t size)
+{
+   Backlog_Slab *slab = ty->backlog_slab;
+   Slab_Chunk *chunk;
+   int cls;
+
+   if (!p)
+     return;
+   cls = _slab_class_get(size);
+   if (cls < 0)
+     {
+        _accounting_change((-1) * (int64_t)size);
+        free(p);
+        return;
+     }
+   chunk = SLAB_CHUNK_GET(p);
+   if ((!chunk->free) && (!chunk->fresh))
+     {
+        _slab_chunk_unlink(&slab->full[cls], chunk);
+        _slab_chunk_link(&slab->partial[cls], chunk);
+     }
+   *(void **)p = chunk->free;
+   chunk->free = p;
+   chunk->used--;
+   /* keep the last chunk with free slots, so that a line scrolling in and
+    * out does not allocate and free a chunk each time */
+   if ((chunk->used) ||
+       ((slab->partial[cls] == chunk) && (!chunk->next)))
+     return;
+   _slab_chunk_unlink(&slab->partial[cls], chunk);
+   _slab_chunk_unmap(chunk);
+}
+
+static void *
+_slab_realloc(Termpty *ty, void *p, size_t old_size, size_t size)
+{
+   void *n;
+   int cls = _slab_class_get(size);
+
+   if ((p) && (cls >= 0) && (cls == _slab_class_get(old_size)))
+     return p;
+   if ((p) && (cls < 0) && (_slab_class_get(old_size) < 0))
+     {
+        n = realloc(p, size);
+        if (n)
+          _accounting_change((int64_t)size - (int64_t)old_size);
+        return n;
+     }
+   n = _slab_alloc(ty, size);
+   if ((!n) || (!p))
+     return n;
+   memcpy(n, p, MIN(old_size, size));
+   _slab_free(ty, p, old_size);
+   return n;
+}
+
+static void
+_slab_chunks_free(Slab_Chunk *chunk)
+{
+   while (chunk)
+     {
+        Slab_Chunk *next = chunk->next;
+
+        _slab_chunk_unmap(chunk);
+        chunk = next;
+     }
+}
+
+/* Give all the chunks back at once, the lines they held must be gone */
+static void
+_slab_reset(Termpty *ty)
+{
+   Backlog_Slab *slab = ty->backlog_slab;
+   int cls;
+
+   if (!slab)
+     return;
+   for (cls = 0; cls < SLAB_CLASSES; cls++)
+     {
+        _slab_chunks_free(slab->partial[cls]);
+        _slab_chunks_free(slab->full[cls]);
+     }
+   free(slab);
+   ty->backlog_slab = NULL;
+}
+
+/* }}} */
+
 int64_t
 termpty_backlog_memory_get(void)
 {
-   return _mem_used;
+   int64_t mem;
+
+   if (_stats_lock_ready)
+     eina_spinlock_take(&_stats_lock);
+   mem = _mem_used;
+   if (_stats_lock_ready)
+     eina_spinlock_release(&_stats_lock);
+   return mem;
+}
+
+/* Number of lines an entry of @w cells takes once wrapped to @ty_w */
+static inline unsigned int
+_lines_at(unsigned int w, int ty_w)
+{
+   if (w == 0)
+     return 1;
+   return (w + ty_w - 1) / ty_w;
+}
+
+/* Number of lines @ts takes on the screen once wrapped */
+static unsigned int
+_ts_lines(const Termpty *ty, const Termsave *ts)
+{
+   if (!ts->cells)
+     return 0;
+   return _lines_at(ts->w, ty->w);
+}
+
+/* {{{ Number of lines */
+
+/* The backlog is made of whole lines, that only get wrapped when looked
+ * at.  How many lines they take at the current width is computed, on a
+ * resize, from the number of entries per width rather than from the
+ * entries themselves */
+#define BACKLOG_HIST_MAX 1024
+
+/* Account for an entry of @w cells being added (@n is 1) or removed (@n
+ * is -1) */
+static void
+_widths_change(Termpty *ty, unsigned int w, int n)
+{
+   if (!ty->backlog_index.hist)
+     return;
+   if (w <= BACKLOG_HIST_MAX)
+     ty->backlog_index.hist[w] += n;
+   else
+     {
+        uintptr_t count;
+
+        count = (uintptr_t)eina_hash_find(ty->backlog_index.wide, &w);
+        count += n;
+        if (count)
+          eina_hash_set(ty->backlog_index.wide, &w, (void *)count);
+        else
+          eina_hash_del_by_key(ty->backlog_index.wide, &w);
+     }
+   if ((ty->backlog_index.total_w) && (ty->backlog_index.total_w == ty->w))
+     ty->backlog_index.total += n * (ssize_t)_lines_at(w, ty->w);
+}
+
+typedef struct _Lines_Count
+{
+   size_t total;
+   int w;
+} Lines_Count;
+
+static Eina_Bool
+_wide_lines_cb(const Eina_Hash *hash EINA_UNUSED, const void *key,
+               void *data, void *fdata)
+{
+   Lines_Count *lc = fdata;
+
+   lc->total += (uintptr_t)data * _lines_at(*(const unsigned int *)key,
+                                            lc->w);
+   return EINA_TRUE;
+}
+
+/* Number of lines of all the entries at the current width */
+static size_t
+_lines_total(Termpty *ty)
+{
+   Lines_Count lc = { 0, ty->w };
+   unsigned int w;
+
+   if (ty->w <= 0)
+     return 0;
+   if (ty->backlog_index.total_w == ty->w)
+     return ty->backlog_index.total;
+   if (ty->backlog_index.hist)
+     for (w = 0; w <= BACKLOG_HIST_MAX; w++)
+       lc.total += ty->backlog_index.hist[w] * _lines_at(w, ty->w);
+   if (ty->backlog_index.wide)
+     eina_hash_foreach(ty->backlog_index.wide, _wide_lines_cb, &lc);
+   ty->backlog_index.total = lc.total;
+   ty->backlog_index.total_w = ty->w;
+   return lc.total;
+}
+
+static Eina_Bool
+_widths_init(Termpty *ty)
+{
+   if (!ty->backlog_index.hist)
+     {
+        ty->backlog_index.hist = calloc(BACKLOG_HIST_MAX + 1,
+                                        sizeof(unsigned int));
+        if (!ty->backlog_index.hist)
+          return EINA_FALSE;
+        _accounting_change((BACKLOG_HIST_MAX + 1) * sizeof(unsigned int));
+     }
+   if (!ty->backlog_index.wide)
+     {
+        ty->backlog_index.wide = eina_hash_int32_new(NULL);
+        if (!ty->backlog_index.wide)
+          return EINA_FALSE;
+     }
+   return EINA_TRUE;
+}
+
+static void
+_widths_shutdown(Termpty *ty)
+{
+   if (ty->backlog_index.hist)
+     {
+        free(ty->backlog_index.hist);
+        _accounting_change((-1) * (int64_t)
+                           ((BACKLOG_HIST_MAX + 1) * sizeof(unsigned int)));
+     }
+   ty->backlog_index.hist = NULL;
+   if (ty->backlog_index.wide)
+     eina_hash_free(ty->backlog_index.wide);
+   ty->backlog_index.wide = NULL;
+   ty->backlog_index.total = 0;
+   ty->backlog_index.total_w = 0;
+}
+
+/* }}} */
+
+/* The index is a Fenwick tree where entry r (0 based) holds the number of
+ * lines of ty->back[backsize - 1 - r], so that walking the backlog from the
+ * most recent entry to the oldest one is walking the tree upward (modulo
+ * backsize) */
+static void
+_index_invalidate(Termpty *ty)
+{
+   if (ty->backlog_index.tree)
+     {
+        _accounting_change((-1) * (int64_t)
+                           ((ty->backsize + 1) * sizeof(unsigned int)));
+        free(ty->backlog_index.tree);
+     }
+   ty->backlog_index.tree = NULL;
+   ty->backlog_index.w = 0;
+}
+
+static Eina_Bool
+_index_ensure(Termpty *ty)
+{
+   unsigned int *tree = ty->backlog_index.tree;
+   size_t i, n = ty->backsize;
+
+   if ((tree) && (ty->backlog_index.w == ty->w))
+     return EINA_TRUE;
+   if (!n)
+     return EINA_FALSE;
+   if (!tree)
+     {
+        tree = calloc(n + 1, sizeof(unsigned int));
+        if (!tree)
+          return EINA_FALSE;
+        _accounting_change((n + 1) * sizeof(unsigned int));
+        ty->backlog_index.tree = tree;
+     }
+   else
+     memset(tree, 0, (n + 1) * sizeof(unsigned int));
+
+   for (i = 1; i <= n; i++)
+     {
+        unsigned int lines = _ts_lines(ty, &ty->back[n - i]);
+        size_t parent = i + (i & (~i + 1));
+
+        tree[i] += lines;
+        if (parent <= n)
+          tree[parent] += tree[i];
+     }
+   ty->backlog_index.w = ty->w;
+   return EINA_TRUE;
+}
+
+/* Account for @ts now taking @lines lines instead of @old_lines */
+static void
+_index_update(Termpty *ty, const Termsave *ts,
+              unsigned int old_lines, unsigned int lines)
+{
+   size_t i, n = ty->backsize;
+
+   if ((!ty->backlog_index.tree) || (ty->backlog_index.w != ty->w) ||
+       (ts < ty->back) || (ts >= ty->back + n) || (old_lines == lines))
+     return;
+
+   for (i = n - (ts - ty->back); i <= n; i += (i & (~i + 1)))
+     {
+        ty->backlog_index.tree[i] += lines;
+        ty->backlog_index.tree[i] -= old_lines;
+     }
+}
+
+/* Sum of the lines of the first @r entries of the tree */
+static size_t
+_index_prefix(const Termpty *ty, size_t r)
+{
+   size_t sum = 0;
+
+   for (; r > 0; r -= (r & (~r + 1)))
+     sum += ty->backlog_index.tree[r];
+   return sum;
+}
+
+/* Smallest r such that the first r + 1 entries hold at least @target lines */
+static size_t
+_index_search(const Termpty *ty, size_t target)
+{
+   size_t r = 0, step = 1, n = ty->backsize;
+
+   while (step * 2 <= n)
+     step *= 2;
+   for (; step > 0; step /= 2)
+     {
+        if ((r + step <= n) && (ty->backlog_index.tree[r + step] < target))
+          {
+             r += step;
+             target -= ty->backlog_index.tree[r];
+          }
+     }
+   return r;
+}
+
+/* Number of screen lines in the backlog.  The entry after the most recent
+ * one is the next to be overwritten and is not part of it */
+static size_t
+_index_length(Termpty *ty)
+{
+   const Termsave *next = &ty->back[(ty->backpos + 1) % ty->backsize];
+
+   return _lines_total(ty) - _ts_lines(ty, next);
+}
+
+/* Same as termpty_backlog_line_get(), walking the entries from the most
+ * recent one */
+static Termsave *
+_line_walk(Termpty *ty, int y, int *row)
+{
+   size_t n = ty->backsize, k, end = 0;
+
+   for (k = 0; k < n; k++)
+     {
+        Termsave *ts = &ty->back[(ty->backpos + n - k) % n];
+
+        ty->backlog_index.walked++;
+        end += _ts_lines(ty, ts);
+        if (end >= (size_t)y)
+          {
+             *row = end - y;
+             return ts;
+          }
+     }
+   return NULL;
+}
+
+/* Get the backlog entry holding the @y-th line above the screen, 1 being
+ * the line right above it.  @row is set to the line of that entry, once
+ * wrapped to the screen width, that is wanted */
+Termsave *
+termpty_backlog_line_get(Termpty *ty, int y, int *row)
+{
+   size_t n = ty->backsize, r, r0, before, after, end;
+
+   if ((y <= 0) || (!n) || (!ty->back) ||
+       ((size_t)y > _index_length(ty)))
+     return NULL;
+
+   /* While the width changes, as when a window is being resized, only the
+    * most recent lines are usually looked at: walk to them rather than
+    * building the index, until walking has cost as much as building it */
+   if (ty->backlog_index.walk_w != ty->w)
+     {
+        ty->backlog_index.walk_w = ty->w;
+        ty->backlog_index.walked = 0;
+     }
+   if ((ty->backlog_index.w != ty->w) &&
+       (ty->backlog_index.walked + y <= n))
+     return _line_walk(ty, y, row);
+   if (!_index_ensure(ty))
+     return NULL;
+
+   /* entry 0 of the tree is back[n - 1], the most recent one is
+    * back[backpos] */
+   r0 = n - 1 - ty->backpos;
+   before = _index_prefix(ty, r0);
+   after = _lines_total(ty) - before;
+   if ((size_t)y <= after)
+     {
+        r = _index_search(ty, before + y);
+        end = _index_prefix(ty, r + 1) - before;
+     }
+   else
+     {
+        r = _index_search(ty, y - after);
+        end = after + _index_prefix(ty, r + 1);
+     }
+   *row = end - y;
+   return &ty->back[n - 1 - r];
 }
 
 
 void
 termpty_save_register(Termpty *ty)
 {
-   termpty_backlog_lock();
+   /* no pty thread can be running yet */
+   if (!_stats_lock_ready)
+     _stats_lock_ready = eina_spinlock_new(&_stats_lock);
    ptys = eina_list_append(ptys, ty);
-   termpty_backlog_unlock();
 }
 
 void
 termpty_save_unregister(Termpty *ty)
 {
-   termpty_backlog_lock();
    ptys = eina_list_remove(ptys, ty);
-   termpty_backlog_unlock();
+   if ((!ptys) && (_compact_timer))
+     {
+        ecore_timer_del(_compact_timer);
+        _compact_timer = NULL;
+     }
+   if (!ptys)
+     _compress_buf_free();
+}
+
+static unsigned char *
+_varint_put(unsigned char *p, unsigned int v)
+{
+   while (v >= 0x80)
+     {
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+     }
+   *p++ = v;
+   return p;
+}
+
+static const unsigned char *
+_varint_get(const unsigned char *p, unsigned int *v)
+{
+   unsigned int shift = 0;
+
+   *v = 0;
+   while (*p & 0x80)
+     {
+        *v |= (*p++ & 0x7f) << shift;
+        shift += 7;
+     }
+   *v |= *p++ << shift;
+   return p;
+}
+
+/* Returns NULL if the line does not compress well */
+static Termsavecomp *
+_save_compress(Termpty *ty, const Termcell *cells, int w)
+{
+   unsigned char *p;
+   Termsavecomp *tc;
+   size_t size;
+   int i = 0;
+
+   /* worst case: one run per cell */
+   size = w * (sizeof(Termatt) + 5 + 5);
+   if (size > _compress_buf_size)
+     {
+        unsigned char *b = realloc(_compress_buf, size);
+
+        if (!b)
+          return NULL;
+        _compress_buf = b;
+        _compress_buf_size = size;
+     }
+   p = _compress_buf;
+   while (i < w)
+     {
+        Termatt att;
+        int j = i + 1;
+
+        while ((j < w) && (cells[j].style == cells[i].style) &&
+               (cells[j].dblwidth == cells[i].dblwidth) &&
+               (cells[j].autowrapped == cells[i].autowrapped) &&
+               (cells[j].newline == cells[i].newline) &&
+               (cells[j].tab_inserted == cells[i].tab_inserted) &&
+               (cells[j].tab_last == cells[i].tab_last))
+          j++;
+        termpty_cell_att_get(ty, &cells[i], &att);
+        memcpy(p, &att, sizeof(Termatt));
+        p += sizeof(Termatt);
+        p = _varint_put(p, j - i);
+        for (; i < j; i++)
+          p = _varint_put(p, cells[i].codepoint);
+     }
+   size = p - _compress_buf;
+   if (sizeof(Termsavecomp) + size >= w * sizeof(Termcell))
+     return NULL;
+
+   tc = _slab_alloc(ty, sizeof(Termsavecomp) + size);
+   if (!tc)
+     return NULL;
+   tc->size = size;
+   memcpy(tc + 1, _compress_buf, size);
+   return tc;
+}
+
+static Eina_Bool
+_save_decompress(Termpty *ty, const Termsavecomp *tc, Termcell *cells, int w)
+{
+   const unsigned char *p, *pe;
+   unsigned int gen;
+   int i;
+
+again:
+   p = (const unsigned char *)(tc + 1);
+   pe = p + tc->size;
+   gen = ty->styles.gen;
+   i = 0;
+   while ((p < pe) && (i < w))
+     {
+        Termatt att;
+        Termcell local;
+        unsigned int n;
+
+        memcpy(&att, p, sizeof(Termatt));
+        p += sizeof(Termatt);
+        p = _varint_get(p, &n);
+        termpty_cell_att_set(ty, &local, &att);
+        for (; (n > 0) && (i < w); n--, i++)
+          {
+             unsigned int g;
+
+             p = _varint_get(p, &g);
+             local.codepoint = g;
+             cells[i] = local;
+          }
+     }
+   /* the styles already written are stale if they got renumbered */
+   if (gen != ty->styles.gen)
+     goto again;
+   return (i == w);
+}
+
+/* Drop the references to links held by the cells of a compressed line */
+static void
+_save_comp_links_unref(Termpty *ty, const Termsavecomp *tc)
+{
+   const unsigned char *p = (const unsigned char *)(tc + 1),
+                       *pe = p + tc->size;
+
+   while (p < pe)
+     {
+        Termatt att;
+        unsigned int n, k;
+
+        memcpy(&att, p, sizeof(Termatt));
+        p += sizeof(Termatt);
+        p = _varint_get(p, &n);
+        if (EINA_UNLIKELY(att.link_id))
+          term_link_refcount_dec(ty, att.link_id, n);
+        /* skip the codepoints */
+        for (k = 0; k < n; k++)
+          {
+             while (*p & 0x80)
+               p++;
+             p++;
+          }
+     }
+}
+
+static void
+_compact_schedule_cb(void *data EINA_UNUSED)
+{
+   if (_stats_lock_ready)
+     eina_spinlock_take(&_stats_lock);
+   _compact_requested = EINA_FALSE;
+   if (_stats_lock_ready)
+     eina_spinlock_release(&_stats_lock);
+   if ((ptys) && (!_compact_timer))
+     _compact_timer = ecore_timer_add(COMPACT_INTERVAL, _compact_cb, NULL);
+}
+
+static void
+_compact_schedule(void)
+{
+#if !defined(ENABLE_FUZZING) && !defined(ENABLE_TESTS)
+   Eina_Bool requested;
+
+   if (eina_main_loop_is())
+     {
+        if (!_compact_timer)
+          _compact_timer = ecore_timer_add(COMPACT_INTERVAL, _compact_cb, NULL);
+        return;
+     }
+   /* from the worker thread of a pty: the timer is added by the main loop */
+   eina_spinlock_take(&_stats_lock);
+   requested = _compact_requested;
+   _compact_requested = EINA_TRUE;
+   eina_spinlock_release(&_stats_lock);
+   if (!requested)
+     ecore_main_loop_thread_safe_call_async(_compact_schedule_cb, NULL);
+#endif
+}
+
+/* {{{ LRU of decompressed lines */
+
+/* The lines decompressed to be used are left as they are while they are
+ * among the BACKLOG_LRU_SIZE most recently used ones, so that scrolling
+ * back and forth over them does not decompress them again and again */
+
+static void
+_lru_remove(Termpty *ty, unsigned int i)
+{
+   ty->back[ty->backlog_compact.lru[i]].lru = 0;
+   ty->backlog_compact.lru_n--;
+   memmove(&ty->backlog_compact.lru[i], &ty->backlog_compact.lru[i + 1],
+           (ty->backlog_compact.lru_n - i) * sizeof(size_t));
+}
+
+static unsigned int
+_lru_find(const Termpty *ty, const Termsave *ts)
+{
+   size_t idx = ts - ty->back;
+   unsigned int i;
+
+   for (i = 0; i < ty->backlog_compact.lru_n; i++)
+     if (ty->backlog_compact.lru[i] == idx)
+       break;
+   return i;
+}
+
+/* Make @ts the most recently used line, the least recently used one
+ * going back to the compactor if there is no room left */
+static void
+_lru_touch(Termpty *ty, Termsave *ts)
+{
+   unsigned int i;
+
+   if ((ts < ty->back) || (ts >= ty->back + ty->backsize))
+     return;
+   if (ts->lru)
+     {
+        i = _lru_find(ty, ts);
+        if (i == 0)
+          return;
+        if (i < ty->backlog_compact.lru_n)
+          _lru_remove(ty, i);
+     }
+   if (ty->backlog_compact.lru_n == BACKLOG_LRU_SIZE)
+     {
+        _lru_remove(ty, BACKLOG_LRU_SIZE - 1);
+        ty->backlog_compact.clean = 0;
+     }
+   memmove(&ty->backlog_compact.lru[1], &ty->backlog_compact.lru[0],
+           ty->backlog_compact.lru_n * sizeof(size_t));
+   ty->backlog_compact.lru[0] = ts - ty->back;
+   ty->backlog_compact.lru_n++;
+   ts->lru = 1;
 }
 
+/* }}} */
+
 Termsave *
-termpty_save_extract(Termsave *ts)
+termpty_save_extract(Termpty *ty, Termsave *ts)
 {
+   Termsavecomp *tc;
+   Termcell *cells;
+
    if (!ts) return NULL;
+   if (!ts->comp)
+     {
+        /* at most once per run of the compactor, that is enough to
+         * tell the lines in use from the others */
+        if ((ts->lru) && (ts->gen != _compact_gen))
+          _lru_touch(ty, ts);
+        ts->gen = _compact_gen;
+        return ts;
+     }
+   ts->gen = _compact_gen;
+
+   tc = (Termsavecomp *)ts->cells;
+   cells = _slab_alloc(ty, ts->w * sizeof(Termcell));
+   if (!cells)
+     return NULL;
+   if (!_save_decompress(ty, tc, cells, ts->w))
+     {
+        ERR("corrupted compressed backlog line");
+        memset(cells, 0, ts->w * sizeof(Termcell));
+     }
+   _slab_free(ty, tc, sizeof(Termsavecomp) + tc->size);
+   ts->cells = cells;
+   ts->comp = 0;
+   _counts_change(-1, 1, 0);
+   _lru_touch(ty, ts);
+   /* it will need to be compressed again once no longer used */
+   _compact_schedule();
    return ts;
 }
 
+/* Cells of @ts, decompressed into @buf, of at least ts->w cells, if it is
+ * compressed.  Unlike termpty_save_extract(), the entry stays as it is:
+ * reading the whole backlog this way does not undo the compactor's work */
+const Termcell *
+termpty_save_peek(Termpty *ty, const Termsave *ts, Termcell *buf)
+{
+   if ((!ts) || (!ts->cells))
+     return NULL;
+   if (!ts->comp)
+     return ts->cells;
+   if (!_save_decompress(ty, (const Termsavecomp *)ts->cells, buf, ts->w))
+     {
+        ERR("corrupted compressed backlog line");
+        return NULL;
+     }
+   return buf;
+}
+
+/* Look at up to COMPACT_BATCH entries of the backlog of @ty, compressing
+ * those that can be.  Returns whether there may be more to compress */
+static Eina_Bool
+_compact_pty(Termpty *ty)
+{
+   size_t n = ty->backsize, k;
+
+   if ((!n) || (!ty->back))
+     return EINA_FALSE;
+   for (k = 0; (k < COMPACT_BATCH) && (ty->backlog_compact.clean < n); k++)
+     {
+        size_t p = ty->backlog_compact.pos;
+        Termsave *ts = &ty->back[p];
+        /* 1 for the most recent entry */
+        size_t y = ((ty->backpos + n - p) % n) + 1;
+        Termsavecomp *tc;
+
+        ty->backlog_compact.pos = (p + 1) % n;
+        if ((!ts->cells) || (ts->comp) || (ts->lru) ||
+            (y <= COMPACT_RECENT) ||
+            (ts->w * sizeof(Termcell) <= sizeof(Termsavecomp)))
+          {
+             ty->backlog_compact.clean++;
+             continue;
+          }
+        if ((unsigned char)(_compact_gen - ts->gen) < 2)
+          {
+             /* used recently, look again later */
+             ty->backlog_compact.clean = 0;
+             continue;
+          }
+        ty->backlog_compact.clean++;
+        tc = _save_compress(ty, ts->cells, ts->w);
+        if (!tc)
+          continue;
+        _slab_free(ty, ts->cells, ts->w * sizeof(Termcell));
+        ts->cells = (Termcell *)tc;
+        ts->comp = 1;
+        _counts_change(1, -1, 0);
+     }
+   return (ty->backlog_compact.clean < n);
+}
+
+static Eina_Bool
+_compact_cb(void *data EINA_UNUSED)
+{
+   Eina_Bool more = EINA_FALSE;
+   Eina_List *l;
+   Termpty *ty;
+
+   _compact_gen++;
+   EINA_LIST_FOREACH(ptys, l, ty)
+     {
+        termpty_backlog_lock(ty);
+        if (_compact_pty(ty))
+          more = EINA_TRUE;
+        termpty_backlog_unlock(ty);
+     }
+   DBG("backlog lines: %i compressed, %i uncompressed, %i freed",
+       ts_comp, ts_uncomp, ts_freeops);
+   if ((!more) || (_compress_buf_size > COMPRESS_BUF_KEEP))
+     _compress_buf_free();
+   if (!more)
+     {
+        _compact_timer = NULL;
+        return ECORE_CALLBACK_CANCEL;
+     }
+   return ECORE_CALLBACK_RENEW;
+}
+
 Termsave *
 termpty_save_new(Termpty *ty, Termsave *ts, int w)
 {
    termpty_save_free(ty, ts);
 
-   Termcell *cells = calloc(1, w * sizeof(Termcell));
+   Termcell *cells = _slab_alloc(ty, w * sizeof(Termcell));
    if (!cells ) return NULL;
+   memset(cells, 0, w * sizeof(Termcell));
    ts->cells = cells;
    ts->w = w;
-   _accounting_change(w * sizeof(Termcell));
+   ts->gen = _compact_gen;
+   _counts_change(0, 1, 0);
+   _index_update(ty, ts, 0, _ts_lines(ty, ts));
+   _widths_change(ty, w, 1);
+   ty->backlog_changes.lines += _ts_lines(ty, ts);
+   ty->backlog_compact.clean = 0;
+   _compact_schedule();
    return ts;
 }
 
@@ -72,49 +1043,100 @@ Termsave *
 termpty_save_expand(Termpty *ty, Termsave *ts, Termcell *cells, size_t delta)
 {
    Termcell *newcells;
+   unsigned int old_lines = _ts_lines(ty, ts);
 
-   newcells = realloc(ts->cells, (ts->w + delta) * sizeof(Termcell));
+   if (!termpty_save_extract(ty, ts))
+     return NULL;
+   newcells = _slab_realloc(ty, ts->cells, ts->w * sizeof(Termcell),
+                            (ts->w + delta) * sizeof(Termcell));
    if (!newcells)
      return NULL;
 
+   /* the last line only gets longer if it did not fill the width */
+   if (ts->w % ty->w)
+     ty->backlog_changes.gen++;
    memset(newcells + ts->w,
           0, delta * sizeof(Termcell));
    TERMPTY_CELL_COPY(ty, cells, &newcells[ts->w], (int)delta);
 
-   _accounting_change((-1) * (int64_t)(ts->w * sizeof(Termcell)));
    ts->w += delta;
-   _accounting_change(ts->w * sizeof(Termcell));
    ts->cells = newcells;
+   ty->backlog_changes.lines += _ts_lines(ty, ts) - old_lines;
+   _index_update(ty, ts, old_lines, _ts_lines(ty, ts));
+   _widths_change(ty, ts->w - delta, -1);
+   _widths_change(ty, ts->w, 1);
    return ts;
 }
 
-void
-termpty_save_free(Termpty *ty, Termsave *ts)
+/* Drop what the line @ts refers to, but not its storage, whose size is
+ * returned */
+static size_t
+_save_release(Termpty *ty, Termsave *ts)
 {
    unsigned int i;
-   if (!ts) return;
-   if (ts->comp) ts_comp--;
-   else ts_uncomp--;
-   ts_freeops++;
-   for (i = 0; i < ts->w; i++)
+   size_t size;
+
+   _index_update(ty, ts, _ts_lines(ty, ts), 0);
+   _widths_change(ty, ts->w, -1);
+   if (ts->lru)
      {
-        if (EINA_UNLIKELY(ts->cells[i].att.link_id))
-          term_link_refcount_dec(ty, ts->cells[i].att.link_id, 1);
+        i = _lru_find(ty, ts);
+        if (i < ty->backlog_compact.lru_n)
+          _lru_remove(ty, i);
+        ts->lru = 0;
      }
-   free(ts->cells);
+   if (ts->comp)
+     {
+        Termsavecomp *tc = (Termsavecomp *)ts->cells;
+
+        _counts_change(-1, 0, 1);
+        _save_comp_links_unref(ty, tc);
+        size = sizeof(Termsavecomp) + tc->size;
+        ts->comp = 0;
+     }
+   else
+     {
+        _counts_change(0, -1, 1);
+        for (i = 0; i < ts->w; i++)
+          {
+             const Termatt *att = TERMPTY_CELL_STYLE(ty, ts->cells[i]);
+
+             if (EINA_UNLIKELY(att->link_id))
+               term_link_refcount_dec(ty, att->link_id, 1);
+          }
+        size = ts->w * sizeof(Termcell);
+     }
+   return size;
+}
+
+void
+termpty_save_free(Termpty *ty, Termsave *ts)
+{
+   if ((!ts) || (!ts->cells)) return;
+   _slab_free(ty, ts->cells, _save_release(ty, ts));
    ts->cells = NULL;
-   _accounting_change((-1) * (int64_t)(ts->w * sizeof(Termcell)));
    ts->w = 0;
 }
 
+/* Protect @ty from its worker thread, if any.  This can be nested */
 void
-termpty_backlog_lock(void)
+termpty_backlog_lock(Termpty *ty)
 {
+   if (ty->thread.on)
+     {
+        eina_lock_take(&ty->thread.lock);
+        ty->thread.depth++;
+     }
 }
 
 void
-termpty_backlog_unlock(void)
+termpty_backlog_unlock(Termpty *ty)
 {
+   if (ty->thread.on)
+     {
+        ty->thread.depth--;
+        eina_lock_release(&ty->thread.lock);
+     }
 }
 
 void
@@ -125,8 +1147,23 @@ termpty_backlog_free(Termpty *ty)
    if (!ty || !ty->back)
      return;
 
+   _index_invalidate(ty);
    for (i = 0; i < ty->backsize; i++)
-     termpty_save_free(ty, &ty->back[i]);
+     {
+        Termsave *ts = &ty->back[i];
+        size_t size;
+
+        if (!ts->cells)
+          continue;
+        size = _save_release(ty, ts);
+        /* the chunks all go at once below */
+        if (_slab_class_get(size) < 0)
+          _slab_free(ty, ts->cells, size);
+        ts->cells = NULL;
+        ts->w = 0;
+     }
+   _slab_reset(ty);
+   _widths_shutdown(ty);
    _accounting_change((-1) * (int64_t)(sizeof(Termsave) * ty->backsize));
    free(ty->back);
    ty->back = NULL;
@@ -137,43 +1174,23 @@ termpty_clear_backlog(Termpty *ty)
 {
    int backsize;
 
-   ty->backlog_beacon.screen_y = 0;
-   ty->backlog_beacon.backlog_y = 0;
-
-   termpty_backlog_lock();
+   termpty_backlog_lock(ty);
+   ty->link_spans.gen++;
+   ty->backlog_changes.gen++;
    termpty_backlog_free(ty);
    ty->backpos = 0;
    backsize = ty->backsize;
    ty->backsize = 0;
    termpty_backlog_size_set(ty, backsize);
-   termpty_backlog_unlock();
+   termpty_backlog_unlock(ty);
 }
 
 ssize_t
 termpty_backlog_length(Termpty *ty)
 {
-   int backlog_y = ty->backlog_beacon.backlog_y;
-   int screen_y = ty->backlog_beacon.screen_y;
-
-   if (!ty->backsize)
+   if ((!ty->backsize) || (!ty->back))
      return 0;
-
-   for (backlog_y++; backlog_y < (int)ty->backsize; backlog_y++)
-     {
-        int nb_lines;
-        const Termsave *ts;
-
-        ts = BACKLOG_ROW_GET(ty, backlog_y);
-        if (!ts->cells)
-          goto end;
-
-        nb_lines = (ts->w == 0) ? 1 : (ts->w + ty->w - 1) / ty->w;
-        screen_y += nb_lines;
-        ty->backlog_beacon.screen_y = screen_y;
-        ty->backlog_beacon.backlog_y = backlog_y;
-     }
-end:
-     return ty->backlog_beacon.screen_y;
+   return _index_length(ty);
 }
 
 
@@ -186,18 +1203,23 @@ termpty_backlog_size_set(Termpty *ty, size_t size)
    if (ty->backsize == size)
      return;
 
-   termpty_backlog_lock();
+   termpty_backlog_lock(ty);
 
+   ty->link_spans.gen++;
+   ty->backlog_changes.gen++;
+   _index_invalidate(ty);
    if (size == 0)
      {
         termpty_backlog_free(ty);
         goto end;
      }
+   if (!_widths_init(ty))
+     goto err;
    if (size > ty->backsize)
      {
         new_back = realloc(ty->back, sizeof(Termsave) * size);
         if (!new_back)
-          return;
+          goto err;
         memset(new_back + ty->backsize, 0,
                sizeof(Termsave) * (size - ty->backsize));
         ty->back = new_back;
@@ -206,7 +1228,7 @@ termpty_backlog_size_set(Termpty *ty, size_t size)
      {
         new_back = calloc(1, sizeof(Termsave) * size);
         if (!new_back)
-          return;
+          goto err;
         for (i = 0; i < size; i++)
           new_back[i] = ty->back[i];
         for (i = size; i < ty->backsize; i++)
@@ -218,9 +1240,8 @@ termpty_backlog_size_set(Termpty *ty, size_t size)
 end:
    ty->backpos = 0;
    ty->backsize = size;
-   /* Reset beacon */
-   ty->backlog_beacon.screen_y = 0;
-   ty->backlog_beacon.backlog_y = 0;
-
-   termpty_backlog_unlock();
+   ty->backlog_compact.pos = 0;
+   ty->backlog_compact.clean = 0;
+err:
+   termpty_backlog_unlock(ty);
 }
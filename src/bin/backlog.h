@@ -3,14 +3,16 @@
 
 void termpty_save_register(Termpty *ty);
 void termpty_save_unregister(Termpty *ty);
-Termsave *termpty_save_extract(Termsave *ts);
+Termsave *termpty_save_extract(Termpty *ty, Termsave *ts);
+const Termcell *termpty_save_peek(Termpty *ty, const Termsave *ts,
+                                  Termcell *buf);
 Termsave *termpty_save_new(Termpty *ty, Termsave *ts, int w);
 void termpty_save_free(Termpty *ty, Termsave *ts);
 Termsave *termpty_save_expand(Termpty *ty, Termsave *ts,
                               Termcell *cells, size_t delta);
 
-void       termpty_backlog_lock(void);
-void       termpty_backlog_unlock(void);
+void       termpty_backlog_lock(Termpty *ty);
+void       termpty_backlog_unlock(Termpty *ty);
 
 void
 termpty_clear_backlog(Termpty *ty);
@@ -20,6 +22,8 @@ void
 termpty_backlog_size_set(Termpty *ty, size_t size);
 ssize_t
 termpty_backlog_length(Termpty *ty);
+Termsave *
+termpty_backlog_line_get(Termpty *ty, int y, int *row);
 
 int64_t
 termpty_backlog_memory_get(void);
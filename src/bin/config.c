@@ -7,7 +7,7 @@
 #include "col.h"
 #include "utils.h"
 
-#define CONF_VER 24
+#define CONF_VER 26
 #define CONFIG_KEY "config"
 
 #define LIM(v, min, max) {if (v >= max) v = max; else if (v <= min) v = min;}
@@ -193,6 +193,10 @@ config_init(void)
      (edd_base, Config, "hide_cursor", hide_cursor, EET_T_DOUBLE);
    EET_DATA_DESCRIPTOR_ADD_BASIC
      (edd_base, Config, "group_all", group_all, EET_T_UCHAR);
+   EET_DATA_DESCRIPTOR_ADD_BASIC
+     (edd_base, Config, "threaded_pty", threaded_pty, EET_T_UCHAR);
+   EET_DATA_DESCRIPTOR_ADD_BASIC
+     (edd_base, Config, "pty_pool_size", pty_pool_size, EET_T_INT);
 }
 
 void
@@ -322,6 +326,8 @@ config_sync(const Config *config_src, Config *config)
    config->translucent = config_src->translucent;
    config->opacity = config_src->opacity;
    config->group_all = config_src->group_all;
+   config->threaded_pty = config_src->threaded_pty;
+   config->pty_pool_size = config_src->pty_pool_size;
 }
 
 static void
@@ -599,6 +605,8 @@ config_new(void)
         config->shine = 255;
         config->hide_cursor = 5.0;
         config->group_all = EINA_FALSE;
+        config->threaded_pty = EINA_FALSE;
+        config->pty_pool_size = 0;
      }
    return config;
 }
@@ -736,7 +744,17 @@ config_load(void)
                   config->group_all = EINA_FALSE;
                   EINA_FALLTHROUGH;
                   /*pass through*/
-                case CONF_VER: /* 24 */
+                case 24:
+                  config->threaded_pty = EINA_FALSE;
+                  EINA_FALLTHROUGH;
+                  /*pass through*/
+                case 25:
+                  config->pty_pool_size = 0;
+                  EINA_FALLTHROUGH;
+                  /*pass through*/
+                case CONF_VER: /* 26 */
+                  /* the config may have been edited by hand */
+                  LIM(config->pty_pool_size, 0, CONFIG_PTY_POOL_SIZE_MAX);
                   config->version = CONF_VER;
                   break;
                 default:
@@ -840,6 +858,8 @@ config_fork(const Config *config)
    CPY(emoji_dbl_width);
    CPY(shine);
    CPY(group_all);
+   CPY(threaded_pty);
+   CPY(pty_pool_size);
 
    EINA_LIST_FOREACH(config->keys, l, key)
      {
@@ -63,6 +63,7 @@ struct _Config
    int               shine;
    int               cg_width;
    int               cg_height;
+   int               pty_pool_size;
    Eina_Bool         jump_on_keypress;
    Eina_Bool         jump_on_change;
    Eina_Bool         flicker_on_key;
@@ -96,6 +97,7 @@ struct _Config
    Eina_Bool         changedir_to_current;
    Eina_Bool         emoji_dbl_width;
    Eina_Bool         group_all;
+   Eina_Bool         threaded_pty;
    Config_Color      colors[(4 * 12)];
    Eina_List        *keys;
 
@@ -118,5 +120,6 @@ const char *config_theme_path_get(const Config *config);
 const char *config_theme_path_default_get(const Config *config);
 
 #define CONFIG_CURSOR_IDLE_TIMEOUT_MAX 60.0
+#define CONFIG_PTY_POOL_SIZE_MAX 8
 
 #endif
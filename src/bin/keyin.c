@@ -7,27 +7,21 @@
 #include "termpty.h"
 #include "termio.h"
 #include "termcmd.h"
+#include "termiosearch.h"
 #include "keyin.h"
 #include "win.h"
 
 typedef struct _Tty_Key Tty_Key;
-typedef struct _Key_Values Key_Values;
 
 struct _s {
     char *s;
     ssize_t len;
 };
 
-struct _Key_Values {
-    struct _s plain;
-    struct _s alt;
-    struct _s ctrl;
-    struct _s ctrl_alt;
-    struct _s shift;
-    struct _s shift_alt;
-    struct _s shift_ctrl;
-    struct _s shift_ctrl_alt;
-};
+/* indexed by _KEY_MODS(), in the order gen_tty_keys.sh emits them */
+typedef struct _s Key_Values[8];
+#define _KEY_MODS(Alt, Shift, Ctrl) \
+   (((Shift) ? 4 : 0) | ((Ctrl) ? 2 : 0) | ((Alt) ? 1 : 0))
 struct _Tty_Key
 {
     char *key;
@@ -48,6 +42,8 @@ struct _Key_Binding
    uint16_t hyper : 1;
 
    uint16_t len;
+   /* of the key name and modifiers, see _key_binding_hash() */
+   unsigned int hash;
 
    Key_Binding_Cb cb;
    const char *keyname;
@@ -57,36 +53,43 @@ static Eina_Hash *_key_bindings = NULL;
 
 /* {{{ Keys to TTY */
 
+/* Same as key_hash() in gen_tty_keys.sh */
+static inline unsigned int
+_tty_key_hash(const char *key, int len, unsigned int seed)
+{
+   unsigned int hash = seed ^ len;
+   int i;
+
+   for (i = 0; i < len; i++)
+     hash = (hash ^ (unsigned char)key[i]) * 16777619U;
+   return hash;
+}
+
+/* @slots is the perfect hash of the key names of @map generated along
+ * with it, giving the index in @map plus one */
 static Eina_Bool
-_key_try(Termpty *ty, const Tty_Key *map, int len, const Evas_Event_Key_Down *ev,
+_key_try(Termpty *ty, const Tty_Key *map, const unsigned char *slots,
+         unsigned int seed, unsigned int mask,
+         const Evas_Event_Key_Down *ev, int inlen,
          int alt, int shift, int ctrl)
 {
-   int i, inlen;
+   const Tty_Key *k;
+   const struct _s *s;
+   unsigned int slot;
 
-   inlen = strlen(ev->key);
-   for (i = 0; i < len; i++)
-     {
-        if ((inlen == map[i].key_len) && (!memcmp(ev->key, map[i].key, inlen)))
-          {
-             const struct _s *s = NULL;
-             const Key_Values *kv;
-
-             if (!ty->termstate.appcursor) kv = &map[i].default_mode;
-             else                          kv = &map[i].cursor;
-             if (!alt && !ctrl && !shift)     s = &kv->plain;
-             else if (alt && !ctrl && !shift) s = &kv->alt;
-             else if (!alt && ctrl && !shift) s = &kv->ctrl;
-             else if (alt && ctrl && !shift)  s = &kv->ctrl_alt;
-             else if (!alt && !ctrl && shift) s = &kv->shift;
-             else if (alt && !ctrl && shift)  s = &kv->shift_alt;
-             else if (!alt && ctrl && shift)  s = &kv->shift_ctrl;
-             else if (alt && ctrl && shift)   s = &kv->shift_ctrl_alt;
-
-             if (s) termpty_write(ty, s->s, s->len);
-             return EINA_TRUE;
-          }
-     }
-   return EINA_FALSE;
+   slot = slots[_tty_key_hash(ev->key, inlen, seed) & mask];
+   if (!slot)
+     return EINA_FALSE;
+   k = &map[slot - 1];
+   if ((inlen != k->key_len) || (memcmp(ev->key, k->key, inlen)))
+     return EINA_FALSE;
+
+   if (!ty->termstate.appcursor)
+     s = &k->default_mode[_KEY_MODS(alt, shift, ctrl)];
+   else
+     s = &k->cursor[_KEY_MODS(alt, shift, ctrl)];
+   termpty_write(ty, s->s, s->len);
+   return EINA_TRUE;
 }
 
 /* }}} */
@@ -103,14 +106,15 @@ keyin_compose_seq_reset(Keys_Handler *khdl)
 
 #include "tty_keys.h"
 
-void
-keyin_handle_key_to_pty(Termpty *ty, const Evas_Event_Key_Down *ev,
-                        const int alt, const int shift, const int ctrl)
+static void
+_key_to_pty(Termpty *ty, const Evas_Event_Key_Down *ev,
+            const int alt, const int shift, const int ctrl)
 {
-   if (!ev->key)
-     return;
+   int len = strlen(ev->key);
 
-   if (!strcmp(ev->key, "BackSpace"))
+#define KEY_IS(Name) \
+   ((len == sizeof(Name) - 1) && (!memcmp(ev->key, Name, sizeof(Name) - 1)))
+   if (KEY_IS("BackSpace"))
      {
         if (alt)
           termpty_write(ty, "\033", 1);
@@ -133,7 +137,7 @@ keyin_handle_key_to_pty(Termpty *ty, const Evas_Event_Key_Down *ev,
           }
         return;
      }
-   if (!strcmp(ev->key, "Return"))
+   if (KEY_IS("Return"))
      {
         if (alt)
           termpty_write(ty, "\033", 1);
@@ -154,29 +158,30 @@ keyin_handle_key_to_pty(Termpty *ty, const Evas_Event_Key_Down *ev,
           {
              if (ty->termstate.alt_kp)
                {
-                  if (_key_try(ty, tty_keys_kp_app,
-                               sizeof(tty_keys_kp_app)/sizeof(tty_keys_kp_app[0]),
-                               ev, alt, shift, ctrl))
+                  if (_key_try(ty, tty_keys_kp_app, tty_keys_kp_slots,
+                               TTY_KEYS_KP_SEED, TTY_KEYS_KP_MASK,
+                               ev, len, alt, shift, ctrl))
                     return;
                }
              else
                {
-                  if (_key_try(ty, tty_keys_kp_plain,
-                               sizeof(tty_keys_kp_plain)/sizeof(tty_keys_kp_plain[0]),
-                               ev, alt, shift, ctrl))
+                  if (_key_try(ty, tty_keys_kp_plain, tty_keys_kp_slots,
+                               TTY_KEYS_KP_SEED, TTY_KEYS_KP_MASK,
+                               ev, len, alt, shift, ctrl))
                     return;
                }
           }
      }
    else
-     if (_key_try(ty, tty_keys, sizeof(tty_keys)/sizeof(tty_keys[0]), ev,
+     if (_key_try(ty, tty_keys, tty_keys_slots,
+                  TTY_KEYS_SEED, TTY_KEYS_MASK, ev, len,
                   alt, shift, ctrl))
        return;
 
    if (ctrl)
      {
 #define CTRL_NUM(Num, Code)                        \
-        if (!strcmp(ev->key, Num))                 \
+        if (KEY_IS(Num))                           \
           {                                        \
              if (alt)                              \
                termpty_write(ty, "\033"Code, 2);   \
@@ -194,6 +199,7 @@ keyin_handle_key_to_pty(Termpty *ty, const Evas_Event_Key_Down *ev,
 
 #undef CTRL_NUM
      }
+#undef KEY_IS
 
    if (ev->string)
      {
@@ -203,29 +209,59 @@ keyin_handle_key_to_pty(Termpty *ty, const Evas_Event_Key_Down *ev,
      }
 }
 
+void
+keyin_handle_key_to_pty(Termpty *ty, const Evas_Event_Key_Down *ev,
+                        const int alt, const int shift, const int ctrl)
+{
+   if (!ev->key)
+     return;
+
+   /* the latency up to the write to the pty is logged by _handle_write()
+    * in termpty.c, from the time recorded here */
+   termpty_input_notify(ty);
+   eina_evlog("+key_to_pty", ty, 0.0, ev->key);
+   _key_to_pty(ty, ev, alt, shift, ctrl);
+   eina_evlog("-key_to_pty", ty, 0.0, NULL);
+}
+
+static unsigned int
+_key_binding_hash(const Key_Binding *kb)
+{
+   unsigned int hash;
+
+   hash = eina_hash_djb2(kb->keyname, kb->len);
+   hash &= 0x3ffffff;
+   hash |= ((unsigned int)kb->hyper << 31);
+   hash |= (kb->meta << 30);
+   hash |= (kb->win << 29);
+   hash |= (kb->ctrl << 28);
+   hash |= (kb->alt << 27);
+   hash |= (kb->shift << 26);
+   return hash;
+}
+
 static Key_Binding *
 key_binding_lookup(const char *keyname,
                    Eina_Bool ctrl, Eina_Bool alt, Eina_Bool shift,
                    Eina_Bool win, Eina_Bool meta, Eina_Bool hyper)
 {
-   Key_Binding *kb;
+   Key_Binding kb;
    size_t len = strlen(keyname);
 
    if (len > UINT16_MAX) return NULL;
 
-   kb = alloca(sizeof(Key_Binding));
-   if (!kb) return NULL;
-   kb->ctrl = ctrl;
-   kb->alt = alt;
-   kb->shift = shift;
-   kb->win = win;
-   kb->meta = meta;
-   kb->hyper = hyper;
-   kb->len = len;
-   kb->keyname = alloca(sizeof(char) * len + 1);
-   strcpy((char *)kb->keyname, keyname);
+   /* the key name is only read while looking up */
+   kb.ctrl = ctrl;
+   kb.alt = alt;
+   kb.shift = shift;
+   kb.win = win;
+   kb.meta = meta;
+   kb.hyper = hyper;
+   kb.len = len;
+   kb.keyname = keyname;
+   kb.hash = _key_binding_hash(&kb);
 
-   return eina_hash_find(_key_bindings, kb);
+   return eina_hash_find(_key_bindings, &kb);
 }
 
 Eina_Bool
@@ -649,6 +685,17 @@ cb_scroll_reset(Evas_Object *termio_obj)
    return EINA_TRUE;
 }
 
+static Eina_Bool
+cb_search_up(Evas_Object *termio_obj)
+{
+   return termio_search_jump(termio_obj, EINA_TRUE);
+}
+
+static Eina_Bool
+cb_search_down(Evas_Object *termio_obj)
+{
+   return termio_search_jump(termio_obj, EINA_FALSE);
+}
 
 static Shortcut_Action _actions[] =
 {
@@ -659,6 +706,8 @@ static Shortcut_Action _actions[] =
      {"one_line_down", gettext_noop("Scroll one line down"), cb_scroll_down_line},
      {"top_backlog", gettext_noop("Go to the top of the backlog"), cb_scroll_top_backlog},
      {"reset_scroll", gettext_noop("Reset scroll"), cb_scroll_reset},
+     {"search_up", gettext_noop("Go to the match of the search above"), cb_search_up},
+     {"search_down", gettext_noop("Go to the match of the search below"), cb_search_down},
 
      {"group", gettext_noop("Copy/Paste"), NULL},
      {"copy_primary", gettext_noop("Copy selection to Primary buffer"), cb_copy_primary},
@@ -724,46 +773,30 @@ _key_binding_key_length(const void *_key EINA_UNUSED)
 }
 
 static int
-_key_binding_key_cmp(const void *key1, int key1_length,
-                     const void *key2, int key2_length)
+_key_binding_key_cmp(const void *key1, int key1_length EINA_UNUSED,
+                     const void *key2, int key2_length EINA_UNUSED)
 {
    const Key_Binding *kb1 = key1,
                      *kb2 = key2;
+   unsigned int m1, m2;
 
-   if (key1_length < key2_length)
-     return -1;
-   else if (key1_length > key2_length)
-     return 1;
-   else
-     {
-        unsigned int m1 = (kb1->hyper << 5) | (kb1->meta << 4) |
-           (kb1->win << 3) | (kb1->ctrl << 2) | (kb1->alt << 1) | kb1->shift,
-                     m2 = (kb2->hyper << 5) | (kb2->meta << 4) |
-           (kb2->win << 3) | (kb2->ctrl << 2) | (kb2->alt << 1) | kb2->shift;
-        if (m1 < m2)
-          return -1;
-        else if (m1 > m2)
-          return 1;
-        else
-          return strncmp(kb1->keyname, kb2->keyname, kb1->len);
-     }
+   if (kb1->len != kb2->len)
+     return kb1->len - kb2->len;
+   m1 = (kb1->hyper << 5) | (kb1->meta << 4) |
+      (kb1->win << 3) | (kb1->ctrl << 2) | (kb1->alt << 1) | kb1->shift;
+   m2 = (kb2->hyper << 5) | (kb2->meta << 4) |
+      (kb2->win << 3) | (kb2->ctrl << 2) | (kb2->alt << 1) | kb2->shift;
+   if (m1 != m2)
+     return (m1 < m2) ? -1 : 1;
+   return memcmp(kb1->keyname, kb2->keyname, kb1->len);
 }
 
 static int
-_key_binding_key_hash(const void *key, int key_length)
+_key_binding_key_hash(const void *key, int key_length EINA_UNUSED)
 {
    const Key_Binding *kb = key;
-   int hash;
 
-   hash = eina_hash_djb2(key, key_length);
-   hash &= 0x3ffffff;
-   hash |= (kb->hyper << 31);
-   hash |= (kb->meta << 30);
-   hash |= (kb->win << 29);
-   hash |= (kb->ctrl << 28);
-   hash |= (kb->alt << 27);
-   hash |= (kb->shift << 26);
-   return hash;
+   return kb->hash;
 }
 
 
@@ -788,6 +821,7 @@ _key_binding_new(const char *keyname,
    kb->hyper = hyper;
    kb->len = len;
    kb->keyname = eina_stringshare_add(keyname);
+   kb->hash = _key_binding_hash(kb);
    kb->cb = cb;
 
    return kb;
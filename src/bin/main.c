@@ -1060,6 +1060,7 @@ elm_main(int argc, char **argv)
    gravatar_shutdown();
 
    windows_free();
+   media_shutdown();
 
    config_del(_main_config);
    key_bindings_shutdown();
@@ -6,12 +6,14 @@
 #include <Efreet.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "media.h"
 #include "config.h"
 #include "utils.h"
 #include "termiolink.h"
 
 typedef struct _Media Media;
+typedef struct _Media_Cache_Entry Media_Cache_Entry;
 
 struct _Media
 {
@@ -26,6 +28,8 @@ struct _Media
    const char *src;
    const char *ext;
    const char *realf;
+   const char *cache_key, *cache_tmp_key; /* of o_img and o_tmp */
+   Media_Cache_Entry *cache; /* shown by o_img, if any */
    const Config *config;
    double download_perc;
    int tmpfd;
@@ -69,6 +73,214 @@ _is_fmt(const char *f, const char **extn)
    return NULL;
 }
 
+//////////////////////// cache
+
+/* Decoded images, shared by all the media objects of the process, so that
+ * an image shown again, after scrolling back to it or in another terminal,
+ * is not loaded again.  The image objects use the pixels of the entries
+ * directly, so only the entries no object refers to get evicted, least
+ * recently used first */
+
+#define MEDIA_CACHE_SIZE_MAX (64 * 1024 * 1024)
+
+struct _Media_Cache_Entry
+{
+   const char *key;
+   uint32_t *pixels;
+   Eina_List *lru; /* node in _cache_lru */
+   size_t size;
+   int w, h; /* of the pixels, as loaded */
+   int iw, ih; /* of the image itself */
+   int refs;
+   Eina_Bool alpha;
+};
+
+static Eina_Hash *_cache_hash = NULL;
+static Eina_List *_cache_lru = NULL; /* least recently used first */
+static size_t _cache_size = 0;
+
+/* Key of the image of @sd once loaded at @w x @h, or 0 x 0 for its own
+ * size.  NULL if it is not to be cached */
+static const char *
+_cache_key_get(const Media *sd, Media_Type type, int w, int h)
+{
+   struct stat st;
+   char buf[PATH_MAX + 128];
+
+   /* only local files: downloaded ones are temporary */
+   if ((!sd->realf) || (sd->realf[0] != '/') || (sd->tmpfd >= 0))
+     return NULL;
+   if (stat(sd->realf, &st) < 0)
+     return NULL;
+   snprintf(buf, sizeof(buf), "%d:%dx%d:%llu:%lld:%lld:%s",
+            type, w, h, (unsigned long long)st.st_ino,
+            (long long)st.st_size, (long long)st.st_mtime, sd->realf);
+   return eina_stringshare_add(buf);
+}
+
+static void
+_cache_entry_free(Media_Cache_Entry *ce)
+{
+   eina_hash_del_by_key(_cache_hash, ce->key);
+   _cache_lru = eina_list_remove_list(_cache_lru, ce->lru);
+   _cache_size -= ce->size;
+   eina_stringshare_del(ce->key);
+   free(ce->pixels);
+   free(ce);
+}
+
+static Media_Cache_Entry *
+_cache_find(const char *key)
+{
+   Media_Cache_Entry *ce;
+
+   if ((!key) || (!_cache_hash))
+     return NULL;
+   ce = eina_hash_find(_cache_hash, key);
+   if (!ce)
+     return NULL;
+   ce->refs++;
+   _cache_lru = eina_list_demote_list(_cache_lru, ce->lru);
+   return ce;
+}
+
+static void
+_cache_unref(Media_Cache_Entry *ce)
+{
+   /* freed only when evicted by _cache_add(), not to pull the pixels from
+    * under an object whose deletion is delayed */
+   if (ce)
+     ce->refs--;
+}
+
+/* Keeps a copy of the pixels of @o, a preloaded image object of an image
+ * of size @iw x @ih */
+static void
+_cache_add(const char *key, Evas_Object *o, int iw, int ih)
+{
+   Media_Cache_Entry *ce;
+   Eina_List *l, *ln;
+   const unsigned char *data;
+   int w = 0, h = 0, stride, y;
+   size_t size;
+
+   if ((!key) || (!o) ||
+       (evas_object_image_animated_get(o)) ||
+       (evas_object_image_colorspace_get(o) != EVAS_COLORSPACE_ARGB8888))
+     return;
+   evas_object_image_size_get(o, &w, &h);
+   if ((w <= 0) || (h <= 0))
+     return;
+   size = (size_t)w * h * sizeof(uint32_t);
+   if (size > MEDIA_CACHE_SIZE_MAX / 4)
+     return;
+   if (!_cache_hash)
+     {
+        _cache_hash = eina_hash_string_superfast_new(NULL);
+        if (!_cache_hash)
+          return;
+     }
+   if (eina_hash_find(_cache_hash, key))
+     return;
+
+   ce = calloc(1, sizeof(Media_Cache_Entry));
+   if (!ce)
+     return;
+   ce->pixels = malloc(size);
+   if (!ce->pixels)
+     {
+        free(ce);
+        return;
+     }
+   data = evas_object_image_data_get(o, EINA_FALSE);
+   if (!data)
+     {
+        free(ce->pixels);
+        free(ce);
+        return;
+     }
+   stride = evas_object_image_stride_get(o);
+   for (y = 0; y < h; y++)
+     memcpy(ce->pixels + ((size_t)y * w), data + ((size_t)y * stride),
+            w * sizeof(uint32_t));
+   evas_object_image_data_set(o, (void *)data);
+
+   ce->key = eina_stringshare_ref(key);
+   ce->size = size;
+   ce->w = w;
+   ce->h = h;
+   ce->iw = iw;
+   ce->ih = ih;
+   ce->alpha = evas_object_image_alpha_get(o);
+   eina_hash_add(_cache_hash, ce->key, ce);
+   _cache_lru = eina_list_append(_cache_lru, ce);
+   ce->lru = eina_list_last(_cache_lru);
+   _cache_size += size;
+
+   EINA_LIST_FOREACH_SAFE(_cache_lru, l, ln, ce)
+     {
+        if (_cache_size <= MEDIA_CACHE_SIZE_MAX)
+          break;
+        if (ce->refs == 0)
+          _cache_entry_free(ce);
+     }
+}
+
+/* New image object of @obj, showing the pixels of @ce */
+static Evas_Object *
+_cache_image_add(Evas_Object *obj, Media_Cache_Entry *ce)
+{
+   Media *sd = evas_object_smart_data_get(obj);
+   Evas_Object *o;
+
+   o = evas_object_image_filled_add(evas_object_evas_get(obj));
+   evas_object_image_alpha_set(o, ce->alpha);
+   evas_object_image_size_set(o, ce->w, ce->h);
+   evas_object_image_data_set(o, ce->pixels);
+   evas_object_image_data_update_add(o, 0, 0, ce->w, ce->h);
+   evas_object_image_smooth_scale_set(o, !sd->nosmooth);
+   evas_object_smart_member_add(o, obj);
+   evas_object_clip_set(o, sd->clip);
+   evas_object_raise(sd->o_event);
+   return o;
+}
+
+/* Makes @sd->o_img show @ce, if not NULL */
+static Eina_Bool
+_cache_image_set(Evas_Object *obj, Media_Cache_Entry *ce)
+{
+   Media *sd = evas_object_smart_data_get(obj);
+
+   if (!ce)
+     return EINA_FALSE;
+   if (sd->o_img)
+     evas_object_del(sd->o_img);
+   _cache_unref(sd->cache);
+   sd->cache = ce;
+   sd->o_img = _cache_image_add(obj, ce);
+   sd->iw = ce->iw;
+   sd->ih = ce->ih;
+   evas_object_show(sd->o_img);
+   evas_object_show(sd->clip);
+   return EINA_TRUE;
+}
+
+void
+media_shutdown(void)
+{
+   Media_Cache_Entry *ce;
+
+   EINA_LIST_FREE(_cache_lru, ce)
+     {
+        eina_stringshare_del(ce->key);
+        free(ce->pixels);
+        free(ce);
+     }
+   eina_hash_free(_cache_hash);
+   _cache_hash = NULL;
+   _cache_size = 0;
+}
+
 //////////////////////// thumb
 
 static Ethumb_Client *et_client = NULL;
@@ -161,6 +373,7 @@ _cb_thumb_preloaded(void *data,
    Evas_Coord ox, oy, ow, oh;
    if (!sd) return;
 
+   _cache_add(sd->cache_key, sd->o_img, sd->iw, sd->ih);
    evas_object_geometry_get(data, &ox, &oy, &ow, &oh);
    _type_thumb_calc(data, ox, oy, ow, oh);
    evas_object_show(sd->o_img);
@@ -263,14 +476,17 @@ _type_thumb_init(Evas_Object *obj)
    EINA_SAFETY_ON_NULL_RETURN_VAL(sd, -1);
 
    sd->type = MEDIA_TYPE_THUMB;
+   sd->iw = 64;
+   sd->ih = 64;
+   sd->cache_key = _cache_key_get(sd, MEDIA_TYPE_THUMB, sd->iw, sd->ih);
+   if (_cache_image_set(obj, _cache_find(sd->cache_key)))
+     return 0;
    _et_init();
    o = sd->o_img = evas_object_image_filled_add(evas_object_evas_get(obj));
    evas_object_image_load_orientation_set(o, EINA_TRUE);
    evas_object_smart_member_add(o, obj);
    evas_object_clip_set(o, sd->clip);
    evas_object_raise(sd->o_event);
-   sd->iw = 64;
-   sd->ih = 64;
    if (!et_connected)
      {
         et_queue = eina_list_append(et_queue, obj);
@@ -289,6 +505,7 @@ _cb_img_preloaded(void *data,
 {
    Media *sd = evas_object_smart_data_get(data);
    if (!sd) return;
+   _cache_add(sd->cache_key, sd->o_img, sd->iw, sd->ih);
    evas_object_show(sd->o_img);
    evas_object_show(sd->clip);
 }
@@ -358,6 +575,9 @@ _type_img_init(Evas_Object *obj)
 
    EINA_SAFETY_ON_NULL_RETURN_VAL(sd, -1);
 
+   sd->cache_key = _cache_key_get(sd, MEDIA_TYPE_IMG, 0, 0);
+   if (_cache_image_set(obj, _cache_find(sd->cache_key)))
+     return 0;
    o = sd->o_img = evas_object_image_filled_add(evas_object_evas_get(obj));
    evas_object_smart_member_add(o, obj);
    evas_object_clip_set(o, sd->clip);
@@ -437,12 +657,19 @@ _cb_scale_preloaded(void *data,
    if (!sd) return;
    if (!sd->o_tmp)
      {
+        _cache_add(sd->cache_key, sd->o_img, sd->iw, sd->ih);
         evas_object_show(sd->o_img);
         evas_object_show(sd->clip);
      }
    else
      {
+        _cache_add(sd->cache_tmp_key, sd->o_tmp, sd->iw, sd->ih);
         evas_object_del(sd->o_img);
+        _cache_unref(sd->cache);
+        sd->cache = NULL;
+        eina_stringshare_del(sd->cache_key);
+        sd->cache_key = sd->cache_tmp_key;
+        sd->cache_tmp_key = NULL;
         sd->o_img = sd->o_tmp;
         sd->o_tmp = NULL;
         evas_object_show(sd->o_img);
@@ -458,6 +685,9 @@ _type_scale_init(Evas_Object *obj)
 
    EINA_SAFETY_ON_NULL_RETURN_VAL(sd, -1);
 
+   sd->cache_key = _cache_key_get(sd, MEDIA_TYPE_SCALE, 0, 0);
+   if (_cache_image_set(obj, _cache_find(sd->cache_key)))
+     return 0;
    o = sd->o_img = evas_object_image_filled_add(evas_object_evas_get(obj));
    evas_object_smart_member_add(o, obj);
    evas_object_clip_set(o, sd->clip);
@@ -529,7 +759,28 @@ _type_scale_calc(Evas_Object *obj, Evas_Coord x, Evas_Coord y, Evas_Coord w, Eva
         if ((lw != sd->sw) || (lh != sd->sh))
           {
              Evas_Object *o;
+             const char *key;
 
+             /* a load at another size still pending is of no use */
+             if (sd->o_tmp)
+               {
+                  evas_object_del(sd->o_tmp);
+                  sd->o_tmp = NULL;
+               }
+             eina_stringshare_del(sd->cache_tmp_key);
+             sd->cache_tmp_key = NULL;
+             key = _cache_key_get(sd, MEDIA_TYPE_SCALE, lw, lh);
+             if (_cache_image_set(obj, _cache_find(key)))
+               {
+                  eina_stringshare_del(sd->cache_key);
+                  sd->cache_key = key;
+                  sd->sw = lw;
+                  sd->sh = lh;
+                  evas_object_move(sd->o_img, x, y);
+                  evas_object_resize(sd->o_img, w, h);
+                  return;
+               }
+             sd->cache_tmp_key = key;
              o = sd->o_tmp = evas_object_image_filled_add(evas_object_evas_get(obj));
              evas_object_smart_member_add(o, obj);
              evas_object_clip_set(o, sd->clip);
@@ -951,8 +1202,11 @@ _smart_del(Evas_Object *obj)
      }
    eina_stringshare_del(sd->src);
    eina_stringshare_del(sd->realf);
+   eina_stringshare_del(sd->cache_key);
+   eina_stringshare_del(sd->cache_tmp_key);
    if (sd->clip) evas_object_del(sd->clip);
    if (sd->o_img) evas_object_del(sd->o_img);
+   _cache_unref(sd->cache);
    if (sd->o_tmp) evas_object_del(sd->o_tmp);
    if (sd->o_ctrl) evas_object_del(sd->o_ctrl);
    if (sd->o_busy) evas_object_del(sd->o_busy);
@@ -39,5 +39,6 @@ const char *media_get(const Evas_Object *obj);
 Media_Type media_src_type_get(const char *src);
 Evas_Object *media_control_get(const Evas_Object *obj);
 void media_unknown_handle(const char *handler, const char *src);
+void media_shutdown(void);
 
 #endif
@@ -29,6 +29,11 @@ int _miniview_log_dom = -1;
 #define INF(...)      EINA_LOG_DOM_INFO(_miniview_log_dom, __VA_ARGS__)
 #define DBG(...)      EINA_LOG_DOM_DBG(_miniview_log_dom, __VA_ARGS__)
 
+/* The output of the terminal is drawn at a lower rate than the terminal
+ * itself, while what the user does on the miniview is drawn sooner */
+#define MINIVIEW_OUTPUT_DELAY 0.25
+#define MINIVIEW_INPUT_DELAY  0.1
+
 static Eina_Bool _deferred_renderer(void *data);
 
 void
@@ -72,6 +77,19 @@ struct _Miniview
 
    Eina_Bool fits_to_img;
 
+   /* rows of the image as last drawn, in a ring starting at row @top, so
+    * that only the rows that changed since get drawn again */
+   struct {
+      unsigned int *pixels;
+      unsigned int top;
+      unsigned int w, h;
+      int hist; /* img_hist they were drawn at */
+      unsigned int lines, gen; /* ty->backlog_changes they were drawn at */
+      unsigned int colors[512];
+      unsigned char reverse : 1;
+      unsigned char valid : 1;
+   } drawn;
+
    struct _screen {
       double size;
       double pos_val;
@@ -86,35 +104,36 @@ _draw_cell(const Termpty *ty, unsigned int *pixel, const Termcell *cell, unsigne
    int fg, bg, fgext, bgext;
    int inv = ty->termstate.reverse;
    Eina_Unicode codepoint;
+   const Termatt *att = TERMPTY_CELL_STYLE(ty, *cell);
 
    codepoint = cell->codepoint;
-   if ((codepoint == 0) || (cell->att.newline) || (cell->att.invisible))
+   if ((codepoint == 0) || (cell->newline) || (att->invisible))
      {
         *pixel = 0;
         return;
      }
    // colors
-   fg = cell->att.fg;
-   bg = cell->att.bg;
-   fgext = cell->att.fg256;
-   bgext = cell->att.bg256;
+   fg = att->fg;
+   bg = att->bg;
+   fgext = att->fg256;
+   bgext = att->bg256;
 
-   if ((fg == COL_DEF) && (cell->att.inverse ^ inv)) fg = COL_INVERSEBG;
+   if ((fg == COL_DEF) && (att->inverse ^ inv)) fg = COL_INVERSEBG;
    if (bg == COL_DEF)
      {
-        if (cell->att.inverse ^ inv) bg = COL_INVERSE;
+        if (att->inverse ^ inv) bg = COL_INVERSE;
         else if (!bgext) bg = COL_INVIS;
      }
-   if ((cell->att.fgintense) && (!fgext)) fg += 48;
-   if ((cell->att.bgintense) && (!bgext)) bg += 48;
-   if (cell->att.inverse ^ inv)
+   if ((att->fgintense) && (!fgext)) fg += 48;
+   if ((att->bgintense) && (!bgext)) bg += 48;
+   if (att->inverse ^ inv)
      {
         int t;
         t = fgext; fgext = bgext; bgext = t;
         t = fg; fg = bg; bg = t;
      }
-   if ((cell->att.bold) && (!fgext)) fg += 12;
-   if ((cell->att.faint) && (!fgext)) fg += 24;
+   if ((att->bold) && (!fgext)) fg += 12;
+   if ((att->faint) && (!fgext)) fg += 24;
    
    if (bgext) *pixel = colors[bg + 256];
    else if (bg && ((bg % 12) != COL_INVIS)) *pixel = colors[bg];
@@ -178,11 +197,19 @@ _screen_visual_bounds(Miniview *mv)
 }
 
 static void
-_queue_render(Miniview *mv)
+_queue_render(Miniview *mv, double delay)
 {
    mv->to_render = 1;
-   if ((!mv->deferred_renderer) && (mv->is_shown))
-     mv->deferred_renderer = ecore_timer_add(0.1, _deferred_renderer, mv);
+   if (!mv->is_shown)
+     return;
+   if ((mv->deferred_renderer) &&
+       (ecore_timer_pending_get(mv->deferred_renderer) > delay))
+     {
+        ecore_timer_del(mv->deferred_renderer);
+        mv->deferred_renderer = NULL;
+     }
+   if (!mv->deferred_renderer)
+     mv->deferred_renderer = ecore_timer_add(delay, _deferred_renderer, mv);
 }
 
 static void
@@ -206,7 +233,7 @@ _smart_cb_mouse_wheel(void *data,
                              (double) (ev->z * 25) / (mv->img_h - mv->rows);
         _screen_visual_bounds(mv);
      }
-   _queue_render(mv);
+   _queue_render(mv, MINIVIEW_INPUT_DELAY);
 }
 
 void
@@ -291,7 +318,7 @@ miniview_handle_key(Evas_Object *obj, const Evas_Event_Key_Down *ev)
              miniview_position_offset(obj, z, EINA_FALSE);
              _screen_visual_bounds(mv);
           }
-        _queue_render(mv);
+        _queue_render(mv, MINIVIEW_INPUT_DELAY);
         return EINA_TRUE;
      }
    else if (!strcmp(ev->key, "Next"))
@@ -306,7 +333,7 @@ miniview_handle_key(Evas_Object *obj, const Evas_Event_Key_Down *ev)
              miniview_position_offset(obj, -z, EINA_FALSE);
              _screen_visual_bounds(mv);
           }
-        _queue_render(mv);
+        _queue_render(mv, MINIVIEW_INPUT_DELAY);
         return EINA_TRUE;
      }
    return EINA_FALSE;
@@ -404,6 +431,7 @@ _smart_del(Evas_Object *obj)
 
    if (!mv) return;
    ecore_timer_del(mv->deferred_renderer);
+   free(mv->drawn.pixels);
    evas_object_del(mv->base);
    evas_object_del(mv->img);
    free(mv);
@@ -446,7 +474,7 @@ _smart_move(Evas_Object *obj,
 
    if (!mv) return;
    _do_configure(obj);
-   _queue_render(mv);
+   _queue_render(mv, MINIVIEW_INPUT_DELAY);
 }
 
 static void
@@ -461,7 +489,7 @@ _smart_show(Evas_Object *obj)
         mv->img_hist = 0;
         mv->initial_pos = 1;
 
-        _queue_render(mv);
+        _queue_render(mv, MINIVIEW_INPUT_DELAY);
         evas_object_show(mv->base);
      }
 }
@@ -487,7 +515,7 @@ miniview_redraw(const Evas_Object *obj)
    if (!obj) return;
    mv = evas_object_smart_data_get(obj);
    if ((!mv) || (!mv->is_shown)) return;
-   _queue_render(mv);
+   _queue_render(mv, MINIVIEW_OUTPUT_DELAY);
 }
 
 static void
@@ -510,14 +538,101 @@ miniview_colors_get(Miniview *mv, unsigned int *colors)
      }
 }
 
+static void
+_draw_row(Miniview *mv, Termpty *ty, unsigned int y, unsigned int *colors)
+{
+   unsigned int *row;
+   Termcell *cells;
+   ssize_t wret = 0;
+
+   row = mv->drawn.pixels + ((mv->drawn.top + y) % mv->drawn.h) * mv->cols;
+   memset(row, 0, sizeof(*row) * mv->cols);
+   cells = termpty_cellrow_get(ty, mv->img_hist + y, &wret);
+   if (!cells)
+     return;
+   if (wret > (ssize_t)mv->cols)
+     wret = mv->cols;
+   _draw_line(ty, row, cells, wret, colors);
+}
+
+/* Draw into the ring of rows those that changed since the last time, and
+ * return the range of rows of the image that need to be updated */
+static void
+_draw_rows(Miniview *mv, Termpty *ty, unsigned int *colors,
+           unsigned int *fromp, unsigned int *endp)
+{
+   unsigned int shift, y, from = mv->img_h, to = 0;
+   Eina_Bool full;
+
+   shift = ty->backlog_changes.lines - mv->drawn.lines;
+   full = ((!mv->drawn.valid) ||
+           (mv->drawn.w != mv->cols) || (mv->drawn.h != mv->img_h) ||
+           (mv->drawn.hist != mv->img_hist) ||
+           (mv->drawn.gen != ty->backlog_changes.gen) ||
+           (mv->drawn.reverse != ty->termstate.reverse) ||
+           (shift >= mv->img_h) ||
+           (memcmp(mv->drawn.colors, colors, sizeof(mv->drawn.colors))));
+   if (full)
+     {
+        if ((mv->drawn.w != mv->cols) || (mv->drawn.h != mv->img_h))
+          {
+             free(mv->drawn.pixels);
+             mv->drawn.pixels = malloc(sizeof(*mv->drawn.pixels) *
+                                       mv->cols * mv->img_h);
+             if (!mv->drawn.pixels)
+               {
+                  mv->drawn.w = mv->drawn.h = 0;
+                  mv->drawn.valid = 0;
+                  *fromp = *endp = 0;
+                  return;
+               }
+             mv->drawn.w = mv->cols;
+             mv->drawn.h = mv->img_h;
+          }
+        mv->drawn.top = 0;
+        from = 0;
+        to = mv->img_h;
+        for (y = 0; y < mv->img_h; y++)
+          _draw_row(mv, ty, y, colors);
+     }
+   else
+     {
+        /* the lines that went into the backlog shift the image up.  The
+         * lines of the screen may have changed, as well as those that
+         * were on the screen when last drawn */
+        mv->drawn.top = (mv->drawn.top + shift) % mv->drawn.h;
+        if (shift)
+          {
+             from = 0;
+             to = mv->img_h;
+          }
+        for (y = 0; y < mv->img_h; y++)
+          {
+             if ((mv->img_hist + (int)y < -(int)shift) &&
+                 (y < mv->img_h - shift))
+               continue;
+             _draw_row(mv, ty, y, colors);
+             if (y < from) from = y;
+             if (y + 1 > to) to = y + 1;
+          }
+     }
+   mv->drawn.hist = mv->img_hist;
+   mv->drawn.lines = ty->backlog_changes.lines;
+   mv->drawn.gen = ty->backlog_changes.gen;
+   mv->drawn.reverse = ty->termstate.reverse;
+   memcpy(mv->drawn.colors, colors, sizeof(mv->drawn.colors));
+   mv->drawn.valid = 1;
+   *fromp = from;
+   *endp = to;
+}
+
 static Eina_Bool
 _deferred_renderer(void *data)
 {
    Miniview *mv = data;
-   Evas_Coord ox, oy, ow, oh;
+   Evas_Coord ox, oy, ow, oh, iw = 0, ih = 0;
    int history_len, pos;
-   ssize_t wret;
-   unsigned int *pixels, y;
+   unsigned int *pixels, from, to, y;
    Termpty *ty;
    unsigned int colors[512];
    double bottom_bound;
@@ -537,33 +652,45 @@ _deferred_renderer(void *data)
    evas_object_geometry_get(mv->termio, &ox, &oy, &ow, &oh);
    if ((ow == 0) || (oh == 0) || (mv->cols == 1)) return EINA_TRUE;
 
+   termpty_backlog_lock(ty);
    history_len = termpty_backlog_length(ty);
 
-   evas_object_image_size_set(mv->img, mv->cols, mv->img_h);
-   ow = mv->cols;
-   oh = mv->img_h;
-
-   pixels = evas_object_image_data_get(mv->img, EINA_TRUE);
-   memset(pixels, 0, sizeof(*pixels) * ow * oh);
-   mv->img_h = oh;
-
    /* "current"? */
    if (mv->img_hist >= - ((int)mv->img_h - (int)mv->rows))
      mv->img_hist = -((int)mv->img_h - (int)mv->rows);
    if (mv->img_hist < -history_len)
      mv->img_hist = -history_len;
 
-   for (y = 0; y < mv->img_h; y++)
+   _draw_rows(mv, ty, colors, &from, &to);
+   termpty_backlog_unlock(ty);
+   if (!mv->drawn.pixels)
+     {
+        mv->deferred_renderer = NULL;
+        return EINA_FALSE;
+     }
+
+   evas_object_image_size_get(mv->img, &iw, &ih);
+   if ((iw != (int)mv->cols) || (ih != (int)mv->img_h))
      {
-        Termcell *cells = termpty_cellrow_get(ty, mv->img_hist + y, &wret);
+        evas_object_image_size_set(mv->img, mv->cols, mv->img_h);
+        from = 0;
+        to = mv->img_h;
+     }
+   ow = mv->cols;
+   oh = mv->img_h;
 
-        if (!cells)
-          break;
-        _draw_line(ty, &pixels[y * mv->cols], cells, wret, colors);
+   if (from < to)
+     {
+        pixels = evas_object_image_data_get(mv->img, EINA_TRUE);
+        for (y = from; y < to; y++)
+          memcpy(&pixels[y * mv->cols],
+                 mv->drawn.pixels +
+                 ((mv->drawn.top + y) % mv->drawn.h) * mv->cols,
+                 sizeof(*pixels) * mv->cols);
+        evas_object_image_data_set(mv->img, pixels);
+        evas_object_image_pixels_dirty_set(mv->img, EINA_FALSE);
+        evas_object_image_data_update_add(mv->img, 0, from, ow, to - from);
      }
-   evas_object_image_data_set(mv->img, pixels);
-   evas_object_image_pixels_dirty_set(mv->img, EINA_FALSE);
-   evas_object_image_data_update_add(mv->img, 0, 0, ow, oh);
 
    if (history_len > (int)(mv->img_h - mv->rows)) mv->fits_to_img = EINA_FALSE;
    else mv->fits_to_img = EINA_TRUE;
@@ -627,7 +754,7 @@ _smart_resize(Evas_Object *obj, Evas_Coord w, Evas_Coord h)
    if ((mv->rows == 0) || (mv->cols == 0)) return;
 
    _do_configure(obj);
-   _queue_render(mv);
+   _queue_render(mv, MINIVIEW_INPUT_DELAY);
 }
 
 
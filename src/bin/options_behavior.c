@@ -66,6 +66,7 @@ CB(ty_escapes, 0);
 CB(changedir_to_current, 0);
 CB(emoji_dbl_width, 0);
 CB(group_all, 0);
+CB(threaded_pty, 0);
 
 #undef CB
 
@@ -203,6 +204,18 @@ _cb_op_behavior_cg_height(void *data,
      }
 }
 
+static void
+_cb_op_behavior_pty_pool_size(void *data,
+                              Evas_Object *obj,
+                              void *_event EINA_UNUSED)
+{
+   Behavior_Ctx *ctx = data;
+   Config *config = ctx->config;
+
+   config->pty_pool_size = (int) elm_spinner_value_get(obj);
+   config_save(config);
+}
+
 static void
 _parent_del_cb(void *data,
                Evas *_e EINA_UNUSED,
@@ -514,6 +527,7 @@ options_behavior(Evas_Object *opbox, Evas_Object *term)
    CX(_("Open new terminals in current working directory"), changedir_to_current, 0);
    CX(_("Treat Emojis as double-width characters"), emoji_dbl_width, 0);
    CX(_("When grouping input, do it on all terminals and not just the visible ones"), group_all, 0);
+   CX(_("Read terminal output in a separate thread (new terminals only)"), threaded_pty, 0);
 
 #undef CX
 
@@ -586,6 +600,30 @@ options_behavior(Evas_Object *opbox, Evas_Object *term)
 
    SEPARATOR;
 
+   o = elm_label_add(bx);
+   evas_object_size_hint_weight_set(o, 0.0, 0.0);
+   evas_object_size_hint_align_set(o, 0.0, 0.5);
+   elm_object_text_set(o, _("Shells kept ready for new terminals:"));
+   tooltip = _("Start that many shells ahead of time,<br>"
+       "so that new tabs and splits show<br>"
+       "a prompt right away");
+   elm_object_tooltip_text_set(o, tooltip);
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+
+   o = elm_spinner_add(bx);
+   elm_spinner_editable_set(o, EINA_TRUE);
+   elm_spinner_min_max_set(o, 0.0, CONFIG_PTY_POOL_SIZE_MAX);
+   evas_object_size_hint_weight_set(o, EVAS_HINT_EXPAND, 0.0);
+   evas_object_size_hint_align_set(o, EVAS_HINT_FILL, 0.5);
+   elm_spinner_value_set(o, config->pty_pool_size);
+   elm_box_pack_end(bx, o);
+   evas_object_show(o);
+   evas_object_smart_callback_add(o, "changed",
+                                  _cb_op_behavior_pty_pool_size, ctx);
+
+   SEPARATOR;
+
    o = elm_label_add(bx);
    evas_object_size_hint_weight_set(o, 0.0, 0.0);
    evas_object_size_hint_align_set(o, 0.0, 0.5);
@@ -5,8 +5,9 @@
 #include <stddef.h>
 #include <string.h>
 
+/* Make room for @len more bytes and a nul after sb->buf + sb->len */
 int
-ty_sb_add(struct ty_sb *sb, const char *s, size_t len)
+ty_sb_reserve(struct ty_sb *sb, size_t len)
 {
    size_t new_len = sb->len + len;
 
@@ -24,6 +25,14 @@ ty_sb_add(struct ty_sb *sb, const char *s, size_t len)
         sb->buf = new_buf + sb->gap;
         sb->alloc = new_alloc;
      }
+   return 0;
+}
+
+int
+ty_sb_add(struct ty_sb *sb, const char *s, size_t len)
+{
+   if (ty_sb_reserve(sb, len) < 0)
+     return -1;
    memcpy(sb->buf + sb->len, s, len);
    sb->len += len;
    sb->buf[sb->len] = '\0';
@@ -10,6 +10,7 @@ struct ty_sb {
    size_t alloc;
 };
 
+int ty_sb_reserve(struct ty_sb *sb, size_t len);
 int ty_sb_add(struct ty_sb *sb, const char *s, size_t len);
 void ty_sb_spaces_rtrim(struct ty_sb *sb);
 int ty_sb_prepend(struct ty_sb *sb, const char *s, size_t  len);
@@ -9,19 +9,24 @@
 #include "media.h"
 #include "utils.h"
 #include "termcmd.h"
+#include "termiosearch.h"
 
 static Eina_Bool
-_termcmd_search(Evas_Object *_obj EINA_UNUSED,
+_termcmd_search(Evas_Object *obj,
                 Evas_Object *_win EINA_UNUSED,
                 Evas_Object *_bg EINA_UNUSED,
-                const char *cmd)
+                const char *cmd,
+                Eina_Bool regex,
+                Eina_Bool next)
 {
-   if (cmd[0] == 0) // clear search
-     {
-        printf("search clear\n");
-        return EINA_TRUE;
-     }
-   printf("search '%s'\n", cmd);
+   Eina_Bool changed;
+
+   // an empty pattern clears the search
+   changed = termio_search_set(obj, cmd, regex);
+   // the first Enter keeps the match the pattern was typed to, the next
+   // ones go up
+   if ((next) && (termio_search_enter(obj)) && (!changed))
+     termio_search_jump(obj, EINA_TRUE);
    return EINA_TRUE;
 }
 
@@ -154,7 +159,9 @@ termcmd_watch(Evas_Object *obj, Evas_Object *win, Evas_Object *bg, const char *c
 {
    if (!cmd) return EINA_FALSE;
    if ((cmd[0] == '/') || (cmd[0] == 's'))
-     return _termcmd_search(obj, win, bg, cmd + 1);
+     return _termcmd_search(obj, win, bg, cmd + 1, EINA_FALSE, EINA_FALSE);
+   if (cmd[0] == 'r')
+     return _termcmd_search(obj, win, bg, cmd + 1, EINA_TRUE, EINA_FALSE);
    return EINA_FALSE;
 }
 
@@ -163,8 +170,11 @@ Eina_Bool
 termcmd_do(Evas_Object *obj, Evas_Object *win, Evas_Object *bg, const char *cmd)
 {
    if (!cmd || !cmd[0]) return EINA_FALSE;
+   // same search again: go to the next match up
    if ((cmd[0] == '/') || (cmd[0] == 's'))
-     return _termcmd_search(obj, win, bg, cmd + 1);
+     return _termcmd_search(obj, win, bg, cmd + 1, EINA_FALSE, EINA_TRUE);
+   if (cmd[0] == 'r')
+     return _termcmd_search(obj, win, bg, cmd + 1, EINA_TRUE, EINA_TRUE);
    if ((cmd[0] == 'f') || (cmd[0] == 'F'))
      return _termcmd_font_size(obj, win, bg, cmd + 1);
    if ((cmd[0] == 'g') || (cmd[0] == 'G'))
@@ -5,6 +5,7 @@
 
 #include "termio.h"
 #include "termiolink.h"
+#include "termiosearch.h"
 #include "termpty.h"
 #include "backlog.h"
 #include "termptyops.h"
@@ -77,6 +78,8 @@ termio_theme_set(Evas_Object *obj, Evas_Object *theme)
    Termio *sd = evas_object_smart_data_get(obj);
    EINA_SAFETY_ON_NULL_RETURN(sd);
    if (theme) sd->theme = theme;
+   /* the palette comes from the theme */
+   if (sd->pty) termpty_truecolor_lut_free(sd->pty);
 }
 
 void
@@ -423,9 +426,11 @@ termio_config_update(Evas_Object *obj)
    sd->jump_on_keypress = sd->config->jump_on_keypress;
 
    termpty_config_update(sd->pty, sd->config);
+   termpty_screen_dirty_all(sd->pty);
    sd->scroll = 0;
 
    colors_term_init(sd->grid.obj, sd->theme, sd->config);
+   termpty_truecolor_lut_free(sd->pty);
 
    evas_object_scale_set(sd->grid.obj, elm_config_scale_get());
    evas_object_textgrid_font_set(sd->grid.obj, sd->font.name, sd->font.size);
@@ -484,6 +489,9 @@ termio_config_set(Evas_Object *obj, Config *config)
    sd->font.chw = w;
    sd->font.chh = h;
 
+   /* the palette may have changed along with the config */
+   if (sd->pty) termpty_truecolor_lut_free(sd->pty);
+
    termio_set_cursor_shape(obj, sd->cursor.shape);
 
    theme_apply(sd->sel.theme, config, "terminology/selection");
@@ -1503,7 +1511,7 @@ _hyperlink_mouseover(Termio *sd,
 
    /* Scan the whole screen and display links as needed */
    termio_object_geometry_get(sd, &ox, &oy, &ow, &oh);
-   termpty_backlog_lock();
+   termpty_backlog_lock(sd->pty);
    termpty_backscroll_adjust(sd->pty, &sd->scroll);
    for (y = 0; y < sd->grid.h; y++)
      {
@@ -1521,7 +1529,8 @@ _hyperlink_mouseover(Termio *sd,
         for (x = 0; x < w; x++)
           {
              Termcell *c = cells + x;
-             if (term_link_eq(sd->pty, hl, c->att.link_id))
+             if (term_link_eq(sd->pty, hl,
+                             TERMPTY_CELL_STYLE(sd->pty, *c)->link_id))
                {
                   if (!o)
                     {
@@ -1573,7 +1582,7 @@ _hyperlink_mouseover(Termio *sd,
                }
           }
      }
-   termpty_backlog_unlock();
+   termpty_backlog_unlock(sd->pty);
 }
 
 
@@ -2334,6 +2343,7 @@ _smart_mouseover_apply(Termio *sd)
    Eina_Bool same_geom = EINA_FALSE;
    Config *config;
    Termcell *cell = NULL;
+   uint16_t link_id;
 
    EINA_SAFETY_ON_NULL_RETURN(sd);
    config = sd->config;
@@ -2344,19 +2354,25 @@ _smart_mouseover_apply(Termio *sd)
         termio_remove_links(sd);
         return;
      }
+   /* the pty thread could change the cell and its style meanwhile */
+   termpty_backlog_lock(sd->pty);
    cell = termpty_cell_get(sd->pty, sd->mouse.cy - sd->scroll, sd->mouse.cx);
    if (!cell)
      {
+        termpty_backlog_unlock(sd->pty);
         termio_remove_links(sd);
         return;
      }
 
-   if (cell->att.link_id)
+   link_id = TERMPTY_CELL_STYLE(sd->pty, *cell)->link_id;
+   if (link_id)
      {
         if (config->active_links_escape)
-          _hyperlink_mouseover(sd, cell->att.link_id);
+          _hyperlink_mouseover(sd, link_id);
+        termpty_backlog_unlock(sd->pty);
         return;
      }
+   termpty_backlog_unlock(sd->pty);
 
    s = termio_link_find(sd->self, sd->mouse.cx, sd->mouse.cy,
                         &x1, &y1, &x2, &y2);
@@ -2832,19 +2848,28 @@ termio_file_send_ok(const Evas_Object *obj, const char *file)
    if (!sd) return EINA_FALSE;
    if (!file) return EINA_FALSE;
    ty = sd->pty;
+   /* the packets of version 2 are handled by the parser */
+   termpty_backlog_lock(ty);
    sd->sendfile.f = fopen(file, "w");
    if (sd->sendfile.f)
      {
         eina_stringshare_del(sd->sendfile.file);
         sd->sendfile.file = eina_stringshare_add(file);
         sd->sendfile.active = EINA_TRUE;
-        termpty_write(ty, "k\n", 2);
+        sd->sendfile.seq = 0;
+        sd->sendfile.percent = 0;
+        if (sd->sendfile.version >= 2)
+          termpty_write(ty, "K\n", 2);
+        else
+          termpty_write(ty, "k\n", 2);
+        termpty_backlog_unlock(ty);
         return EINA_TRUE;
      }
    eina_stringshare_del(sd->sendfile.file);
    sd->sendfile.file = NULL;
    sd->sendfile.active = EINA_FALSE;
    termpty_write(ty, "n\n", 2);
+   termpty_backlog_unlock(ty);
    return EINA_FALSE;
 }
 
@@ -2856,6 +2881,7 @@ termio_file_send_cancel(const Evas_Object *obj)
 
    if (!sd) return;
    ty = sd->pty;
+   termpty_backlog_lock(ty);
    if (!sd->sendfile.active) goto done;
    sd->sendfile.progress = 0.0;
    sd->sendfile.total = 0;
@@ -2874,6 +2900,154 @@ termio_file_send_cancel(const Evas_Object *obj)
    sd->sendfile.active = EINA_FALSE;
 done:
    termpty_write(ty, "n\n", 2);
+   termpty_backlog_unlock(ty);
+}
+
+static void
+_sendfile_progress_cb(void *data)
+{
+   evas_object_smart_callback_call(data, "send,progress", NULL);
+}
+
+static void
+_sendfile_end_cb(void *data)
+{
+   evas_object_smart_callback_call(data, "send,end", NULL);
+}
+
+static int
+_base64_value(Eina_Unicode c)
+{
+   if ((c >= 'A') && (c <= 'Z')) return c - 'A';
+   if ((c >= 'a') && (c <= 'z')) return c - 'a' + 26;
+   if ((c >= '0') && (c <= '9')) return c - '0' + 52;
+   if (c == '+') return 62;
+   if (c == '/') return 63;
+   return -1;
+}
+
+/* Decode the base64 of the @len codepoints of @in into @out, that has room
+ * for (@len / 4) * 3 bytes.  Returns the number of bytes, -1 if invalid */
+static ssize_t
+_base64_decode(const Eina_Unicode *in, size_t len, unsigned char *out)
+{
+   unsigned char *o = out;
+   size_t i;
+
+   if (len % 4)
+     return -1;
+   for (i = 0; i < len; i += 4)
+     {
+        int a, b, c, d;
+
+        a = _base64_value(in[i]);
+        b = _base64_value(in[i + 1]);
+        if ((a < 0) || (b < 0))
+          return -1;
+        *o++ = (a << 2) | (b >> 4);
+        if (in[i + 2] == '=')
+          {
+             if ((i + 4 != len) || (in[i + 3] != '='))
+               return -1;
+             break;
+          }
+        c = _base64_value(in[i + 2]);
+        if (c < 0)
+          return -1;
+        *o++ = ((b & 0xf) << 4) | (c >> 2);
+        if (in[i + 3] == '=')
+          {
+             if (i + 4 != len)
+               return -1;
+             break;
+          }
+        d = _base64_value(in[i + 3]);
+        if (d < 0)
+          return -1;
+        *o++ = ((c & 0x3) << 6) | d;
+     }
+   return o - out;
+}
+
+/* Data packet of version 2 of tysend, "<seq> <crc32> <base64>" in @buf,
+ * decoded from the escape straight into the file.  Called by the parser,
+ * from the thread of the pty if it has one */
+void
+termio_file_send_data(Evas_Object *obj, const Eina_Unicode *buf, size_t blen)
+{
+   Termio *sd = evas_object_smart_data_get(obj);
+   const Eina_Unicode *p = buf, *end = buf + blen;
+   unsigned int seq = 0, crc = 0;
+   ssize_t len;
+   size_t need;
+   int i;
+
+   if (!sd) return;
+   /* packets still in flight after an error or a cancel: tysend already
+    * stopped on the "n" it got then */
+   if (!sd->sendfile.active) return;
+
+   for (; (p < end) && (*p >= '0') && (*p <= '9'); p++)
+     seq = (seq * 10) + (*p - '0');
+   if ((p == end) || (*p != ' ')) goto bad;
+   for (i = 0, p++; (i < 8) && (p < end); i++, p++)
+     {
+        if ((*p >= '0') && (*p <= '9')) crc = (crc << 4) | (*p - '0');
+        else if ((*p >= 'a') && (*p <= 'f')) crc = (crc << 4) | (*p - 'a' + 10);
+        else goto bad;
+     }
+   if ((i < 8) || (p == end) || (*p != ' ')) goto bad;
+   p++;
+
+   need = ((end - p) / 4) * 3;
+   if (need > sd->sendfile.bufsize)
+     {
+        unsigned char *tmp = realloc(sd->sendfile.buf, need);
+
+        if (!tmp) goto bad;
+        sd->sendfile.buf = tmp;
+        sd->sendfile.bufsize = need;
+     }
+   len = _base64_decode(p, end - p, sd->sendfile.buf);
+   if ((len < 0) || (seq != sd->sendfile.seq) ||
+       (eina_crc((const char *)sd->sendfile.buf, len,
+                 0xffffffff, EINA_TRUE) != crc))
+     goto bad;
+   if ((len > 0) &&
+       (fwrite(sd->sendfile.buf, len, 1, sd->sendfile.f) != 1))
+     goto bad;
+   sd->sendfile.seq++;
+   sd->sendfile.total += len;
+   termpty_write(sd->pty, "k\n", 2);
+
+   /* do not stop the parser for every packet */
+   if (sd->sendfile.size > 0)
+     {
+        sd->sendfile.progress =
+           (double)sd->sendfile.total / (double)sd->sendfile.size;
+        if ((int)(sd->sendfile.progress * 100) != sd->sendfile.percent)
+          {
+             sd->sendfile.percent = sd->sendfile.progress * 100;
+             termpty_main_loop_call(sd->pty, _sendfile_progress_cb, obj);
+          }
+     }
+   return;
+
+bad:
+   if (sd->sendfile.file)
+     {
+        ecore_file_unlink(sd->sendfile.file);
+        eina_stringshare_del(sd->sendfile.file);
+        sd->sendfile.file = NULL;
+     }
+   if (sd->sendfile.f)
+     {
+        fclose(sd->sendfile.f);
+        sd->sendfile.f = NULL;
+     }
+   termpty_write(sd->pty, "n\n", 2);
+   sd->sendfile.active = EINA_FALSE;
+   termpty_main_loop_call(sd->pty, _sendfile_end_cb, obj);
 }
 
 double
@@ -2896,6 +3070,7 @@ _smart_apply(Evas_Object *obj)
    int preedit_x = 0, preedit_y = 0;
    Termblock *blk;
    Eina_List *l, *ln;
+   Eina_Bool hide_cursor;
 
    EINA_SAFETY_ON_NULL_RETURN(sd);
 
@@ -2905,6 +3080,8 @@ _smart_apply(Evas_Object *obj)
                           ox, oy,
                           &preedit_x, &preedit_y);
 
+   /* the worker thread of the pty changes these */
+   termpty_backlog_lock(sd->pty);
    EINA_LIST_FOREACH_SAFE(sd->pty->block.active, l, ln, blk)
      {
         if (!blk->active)
@@ -2915,12 +3092,15 @@ _smart_apply(Evas_Object *obj)
                (sd->pty->block.active, l);
           }
      }
-   if ((sd->scroll != 0) || (sd->pty->termstate.hide_cursor))
+   hide_cursor = sd->pty->termstate.hide_cursor;
+   sd->cursor.x = sd->pty->cursor_state.cx;
+   sd->cursor.y = sd->pty->cursor_state.cy;
+   termpty_backlog_unlock(sd->pty);
+
+   if ((sd->scroll != 0) || (hide_cursor))
      evas_object_hide(sd->cursor.obj);
    else
      evas_object_show(sd->cursor.obj);
-   sd->cursor.x = sd->pty->cursor_state.cx;
-   sd->cursor.y = sd->pty->cursor_state.cy;
    evas_object_move(sd->cursor.obj,
                     ox + ((sd->cursor.x + preedit_x) * sd->font.chw),
                     oy + ((sd->cursor.y + preedit_y) * sd->font.chh));
@@ -3067,15 +3247,27 @@ _smart_cb_delayed_size(void *data)
    return EINA_FALSE;
 }
 
+/* Under an output flood, render at most every FLOOD_FRAME_DELAY, or more
+ * seldom if rendering is slow, to leave the time to parsing */
+#define FLOOD_FRAME_DELAY 0.1
+
 static Eina_Bool
 _smart_cb_change(void *data)
 {
    Evas_Object *obj = data;
    Termio *sd = evas_object_smart_data_get(obj);
+   double t;
 
    EINA_SAFETY_ON_NULL_RETURN_VAL(sd, EINA_FALSE);
+   t = ecore_time_get();
+   if ((sd->pty) && (termpty_flood_get(sd->pty)) &&
+       (t - sd->last_render.time <
+        MAX(FLOOD_FRAME_DELAY, 4 * sd->last_render.duration)))
+     return ECORE_CALLBACK_RENEW;
    sd->anim = NULL;
    _smart_apply(obj);
+   sd->last_render.time = t;
+   sd->last_render.duration = ecore_time_get() - t;
    evas_object_smart_callback_call(obj, "changed", NULL);
    return EINA_FALSE;
 }
@@ -3101,8 +3293,9 @@ termio_sel_set(Termio *sd, Eina_Bool enable)
         evas_object_smart_callback_call(sd->win, "selection,off", NULL);
         sd->pty->selection.by_word = EINA_FALSE;
         sd->pty->selection.by_line = EINA_FALSE;
-        free(sd->pty->selection.codepoints);
-        sd->pty->selection.codepoints = NULL;
+        free(sd->pty->selection.row_hashes);
+        sd->pty->selection.row_hashes = NULL;
+        sd->pty->selection.row_hashes_count = 0;
      }
 }
 
@@ -3232,6 +3425,8 @@ _smart_del(Evas_Object *obj)
    if (sd->link_do_timer) ecore_timer_del(sd->link_do_timer);
    if (sd->mouse_move_job) ecore_job_del(sd->mouse_move_job);
    if (sd->mouseover_delay) ecore_timer_del(sd->mouseover_delay);
+   termio_search_free(sd);
+   free(sd->blocks.rows);
    eina_stringshare_del(sd->font.name);
    if (sd->pty) termpty_free(sd->pty);
    eina_stringshare_del(sd->link.string);
@@ -3261,6 +3456,7 @@ _smart_del(Evas_Object *obj)
           }
         sd->sendfile.active = EINA_FALSE;
      }
+   free(sd->sendfile.buf);
    eina_stringshare_del(sd->sel_str);
    if (sd->sel_reset_job) ecore_job_del(sd->sel_reset_job);
    EINA_LIST_FREE(sd->cur_chids, chid) eina_stringshare_del(chid);
@@ -3712,6 +3908,11 @@ _smart_pty_command(void *data)
              sd->sendfile.progress = 0.0;
              sd->sendfile.total = 0;
              sd->sendfile.size = 0;
+             sd->sendfile.version = 1;
+          }
+        else if (ty->cur_cmd[1] == 'v') // version of the data packets
+          {
+             sd->sendfile.version = atoi(&(ty->cur_cmd[2]));
           }
         else if (ty->cur_cmd[1] == 's') // file size
           {
@@ -3814,6 +4015,9 @@ _smart_pty_command(void *data)
                   evas_object_smart_callback_call
                     (obj, "send,end", NULL);
                }
+             free(sd->sendfile.buf);
+             sd->sendfile.buf = NULL;
+             sd->sendfile.bufsize = 0;
           }
      }
    evas_object_smart_callback_call(obj, "command", (void *)ty->cur_cmd);
@@ -56,6 +56,7 @@ Config      *termio_config_get(const Evas_Object *obj);
 Eina_Bool    termio_file_send_ok(const Evas_Object *obj, const char *file);
 void         termio_file_send_cancel(const Evas_Object *obj);
 double       termio_file_send_progress_get(const Evas_Object *obj);
+void         termio_file_send_data(Evas_Object *obj, const Eina_Unicode *buf, size_t blen);
 
 void
 termio_imf_cursor_set(Evas_Object *obj, Ecore_IMF_Context *imf);
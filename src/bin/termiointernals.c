@@ -9,22 +9,28 @@
 #include "termptydbl.h"
 #include "termptyops.h"
 #include "termiointernals.h"
+#include "termiosearch.h"
 #include "utf8.h"
 #include "tytest.h"
 
 /* {{{ Selection */
 
-void
-termio_selection_get(Termio *sd,
-                     int c1x, int c1y, int c2x, int c2y,
-                     struct ty_sb *sb,
-                     Eina_Bool rtrim)
+/* Append to @sb the text of the row @y of the selection going from
+ * (@c1x, @c1y) to (@c2x, @c2y).  Room is made for the whole row at once,
+ * then it is encoded in place.  Returns -1 if it could not be
+ * allocated */
+static int
+_sel_row_get(Termio *sd, int y,
+             int c1x, int c1y, int c2x, int c2y,
+             struct ty_sb *sb,
+             Eina_Bool rtrim)
 {
-   int x, y;
+   Termcell *cells;
+   ssize_t w;
+   int x, last0, v, start_x, end_x;
 
-#define SB_ADD(STR, LEN) do {         \
-     if (ty_sb_add(sb, STR, LEN) < 0) \
-       goto err;                      \
+#define SB_ADD(C) do {                \
+     sb->buf[sb->len++] = (C);        \
 } while (0)
 
 #define RTRIM() do {                  \
@@ -32,249 +38,339 @@ termio_selection_get(Termio *sd,
        ty_sb_spaces_rtrim(sb);        \
 } while (0)
 
-   termpty_backlog_lock();
-   for (y = c1y; y <= c2y; y++)
-     {
-        Termcell *cells;
-        ssize_t w;
-        int last0, v, start_x, end_x;
+   w = 0;
+   last0 = -1;
+   cells = termpty_cellrow_get(sd->pty, y, &w);
+   if (w > sd->grid.w)
+     w = sd->grid.w;
+   /* a cell is at most a tab, a space for a previous empty cell, its
+    * utf-8 sequence and a newline */
+   if (ty_sb_reserve(sb, (MAX(w, 0) + 1) * 9) < 0)
+     return -1;
+   if (!cells || !w)
+     {
+        SB_ADD('\n');
+        goto end;
+     }
 
-        w = 0;
-        last0 = -1;
-        cells = termpty_cellrow_get(sd->pty, y, &w);
-        if (!cells || !w)
+   /* Define how much needs to be read on that line */
+   if (y == c1y && c1x >= w)
+     {
+        RTRIM();
+        SB_ADD('\n');
+        goto end;
+     }
+   start_x = c1x;
+   end_x = (c2x >= w) ? w - 1 : c2x;
+   if (c1y != c2y)
+     {
+        if (y == c1y)
+          end_x = w - 1;
+        else if (y == c2y)
+          start_x = 0;
+        else
           {
-             SB_ADD("\n", 1);
-             continue;
+             start_x = 0;
+             end_x = w - 1;
           }
+     }
 
-        /* Define how much needs to be read on that line */
-        if (w > sd->grid.w)
-          w = sd->grid.w;
-        if (y == c1y && c1x >= w)
-          {
-             RTRIM();
-             SB_ADD("\n", 1);
-             continue;
-          }
-        start_x = c1x;
-        end_x = (c2x >= w) ? w - 1 : c2x;
-        if (c1y != c2y)
+   for (x = start_x; x <= end_x; x++)
+     {
+        if ((cells[x].codepoint == 0) && (cells[x].dblwidth))
           {
-             if (y == c1y)
-               end_x = w - 1;
-             else if (y == c2y)
-               start_x = 0;
+             if (x < end_x)
+               x++;
              else
-               {
-                  start_x = 0;
-                  end_x = w - 1;
-               }
+               break;
           }
-
-        for (x = start_x; x <= end_x; x++)
+        if (x >= w)
+          break;
+        if (cells[x].tab_inserted)
           {
-             if ((cells[x].codepoint == 0) && (cells[x].att.dblwidth))
+             /* There was a tab inserted.
+              * Only output it if there were spaces/empty cells "bellow"
+              */
+             Eina_Bool is_tab = EINA_TRUE;
+             while ((is_tab) && (x < end_x))
                {
-                  if (x < end_x)
-                    x++;
+                  if (((cells[x].codepoint == 0) ||
+                       (TERMPTY_CELL_STYLE(sd->pty, cells[x])->invisible == 1) ||
+                       (cells[x].codepoint == ' ')))
+                    {
+                         x++;
+                    }
                   else
-                    break;
-               }
-             if (x >= w)
-               break;
-             if (cells[x].att.tab_inserted)
-               {
-                  /* There was a tab inserted.
-                   * Only output it if there were spaces/empty cells "bellow"
-                   */
-                  Eina_Bool is_tab = EINA_TRUE;
-                  while ((is_tab) && (x < end_x))
                     {
-                       if (((cells[x].codepoint == 0) ||
-                            (cells[x].att.invisible == 1) ||
-                            (cells[x].codepoint == ' ')))
-                         {
-                              x++;
-                         }
-                       else
+                       is_tab = EINA_FALSE;
+                    }
+                  if (cells[x].tab_last)
+                    {
+                       SB_ADD('\t');
+                       if (is_tab)
                          {
+                            x++;
                             is_tab = EINA_FALSE;
                          }
-                       if (cells[x].att.tab_last)
-                         {
-                            SB_ADD("\t", 1);
-                            if (is_tab)
-                              {
-                                 x++;
-                                 is_tab = EINA_FALSE;
-                              }
-                            break;
-                         }
+                       break;
                     }
                }
-             if (cells[x].att.newline)
+          }
+        if (cells[x].newline)
+          {
+             last0 = -1;
+             if ((y != c2y) || (x != end_x))
                {
+                  RTRIM();
+                  SB_ADD('\n');
+               }
+             break;
+          }
+        else if (cells[x].codepoint == 0)
+          {
+             /* empty cell, track it to know whether to replace with
+              * spaces */
+             if (last0 < 0)
+               last0 = x;
+          }
+        else
+          {
+             int txtlen;
+
+             if (last0 >= 0)
+               {
+                  v = x - last0 - 1;
                   last0 = -1;
-                  if ((y != c2y) || (x != end_x))
+                  while (v >= 0)
                     {
-                       RTRIM();
-                       SB_ADD("\n", 1);
+                       SB_ADD(' ');
+                       v--;
                     }
-                  break;
                }
-             else if (cells[x].codepoint == 0)
+             if (cells[x].codepoint < 0x80)
+               SB_ADD(cells[x].codepoint);
+             else
                {
-                  /* empty cell, track it to know whether to replace with
-                   * spaces */
-                  if (last0 < 0)
-                    last0 = x;
+                  txtlen = codepoint_to_utf8(cells[x].codepoint,
+                                             sb->buf + sb->len);
+                  if (txtlen > 0)
+                    sb->len += txtlen;
                }
-             else
+             if ((x == (w - 1)) &&
+                 ((x != c2x) || (y != c2y)))
                {
-                  char txt[8];
-                  int txtlen;
+                  if (!cells[x].autowrapped)
+                    {
+                       RTRIM();
+                       SB_ADD('\n');
+                    }
+               }
+          }
+     }
+   if (last0 >= 0)
+     {
+        /* line stop by empty cell, need to know whether to insert spaces
+         * or just go to next line */
+        if (y == c2y)
+          {
+             Eina_Bool have_more = EINA_FALSE;
 
-                  if (last0 >= 0)
+             for (x = end_x + 1; x < w; x++)
+               {
+                  if ((cells[x].codepoint == 0) &&
+                      (cells[x].dblwidth))
                     {
-                       v = x - last0 - 1;
-                       last0 = -1;
-                       while (v >= 0)
-                         {
-                            SB_ADD(" ", 1);
-                            v--;
-                         }
+                       if (x < (w - 1))
+                         x++;
+                       else
+                         break;
                     }
-                  txtlen = codepoint_to_utf8(cells[x].codepoint, txt);
-                  if (txtlen > 0)
-                    SB_ADD(txt, txtlen);
-                  if ((x == (w - 1)) &&
-                      ((x != c2x) || (y != c2y)))
+                  if (((cells[x].codepoint != 0) &&
+                       (cells[x].codepoint != ' ')) ||
+                      (cells[x].newline))
                     {
-                       if (!cells[x].att.autowrapped)
-                         {
-                            RTRIM();
-                            SB_ADD("\n", 1);
-                         }
+                       have_more = EINA_TRUE;
+                       break;
                     }
                }
-          }
-        if (last0 >= 0)
-          {
-             /* line stop by empty cell, need to know whether to insert spaces
-              * or just go to next line */
-             if (y == c2y)
+             if (!have_more)
                {
-                  Eina_Bool have_more = EINA_FALSE;
-
-                  for (x = end_x + 1; x < w; x++)
+                  RTRIM();
+                  SB_ADD('\n');
+               }
+             else
+               {
+                  for (x = last0; x <= end_x; x++)
                     {
                        if ((cells[x].codepoint == 0) &&
-                           (cells[x].att.dblwidth))
+                           (cells[x].dblwidth))
                          {
                             if (x < (w - 1))
                               x++;
                             else
                               break;
                          }
-                       if (((cells[x].codepoint != 0) &&
-                            (cells[x].codepoint != ' ')) ||
-                           (cells[x].att.newline))
-                         {
-                            have_more = EINA_TRUE;
-                            break;
-                         }
-                    }
-                  if (!have_more)
-                    {
-                       RTRIM();
-                       SB_ADD("\n", 1);
-                    }
-                  else
-                    {
-                       for (x = last0; x <= end_x; x++)
-                         {
-                            if ((cells[x].codepoint == 0) &&
-                                (cells[x].att.dblwidth))
-                              {
-                                 if (x < (w - 1))
-                                   x++;
-                                 else
-                                   break;
-                              }
-                            if (x >= w)
-                              break;
-                            SB_ADD(" ", 1);
-                         }
+                       if (x >= w)
+                         break;
+                       SB_ADD(' ');
                     }
                }
-             else
-               {
-                  RTRIM();
-                  SB_ADD("\n", 1);
-               }
+          }
+        else
+          {
+             RTRIM();
+             SB_ADD('\n');
           }
      }
-   termpty_backlog_unlock();
-
-   RTRIM();
-
-   return;
-
-err:
-   ty_sb_free(sb);
+end:
+   sb->buf[sb->len] = '\0';
+   return 0;
 #undef SB_ADD
 #undef RTRIM
 }
 
+void
+termio_selection_get(Termio *sd,
+                     int c1x, int c1y, int c2x, int c2y,
+                     struct ty_sb *sb,
+                     Eina_Bool rtrim)
+{
+   int y;
 
-struct Codepoints_Buf {
-   Eina_Unicode *codepoints;
-   size_t len;
-   size_t size;
-};
+   termpty_backlog_lock(sd->pty);
+   for (y = c1y; y <= c2y; y++)
+     {
+        if (_sel_row_get(sd, y, c1x, c1y, c2x, c2y, sb, rtrim) < 0)
+          {
+             termpty_backlog_unlock(sd->pty);
+             ty_sb_free(sb);
+             return;
+          }
+     }
+   termpty_backlog_unlock(sd->pty);
 
-static int
-_codepoint_buf_append(struct Codepoints_Buf *buf,
-                      Eina_Unicode u)
+   if (rtrim)
+     ty_sb_spaces_rtrim(sb);
+}
+
+/* Start exporting the current selection.  The backlog is only locked while
+ * exporting rows, so the pty thread is not held up by a large selection */
+void
+termio_selection_export_begin(Termio *sd, Termio_Sel_Export *ex)
+{
+   memset(ex, 0, sizeof(*ex));
+   ex->sd = sd;
+   ex->c1x = sd->pty->selection.start.x;
+   ex->c1y = sd->pty->selection.start.y;
+   ex->c2x = sd->pty->selection.end.x;
+   ex->c2y = sd->pty->selection.end.y;
+   if (!sd->pty->selection.is_top_to_bottom)
+     {
+        INT_SWAP(ex->c1y, ex->c2y);
+        INT_SWAP(ex->c1x, ex->c2x);
+     }
+   ex->box = sd->pty->selection.is_box;
+   ex->y = ex->c1y;
+   termpty_backlog_lock(sd->pty);
+   ex->lines = sd->pty->backlog_changes.lines;
+   ex->gen = sd->pty->backlog_changes.gen;
+   termpty_backlog_unlock(sd->pty);
+}
+
+/* Append to @sb the text of at most @rows more rows of the selection.
+ * Returns the number of rows exported, 0 once done, or -1 on allocation
+ * failure */
+int
+termio_selection_export_next(Termio_Sel_Export *ex, struct ty_sb *sb,
+                             int rows)
 {
-   if (EINA_UNLIKELY(buf->len == buf->size))
+   Termpty *ty = ex->sd->pty;
+   int n, shift;
+
+   termpty_backlog_lock(ty);
+   if (ty->backlog_changes.gen != ex->gen)
      {
-        buf->size *= 2;
-        Eina_Unicode *codepoints = realloc(buf->codepoints,
-                                           buf->size * sizeof(Eina_Unicode));
-        if (EINA_UNLIKELY(!codepoints))
+        /* the backlog was cleared or reflowed: the rows are gone */
+        termpty_backlog_unlock(ty);
+        return 0;
+     }
+   /* follow the rows that scrolled into the backlog meanwhile */
+   shift = ty->backlog_changes.lines - ex->lines;
+   ex->lines = ty->backlog_changes.lines;
+   ex->c1y -= shift;
+   ex->c2y -= shift;
+   ex->y -= shift;
+
+   for (n = 0; (n < rows) && (ex->y <= ex->c2y); n++, ex->y++)
+     {
+        if (ex->box)
           {
-             free(buf->codepoints);
-             buf->len = buf->size = 0;
-             return -1;
+             size_t len = sb->len;
+
+             /* each row on its own, skipped if it has no text */
+             if (_sel_row_get(ex->sd, ex->y, ex->c1x, ex->y, ex->c2x, ex->y,
+                              sb, EINA_TRUE) < 0)
+               goto err;
+             ty_sb_spaces_rtrim(sb);
+             if ((sb->len > len) && (sb->buf[sb->len - 1] != '\n') &&
+                 (ex->y != ex->c2y) && (ty_sb_add(sb, "\n", 1) < 0))
+               goto err;
           }
-        buf->codepoints = codepoints;
+        else if (_sel_row_get(ex->sd, ex->y, ex->c1x, ex->c1y,
+                              ex->c2x, ex->c2y, sb, EINA_TRUE) < 0)
+          goto err;
      }
-   buf->codepoints[buf->len++] = u;
-   return 0;
+   termpty_backlog_unlock(ty);
+   if ((ex->y > ex->c2y) && (!ex->box))
+     ty_sb_spaces_rtrim(sb);
+   return n;
+
+err:
+   termpty_backlog_unlock(ty);
+   return -1;
+}
+
+void
+termio_selection_export_end(Termio_Sel_Export *_ex EINA_UNUSED)
+{
+}
+
+
+/* Rather than a copy of the selected cells, the selection keeps a hash of
+ * what each of its rows shows, to notice when that changes */
+static inline uint32_t
+_sel_hash_add(uint32_t hash, Eina_Unicode u)
+{
+   return (hash ^ u) * 16777619u;
+}
+#define SEL_HASH_INIT 2166136261u
+
+/* What @cell looks like, as far as the selection is concerned */
+static inline Eina_Unicode
+_sel_cell_shown(const Termpty *ty, const Termcell *cell)
+{
+   int bx, by;
+
+   if ((cell->codepoint == 0) ||
+       (termpty_block_id_get(cell, &bx, &by) >= 0) ||
+       (TERMPTY_CELL_STYLE(ty, *cell)->invisible))
+     return ' ';
+   return cell->codepoint;
 }
 
 static void
-_sel_codepoints_get(const Termio *sd,
-                    struct Codepoints_Buf *buf,
+_sel_row_hashes_get(const Termio *sd, uint32_t *hashes,
                     int c1x, int c1y, int c2x, int c2y)
 {
    int x, y;
 
-#define TRY(ACTION) do {               \
-     if (EINA_UNLIKELY(ACTION < 0))    \
-       {                               \
-          goto err;                    \
-       }                               \
-} while (0)
-
-   termpty_backlog_lock();
+   termpty_backlog_lock(sd->pty);
    for (y = c1y; y <= c2y; y++)
      {
         Termcell *cells;
         ssize_t w = 0;
         int start_x, end_x;
+        uint32_t hash = SEL_HASH_INIT;
 
         cells = termpty_cellrow_get(sd->pty, y, &w);
         if (!cells || !w || (y == c1y && c1x >= w))
@@ -301,48 +397,34 @@ _sel_codepoints_get(const Termio *sd,
                   end_x = sd->grid.w - 1;
                }
           }
-        /* Lookup every cell in that line */
+        if (end_x >= sd->grid.w)
+          end_x = sd->grid.w - 1;
+        /* Hash every cell in that line, as termio_internal_render() does */
         for (x = start_x; x <= end_x; x++)
           {
              if (x >= w)
-               {
-                  /* Selection outside of current line of "text" */
-                  TRY(_codepoint_buf_append(buf, ' '));
-               }
-             else if (!cells || cells[x].codepoint == 0)
-               {
-                  TRY(_codepoint_buf_append(buf, ' '));
-               }
+               hash = _sel_hash_add(hash, ' ');
              else
-               {
-                  TRY(_codepoint_buf_append(buf, cells[x].codepoint));
-               }
+               hash = _sel_hash_add(hash, _sel_cell_shown(sd->pty, &cells[x]));
           }
+        *hashes++ = hash;
      }
-err:
-   termpty_backlog_unlock();
+   termpty_backlog_unlock(sd->pty);
 }
 
 static void
-_sel_fill_in_codepoints_array(Termio *sd)
+_sel_fill_in_row_hashes(Termio *sd)
 {
    int start_x = 0, start_y = 0, end_x = 0, end_y = 0;
-   struct Codepoints_Buf buf = {
-        .codepoints = NULL,
-        .len = 0,
-        .size = 256,
-   };
+   uint32_t *hashes;
 
-   free(sd->pty->selection.codepoints);
-   sd->pty->selection.codepoints = NULL;
+   free(sd->pty->selection.row_hashes);
+   sd->pty->selection.row_hashes = NULL;
+   sd->pty->selection.row_hashes_count = 0;
 
    if (!sd->pty->selection.is_active)
      return;
 
-   buf.codepoints = malloc(sizeof(Eina_Unicode) * buf.size);
-   if (!buf.codepoints)
-     return;
-
    start_x = sd->pty->selection.start.x;
    start_y = sd->pty->selection.start.y;
    end_x = sd->pty->selection.end.x;
@@ -354,44 +436,39 @@ _sel_fill_in_codepoints_array(Termio *sd)
         INT_SWAP(start_x, end_x);
      }
 
+   hashes = malloc(sizeof(uint32_t) * (end_y - start_y + 1));
+   if (!hashes)
+     return;
+
    if (sd->pty->selection.is_box)
      {
         int i;
 
         for (i = start_y; i <= end_y; i++)
           {
-             _sel_codepoints_get(sd, &buf, start_x, i, end_x, i);
+             _sel_row_hashes_get(sd, hashes + (i - start_y),
+                                 start_x, i, end_x, i);
           }
      }
    else
      {
-        _sel_codepoints_get(sd, &buf, start_x, start_y, end_x, end_y);
+        _sel_row_hashes_get(sd, hashes, start_x, start_y, end_x, end_y);
      }
-   sd->pty->selection.codepoints = buf.codepoints;
+   sd->pty->selection.row_hashes = hashes;
+   sd->pty->selection.row_hashes_count = end_y - start_y + 1;
 }
 
 const char *
 termio_internal_get_selection(Termio *sd, size_t *lenp)
 {
-   int start_x = 0, start_y = 0, end_x = 0, end_y = 0;
    const char *s = NULL;
    size_t len = 0;
+   struct ty_sb sb = {.buf = NULL, .len = 0, .alloc = 0};
+   Termio_Sel_Export ex;
+   int n;
 
    EINA_SAFETY_ON_NULL_RETURN_VAL(sd, NULL);
-   if (sd->pty->selection.is_active)
-     {
-        start_x = sd->pty->selection.start.x;
-        start_y = sd->pty->selection.start.y;
-        end_x = sd->pty->selection.end.x;
-        end_y = sd->pty->selection.end.y;
-
-        if (!sd->pty->selection.is_top_to_bottom)
-          {
-             INT_SWAP(start_y, end_y);
-             INT_SWAP(start_x, end_x);
-          }
-     }
-   else
+   if (!sd->pty->selection.is_active)
      {
         if (sd->link.string)
           {
@@ -401,54 +478,17 @@ termio_internal_get_selection(Termio *sd, size_t *lenp)
         goto end;
      }
 
-   if (sd->pty->selection.is_box)
-     {
-        int i;
-        struct ty_sb sb = {.buf = NULL, .len = 0, .alloc = 0};
-        char *tmp;
-
-        for (i = start_y; i <= end_y; i++)
-          {
-             struct ty_sb isb = {.buf = NULL, .len = 0, .alloc = 0};
-             termio_selection_get(sd, start_x, i, end_x, i,
-                                  &isb, EINA_TRUE);
-
-             if (isb.len)
-               {
-                  int res;
-                  if (isb.buf[isb.len - 1] != '\n' && i != end_y)
-                    {
-                       res = ty_sb_add(&isb, "\n", 1);
-                       if (res < 0)
-                         {
-                            ERR("failure to add newline to selection buffer");
-                         }
-                    }
-                  res = ty_sb_add(&sb, isb.buf, isb.len);
-                  if (res < 0)
-                    {
-                       ERR("failure to add %zd characters to selection buffer",
-                           isb.len);
-                    }
-               }
-             ty_sb_free(&isb);
-          }
-        len = sb.len;
-        tmp = ty_sb_steal_buf(&sb);
-        s = eina_stringshare_add_length(tmp, len);
-        free(tmp);
-        ty_sb_free(&sb);
-     }
-   else
-     {
-        struct ty_sb sb = {.buf = NULL, .len = 0, .alloc = 0};
-
-        termio_selection_get(sd, start_x, start_y, end_x, end_y, &sb, EINA_TRUE);
-        len = sb.len;
+   termio_selection_export_begin(sd, &ex);
+   do
+     n = termio_selection_export_next(&ex, &sb, SEL_EXPORT_ROWS);
+   while (n > 0);
+   termio_selection_export_end(&ex);
+   if (n < 0)
+     ERR("failure to add %zd characters to selection buffer", sb.len);
 
-        s = eina_stringshare_add_length(sb.buf, len);
-        ty_sb_free(&sb);
-     }
+   len = sb.len;
+   s = eina_stringshare_add_length(sb.buf, len);
+   ty_sb_free(&sb);
 
 end:
    *lenp = len;
@@ -462,7 +502,7 @@ _sel_line(Termio *sd, int cy)
    ssize_t w = 0;
    Termcell *cells;
 
-   termpty_backlog_lock();
+   termpty_backlog_lock(sd->pty);
 
    termio_sel_set(sd, EINA_TRUE);
    sd->pty->selection.makesel = EINA_FALSE;
@@ -477,7 +517,7 @@ _sel_line(Termio *sd, int cy)
    for (;;)
      {
         cells = termpty_cellrow_get(sd->pty, y - 1, &w);
-        if (!cells || w <= 0 || !cells[w-1].att.autowrapped)
+        if (!cells || w <= 0 || !cells[w-1].autowrapped)
           break;
         y--;
      }
@@ -488,7 +528,7 @@ _sel_line(Termio *sd, int cy)
    for (;;)
      {
         cells = termpty_cellrow_get(sd->pty, y, &w);
-        if (!cells || !cells[w-1].att.autowrapped)
+        if (!cells || !cells[w-1].autowrapped)
           {
              sd->pty->selection.end.x = w - 1;
              break;
@@ -499,7 +539,7 @@ _sel_line(Termio *sd, int cy)
    x = sd->pty->selection.end.x;
    while ((x > 0) && (cells != NULL) && ((cells[x].codepoint == 0) ||
                                          (cells[x].codepoint == ' ') ||
-                                         (cells[x].att.newline)))
+                                         (cells[x].newline)))
      {
         x--;
      }
@@ -509,7 +549,7 @@ _sel_line(Termio *sd, int cy)
    sd->pty->selection.by_line = EINA_TRUE;
    sd->pty->selection.is_top_to_bottom = EINA_TRUE;
 
-   termpty_backlog_unlock();
+   termpty_backlog_unlock(sd->pty);
 }
 
 static void
@@ -915,7 +955,7 @@ _sel_word(Termio *sd, int cx, int cy)
    ssize_t w = 0;
    Eina_Bool done = EINA_FALSE;
 
-   termpty_backlog_lock();
+   termpty_backlog_lock(sd->pty);
 
    termio_sel_set(sd, EINA_TRUE);
    sd->pty->selection.makesel = EINA_TRUE;
@@ -953,7 +993,7 @@ _sel_word(Termio *sd, int cx, int cy)
      {
         for (; x >= 0; x--)
           {
-             if ((cells[x].codepoint == 0) && (cells[x].att.dblwidth) &&
+             if ((cells[x].codepoint == 0) && (cells[x].dblwidth) &&
                  (x > 0))
                {
                   x--;
@@ -972,7 +1012,7 @@ _sel_word(Termio *sd, int cx, int cy)
              size_t old_w = w;
 
              cells = termpty_cellrow_get(sd->pty, y - 1, &w);
-             if ((!cells) || (w == 0) || (!cells[w-1].att.autowrapped))
+             if ((!cells) || (w == 0) || (!cells[w-1].autowrapped))
                {
                   x = cx;
                   cells = old_cells;
@@ -1005,7 +1045,7 @@ _sel_word(Termio *sd, int cx, int cy)
      {
         for (; x < w; x++)
           {
-             if ((cells[x].codepoint == 0) && (cells[x].att.dblwidth) &&
+             if ((cells[x].codepoint == 0) && (cells[x].dblwidth) &&
                  (x < (w - 1)))
                {
                   sd->pty->selection.end.x = x;
@@ -1021,7 +1061,7 @@ _sel_word(Termio *sd, int cx, int cy)
           }
         if (!done)
           {
-             if (!cells[w - 1].att.autowrapped)
+             if (!cells[w - 1].autowrapped)
                {
                   goto end;
                }
@@ -1043,7 +1083,7 @@ _sel_word(Termio *sd, int cx, int cy)
 
    _trim_sel_word(sd);
 
-   termpty_backlog_unlock();
+   termpty_backlog_unlock(sd->pty);
 }
 
 static void
@@ -1325,7 +1365,7 @@ _selection_newline_extend_fix(Termio *sd)
    if ((sd->top_left) || (sd->bottom_right) || (sd->pty->selection.is_box))
      return;
 
-   termpty_backlog_lock();
+   termpty_backlog_lock(sd->pty);
 
    start_x = sd->pty->selection.start.x;
    start_y = sd->pty->selection.start.y;
@@ -1370,7 +1410,7 @@ _selection_newline_extend_fix(Termio *sd)
    sd->pty->selection.end.x = end_x;
    sd->pty->selection.end.y = end_y;
 
-   termpty_backlog_unlock();
+   termpty_backlog_unlock(sd->pty);
 }
 
 void
@@ -1393,7 +1433,7 @@ termio_selection_dbl_fix(Termio *sd)
         INT_SWAP(start_x, end_x);
      }
 
-   termpty_backlog_lock();
+   termpty_backlog_lock(sd->pty);
    cells = termpty_cellrow_get(sd->pty, end_y - sd->scroll, &w);
    if (cells)
      {
@@ -1405,7 +1445,7 @@ termio_selection_dbl_fix(Termio *sd)
              if (end_x < (w - 1))
                {
                   if ((cells[end_x].codepoint != 0) &&
-                      (cells[end_x].att.dblwidth))
+                      (cells[end_x].dblwidth))
                     end_x++;
                }
           }
@@ -1415,7 +1455,7 @@ termio_selection_dbl_fix(Termio *sd)
              if (end_x > 0)
                {
                   if ((cells[end_x].codepoint == 0) &&
-                      (cells[end_x].att.dblwidth))
+                      (cells[end_x].dblwidth))
                     end_x--;
                }
           }
@@ -1431,7 +1471,7 @@ termio_selection_dbl_fix(Termio *sd)
              if ((start_x > 0) && (start_x < w))
                {
                   if ((cells[start_x].codepoint == 0) &&
-                      (cells[start_x].att.dblwidth))
+                      (cells[start_x].dblwidth))
                     start_x--;
                }
           }
@@ -1441,12 +1481,12 @@ termio_selection_dbl_fix(Termio *sd)
              if (start_x < (w - 1))
                {
                   if ((cells[start_x].codepoint != 0) &&
-                      (cells[start_x].att.dblwidth))
+                      (cells[start_x].dblwidth))
                     start_x++;
                }
           }
      }
-   termpty_backlog_unlock();
+   termpty_backlog_unlock(sd->pty);
 
    if (!sd->pty->selection.is_top_to_bottom)
      {
@@ -1697,7 +1737,7 @@ termio_internal_mouse_down(Termio *sd,
                   termio_take_selection(sd->self, ELM_SEL_TYPE_PRIMARY);
                }
              sd->didclick = EINA_TRUE;
-             _sel_fill_in_codepoints_array(sd);
+             _sel_fill_in_row_hashes(sd);
           }
         else if (ev->flags & EVAS_BUTTON_DOUBLE_CLICK)
           {
@@ -1721,7 +1761,7 @@ termio_internal_mouse_down(Termio *sd,
                     }
                }
              sd->didclick = EINA_TRUE;
-             _sel_fill_in_codepoints_array(sd);
+             _sel_fill_in_row_hashes(sd);
           }
         else
           {
@@ -1953,7 +1993,7 @@ termio_internal_mouse_up(Termio *sd,
                   sd->pty->selection.last_click = time(NULL);
                   sd->pty->selection.by_line = EINA_FALSE;
                   sd->pty->selection.by_word = EINA_FALSE;
-                  _sel_fill_in_codepoints_array(sd);
+                  _sel_fill_in_row_hashes(sd);
                   termio_smart_update_queue(sd);
                   return;
                }
@@ -1991,7 +2031,7 @@ termio_internal_mouse_up(Termio *sd,
              termio_selection_dbl_fix(sd);
              _selection_newline_extend_fix(sd);
              termio_take_selection(sd->self, ELM_SEL_TYPE_PRIMARY);
-             _sel_fill_in_codepoints_array(sd);
+             _sel_fill_in_row_hashes(sd);
              sd->pty->selection.makesel = EINA_FALSE;
              termio_smart_update_queue(sd);
           }
@@ -2407,6 +2447,128 @@ termio_scroll(Evas_Object *obj, int direction,
    _termio_scroll_selection(sd, ty, direction, start_y, end_y);
 }
 
+/* How the cells sharing a style are drawn */
+struct Style_Render {
+   int style; /* -1 if not computed yet */
+   int fg, bg, fgext, bgext;
+   unsigned char bold, italic, underline, strike, invisible;
+};
+
+static void
+_style_render_get(const Termio *sd, uint16_t style, int inv,
+                  struct Style_Render *sr)
+{
+   const Termatt *att = termpty_style_get(sd->pty, style);
+   int fg, bg, fgext, bgext;
+
+   fg = att->fg;
+   bg = att->bg;
+   fgext = att->fg256;
+   bgext = att->bg256;
+   if (sd->config->font.bolditalic)
+     {
+        sr->bold = att->bold;
+        sr->italic = att->italic;
+     }
+   else
+     {
+        sr->bold = 0;
+        sr->italic = 0;
+     }
+
+   if ((fg == COL_DEF) && (att->inverse ^ inv))
+     fg = COL_INVERSEBG;
+   if (bg == COL_DEF)
+     {
+        if (att->inverse ^ inv)
+          bg = COL_INVERSE;
+        else if (!bgext)
+          bg = COL_INVIS;
+     }
+   if ((att->fgintense) && (!fgext))
+     fg += 48;
+   if ((att->bgintense) && (!bgext))
+     bg += 48;
+   if ((att->bold) && (!fgext))
+     fg += 12;
+   if ((att->faint) && (!fgext))
+     fg += 24;
+   if (att->inverse ^ inv)
+     {
+        int t;
+        t = fgext; fgext = bgext; bgext = t;
+        t = fg; fg = bg; bg = t;
+     }
+   sr->style = style;
+   sr->fg = fg;
+   sr->bg = bg;
+   sr->fgext = fgext;
+   sr->bgext = bgext;
+   sr->underline = att->underline;
+   sr->strike = att->strike;
+   sr->invisible = att->invisible;
+   // att->blink
+   // att->blink2
+}
+
+/* Activates @blk, whose top-left corner is at @x,@y on the grid, and moves
+ * its object there if needed.  Done once per render for every block seen */
+static void
+_block_place(Termio *sd, Termblock *blk, int x, int y,
+             Evas_Coord ox, Evas_Coord oy)
+{
+   Evas_Coord bx, by, bw, bh;
+
+   termio_block_activate(sd->self, blk);
+   blk->x = x;
+   blk->y = y;
+   if (!blk->obj)
+     return;
+   evas_object_geometry_get(blk->obj, &bx, &by, &bw, &bh);
+   if ((bx != ox + (x * sd->font.chw)) || (by != oy + (y * sd->font.chh)))
+     evas_object_move(blk->obj,
+                      ox + (x * sd->font.chw),
+                      oy + (y * sd->font.chh));
+   if ((bw != blk->w * sd->font.chw) || (bh != blk->h * sd->font.chh))
+     evas_object_resize(blk->obj,
+                        blk->w * sd->font.chw,
+                        blk->h * sd->font.chh);
+}
+
+/* Remembers the rows showing the active blocks, so that the next render
+ * looks at them even if they are not dirty: a block no longer found there
+ * gets deactivated */
+static void
+_blocks_rows_update(Termio *sd)
+{
+   Termblock *blk;
+   Eina_List *l;
+
+   if (sd->blocks.h != sd->grid.h)
+     {
+        free(sd->blocks.rows);
+        sd->blocks.h = 0;
+        sd->blocks.rows = NULL;
+        if (sd->grid.h <= 0)
+          return;
+        sd->blocks.rows = malloc(sd->grid.h);
+        if (!sd->blocks.rows)
+          return;
+        sd->blocks.h = sd->grid.h;
+     }
+   memset(sd->blocks.rows, 0, sd->blocks.h);
+   EINA_LIST_FOREACH(sd->pty->block.active, l, blk)
+     {
+        int y, y2;
+
+        if (!blk->active)
+          continue;
+        y2 = MIN(blk->y + blk->h, sd->blocks.h);
+        for (y = MAX(blk->y, 0); y < y2; y++)
+          sd->blocks.rows[y] = 1;
+     }
+}
+
 void
 termio_internal_render(Termio *sd,
                        Evas_Coord ox, Evas_Coord oy,
@@ -2416,9 +2578,13 @@ termio_internal_render(Termio *sd,
    const char *preedit_str;
    ssize_t w;
    int sel_start_x = 0, sel_start_y = 0, sel_end_x = 0, sel_end_y = 0;
-   Termblock *blk;
+   Termblock *blk, *last_blk = NULL;
    Eina_List *l;
+   Eina_Bool full;
+   struct Style_Render sr = { .style = -1 };
+   int last_bid = -1;
 
+   termpty_backlog_lock(sd->pty);
    EINA_LIST_FOREACH(sd->pty->block.active, l, blk)
      {
         blk->was_active = blk->active;
@@ -2426,8 +2592,19 @@ termio_internal_render(Termio *sd,
      }
 
    inv = sd->pty->termstate.reverse;
-   termpty_backlog_lock();
    termpty_backscroll_adjust(sd->pty, &sd->scroll);
+   preedit_str = term_preedit_str_get(sd->term);
+   termio_search_update(sd);
+
+   /* Only the rows of the screen written since the last render need to be
+    * looked at, unless the whole view may have moved or changed */
+   full = (sd->pty->dirty.all ||
+           (sd->scroll != 0) || (sd->last_render.scroll != 0) ||
+           (inv != sd->last_render.inverse) ||
+           ((sd->pty->block.active != NULL) &&
+            (sd->blocks.h != sd->grid.h)) ||
+           (preedit_str && preedit_str[0]) || (sd->last_render.preedit) ||
+           (sd->search.changes != sd->last_render.search));
 
    /* Make selection bottom to top */
    sel_start_x = sd->pty->selection.start.x;
@@ -2445,54 +2622,53 @@ termio_internal_render(Termio *sd,
      {
         Termcell *cells;
         Evas_Textgrid_Cell *tc;
-        Eina_Unicode *cp = NULL;
+        const uint32_t *sel_row = NULL;
+        uint32_t sel_hash = SEL_HASH_INIT;
         int cur_sel_start_x = -1, cur_sel_end_x = -1;
         int rel_y = y - sd->scroll;
         int l1 = -1, l2 = -1;
+        Termio_Search_Row found_row;
+        Eina_Bool found;
+
+        if ((!full) && (rel_y < sd->pty->h) &&
+            (!termpty_row_is_dirty(sd->pty, rel_y)) &&
+            ((sd->blocks.h != sd->grid.h) || (!sd->blocks.rows[y])))
+          continue;
 
         w = 0;
         cells = termpty_cellrow_get(sd->pty, rel_y, &w);
         if (!cells)
           continue;
+        /* fetching a backlog row may have renumbered the styles */
+        sr.style = -1;
         tc = evas_object_textgrid_cellrow_get(sd->grid.obj, y);
         if (!tc)
           continue;
+        found = ((sd->search.s) &&
+                 (termio_search_row_get(sd, rel_y, &found_row)));
 
         /* Compute @cur_sel_start_x, @cur_sel_end_x */
-        if (sd->pty->selection.codepoints)
+        if ((sd->pty->selection.row_hashes) &&
+            (sel_start_y <= rel_y) && (rel_y <= sel_end_y) &&
+            (rel_y - sel_start_y < sd->pty->selection.row_hashes_count))
           {
-             cp = sd->pty->selection.codepoints;
-             if (sel_start_y <= rel_y && rel_y <= sel_end_y)
+             sel_row = sd->pty->selection.row_hashes + (rel_y - sel_start_y);
+             cur_sel_start_x = sel_start_x;
+             cur_sel_end_x = sel_end_x;
+             if ((!sd->pty->selection.is_box) && (sel_start_y != sel_end_y))
                {
-                  if (sd->pty->selection.is_box)
+                  if (rel_y == sel_start_y)
+                    {
+                       cur_sel_end_x = sd->grid.w - 1;
+                    }
+                  else if (rel_y == sel_end_y)
                     {
-                       cp += (rel_y - sel_start_y) * (sel_end_x - sel_start_x + 1);
-                       cur_sel_start_x = sel_start_x;
-                       cur_sel_end_x = sel_end_x;
+                       cur_sel_start_x = 0;
                     }
                   else
                     {
-                       cp += (rel_y - sel_start_y) * sd->pty->w;
-                       cur_sel_start_x = sel_start_x;
-                       cur_sel_end_x = sel_end_x;
-                       if (sel_start_y != sel_end_y)
-                         {
-                            if (rel_y == sel_start_y)
-                              {
-                                 cur_sel_end_x = sd->grid.w - 1;
-                              }
-                            else if (rel_y == sel_end_y)
-                              {
-                                 cp -= sel_start_x;
-                                 cur_sel_start_x = 0;
-                              }
-                            else
-                              {
-                                 cp -= sel_start_x;
-                                 cur_sel_start_x = 0;
-                                 cur_sel_end_x = sd->grid.w - 1;
-                              }
-                         }
+                       cur_sel_start_x = 0;
+                       cur_sel_end_x = sd->grid.w - 1;
                     }
                }
           }
@@ -2530,10 +2706,9 @@ termio_internal_render(Termio *sd,
         /* Look at every cell in that line */
         for (x = 0; x < sd->grid.w; x++)
           {
-             Eina_Unicode *u = NULL;
-
-             if (cp && cur_sel_start_x <= x && x <= cur_sel_end_x)
-               u = cp++;
+             Eina_Bool in_sel = ((sel_row) &&
+                                 (cur_sel_start_x <= x) &&
+                                 (x <= cur_sel_end_x));
 
              if ((!cells) || (x >= w))
                {
@@ -2554,11 +2729,8 @@ termio_internal_render(Termio *sd,
                   tc[x].italic = 0;
                   tc[x].double_width = 0;
 
-                  if (u && *u != ' ' && *u)
-                    {
-                       termio_sel_set(sd, EINA_FALSE);
-                       u = cp = NULL;
-                    }
+                  if (in_sel)
+                    sel_hash = _sel_hash_add(sel_hash, ' ');
                   if (EINA_UNLIKELY(l1 >= 0 && x >= l1 && x <= l2))
                     {
                        termio_remove_links(sd);
@@ -2570,11 +2742,21 @@ termio_internal_render(Termio *sd,
                   int bid, bx = 0, by = 0;
 
                   bid = termpty_block_id_get(&(cells[x]), &bx, &by);
+                  if (cells[x].style != sr.style)
+                    _style_render_get(sd, cells[x].style, inv, &sr);
                   if (bid >= 0)
                     {
-                       if (ch1 < 0)
-                         ch1 = x;
-                       ch2 = x;
+                       if ((tc[x].codepoint != 0) ||
+                           (tc[x].fg != COL_INVIS) ||
+                           (tc[x].bg != COL_INVIS) ||
+                           (tc[x].fg_extended) || (tc[x].bg_extended) ||
+                           (tc[x].underline) || (tc[x].strikethrough) ||
+                           (tc[x].double_width))
+                         {
+                            if (ch1 < 0)
+                              ch1 = x;
+                            ch2 = x;
+                         }
                        tc[x].codepoint = 0;
                        tc[x].fg_extended = 0;
                        tc[x].bg_extended = 0;
@@ -2585,31 +2767,24 @@ termio_internal_render(Termio *sd,
                        tc[x].double_width = 0;
                        tc[x].fg = COL_INVIS;
                        tc[x].bg = COL_INVIS;
-                       blk = termpty_block_get(sd->pty, bid);
-                       if (blk)
+                       /* a block spans several cells in a row, and is
+                        * placed only from the first one seen */
+                       if (bid != last_bid)
                          {
-                            termio_block_activate(sd->self, blk);
-                            blk->x = (x - bx);
-                            blk->y = (y - by);
-                            evas_object_move(blk->obj,
-                                             ox + (blk->x * sd->font.chw),
-                                             oy + (blk->y * sd->font.chh));
-                            evas_object_resize(blk->obj,
-                                               blk->w * sd->font.chw,
-                                               blk->h * sd->font.chh);
-                         }
-                       if (u && *u != ' ' && *u)
-                         {
-                            termio_sel_set(sd, EINA_FALSE);
-                            u = cp = NULL;
+                            last_bid = bid;
+                            last_blk = termpty_block_get(sd->pty, bid);
                          }
+                       if ((last_blk) && (!last_blk->active))
+                         _block_place(sd, last_blk, x - bx, y - by, ox, oy);
+                       if (in_sel)
+                         sel_hash = _sel_hash_add(sel_hash, ' ');
                        if (EINA_UNLIKELY(l1 >= 0 && x >= l1 && x <= l2))
                          {
                             termio_remove_links(sd);
                             l1 = l2 = -1;
                          }
                     }
-                  else if (cells[x].att.invisible)
+                  else if (sr.invisible)
                     {
                        if ((tc[x].codepoint != 0) ||
                            (tc[x].bg != COL_INVIS) ||
@@ -2626,15 +2801,12 @@ termio_internal_render(Termio *sd,
                        tc[x].strikethrough = 0;
                        tc[x].bold = 0;
                        tc[x].italic = 0;
-                       tc[x].double_width = cells[x].att.dblwidth;
+                       tc[x].double_width = cells[x].dblwidth;
                        if ((tc[x].double_width) && (tc[x].codepoint == 0) &&
                            (ch2 == x - 1))
                          ch2 = x;
-                       if (u && *u != ' ' && *u)
-                         {
-                            termio_sel_set(sd, EINA_FALSE);
-                            u = cp = NULL;
-                         }
+                       if (in_sel)
+                         sel_hash = _sel_hash_add(sel_hash, ' ');
                        if (EINA_UNLIKELY(l1 >= 0 && x >= l1 && x <= l2))
                          {
                             termio_remove_links(sd);
@@ -2643,80 +2815,51 @@ termio_internal_render(Termio *sd,
                     }
                   else
                     {
-                       int fg, bg, fgext, bgext, bold, italic;
-                       Eina_Unicode codepoint;
-
-                       // colors
-                       fg = cells[x].att.fg;
-                       bg = cells[x].att.bg;
-                       fgext = cells[x].att.fg256;
-                       bgext = cells[x].att.bg256;
-                       codepoint = cells[x].codepoint;
-                       if (sd->config->font.bolditalic)
+                       Eina_Unicode codepoint = cells[x].codepoint;
+                       const struct Style_Render *r = &sr;
+                       struct Style_Render found_sr;
+                       int found_cell = 0;
+
+                       if (EINA_UNLIKELY(found))
+                         found_cell = termio_search_cell_get(sd, &found_row, x);
+                       if (found_cell)
                          {
-                            bold = cells[x].att.bold;
-                            italic = cells[x].att.italic;
-                         }
-                       else
-                         {
-                            bold = 0;
-                            italic = 0;
-                         }
-
-                       if ((fg == COL_DEF) && (cells[x].att.inverse ^ inv))
-                         fg = COL_INVERSEBG;
-                       if (bg == COL_DEF)
-                         {
-                            if (cells[x].att.inverse ^ inv)
-                              bg = COL_INVERSE;
-                            else if (!bgext)
-                              bg = COL_INVIS;
-                         }
-                       if ((cells[x].att.fgintense) && (!fgext))
-                         fg += 48;
-                       if ((cells[x].att.bgintense) && (!bgext))
-                         bg += 48;
-                       if ((cells[x].att.bold) && (!fgext))
-                         fg += 12;
-                       if ((cells[x].att.faint) && (!fgext))
-                         fg += 24;
-                       if (cells[x].att.inverse ^ inv)
-                         {
-                            int t;
-                            t = fgext; fgext = bgext; bgext = t;
-                            t = fg; fg = bg; bg = t;
+                            /* matched by the search */
+                            found_sr = sr;
+                            found_sr.fg = COL_BLACK;
+                            found_sr.bg = COL_YELLOW;
+                            found_sr.fgext = 0;
+                            found_sr.bgext = 0;
+                            if (found_cell > 1)
+                              {
+                                 found_sr.bg += 48;
+                                 found_sr.underline = 1;
+                              }
+                            r = &found_sr;
                          }
                        if ((tc[x].codepoint != codepoint) ||
-                           (tc[x].bold != bold) ||
-                           (tc[x].italic != italic) ||
-                           (tc[x].fg != fg) ||
-                           (tc[x].bg != bg) ||
-                           (tc[x].fg_extended != fgext) ||
-                           (tc[x].bg_extended != bgext) ||
-                           (tc[x].underline != cells[x].att.underline) ||
-                           (tc[x].strikethrough != cells[x].att.strike))
+                           (tc[x].bold != r->bold) ||
+                           (tc[x].italic != r->italic) ||
+                           (tc[x].fg != r->fg) ||
+                           (tc[x].bg != r->bg) ||
+                           (tc[x].fg_extended != r->fgext) ||
+                           (tc[x].bg_extended != r->bgext) ||
+                           (tc[x].underline != r->underline) ||
+                           (tc[x].strikethrough != r->strike))
                          {
                             if (ch1 < 0)
                               ch1 = x;
                             ch2 = x;
                          }
-                       tc[x].fg_extended = fgext;
-                       tc[x].bg_extended = bgext;
-                       tc[x].underline = cells[x].att.underline;
-                       tc[x].strikethrough = cells[x].att.strike;
-                       if (sd->config->font.bolditalic)
-                         {
-                            tc[x].bold = cells[x].att.bold;
-                            tc[x].italic = cells[x].att.italic;
-                         }
-                       else
-                         {
-                            tc[x].bold = 0;
-                            tc[x].italic = 0;
-                         }
-                       tc[x].double_width = cells[x].att.dblwidth;
-                       tc[x].fg = fg;
-                       tc[x].bg = bg;
+                       tc[x].fg_extended = r->fgext;
+                       tc[x].bg_extended = r->bgext;
+                       tc[x].underline = r->underline;
+                       tc[x].strikethrough = r->strike;
+                       tc[x].bold = r->bold;
+                       tc[x].italic = r->italic;
+                       tc[x].double_width = cells[x].dblwidth;
+                       tc[x].fg = r->fg;
+                       tc[x].bg = r->bg;
                        if (tc[x].codepoint != codepoint &&
                            EINA_UNLIKELY(l1 >= 0 && x >= l1 && x <= l2))
                          {
@@ -2727,26 +2870,28 @@ termio_internal_render(Termio *sd,
                        if ((tc[x].double_width) && (tc[x].codepoint == 0) &&
                            (ch2 == x - 1))
                          ch2 = x;
-                       // cells[x].att.blink
-                       // cells[x].att.blink2
-                       if (u && (*u != codepoint) &&
-                           !(*u == 0x20 && codepoint == 0))
-                         {
-                            termio_sel_set(sd, EINA_FALSE);
-                            u = cp = NULL;
-                         }
+                       if (in_sel)
+                         sel_hash = _sel_hash_add(sel_hash,
+                                                   codepoint ? codepoint : ' ');
                     }
                }
           }
         evas_object_textgrid_cellrow_set(sd->grid.obj, y, tc);
+        if ((sel_row) && (*sel_row != sel_hash))
+          termio_sel_set(sd, EINA_FALSE);
         /* only bothering to keep 1 change span per row - not worth doing
          * more really */
         if (ch1 >= 0)
           evas_object_textgrid_update_add(sd->grid.obj, ch1, y,
                                           ch2 - ch1 + 1, 1);
      }
+   termpty_screen_dirty_clear(sd->pty);
+   _blocks_rows_update(sd);
+   sd->last_render.scroll = sd->scroll;
+   sd->last_render.search = sd->search.changes;
+   sd->last_render.inverse = inv;
+   sd->last_render.preedit = (preedit_str && preedit_str[0]);
 
-   preedit_str = term_preedit_str_get(sd->term);
    if (preedit_str && preedit_str[0])
      {
         Eina_Unicode *uni;
@@ -2825,7 +2970,7 @@ termio_internal_render(Termio *sd,
         preedit_x = x - sd->cursor.x;
         preedit_y = y - sd->cursor.y;
      }
-   termpty_backlog_unlock();
+   termpty_backlog_unlock(sd->pty);
    *preedit_xp = preedit_x;
    *preedit_yp = preedit_y;
 }
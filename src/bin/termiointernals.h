@@ -6,6 +6,7 @@ typedef void Term;
 #endif
 
 typedef struct _Termio Termio;
+typedef struct _Termio_Search Termio_Search;
 
 struct _Termio
 {
@@ -50,11 +51,32 @@ struct _Termio
       FILE *f;
       double progress;
       unsigned long long total, size;
+      int version; /* of the data packets, see tysend.c */
+      unsigned int seq; /* expected sequence number of the next packet */
+      int percent; /* last progress notified */
+      unsigned char *buf; /* to decode the packets of version 2 */
+      size_t bufsize;
       Eina_Bool active : 1;
    } sendfile;
+   struct {
+      Termio_Search *s; /* NULL if there is none, see termiosearch.c */
+      unsigned int changes; /* bumped when what is highlighted changed */
+   } search;
+   struct {
+      unsigned char *rows; /* rows of the grid showing an active block */
+      int h;
+   } blocks;
    Evas_Object *ctxpopup;
    int zoom_fontsize_start;
    int scroll;
+   struct {
+      int scroll;
+      unsigned int search; /* search.changes */
+      unsigned char inverse : 1;
+      unsigned char preedit : 1;
+      double time; /* when it happened */
+      double duration; /* how long it took */
+   } last_render;
    Evas_Object *self;
    Evas_Object *event;
    Term *term;
@@ -131,6 +153,29 @@ termio_selection_get(Termio *sd,
                      int c1x, int c1y, int c2x, int c2y,
                      struct ty_sb *sb,
                      Eina_Bool rtrim);
+
+/* Rows of the selection exported at once by termio_internal_get_selection() */
+#define SEL_EXPORT_ROWS 1024
+
+typedef struct _Termio_Sel_Export Termio_Sel_Export;
+struct _Termio_Sel_Export
+{
+   Termio *sd;
+   int c1x, c1y, c2x, c2y;
+   int y; /* next row to export */
+   /* ty->backlog_changes when the last rows were exported, as the pty
+    * thread can scroll between two calls */
+   unsigned int lines, gen;
+   Eina_Bool box;
+};
+
+void
+termio_selection_export_begin(Termio *sd, Termio_Sel_Export *ex);
+int
+termio_selection_export_next(Termio_Sel_Export *ex, struct ty_sb *sb,
+                             int rows);
+void
+termio_selection_export_end(Termio_Sel_Export *ex);
 void
 termio_scroll(Evas_Object *obj, int direction, int start_y, int end_y);
 void
@@ -213,7 +213,7 @@ _txt_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp, int *codepointp)
    if ((*x >= w))
      goto empty;
    cell = cells[*x];
-   if ((cell.codepoint == 0) && (cell.att.dblwidth))
+   if ((cell.codepoint == 0) && (cell.dblwidth))
      {
         (*x)--;
         if (*x < 0)
@@ -221,7 +221,7 @@ _txt_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp, int *codepointp)
         cell = cells[*x];
      }
 
-   if ((cell.codepoint == 0) || (cell.att.link_id))
+   if ((cell.codepoint == 0) || (TERMPTY_CELL_STYLE(ty, cell)->link_id))
      goto empty;
 
    *txtlenp = codepoint_to_utf8(cell.codepoint, txt);
@@ -263,7 +263,7 @@ _txt_prev_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
         /* Either the cell is in the normal screen and needs to have
          * autowrapped flag or is in the backlog and its length is larger than
          * the screen, spanning multiple lines */
-        if (((!cell.att.autowrapped) && (*y) >= 0)
+        if (((!cell.autowrapped) && (*y) >= 0)
             || (w < ty->w))
           goto empty;
      }
@@ -277,7 +277,7 @@ _txt_prev_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
 
         cell = cells[*x];
      }
-   if ((cell.codepoint == 0) && (cell.att.dblwidth))
+   if ((cell.codepoint == 0) && (cell.dblwidth))
      {
         (*x)--;
         if (*x < 0)
@@ -285,7 +285,7 @@ _txt_prev_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
         cell = cells[*x];
      }
 
-   if ((cell.codepoint == 0) || (cell.att.link_id))
+   if ((cell.codepoint == 0) || (TERMPTY_CELL_STYLE(ty, cell)->link_id))
      goto empty;
 
    *txtlenp = codepoint_to_utf8(cell.codepoint, txt);
@@ -323,7 +323,7 @@ _txt_next_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
         if ((*x) <= ty->w)
           {
              cell = cells[w-1];
-             if (!cell.att.autowrapped)
+             if (!cell.autowrapped)
                goto empty;
           }
 
@@ -334,13 +334,13 @@ _txt_next_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
      }
 
    cell = cells[*x];
-   if ((cell.codepoint == 0) && (cell.att.dblwidth))
+   if ((cell.codepoint == 0) && (cell.dblwidth))
      {
         (*x)++;
         if (*x >= w)
           {
              cell = cells[w-1];
-             if (!cell.att.autowrapped && w == ty->w)
+             if (!cell.autowrapped && w == ty->w)
                goto empty;
              (*y)++;
              *x = 0;
@@ -352,7 +352,7 @@ _txt_next_at(Termpty *ty, int *x, int *y, char *txt, int *txtlenp,
      }
 
    cell = cells[*x];
-   if ((cell.codepoint == 0) || (cell.att.link_id))
+   if ((cell.codepoint == 0) || (TERMPTY_CELL_STYLE(ty, cell)->link_id))
      goto empty;
 
    *txtlenp = codepoint_to_utf8(cell.codepoint, txt);
@@ -372,38 +372,29 @@ bad:
    return -1;
 }
 
-/* returned string must be freed */
-char *
-termio_link_find(const Evas_Object *obj, int cx, int cy,
-                 int *x1r, int *y1r, int *x2r, int *y2r)
+/* Find the link around the cell (@x, @y) of @ty, in the text.  Fills in
+ * @span with the result, with @span->str as NULL if there is none.  The
+ * rows the text was read from go from @first to @last */
+static void
+_link_span_find(Termpty *ty, int x, int y, Term_Link_Span *span,
+                int *first, int *last)
 {
-   char *s = NULL;
    int endmatch1 = 0, endmatch2 = 0;
-   int x1, x2, y1, y2, w = 0, h = 0, sc;
+   int x1, x2, y1, y2;
    Eina_Bool goback = EINA_TRUE,
              goforward = EINA_FALSE,
              escaped = EINA_FALSE;
    struct ty_sb sb = {.buf = NULL, .gap = 0, .len = 0, .alloc = 0};
-   Termpty *ty = termio_pty_get(obj);
    int res;
    char txt[8];
    int txtlen = 0;
    int codepoint = 0;
    Eina_Bool was_protocol = EINA_FALSE;
 
-   EINA_SAFETY_ON_NULL_RETURN_VAL(ty, NULL);
-
-   x1 = x2 = cx;
-   y1 = y2 = cy;
-   termio_size_get(obj, &w, &h);
-   if ((w <= 0) || (h <= 0)) goto end;
-
-   sc = termio_scroll_get(obj);
-
-   termpty_backlog_lock();
-
-   y1 -= sc;
-   y2 -= sc;
+   span->str = NULL;
+   x1 = x2 = x;
+   y1 = y2 = y;
+   *first = *last = y;
 
    res = _txt_at(ty, &x1, &y1, txt, &txtlen, &codepoint);
    if ((res != 0) || (txtlen == 0)) goto end;
@@ -417,6 +408,7 @@ termio_link_find(const Evas_Object *obj, int cx, int cy,
         int new_x1 = x1, new_y1 = y1;
 
         res = _txt_prev_at(ty, &new_x1, &new_y1, txt, &txtlen, &codepoint);
+        *first = new_y1;
         if ((res != 0) || (txtlen == 0))
           {
              goback = EINA_FALSE;
@@ -429,6 +421,7 @@ termio_link_find(const Evas_Object *obj, int cx, int cy,
           {
              int old_txtlen = txtlen;
              res = _txt_prev_at(ty, &new_x1, &new_y1, txt, &txtlen, &codepoint);
+             *first = new_y1;
              if ((res != 0) || (txtlen == 0) || (codepoint != '\\'))
                {
                   ty_sb_lskip(&sb, old_txtlen);
@@ -496,6 +489,8 @@ termio_link_find(const Evas_Object *obj, int cx, int cy,
         int new_x2 = x2, new_y2 = y2;
         /* Check if the previous char is a delimiter */
         res = _txt_next_at(ty, &new_x2, &new_y2, txt, &txtlen, &codepoint);
+        if (new_y2 > *last)
+          *last = new_y2;
         if ((res != 0) || (txtlen == 0))
           {
              goforward = EINA_FALSE;
@@ -583,34 +578,279 @@ termio_link_find(const Evas_Object *obj, int cx, int cy,
 out:
    if (sb.len)
      {
-        Eina_Bool is_file = link_is_file(sb.buf);
-
-        if (is_file ||
+        if (link_is_file(sb.buf) ||
             link_is_email(sb.buf) ||
             link_is_url(sb.buf))
           {
-             if (x1r) *x1r = x1;
-             if (y1r) *y1r = y1 + sc;
-             if (x2r) *x2r = x2;
-             if (y2r) *y2r = y2 + sc;
+             span->x1 = x1;
+             span->y1 = y1;
+             span->x2 = x2;
+             span->y2 = y2;
+             span->str = ty_sb_steal_buf(&sb);
+          }
+     }
+end:
+   ty_sb_free(&sb);
+}
 
-             if (is_file && (sb.buf[0] != '/'))
-               {
-                  char *local= _local_path_get(obj, (const char*)sb.buf);
-                  ty_sb_free(&sb);
-                  s = local;
-                  goto end;
-               }
-             else
-               {
-                  s = ty_sb_steal_buf(&sb);
-               }
+/* {{{ Link spans */
+
+/* Looking for links means going through the text around the mouse
+ * cursor, cell by cell, each time it moves.  What was found is kept, for
+ * the cells it was looked from, by row counted from the top of the
+ * backlog, so that it stays valid when the screen scrolls.  It is dropped
+ * once one of the rows the text was read from changed, as told by
+ * termpty_cells_dirty() */
+
+static Eina_Bool
+_link_span_eq(const Term_Link_Span *a, const Term_Link_Span *b)
+{
+   if ((!a->str) || (!b->str))
+     return (!a->str) && (!b->str);
+   return (a->x1 == b->x1) && (a->y1 == b->y1) &&
+          (a->x2 == b->x2) && (a->y2 == b->y2) &&
+          (!strcmp(a->str, b->str));
+}
+
+static void
+_link_spans_row_clear(Termpty *ty, unsigned int r)
+{
+   unsigned int i;
+
+   for (i = 0; i < ty->link_spans.rows[r].n; i++)
+     free(ty->link_spans.rows[r].spans[i].str);
+   ty->link_spans.rows[r].n = 0;
+}
+
+void
+termio_link_spans_free(Termpty *ty)
+{
+   unsigned int r;
 
-             goto end;
+   for (r = 0; r < LINK_SPAN_ROWS; r++)
+     {
+        _link_spans_row_clear(ty, r);
+        free(ty->link_spans.rows[r].spans);
+        ty->link_spans.rows[r].spans = NULL;
+        ty->link_spans.rows[r].size = 0;
+     }
+}
+
+/* The rows from @start_y to @end_y included of the screen were scrolled
+ * by termpty_text_scroll(), with @lines lines in the backlog before, or
+ * by termpty_text_scroll_rev() */
+void
+termio_link_spans_scroll(Termpty *ty, int start_y, int end_y,
+                         unsigned int lines)
+{
+   unsigned int m, r;
+   int y;
+
+   if (ty->backlog_changes.lines == lines + 1)
+     {
+        /* the top row went to the backlog, the others keep their number.
+         * It is now the bottom one */
+        m = (ty->rows[end_y] - ty->screen) / ty->w;
+        r = lines % LINK_SPAN_ROWS;
+        ty->link_spans.saved[r].row = lines;
+        ty->link_spans.saved[r].stamp = ty->dirty.changed[m];
+        ty->dirty.changed[m] = ty->link_spans.stamp;
+     }
+   else if (ty->backlog_changes.lines == lines)
+     {
+        for (y = start_y; y <= end_y; y++)
+          {
+             m = (ty->rows[y] - ty->screen) / ty->w;
+             ty->dirty.changed[m] = ty->link_spans.stamp;
           }
      }
+   else
+     ty->link_spans.gen++;
+}
+
+/* Whether none of the rows the links of table row @r were looked for in
+ * changed since */
+static Eina_Bool
+_link_spans_row_valid(const Termpty *ty, unsigned int r)
+{
+   unsigned int lines = ty->backlog_changes.lines;
+   unsigned int row, stamp;
+
+   if ((ty->link_spans.rows[r].gen != ty->link_spans.gen) ||
+       (ty->link_spans.rows[r].backlog_gen != ty->backlog_changes.gen))
+     return EINA_FALSE;
+   for (row = ty->link_spans.rows[r].first;
+        (int)(row - ty->link_spans.rows[r].last) <= 0;
+        row++)
+     {
+        int y = (int)(row - lines);
+
+        if (y >= ty->h)
+          break;
+        if (y >= 0)
+          stamp = ty->dirty.changed[(ty->rows[y] - ty->screen) / ty->w];
+        else if ((int)(row - ty->link_spans.rows[r].lines) < 0)
+          continue; /* already in the backlog */
+        else if (ty->link_spans.saved[row % LINK_SPAN_ROWS].row == row)
+          stamp = ty->link_spans.saved[row % LINK_SPAN_ROWS].stamp;
+        else
+          return EINA_FALSE;
+        if ((int)(stamp - ty->link_spans.rows[r].stamp) > 0)
+          return EINA_FALSE;
+     }
+   return EINA_TRUE;
+}
+
+/* What is known about looking from cell (@x, @y).  @pos is set to where
+ * it would be inserted otherwise */
+static Term_Link_Span *
+_link_span_get(Termpty *ty, int x, int y, unsigned int *pos)
+{
+   unsigned int row = ty->backlog_changes.lines + y;
+   unsigned int r = row % LINK_SPAN_ROWS;
+   unsigned int lo = 0, hi;
+
+   if ((!ty->link_spans.rows[r].spans) ||
+       (ty->link_spans.rows[r].row != row) ||
+       (!_link_spans_row_valid(ty, r)))
+     {
+        _link_spans_row_clear(ty, r);
+        ty->link_spans.rows[r].row = row;
+        ty->link_spans.rows[r].first = ty->link_spans.rows[r].last = row;
+        ty->link_spans.rows[r].lines = ty->backlog_changes.lines;
+        ty->link_spans.rows[r].gen = ty->link_spans.gen;
+        ty->link_spans.rows[r].backlog_gen = ty->backlog_changes.gen;
+        /* what changes from now on gets a later stamp */
+        ty->link_spans.rows[r].stamp = ty->link_spans.stamp++;
+     }
+   hi = ty->link_spans.rows[r].n;
+   while (lo < hi)
+     {
+        unsigned int mid = (lo + hi) / 2;
+        Term_Link_Span *span = &ty->link_spans.rows[r].spans[mid];
+
+        if (x < span->from)
+          hi = mid;
+        else if (x > span->to)
+          lo = mid + 1;
+        else
+          return span;
+     }
+   *pos = lo;
+   return NULL;
+}
+
+/* Remember @span, looked for from cell (@x, @y) in the text of rows
+ * @first to @last, before the span at @pos.  It is merged with its
+ * neighbours when they are the same */
+static Term_Link_Span *
+_link_span_add(Termpty *ty, int x, int y, int first, int last,
+               unsigned int pos, Term_Link_Span *span)
+{
+   unsigned int row = ty->backlog_changes.lines + y;
+   unsigned int r = row % LINK_SPAN_ROWS;
+   Term_Link_Span *spans = ty->link_spans.rows[r].spans;
+   unsigned int n = ty->link_spans.rows[r].n;
+   Eina_Bool left, right;
+
+   if ((int)(row + (first - y) - ty->link_spans.rows[r].first) < 0)
+     ty->link_spans.rows[r].first = row + (first - y);
+   if ((int)(row + (last - y) - ty->link_spans.rows[r].last) > 0)
+     ty->link_spans.rows[r].last = row + (last - y);
+   if (span->str)
+     {
+        span->y1 -= y;
+        span->y2 -= y;
+     }
+
+   left = ((pos > 0) && (spans[pos - 1].to == x - 1) &&
+           (_link_span_eq(&spans[pos - 1], span)));
+   right = ((pos < n) && (spans[pos].from == x + 1) &&
+            (_link_span_eq(&spans[pos], span)));
+   if (left && right)
+     {
+        spans[pos - 1].to = spans[pos].to;
+        free(spans[pos].str);
+        memmove(&spans[pos], &spans[pos + 1],
+                (n - pos - 1) * sizeof(Term_Link_Span));
+        ty->link_spans.rows[r].n--;
+     }
+   else if (left)
+     spans[pos - 1].to = x;
+   else if (right)
+     spans[pos].from = x;
+   if (left || right)
+     {
+        free(span->str);
+        return left ? &spans[pos - 1] : &spans[pos];
+     }
+
+   if (n == ty->link_spans.rows[r].size)
+     {
+        unsigned int size = n ? n * 2 : 8;
+
+        spans = realloc(spans, size * sizeof(Term_Link_Span));
+        if (!spans)
+          {
+             free(span->str);
+             return NULL;
+          }
+        ty->link_spans.rows[r].spans = spans;
+        ty->link_spans.rows[r].size = size;
+     }
+   memmove(&spans[pos + 1], &spans[pos], (n - pos) * sizeof(Term_Link_Span));
+   span->from = span->to = x;
+   spans[pos] = *span;
+   ty->link_spans.rows[r].n++;
+   return &spans[pos];
+}
+
+/* }}} */
+
+/* returned string must be freed */
+char *
+termio_link_find(const Evas_Object *obj, int cx, int cy,
+                 int *x1r, int *y1r, int *x2r, int *y2r)
+{
+   char *s = NULL;
+   int w = 0, h = 0, sc, y;
+   unsigned int pos = 0;
+   Termpty *ty = termio_pty_get(obj);
+   Term_Link_Span *span;
+
+   EINA_SAFETY_ON_NULL_RETURN_VAL(ty, NULL);
+
+   termio_size_get(obj, &w, &h);
+   if ((w <= 0) || (h <= 0)) return NULL;
+
+   sc = termio_scroll_get(obj);
+   y = cy - sc;
+
+   termpty_backlog_lock(ty);
+
+   span = _link_span_get(ty, cx, y, &pos);
+   if (!span)
+     {
+        Term_Link_Span found;
+        int first, last;
+
+        _link_span_find(ty, cx, y, &found, &first, &last);
+        span = _link_span_add(ty, cx, y, first, last, pos, &found);
+     }
+   if ((!span) || (!span->str))
+     goto end;
+
+   if (x1r) *x1r = span->x1;
+   if (y1r) *y1r = span->y1 + cy;
+   if (x2r) *x2r = span->x2;
+   if (y2r) *y2r = span->y2 + cy;
+
+   if ((link_is_file(span->str)) && (span->str[0] != '/'))
+     s = _local_path_get(obj, span->str);
+   else
+     s = strdup(span->str);
+
 end:
-   termpty_backlog_unlock();
-   ty_sb_free(&sb);
+   termpty_backlog_unlock(ty);
    return s;
 }
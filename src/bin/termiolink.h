@@ -2,6 +2,8 @@
 #define _TERMIO_LINK_H__ 1
 
 char *termio_link_find(const Evas_Object *obj, int cx, int cy, int *x1r, int *y1r, int *x2r, int *y2r);
+void termio_link_spans_free(Termpty *ty);
+void termio_link_spans_scroll(Termpty *ty, int start_y, int end_y, unsigned int lines);
 Eina_Bool link_is_protocol(const char *str);
 Eina_Bool link_is_file(const char *str);
 Eina_Bool link_is_url(const char *str);
@@ -0,0 +1,933 @@
+#include "private.h"
+
+#include <Elementary.h>
+#include <regex.h>
+#include <wctype.h>
+
+#include "termio.h"
+#include "termpty.h"
+#include "backlog.h"
+#include "termiosearch.h"
+#include "utf8.h"
+
+/* Search of the text of the backlog and of the screen, from the command
+ * box.
+ *
+ * The text is looked at by logical lines, made of the rows autowrapped
+ * into each other, so that a match can span several rows.  The lines of
+ * the backlog do not change, unless it is resized or cleared, which bumps
+ * ty->backlog_changes.gen: the matches found there are kept and the
+ * backlog is looked at bit by bit from a timer, in both directions from
+ * the line at the top of the screen when the search started:
+ *   - up to the top of the backlog, in @older;
+ *   - down, as lines scroll off the screen, in @newer.
+ * The screen, along with the line it may start in the backlog, can change
+ * at any time and is looked at again before rendering whenever its text
+ * changed, in @screen.
+ *
+ * Rows are numbered ty->backlog_changes.lines + y, y being the row in the
+ * pty, so that these numbers do not change as lines get added.  In the
+ * order of the matches, the bottom-most first, come @screen, @newer read
+ * backwards then @older.
+ */
+
+/* Time spent looking at the backlog per run of the timer */
+#define SEARCH_BUDGET 0.004
+#define SEARCH_INTERVAL 0.01
+/* Cells of a line looked at, the rest of longer lines is ignored */
+#define SEARCH_LINE_MAX (1 << 20)
+/* Do not look further up once that many matches are known */
+#define SEARCH_MATCHES_MAX (1 << 20)
+
+typedef struct _Termio_Search_Match Termio_Search_Match;
+struct _Termio_Search_Match
+{
+   unsigned int y1, y2;
+   int x1, x2;
+};
+
+typedef struct _Termio_Search_Matches Termio_Search_Matches;
+struct _Termio_Search_Matches
+{
+   Termio_Search_Match *m;
+   unsigned int n, size;
+};
+
+struct _Termio_Search
+{
+   Termio *sd;
+   char *pattern;
+   Eina_Unicode *needle; /* lowercase if @icase */
+   int needle_len;
+   regex_t re;
+   unsigned char is_regex : 1;
+   unsigned char icase : 1;
+   unsigned char has_current : 1;
+   unsigned char done : 1; /* @older reached the top of the backlog */
+   unsigned char entered : 1; /* see termio_search_enter() */
+
+   unsigned int gen; /* ty->backlog_changes.gen of the matches */
+   int w;
+   Termio_Search_Matches screen; /* from the bottom up */
+   Termio_Search_Matches newer; /* from the top down */
+   Termio_Search_Matches older; /* from the bottom up */
+   unsigned int top; /* first row of the lines looked at in @older */
+   unsigned int bottom; /* row after the lines looked at in @newer */
+   unsigned int screen_lines, screen_text; /* when @screen was filled */
+
+   unsigned int cur_y; /* start of the match jumped to */
+   int cur_x;
+   int pending; /* jump to do once more is known: 1 up, -1 down */
+   int origin; /* scroll when the search started */
+   Ecore_Timer *timer;
+
+   /* the line being looked at */
+   Termcell *cells;
+   size_t cells_size;
+   Eina_Unicode *text;
+   unsigned int *idx; /* cell of each codepoint of @text */
+   unsigned int idx_end; /* cell after the last one of @text */
+   size_t text_len, text_size;
+   char *utf8;
+   unsigned int *offs; /* in @utf8 of each codepoint of @text */
+   size_t utf8_size;
+};
+
+static Eina_Bool _search_timer_cb(void *data);
+
+/* {{{ Matches */
+
+static Eina_Bool
+_matches_add(Termio_Search_Matches *ms, const Termio_Search_Match *m)
+{
+   if (ms->n == ms->size)
+     {
+        unsigned int size = ms->size ? ms->size * 2 : 64;
+        Termio_Search_Match *tmp;
+
+        tmp = realloc(ms->m, size * sizeof(Termio_Search_Match));
+        if (!tmp)
+          return EINA_FALSE;
+        ms->m = tmp;
+        ms->size = size;
+     }
+   ms->m[ms->n++] = *m;
+   return EINA_TRUE;
+}
+
+static void
+_matches_reverse(Termio_Search_Matches *ms, unsigned int from)
+{
+   unsigned int i, j;
+
+   if (ms->n == 0)
+     return;
+   for (i = from, j = ms->n - 1; i < j; i++, j--)
+     {
+        Termio_Search_Match t = ms->m[i];
+
+        ms->m[i] = ms->m[j];
+        ms->m[j] = t;
+     }
+}
+
+static void
+_matches_free(Termio_Search_Matches *ms)
+{
+   free(ms->m);
+   ms->m = NULL;
+   ms->n = ms->size = 0;
+}
+
+static unsigned int
+_search_count(const Termio_Search *s)
+{
+   return s->screen.n + s->newer.n + s->older.n;
+}
+
+/* The @i-th match from the bottom */
+static const Termio_Search_Match *
+_search_nth(const Termio_Search *s, unsigned int i)
+{
+   if (i < s->screen.n)
+     return &s->screen.m[i];
+   i -= s->screen.n;
+   if (i < s->newer.n)
+     return &s->newer.m[s->newer.n - 1 - i];
+   i -= s->newer.n;
+   return &s->older.m[i];
+}
+
+/* Index of the first match, from the bottom, starting before (@x, @y) */
+static unsigned int
+_search_first_before(const Termio_Search *s, unsigned int y, int x)
+{
+   unsigned int lo = 0, hi = _search_count(s);
+
+   while (lo < hi)
+     {
+        unsigned int mid = lo + (hi - lo) / 2;
+        const Termio_Search_Match *m = _search_nth(s, mid);
+        int d = (int)(m->y1 - y);
+
+        if ((d < 0) || ((d == 0) && (m->x1 < x)))
+          hi = mid;
+        else
+          lo = mid + 1;
+     }
+   return lo;
+}
+
+/* Whether @m is in the rows shown */
+static Eina_Bool
+_search_match_visible(const Termio_Search *s, const Termio_Search_Match *m)
+{
+   const Termio *sd = s->sd;
+   unsigned int top = sd->pty->backlog_changes.lines - sd->scroll;
+
+   return (((int)(m->y2 - top) >= 0) &&
+           ((int)(m->y1 - top) < sd->grid.h));
+}
+
+/* }}} */
+/* {{{ Text of a line */
+
+static Eina_Bool
+_text_reserve(Termio_Search *s, size_t len)
+{
+   if (len > s->text_size)
+     {
+        size_t size = MAX(len, s->text_size * 2);
+        Eina_Unicode *text;
+        unsigned int *idx;
+
+        text = realloc(s->text, size * sizeof(Eina_Unicode));
+        if (!text)
+          return EINA_FALSE;
+        s->text = text;
+        idx = realloc(s->idx, size * sizeof(unsigned int));
+        if (!idx)
+          return EINA_FALSE;
+        s->idx = idx;
+        s->text_size = size;
+     }
+   return EINA_TRUE;
+}
+
+/* Append the @n cells @cells to the text, the first one being the cell
+ * @c0 of the line, counting from the start of its first row */
+static void
+_text_add(Termio_Search *s, const Termcell *cells, int n, unsigned int c0)
+{
+   int i;
+
+   if (s->text_len + n > SEARCH_LINE_MAX)
+     n = SEARCH_LINE_MAX - (int)s->text_len;
+   if ((n <= 0) || (!_text_reserve(s, s->text_len + n)))
+     return;
+   for (i = 0; i < n; i++)
+     {
+        Eina_Unicode g = cells[i].codepoint;
+
+        if (g == 0)
+          {
+             /* second half of a double width character */
+             if (cells[i].dblwidth)
+               continue;
+             g = ' ';
+          }
+        else if ((s->icase) && (!s->is_regex))
+          g = towlower(g);
+        s->text[s->text_len] = g;
+        s->idx[s->text_len] = c0 + i;
+        s->text_len++;
+     }
+   s->idx_end = c0 + n;
+   /* the second half of a double width character ending the line may not
+    * be counted in @n */
+   if ((cells[n - 1].dblwidth) && (cells[n - 1].codepoint))
+     s->idx_end++;
+}
+
+/* Turn the codepoints of @text from @a to @b, excluded, into a match, the
+ * line starting on the row @y */
+static void
+_text_match(Termio_Search *s, unsigned int y, size_t a, size_t b,
+            Termio_Search_Matches *ms)
+{
+   Termio_Search_Match m;
+   unsigned int c1, c2;
+
+   c1 = s->idx[a];
+   c2 = ((b < s->text_len) ? s->idx[b] : s->idx_end) - 1;
+   m.y1 = y + (c1 / s->w);
+   m.x1 = c1 % s->w;
+   m.y2 = y + (c2 / s->w);
+   m.x2 = c2 % s->w;
+   if ((ms->n < SEARCH_MATCHES_MAX) && (_matches_add(ms, &m)) &&
+       (_search_match_visible(s, &m)))
+     s->sd->search.changes++;
+}
+
+/* Index of the codepoint of @text at the offset @off of @utf8 */
+static size_t
+_text_offset_find(const Termio_Search *s, size_t off)
+{
+   size_t lo = 0, hi = s->text_len;
+
+   while (lo < hi)
+     {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (s->offs[mid] < off)
+          lo = mid + 1;
+        else
+          hi = mid;
+     }
+   return lo;
+}
+
+static void
+_text_regex_find(Termio_Search *s, unsigned int y, Termio_Search_Matches *ms)
+{
+   size_t i, len = 0, off = 0;
+   int eflags = 0;
+
+   if (s->text_len * 4 + 5 > s->utf8_size)
+     {
+        size_t size = MAX(s->text_len * 4 + 5, s->utf8_size * 2);
+        char *utf8;
+        unsigned int *offs;
+
+        utf8 = realloc(s->utf8, size);
+        if (!utf8)
+          return;
+        s->utf8 = utf8;
+        offs = realloc(s->offs, size * sizeof(unsigned int));
+        if (!offs)
+          return;
+        s->offs = offs;
+        s->utf8_size = size;
+     }
+   for (i = 0; i < s->text_len; i++)
+     {
+        s->offs[i] = len;
+        len += codepoint_to_utf8(s->text[i], s->utf8 + len);
+     }
+   s->offs[i] = len;
+   s->utf8[len] = '\0';
+
+   while (off <= len)
+     {
+        regmatch_t rm;
+        size_t a, b;
+
+        if (regexec(&s->re, s->utf8 + off, 1, &rm, eflags) != 0)
+          break;
+        eflags = REG_NOTBOL;
+        a = _text_offset_find(s, off + rm.rm_so);
+        b = _text_offset_find(s, off + rm.rm_eo);
+        if (a >= s->text_len)
+          break;
+        if (b <= a)
+          {
+             /* empty, look again from the next codepoint */
+             off = s->offs[a + 1];
+             continue;
+          }
+        _text_match(s, y, a, b, ms);
+        off = s->offs[b];
+     }
+}
+
+/* Add to @ms the matches in the text, of the line starting on the row @y,
+ * from the left or, if @up, from the right */
+static void
+_text_find(Termio_Search *s, unsigned int y, Termio_Search_Matches *ms,
+           Eina_Bool up)
+{
+   unsigned int from = ms->n;
+   size_t i, n = s->needle_len;
+
+   if (s->is_regex)
+     _text_regex_find(s, y, ms);
+   else if (n > 0)
+     {
+        for (i = 0; i + n <= s->text_len;)
+          {
+             if ((s->text[i] == s->needle[0]) &&
+                 (!memcmp(s->text + i, s->needle, n * sizeof(Eina_Unicode))))
+               {
+                  _text_match(s, y, i, i + n, ms);
+                  i += n;
+               }
+             else
+               i++;
+          }
+     }
+   if (up)
+     _matches_reverse(ms, from);
+}
+
+/* Set the text to the line of the backlog on the row @y, setting @y1 and
+ * @y2 to its first and last rows and @wrapped to whether it goes on on the
+ * screen */
+static Eina_Bool
+_text_backlog_get(Termio_Search *s, Termpty *ty, int y,
+                  int *y1, int *y2, Eina_Bool *wrapped)
+{
+   const Termcell *cells;
+   Termsave *ts;
+   int row = 0;
+
+   ts = termpty_backlog_line_get(ty, -y, &row);
+   if (!ts)
+     return EINA_FALSE;
+   *y1 = y - row;
+   *y2 = *y1 + ((ts->w == 0) ? 1 : ((int)ts->w + ty->w - 1) / ty->w) - 1;
+   *wrapped = EINA_FALSE;
+   s->text_len = 0;
+   s->idx_end = 0;
+   if (ts->w > s->cells_size)
+     {
+        Termcell *tmp = realloc(s->cells, ts->w * sizeof(Termcell));
+
+        if (!tmp)
+          return EINA_TRUE;
+        s->cells = tmp;
+        s->cells_size = ts->w;
+     }
+   cells = termpty_save_peek(ty, ts, s->cells);
+   if (!cells)
+     return EINA_TRUE;
+   _text_add(s, cells, ts->w, 0);
+   *wrapped = ((ts->w > 0) && (cells[ts->w - 1].autowrapped));
+   return EINA_TRUE;
+}
+
+/* }}} */
+/* {{{ Looking for matches */
+
+/* First row of the line going on on the top row of the screen.  The most
+ * recent lines of the backlog are never compressed */
+static int
+_search_screen_top(Termpty *ty)
+{
+   Termsave *ts;
+   int row = 0;
+
+   if (ty->altbuf)
+     return 0;
+   ts = termpty_save_extract(ty, termpty_backlog_line_get(ty, 1, &row));
+   if ((!ts) || (!ts->w) || (!ts->cells[ts->w - 1].autowrapped))
+     return 0;
+   return -1 - row;
+}
+
+/* Fill @screen from the line going on on the top row of the screen */
+static void
+_search_screen(Termio_Search *s, Termpty *ty)
+{
+   unsigned int lines = ty->backlog_changes.lines;
+   unsigned int changes = s->sd->search.changes;
+   Termio_Search_Match *old = s->screen.m;
+   unsigned int old_n = s->screen.n;
+   int y = _search_screen_top(ty), y0;
+   unsigned int c0 = 0;
+
+   s->screen.m = NULL;
+   s->screen.n = s->screen.size = 0;
+   s->screen_lines = lines;
+   s->screen_text = ty->dirty.gen;
+
+   s->text_len = 0;
+   s->idx_end = 0;
+   y0 = y;
+   if (y < 0)
+     {
+        int y1, y2;
+        Eina_Bool wrapped;
+
+        _text_backlog_get(s, ty, y, &y1, &y2, &wrapped);
+        c0 = (y2 - y1 + 1) * ty->w;
+        y = 0;
+     }
+   for (; y < ty->h; y++)
+     {
+        Termcell *cells;
+        ssize_t w = 0;
+
+        cells = termpty_cellrow_get(ty, y, &w);
+        if (!cells)
+          break;
+        if ((y < ty->h - 1) && (cells[ty->w - 1].autowrapped))
+          {
+             _text_add(s, cells, ty->w, c0);
+             c0 += ty->w;
+             continue;
+          }
+        _text_add(s, cells, w, c0);
+        _text_find(s, lines + y0, &s->screen, EINA_FALSE);
+        s->text_len = 0;
+        s->idx_end = 0;
+        c0 = 0;
+        y0 = y + 1;
+     }
+   _matches_reverse(&s->screen, 0);
+
+   /* the matches found were counted as changes if visible, only what
+    * differs from before matters */
+   s->sd->search.changes = changes;
+   if ((old_n != s->screen.n) ||
+       ((old_n) &&
+        (memcmp(old, s->screen.m, old_n * sizeof(Termio_Search_Match)))))
+     s->sd->search.changes++;
+   free(old);
+}
+
+static void
+_search_restart(Termio_Search *s, Termpty *ty)
+{
+   _matches_free(&s->screen);
+   _matches_free(&s->newer);
+   _matches_free(&s->older);
+   s->gen = ty->backlog_changes.gen;
+   s->w = ty->w;
+   s->top = s->bottom = ty->backlog_changes.lines + _search_screen_top(ty);
+   s->screen_lines = s->screen_text = 0;
+   s->done = EINA_FALSE;
+   s->has_current = EINA_FALSE;
+   s->sd->search.changes++;
+   _search_screen(s, ty);
+}
+
+/* Forget the matches on rows no longer in the backlog */
+static void
+_search_prune(Termio_Search *s, Termpty *ty)
+{
+   unsigned int first = ty->backlog_changes.lines - termpty_backlog_length(ty);
+   unsigned int k;
+
+   while ((s->older.n) && ((int)(s->older.m[s->older.n - 1].y1 - first) < 0))
+     s->older.n--;
+   if ((int)(s->top - first) <= 0)
+     s->done = EINA_TRUE;
+   if (s->older.n)
+     return;
+   for (k = 0; (k < s->newer.n) && ((int)(s->newer.m[k].y1 - first) < 0); k++)
+     ;
+   if (k)
+     {
+        memmove(s->newer.m, s->newer.m + k,
+                (s->newer.n - k) * sizeof(Termio_Search_Match));
+        s->newer.n -= k;
+     }
+}
+
+/* Look at the line above @top.  Returns whether there is more to look at */
+static Eina_Bool
+_search_up(Termio_Search *s, Termpty *ty)
+{
+   unsigned int lines = ty->backlog_changes.lines;
+   int y1, y2;
+   Eina_Bool wrapped;
+
+   if ((s->done) || (s->older.n >= SEARCH_MATCHES_MAX) ||
+       (!_text_backlog_get(s, ty, (int)(s->top - lines) - 1,
+                           &y1, &y2, &wrapped)))
+     {
+        s->done = EINA_TRUE;
+        return EINA_FALSE;
+     }
+   _text_find(s, lines + y1, &s->older, EINA_TRUE);
+   s->top = lines + y1;
+   return EINA_TRUE;
+}
+
+/* Look at the line at @bottom if it scrolled off the screen for good.
+ * Returns whether there is more to look at */
+static Eina_Bool
+_search_down(Termio_Search *s, Termpty *ty)
+{
+   unsigned int lines = ty->backlog_changes.lines;
+   int y = (int)(s->bottom - lines), y1, y2;
+   Eina_Bool wrapped;
+
+   if (y >= 0)
+     return EINA_FALSE;
+   if (y < -termpty_backlog_length(ty))
+     {
+        s->bottom = lines - termpty_backlog_length(ty);
+        return EINA_TRUE;
+     }
+   if (!_text_backlog_get(s, ty, y, &y1, &y2, &wrapped))
+     return EINA_FALSE;
+   /* still going on on the screen */
+   if ((y2 == -1) && (wrapped))
+     return EINA_FALSE;
+   if (y1 == y)
+     _text_find(s, lines + y1, &s->newer, EINA_FALSE);
+   s->bottom = lines + y2 + 1;
+   return EINA_TRUE;
+}
+
+/* }}} */
+/* {{{ Jumps */
+
+static void
+_search_current_show(Termio_Search *s)
+{
+   Termio *sd = s->sd;
+   int y = (int)(s->cur_y - sd->pty->backlog_changes.lines);
+   int scroll = sd->scroll;
+
+   if (!sd->pty->altbuf &&
+       ((y < -scroll) || (y >= -scroll + sd->grid.h)))
+     {
+        scroll = (sd->grid.h / 2) - y;
+        if (scroll < 0)
+          scroll = 0;
+     }
+   sd->search.changes++;
+   if (scroll != sd->scroll)
+     termio_scroll_set(sd->self, scroll);
+   else
+     termio_smart_update_queue(sd);
+}
+
+/* Make the match above, or below, the current one the current one, or
+ * the first one above the bottom of the view at @scroll if there is none.
+ * Returns whether a match was found */
+static Eina_Bool
+_search_jump(Termio_Search *s, Eina_Bool up, int scroll)
+{
+   Termio *sd = s->sd;
+   unsigned int count = _search_count(s), i;
+   unsigned int lines = sd->pty->backlog_changes.lines;
+   const Termio_Search_Match *m;
+
+   if (up)
+     {
+        if (s->has_current)
+          i = _search_first_before(s, s->cur_y, s->cur_x);
+        else
+          i = _search_first_before(s, lines - scroll + sd->grid.h, 0);
+        if (i >= count)
+          {
+             if ((!s->done) || (!count))
+               return EINA_FALSE;
+             i = 0;
+          }
+     }
+   else
+     {
+        if (s->has_current)
+          i = _search_first_before(s, s->cur_y, s->cur_x + 1);
+        else
+          i = _search_first_before(s, lines - scroll, 0);
+        if (i == 0)
+          {
+             if ((!s->done) || (!count))
+               return EINA_FALSE;
+             i = count;
+          }
+        i--;
+     }
+   m = _search_nth(s, i);
+   s->cur_y = m->y1;
+   s->cur_x = m->x1;
+   s->has_current = EINA_TRUE;
+   return EINA_TRUE;
+}
+
+/* }}} */
+
+unsigned int
+termio_search_count(const Termio *sd)
+{
+   if (!sd->search.s)
+     return 0;
+   return _search_count(sd->search.s);
+}
+
+/* Keep the matches up to date with the text, to be called with the
+ * backlog locked */
+void
+termio_search_update(Termio *sd)
+{
+   Termio_Search *s = sd->search.s;
+   Termpty *ty = sd->pty;
+
+   if (!s)
+     return;
+   if ((s->gen != ty->backlog_changes.gen) || (s->w != ty->w))
+     _search_restart(s, ty);
+   else if ((s->screen_lines != ty->backlog_changes.lines) ||
+            (s->screen_text != ty->dirty.gen))
+     _search_screen(s, ty);
+   if ((!s->timer) &&
+       ((!s->done) || ((int)(s->bottom - ty->backlog_changes.lines) < 0)))
+     s->timer = ecore_timer_add(SEARCH_INTERVAL, _search_timer_cb, sd);
+}
+
+/* Look for matches in the backlog for about @budget seconds.  Returns
+ * whether there is more to look at */
+Eina_Bool
+termio_search_run(Termio *sd, double budget)
+{
+   Termio_Search *s = sd->search.s;
+   Termpty *ty = sd->pty;
+   double t0 = ecore_time_get();
+   unsigned int changes = sd->search.changes;
+   Eina_Bool more_up = EINA_TRUE, more_down = EINA_TRUE;
+
+   if (!s)
+     return EINA_FALSE;
+   termpty_backlog_lock(ty);
+   termio_search_update(sd);
+   _search_prune(s, ty);
+   while ((more_up) || (more_down))
+     {
+        /* what scrolled off the screen first, as it is more likely to be
+         * looked at */
+        if (more_down)
+          more_down = _search_down(s, ty);
+        else
+          more_up = _search_up(s, ty);
+        if (ecore_time_get() - t0 > budget)
+          break;
+     }
+   if ((s->pending) &&
+       (_search_jump(s, (s->pending > 0), sd->scroll)))
+     {
+        s->pending = 0;
+        termpty_backlog_unlock(ty);
+        _search_current_show(s);
+        return (more_up || more_down);
+     }
+   if (s->done)
+     s->pending = 0;
+   termpty_backlog_unlock(ty);
+   if (changes != sd->search.changes)
+     termio_smart_update_queue(sd);
+   return (more_up || more_down);
+}
+
+static Eina_Bool
+_search_timer_cb(void *data)
+{
+   Termio *sd = data;
+
+   if (termio_search_run(sd, SEARCH_BUDGET))
+     return ECORE_CALLBACK_RENEW;
+   if (sd->search.s)
+     sd->search.s->timer = NULL;
+   return ECORE_CALLBACK_CANCEL;
+}
+
+void
+termio_search_free(Termio *sd)
+{
+   Termio_Search *s = sd->search.s;
+
+   if (!s)
+     return;
+   if (s->timer)
+     ecore_timer_del(s->timer);
+   if (s->is_regex)
+     regfree(&s->re);
+   _matches_free(&s->screen);
+   _matches_free(&s->newer);
+   _matches_free(&s->older);
+   free(s->pattern);
+   free(s->needle);
+   free(s->cells);
+   free(s->text);
+   free(s->idx);
+   free(s->utf8);
+   free(s->offs);
+   free(s);
+   sd->search.s = NULL;
+   sd->search.changes++;
+}
+
+/* Look for @pattern, as a POSIX extended regular expression if @regex,
+ * ignoring the case if it is all lowercase.  An empty pattern stops the
+ * search.  Goes to the first match above the bottom of the view the
+ * search started from.  Returns whether the search changed */
+Eina_Bool
+termio_search_set(Evas_Object *obj, const char *pattern, Eina_Bool regex)
+{
+   Termio *sd = termio_get_from_obj(obj);
+   Termio_Search *s;
+   int origin, i;
+
+   EINA_SAFETY_ON_NULL_RETURN_VAL(sd, EINA_FALSE);
+   s = sd->search.s;
+   if ((s) && (pattern) && (!strcmp(s->pattern, pattern)) &&
+       (!s->is_regex == !regex))
+     return EINA_FALSE;
+   origin = (s) ? s->origin : sd->scroll;
+   termio_search_free(sd);
+   if ((!pattern) || (!pattern[0]))
+     {
+        termio_smart_update_queue(sd);
+        return EINA_TRUE;
+     }
+
+   s = calloc(1, sizeof(Termio_Search));
+   if (!s)
+     return EINA_TRUE;
+   s->sd = sd;
+   s->origin = origin;
+   s->pattern = strdup(pattern);
+   s->needle = eina_unicode_utf8_to_unicode(pattern, &s->needle_len);
+   if ((!s->pattern) || (!s->needle))
+     goto err;
+   s->icase = EINA_TRUE;
+   for (i = 0; i < s->needle_len; i++)
+     if (iswupper(s->needle[i]))
+       s->icase = EINA_FALSE;
+   if (s->icase)
+     for (i = 0; i < s->needle_len; i++)
+       s->needle[i] = towlower(s->needle[i]);
+   if (regex)
+     {
+        if (regcomp(&s->re, pattern,
+                    REG_EXTENDED | (s->icase ? REG_ICASE : 0)) != 0)
+          {
+             /* most likely not typed in full yet */
+             DBG("invalid regular expression '%s'", pattern);
+             goto err;
+          }
+        s->is_regex = EINA_TRUE;
+     }
+   sd->search.s = s;
+
+   termpty_backlog_lock(sd->pty);
+   _search_restart(s, sd->pty);
+   termpty_backlog_unlock(sd->pty);
+   termio_search_run(sd, SEARCH_BUDGET);
+   termpty_backlog_lock(sd->pty);
+   if (_search_jump(s, EINA_TRUE, origin))
+     {
+        termpty_backlog_unlock(sd->pty);
+        _search_current_show(s);
+     }
+   else
+     {
+        s->pending = 1;
+        termpty_backlog_unlock(sd->pty);
+        termio_smart_update_queue(sd);
+     }
+   return EINA_TRUE;
+
+err:
+   sd->search.s = s;
+   termio_search_free(sd);
+   termio_smart_update_queue(sd);
+   return EINA_TRUE;
+}
+
+/* Go to the match above, or below, the current one, or the first one
+ * from the view.  Returns whether there is a search going on */
+Eina_Bool
+termio_search_jump(Evas_Object *obj, Eina_Bool up)
+{
+   Termio *sd = termio_get_from_obj(obj);
+   Termio_Search *s;
+   Eina_Bool found;
+
+   EINA_SAFETY_ON_NULL_RETURN_VAL(sd, EINA_FALSE);
+   s = sd->search.s;
+   if (!s)
+     return EINA_FALSE;
+   termpty_backlog_lock(sd->pty);
+   termio_search_update(sd);
+   found = _search_jump(s, up, sd->scroll);
+   s->pending = (found) ? 0 : ((up) ? 1 : -1);
+   termpty_backlog_unlock(sd->pty);
+   if (found)
+     _search_current_show(s);
+   return EINA_TRUE;
+}
+
+/* Mark the search as entered, as when Enter is pressed in the command box.
+ * Returns whether it already was */
+Eina_Bool
+termio_search_enter(Evas_Object *obj)
+{
+   Termio *sd = termio_get_from_obj(obj);
+   Eina_Bool entered;
+
+   EINA_SAFETY_ON_NULL_RETURN_VAL(sd, EINA_FALSE);
+   if (!sd->search.s)
+     return EINA_FALSE;
+   entered = sd->search.s->entered;
+   sd->search.s->entered = 1;
+   return entered;
+}
+
+/* {{{ Render */
+
+/* Set @row to the matches on the row @y of the pty.  Returns whether there
+ * are some */
+Eina_Bool
+termio_search_row_get(const Termio *sd, int y, Termio_Search_Row *row)
+{
+   const Termio_Search *s = sd->search.s;
+   unsigned int lo, hi, count;
+
+   if ((!s) || (!(count = _search_count(s))))
+     return EINA_FALSE;
+   row->y = sd->pty->backlog_changes.lines + y;
+   /* first one starting on that row or above */
+   lo = _search_first_before(s, row->y + 1, 0);
+   /* after the last one ending on that row or below */
+   hi = count;
+   {
+      unsigned int a = lo;
+
+      while (a < hi)
+        {
+           unsigned int mid = a + (hi - a) / 2;
+
+           if ((int)(_search_nth(s, mid)->y2 - row->y) < 0)
+             hi = mid;
+           else
+             a = mid + 1;
+        }
+   }
+   if (hi <= lo)
+     return EINA_FALSE;
+   row->lo = lo;
+   row->i = hi - 1;
+   return EINA_TRUE;
+}
+
+/* Whether the cell @x of @row is matched: 0 if not, 1 if it is, 2 if it is
+ * by the current match.  The cells are to be looked at from the left */
+int
+termio_search_cell_get(const Termio *sd, Termio_Search_Row *row, int x)
+{
+   const Termio_Search *s = sd->search.s;
+
+   while (row->i >= row->lo)
+     {
+        const Termio_Search_Match *m = _search_nth(s, row->i);
+
+        if ((m->y1 == row->y) && (x < m->x1))
+          return 0;
+        if ((m->y2 != row->y) || (x <= m->x2))
+          {
+             if ((s->has_current) &&
+                 (m->y1 == s->cur_y) && (m->x1 == s->cur_x))
+               return 2;
+             return 1;
+          }
+        row->i--;
+     }
+   return 0;
+}
+
+/* }}} */
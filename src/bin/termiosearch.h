@@ -0,0 +1,27 @@
+#ifndef _TERMIO_SEARCH_H__
+#define _TERMIO_SEARCH_H__ 1
+
+Eina_Bool termio_search_set(Evas_Object *obj, const char *pattern,
+                            Eina_Bool regex);
+Eina_Bool termio_search_jump(Evas_Object *obj, Eina_Bool up);
+Eina_Bool termio_search_enter(Evas_Object *obj);
+void termio_search_free(Termio *sd);
+void termio_search_update(Termio *sd);
+Eina_Bool termio_search_run(Termio *sd, double budget);
+unsigned int termio_search_count(const Termio *sd);
+
+/* Matches of the search on a row of the pty, from left to right, see
+ * termio_internal_render() */
+typedef struct _Termio_Search_Row Termio_Search_Row;
+struct _Termio_Search_Row
+{
+   unsigned int y; /* numbered as in termiosearch.c */
+   int i; /* match looked at, going down to @lo */
+   int lo;
+};
+
+Eina_Bool termio_search_row_get(const Termio *sd, int y,
+                                Termio_Search_Row *row);
+int termio_search_cell_get(const Termio *sd, Termio_Search_Row *row, int x);
+
+#endif
@@ -7,11 +7,13 @@
 #include "termptyesc.h"
 #include "termptyops.h"
 #include "backlog.h"
+#include "utf8.h"
 #include "keyin.h"
 #if !defined(ENABLE_FUZZING) && !defined(ENABLE_TESTS)
 # include "win.h"
 #endif
 #include "termio.h"
+#include "termiolink.h"
 #include <sys/types.h>
 #include <signal.h>
 #include <sys/wait.h>
@@ -23,6 +25,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <termios.h>
+#include <poll.h>
 #if defined (__sun) || defined (__sun__)
 # include <stropts.h>
 #endif
@@ -53,9 +56,13 @@ termpty_init(void)
      EINA_LOG_CRIT("Could not create logging domain '%s'.", "termpty");
 }
 
+static void _pool_shutdown(void);
+static void _scrolls_flush(Termpty *ty);
+
 void
 termpty_shutdown(void)
 {
+   _pool_shutdown();
    if (_termpty_log_dom < 0) return;
    eina_log_domain_unregister(_termpty_log_dom);
    _termpty_log_dom = -1;
@@ -81,136 +88,133 @@ termpty_can_handle_key(const Termpty *ty,
 
 
 
-void
-termpty_handle_buf(Termpty *ty, const Eina_Unicode *codepoints, int len)
+/* Keep @len codepoints of an incomplete sequence at the end of ty->buf,
+ * growing it geometrically so that a sequence arriving over many reads is
+ * only copied once */
+static Eina_Bool
+_buf_append(Termpty *ty, const Eina_Unicode *codepoints, size_t len)
 {
-   Eina_Unicode *c, *ce, *c2, *b, *d;
-   int n, bytes;
-
-   c = (Eina_Unicode *)codepoints;
-   ce = &(c[len]);
+   const Eina_Unicode *c, *ce;
 
-   if (ty->buf)
+   if (ty->buflen + len + 1 > ty->bufsize)
      {
-        bytes = (ty->buflen + len + 1) * sizeof(int);
-        b = realloc(ty->buf, bytes);
+        size_t size = ty->bufsize * 2;
+        Eina_Unicode *b;
+
+        if (size < ty->buflen + len + 1)
+          size = ty->buflen + len + 1;
+        if (size < 64)
+          size = 64;
+        b = realloc(ty->buf, size * sizeof(Eina_Unicode));
         if (!b)
           {
              ERR(_("memerr: %s"), strerror(errno));
-             return;
+             return EINA_FALSE;
           }
-        DBG("realloc add %i + %i", (int)(ty->buflen * sizeof(int)), (int)(len * sizeof(int)));
-        if (!ty->buf_have_zero)
+        DBG("realloc buf to %zu codepoints", size);
+        ty->buf = b;
+        ty->bufsize = size;
+     }
+   if (!ty->buf_have_zero)
+     {
+        ce = codepoints + len;
+        for (c = codepoints; c < ce; c++)
           {
-             d = &(b[ty->buflen]);
-             ce = (Eina_Unicode *)codepoints + len;
-             for (c = (Eina_Unicode *)codepoints; c < ce; c++, d++)
+             if (*c == 0x0)
                {
-                  *d = *c;
-                  if (*c == 0x0)
-                    {
-                       ty->buf_have_zero = EINA_TRUE;
-                       break;
-                    }
+                  ty->buf_have_zero = EINA_TRUE;
+                  break;
                }
-             for (; c < ce; c++, d++) *d = *c;
           }
-        else
-          {
-             bytes = len * sizeof(Eina_Unicode);
-             memcpy(&(b[ty->buflen]), codepoints, bytes);
-          }
-        ty->buf = b;
-        ty->buflen += len;
-        ty->buf[ty->buflen] = 0;
-        c = ty->buf;
-        ce = c + ty->buflen;
+     }
+   memcpy(&(ty->buf[ty->buflen]), codepoints, len * sizeof(Eina_Unicode));
+   ty->buflen += len;
+   ty->buf[ty->buflen] = 0;
+   return EINA_TRUE;
+}
+
+static void
+_handle_buf(Termpty *ty, const Eina_Unicode *codepoints, int len)
+{
+   const Eina_Unicode *c, *ce;
+   size_t old_len;
+   int n;
+
+   ty->dirty.gen++;
+   if (!ty->buflen)
+     {
+        /* nothing pending, parse straight from the input */
+        c = codepoints;
+        ce = c + len;
+        ty->buf_have_zero = EINA_TRUE;
         while (c < ce)
           {
              n = termpty_handle_seq(ty, c, ce);
              if (n == 0)
                {
-                  Eina_Unicode *tmp = ty->buf;
-                  ty->buf = NULL;
-                  ty->buflen = 0;
-                  bytes = ((char *)ce - (char *)c) + sizeof(Eina_Unicode);
-                  DBG("malloc till %i", (int)(bytes - sizeof(Eina_Unicode)));
-                  ty->buf = malloc(bytes);
-                  if (!ty->buf)
-                    {
-                       ERR(_("memerr: %s"), strerror(errno));
-                       return;
-                    }
                   ty->buf_have_zero = EINA_FALSE;
-                  for (d = ty->buf, c2 = c; c2 < ce; c2++, d++)
-                    {
-                       *d = *c2;
-                       if (*c2 == 0x0)
-                         {
-                            ty->buf_have_zero = EINA_TRUE;
-                            break;
-                         }
-                    }
-                  for (; c2 < ce; c2++, d++) *d = *c2;
-                  bytes = (char *)ce - (char *)c;
-                  ty->buflen = bytes / sizeof(Eina_Unicode);
-                  ty->buf[ty->buflen] = 0;
-                  free(tmp);
-                  break;
+                  _buf_append(ty, c, ce - c);
+                  return;
                }
              c += n;
           }
-        if (c == ce)
+        return;
+     }
+
+   old_len = ty->buflen;
+   if (!_buf_append(ty, codepoints, len))
+     return;
+   c = ty->buf;
+   ce = c + ty->buflen;
+   /* do not parse again a sequence that can not be complete yet */
+   if (!termpty_seq_can_complete(c, ce, c + old_len))
+     return;
+   while (c < ce)
+     {
+        n = termpty_handle_seq(ty, c, ce);
+        if (n == 0)
+          break;
+        c += n;
+     }
+   if (c == ce)
+     {
+        ty->buflen = 0;
+        ty->buf_have_zero = EINA_FALSE;
+        /* do not keep a large buffer around after a big sequence */
+        if (ty->bufsize > 4096)
           {
-             if (ty->buf)
-               {
-                  ty->buf_have_zero = EINA_FALSE;
-                  free(ty->buf);
-                  ty->buf = NULL;
-               }
-             ty->buflen = 0;
+             free(ty->buf);
+             ty->buf = NULL;
+             ty->bufsize = 0;
           }
      }
-   else
+   else if (c != ty->buf)
      {
-        ty->buf_have_zero = EINA_TRUE;
-        while (c < ce)
+        size_t left = ce - c;
+
+        memmove(ty->buf, c, (left + 1) * sizeof(Eina_Unicode));
+        ty->buflen = left;
+        ty->buf_have_zero = EINA_FALSE;
+        for (c = ty->buf, ce = c + left; c < ce; c++)
           {
-             n = termpty_handle_seq(ty, c, ce);
-             if (n == 0)
+             if (*c == 0x0)
                {
-                  bytes = ((char *)ce - (char *)c) + sizeof(Eina_Unicode);
-                  ty->buf_have_zero = EINA_FALSE;
-                  ty->buf = malloc(bytes);
-                  DBG("malloc %i", (int)(bytes - sizeof(Eina_Unicode)));
-                  if (!ty->buf)
-                    {
-                       ERR(_("memerr: %s"), strerror(errno));
-                    }
-                  else
-                    {
-                       ty->buf_have_zero = EINA_FALSE;
-                       for (d = ty->buf, c2 = c; c2 < ce; c2++, d++)
-                         {
-                            *d = *c2;
-                            if (*c2 == 0x0)
-                              {
-                                 ty->buf_have_zero = EINA_TRUE;
-                                 break;
-                              }
-                         }
-                       for (; c2 < ce; c2++, d++) *d = *c2;
-                       bytes = (char *)ce - (char *)c;
-                       ty->buflen = bytes / sizeof(Eina_Unicode);
-                       ty->buf[ty->buflen] = 0;
-                    }
+                  ty->buf_have_zero = EINA_TRUE;
                   break;
                }
-             c += n;
           }
      }
 }
 
+void
+termpty_handle_buf(Termpty *ty, const Eina_Unicode *codepoints, int len)
+{
+   _handle_buf(ty, codepoints, len);
+   /* the worker leaves that to the main loop */
+   if ((!ty->thread.on) || (eina_main_loop_is()))
+     _scrolls_flush(ty);
+}
+
 static void
 _pty_size(Termpty *ty)
 {
@@ -224,99 +228,192 @@ _pty_size(Termpty *ty)
      ERR(_("Size set ioctl failed: %s"), strerror(errno));
 }
 
-static Eina_Bool
-_handle_read(Termpty *ty, Eina_Bool false_on_empty)
+/* Read once from the pty and handle what was read.
+ * Returns the number of bytes read, 0 if there was nothing to read or -1
+ * on error */
+static int
+_read_once(Termpty *ty)
 {
-   int len, reads;
+   Eina_Unicode codepoint[4097];
+   char buf[4097];
+   char *rbuf = buf;
+   int i, j, len;
 
-   // read up to 64 * 4096 bytes
-   for (reads = 0; reads < 64; reads++)
+   len = sizeof(buf) - 1;
+   for (i = 0; i < (int)sizeof(ty->oldbuf) && ty->oldbuf[i] & 0x80; i++)
      {
-        Eina_Unicode codepoint[4097];
-        char buf[4097];
-        char *rbuf = buf;
-        int i, j;
-        len = sizeof(buf) - 1;
-
-        for (i = 0; i < (int)sizeof(ty->oldbuf) && ty->oldbuf[i] & 0x80; i++)
-          {
-             *rbuf = ty->oldbuf[i];
-             rbuf++;
-             len--;
-          }
-        errno = 0;
-        len = read(ty->fd, rbuf, len);
-        if ((len < 0 && !(errno == EAGAIN || errno == EINTR)) ||
-            (len == 0 && errno != 0))
+        *rbuf = ty->oldbuf[i];
+        rbuf++;
+        len--;
+     }
+   errno = 0;
+   len = read(ty->fd, rbuf, len);
+   if ((len < 0 && !(errno == EAGAIN || errno == EINTR)) ||
+       (len == 0 && errno != 0))
+     {
+        /* Do not print error if the child has exited */
+        if (ty->pid != -1)
           {
-             /* Do not print error if the child has exited */
-             if (ty->pid != -1)
-               {
-                  ERR("error while reading from tty slave fd: %s", strerror(errno));
-               }
-             close(ty->fd);
-             ty->fd = -1;
-             if (ty->hand_fd)
-               ecore_main_fd_handler_del(ty->hand_fd);
-             ty->hand_fd = NULL;
-             return ECORE_CALLBACK_CANCEL;
+             ERR("error while reading from tty slave fd: %s", strerror(errno));
           }
-        if (len <= 0) break;
+        return -1;
+     }
+   if (len <= 0)
+     return 0;
 
-        for (i = 0; i < (int)sizeof(ty->oldbuf); i++)
-          ty->oldbuf[i] = 0;
+   for (i = 0; i < (int)sizeof(ty->oldbuf); i++)
+     ty->oldbuf[i] = 0;
 
-        len += rbuf - buf;
+   len += rbuf - buf;
 
-        /*
-        printf(" I: ");
-        int jj;
-        for (jj = 0; jj < len; jj++)
+   /*
+   printf(" I: ");
+   int jj;
+   for (jj = 0; jj < len; jj++)
+     {
+        if ((buf[jj] < ' ') || (buf[jj] >= 0x7f))
+          printf("\033[33m%02x\033[0m", (unsigned char)buf[jj]);
+        else
+          printf("%c", buf[jj]);
+     }
+   printf("\n");
+   */
+   buf[len] = 0;
+   // convert UTF8 to codepoint integers
+   j = utf8_to_codepoints(buf, len, codepoint,
+                          (int)sizeof(ty->oldbuf), &i);
+   if (i < len)
+     {
+        int k;
+
+        /* keep the incomplete sequence for the next read */
+        for (k = 0; k < (len - i); k++)
+          ty->oldbuf[k] = buf[i + k];
+        DBG("failure at %d/%d", i, len);
+     }
+   codepoint[j] = 0;
+//   DBG("---------------- handle buf %i", j);
+   termpty_handle_buf(ty, codepoint, j);
+   return len;
+}
+
+/* Adaptive read budget {{{ */
+
+/* Reads of 4096 bytes allowed per wakeup */
+#define READ_BUDGET_MIN      4
+#define READ_BUDGET_DEFAULT  64
+#define READ_BUDGET_MAX      4096
+/* Under a flood, aim at spending that long reading per wakeup */
+#define READ_TIME_SLICE      (1.0 / 30.0)
+/* Keep the latency low for that long after the user typed something */
+#define READ_INPUT_DELAY     0.5
+
+/* Called after a wakeup that did @reads reads of @bytes in total, over
+ * @elapsed seconds.  @drained is whether there was nothing left to read */
+static void
+_read_budget_update(Termpty *ty, int reads, ssize_t bytes, double elapsed,
+                    Eina_Bool drained)
+{
+   unsigned int budget = ty->read.budget;
+
+   if (ecore_time_get() - ty->read.input_time < READ_INPUT_DELAY)
+     {
+        /* interactive: parse small chunks and render them right away */
+        ty->read.budget = READ_BUDGET_MIN;
+        ty->read.flood = EINA_FALSE;
+        return;
+     }
+   if (drained)
+     {
+        if ((unsigned int)reads < budget / 2)
+          budget /= 2;
+        ty->read.flood = EINA_FALSE;
+     }
+   else
+     {
+        /* fill the time slice with what the parser can handle, growing
+         * no faster than twice per wakeup */
+        if ((elapsed > 0.0) && (bytes > 0))
           {
-             if ((buf[jj] < ' ') || (buf[jj] >= 0x7f))
-               printf("\033[33m%02x\033[0m", (unsigned char)buf[jj]);
+             double fit = (bytes / elapsed) * READ_TIME_SLICE / 4096;
+
+             if (fit < budget * 2)
+               budget = (fit < READ_BUDGET_MIN) ? READ_BUDGET_MIN : fit;
              else
-               printf("%c", buf[jj]);
+               budget *= 2;
           }
-        printf("\n");
-        */
-        buf[len] = 0;
-        // convert UTF8 to codepoint integers
-        j = 0;
-        for (i = 0; i < len;)
+        ty->read.flood = EINA_TRUE;
+     }
+   if (budget < READ_BUDGET_MIN)
+     budget = READ_BUDGET_MIN;
+   else if (budget > READ_BUDGET_MAX)
+     budget = READ_BUDGET_MAX;
+   ty->read.budget = budget;
+}
+
+/* Read up to the budget of @ty.  Returns the number of successful reads and
+ * sets @lenp to the result of the last one */
+static int
+_read_budgeted(Termpty *ty, int *lenp)
+{
+   double start = ecore_time_get(), elapsed;
+   ssize_t bytes = 0;
+   int len = 0, reads;
+
+   for (reads = 0; reads < (int)ty->read.budget; reads++)
+     {
+        len = _read_once(ty);
+        if (len <= 0)
+          break;
+        bytes += len;
+        /* the budget was computed for a throughput that may have changed */
+        if (((reads & 15) == 15) &&
+            (ecore_time_get() - start > 2 * READ_TIME_SLICE))
           {
-             Eina_Unicode g = 0, prev_i = i;
+             reads++;
+             break;
+          }
+     }
+   elapsed = ecore_time_get() - start;
+   if (len >= 0)
+     _read_budget_update(ty, reads, bytes, elapsed, len == 0);
+   *lenp = len;
+   return reads;
+}
 
-             if (buf[i])
-               {
-                  g = eina_unicode_utf8_next_get(buf, &i);
-                  if ((0xdc80 <= g) && (g <= 0xdcff) &&
-                      (len - prev_i) <= (int)sizeof(ty->oldbuf))
-                    {
-                       unsigned int k;
+/* Called on user input */
+void
+termpty_input_notify(Termpty *ty)
+{
+   termpty_backlog_lock(ty);
+   ty->read.input_time = ecore_time_get();
+   termpty_backlog_unlock(ty);
+}
 
-                       for (k = 0;
-                            (k < (unsigned int)sizeof(ty->oldbuf)) &&
-                            (k < (unsigned int)(len - prev_i));
-                            k++)
-                         {
-                            ty->oldbuf[k] = buf[prev_i+k];
-                         }
-                       DBG("failure at %d/%d/%d", prev_i, i, len);
-                       break;
-                    }
-               }
-             else
-               {
-                  g = 0;
-                  i++;
-               }
-             codepoint[j] = g;
-             j++;
-          }
-        codepoint[j] = 0;
-//        DBG("---------------- handle buf %i", j);
-        termpty_handle_buf(ty, codepoint, j);
+/* Whether the output of @ty comes faster than it can be displayed */
+Eina_Bool
+termpty_flood_get(const Termpty *ty)
+{
+   return ((ty->read.flood) &&
+           (ecore_time_get() - ty->read.input_time >= READ_INPUT_DELAY));
+}
+
+/* }}} */
+
+static Eina_Bool
+_handle_read(Termpty *ty, Eina_Bool false_on_empty)
+{
+   int len = 0;
+
+   _read_budgeted(ty, &len);
+   if (len < 0)
+     {
+        close(ty->fd);
+        ty->fd = -1;
+        if (ty->hand_fd)
+          ecore_main_fd_handler_del(ty->hand_fd);
+        ty->hand_fd = NULL;
+        return ECORE_CALLBACK_CANCEL;
      }
    if (ty->cb.change.func)
      ty->cb.change.func(ty->cb.change.data);
@@ -351,22 +448,35 @@ _handle_write(Termpty *ty)
    struct ty_sb *sb = &ty->write_buffer;
    ssize_t len;
 
+   termpty_backlog_lock(ty);
    if (!sb->len)
-     return ECORE_CALLBACK_RENEW;
+     {
+        termpty_backlog_unlock(ty);
+        return ECORE_CALLBACK_RENEW;
+     }
 
    len = write(ty->fd, sb->buf, sb->len);
    if (len < 0 && (errno != EINTR && errno != EAGAIN))
      {
         ERR(_("Could not write to file descriptor %d: %s"),
             ty->fd, strerror(errno));
+        termpty_backlog_unlock(ty);
         return ECORE_CALLBACK_CANCEL;
      }
    ty_sb_lskip(sb, len);
+   /* latency from the key event to the write, see keyin_handle_key_to_pty() */
+   if ((len > 0) && (ty->read.input_time > ty->read.input_written))
+     {
+        eina_evlog("!key_written", ty, ty->read.input_time, NULL);
+        ty->read.input_written = ty->read.input_time;
+     }
 
+   /* the worker thread does the reading of a threaded pty */
    if (!sb->len && ty->hand_fd)
      ecore_main_fd_handler_active_set(ty->hand_fd,
                                       ECORE_FD_ERROR |
-                                      ECORE_FD_READ);
+                                      (ty->thread.on ? 0 : ECORE_FD_READ));
+   termpty_backlog_unlock(ty);
 
    return ECORE_CALLBACK_RENEW;
 }
@@ -415,6 +525,365 @@ _cb_fd(void *data, Ecore_Fd_Handler *fd_handler)
    return _fd_do(data, fd_handler, EINA_FALSE);
 }
 
+/* Threaded pty {{{ */
+
+/* Messages from the worker thread to the main loop:
+ * 'c': the screen changed
+ * 'w': there is something to write to the pty
+ * 'f': run thread.call from the main loop
+ * 'x': the worker exited */
+static void
+_thread_notify(Termpty *ty, char msg)
+{
+   if (!ecore_pipe_write(ty->thread.pipe, &msg, 1))
+     ERR("could not notify the main loop of '%c'", msg);
+}
+
+static void
+_thread_wake(Termpty *ty)
+{
+   char c = 0;
+
+   if (write(ty->thread.wake[1], &c, 1) < 0)
+     ERR("could not wake the pty thread up: %s", strerror(errno));
+}
+
+/* Tell termio about the scrolls done since last time, from the main loop */
+static void
+_scrolls_flush(Termpty *ty)
+{
+   unsigned int i;
+   int n;
+
+   for (i = 0; i < ty->scrolls.n; i++)
+     for (n = ty->scrolls.runs[i].n; n > 0; n--)
+       termio_scroll(ty->obj, ty->scrolls.runs[i].direction,
+                     ty->scrolls.runs[i].start_y, ty->scrolls.runs[i].end_y);
+   ty->scrolls.n = 0;
+   /* do not keep many runs around after scroll regions kept changing */
+   if (ty->scrolls.size > 64)
+     {
+        free(ty->scrolls.runs);
+        ty->scrolls.runs = NULL;
+        ty->scrolls.size = 0;
+     }
+}
+
+static void
+_thread_call_run(Termpty *ty)
+{
+   void (*func) (void *data);
+   void *data;
+
+   eina_lock_take(&ty->thread.sync_lock);
+   func = ty->thread.call.func;
+   data = ty->thread.call.data;
+   eina_lock_release(&ty->thread.sync_lock);
+
+   /* the worker waits for the call to be done */
+   _scrolls_flush(ty);
+   if (func)
+     func(data);
+
+   eina_lock_take(&ty->thread.sync_lock);
+   ty->thread.call_done = EINA_TRUE;
+   eina_condition_broadcast(&ty->thread.cond);
+   eina_lock_release(&ty->thread.sync_lock);
+}
+
+static void
+_thread_exited(Termpty *ty)
+{
+   eina_thread_join(ty->thread.id);
+   ty->thread.running = EINA_FALSE;
+
+   if (ty->hand_fd)
+     ecore_main_fd_handler_del(ty->hand_fd);
+   ty->hand_fd = NULL;
+   if (ty->fd >= 0)
+     close(ty->fd);
+   ty->fd = -1;
+   /* the child exited, finish what _cb_exe_exit() started */
+   if (ty->pid == -1)
+     {
+        if (ty->slavefd >= 0)
+          close(ty->slavefd);
+        ty->slavefd = -1;
+        if (ty->cb.exited.func)
+          ty->cb.exited.func(ty->cb.exited.data);
+     }
+}
+
+/* Free the blocks the worker could not, see termpty_block_free() */
+static void
+_thread_blocks_dead_free(Termpty *ty)
+{
+   Termblock *tb;
+
+   EINA_LIST_FREE(ty->block.dead, tb)
+     termpty_block_free(tb);
+}
+
+static void
+_thread_pipe_cb(void *data, void *buffer, unsigned int nbyte)
+{
+   Termpty *ty = data;
+   const char *msgs = buffer;
+   unsigned int i;
+
+   for (i = 0; i < nbyte; i++)
+     {
+        switch (msgs[i])
+          {
+           case 'c':
+              termpty_backlog_lock(ty);
+              ty->thread.change = EINA_FALSE;
+              _thread_blocks_dead_free(ty);
+              _scrolls_flush(ty);
+              if (ty->cb.change.func)
+                ty->cb.change.func(ty->cb.change.data);
+              termpty_backlog_unlock(ty);
+              break;
+           case 'w':
+              termpty_backlog_lock(ty);
+              ty->thread.write = EINA_FALSE;
+              if ((ty->write_buffer.len) && (ty->hand_fd))
+                ecore_main_fd_handler_active_set(ty->hand_fd,
+                                                 ECORE_FD_ERROR |
+                                                 ECORE_FD_WRITE);
+              termpty_backlog_unlock(ty);
+              break;
+           case 'f':
+              _thread_call_run(ty);
+              break;
+           case 'x':
+              /* @ty may be gone once the exited callback returns */
+              _thread_exited(ty);
+              return;
+           default:
+              ERR("unknown message from the pty thread: %d", msgs[i]);
+          }
+     }
+}
+
+static void *
+_thread_run(void *data, Eina_Thread t EINA_UNUSED)
+{
+   Termpty *ty = data;
+   struct pollfd fds[2];
+   Eina_Bool drain = EINA_FALSE, quit = EINA_FALSE;
+
+   fds[0].fd = ty->fd;
+   fds[0].events = POLLIN;
+   fds[1].fd = ty->thread.wake[0];
+   fds[1].events = POLLIN;
+   for (;;)
+     {
+        int len = 0, reads;
+
+        fds[0].revents = 0;
+        fds[1].revents = 0;
+        if ((!drain) && (poll(fds, 2, -1) < 0))
+          {
+             if (errno == EINTR)
+               continue;
+             ERR("poll() on the pty failed: %s", strerror(errno));
+             break;
+          }
+        if (fds[1].revents)
+          {
+             char buf[16];
+
+             while (read(ty->thread.wake[0], buf, sizeof(buf)) > 0)
+               ;
+             eina_lock_take(&ty->thread.sync_lock);
+             quit = ty->thread.quit;
+             drain = ty->thread.drain;
+             eina_lock_release(&ty->thread.sync_lock);
+             /* termpty_free() is waiting for us */
+             if (quit)
+               return NULL;
+          }
+        if ((!drain) && (!fds[0].revents))
+          continue;
+
+        termpty_backlog_lock(ty);
+        reads = _read_budgeted(ty, &len);
+        if ((reads > 0) && (!ty->thread.change))
+          {
+             ty->thread.change = EINA_TRUE;
+             _thread_notify(ty, 'c');
+          }
+        termpty_backlog_unlock(ty);
+
+        if ((len < 0) || ((len == 0) && (drain)) ||
+            ((len == 0) && (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))))
+          break;
+     }
+   _thread_notify(ty, 'x');
+   return NULL;
+}
+
+static void
+_thread_shutdown(Termpty *ty)
+{
+   if (!ty->thread.on)
+     return;
+   if (ty->thread.running)
+     {
+        eina_lock_take(&ty->thread.sync_lock);
+        ty->thread.quit = EINA_TRUE;
+        eina_condition_broadcast(&ty->thread.cond);
+        eina_lock_release(&ty->thread.sync_lock);
+        _thread_wake(ty);
+        eina_thread_join(ty->thread.id);
+        ty->thread.running = EINA_FALSE;
+     }
+   if (ty->thread.pipe)
+     ecore_pipe_del(ty->thread.pipe);
+   ty->thread.pipe = NULL;
+   if (ty->thread.wake[0] >= 0)
+     close(ty->thread.wake[0]);
+   if (ty->thread.wake[1] >= 0)
+     close(ty->thread.wake[1]);
+   ty->thread.wake[0] = ty->thread.wake[1] = -1;
+   eina_condition_free(&ty->thread.cond);
+   eina_lock_free(&ty->thread.sync_lock);
+   eina_lock_free(&ty->thread.lock);
+   ty->thread.on = EINA_FALSE;
+}
+
+static Eina_Bool
+_thread_start(Termpty *ty)
+{
+   int i;
+
+   ty->thread.wake[0] = ty->thread.wake[1] = -1;
+   if (!eina_lock_recursive_new(&ty->thread.lock))
+     return EINA_FALSE;
+   if (!eina_lock_new(&ty->thread.sync_lock))
+     {
+        eina_lock_free(&ty->thread.lock);
+        return EINA_FALSE;
+     }
+   if (!eina_condition_new(&ty->thread.cond, &ty->thread.sync_lock))
+     {
+        eina_lock_free(&ty->thread.sync_lock);
+        eina_lock_free(&ty->thread.lock);
+        return EINA_FALSE;
+     }
+   ty->thread.on = EINA_TRUE;
+
+   if (pipe(ty->thread.wake) < 0)
+     {
+        ERR("pipe() failed: %s", strerror(errno));
+        ty->thread.wake[0] = ty->thread.wake[1] = -1;
+        goto err;
+     }
+   for (i = 0; i < 2; i++)
+     {
+        if ((fcntl(ty->thread.wake[i], F_SETFD, FD_CLOEXEC) < 0) ||
+            (fcntl(ty->thread.wake[i], F_SETFL, O_NONBLOCK) < 0))
+          {
+             ERR("fcntl() on pipe failed: %s", strerror(errno));
+             goto err;
+          }
+     }
+   ty->thread.pipe = ecore_pipe_add(_thread_pipe_cb, ty);
+   if (!ty->thread.pipe)
+     goto err;
+   if (!eina_thread_create(&ty->thread.id, EINA_THREAD_NORMAL, -1,
+                           _thread_run, ty))
+     {
+        ERR("could not create the pty thread");
+        goto err;
+     }
+   ty->thread.running = EINA_TRUE;
+   return EINA_TRUE;
+
+err:
+   _thread_shutdown(ty);
+   return EINA_FALSE;
+}
+
+/* Run @func from the main loop, waiting for it to be done.  To be used
+ * from the parser of a threaded pty for anything touching the UI.
+ * The lock of the pty is released meanwhile, however many times it is
+ * held, so the pty may have changed once this returns */
+void
+termpty_main_loop_call(Termpty *ty, void (*func) (void *data), void *data)
+{
+   int depth, i;
+
+   if ((!ty->thread.on) || (eina_main_loop_is()))
+     {
+        termpty_backlog_lock(ty);
+        _scrolls_flush(ty);
+        termpty_backlog_unlock(ty);
+        if (func)
+          func(data);
+        return;
+     }
+
+   /* the main loop may be waiting for the lock of the pty */
+   depth = ty->thread.depth;
+   for (i = 0; i < depth; i++)
+     termpty_backlog_unlock(ty);
+   eina_lock_take(&ty->thread.sync_lock);
+   if (!ty->thread.quit)
+     {
+        ty->thread.call.func = func;
+        ty->thread.call.data = data;
+        ty->thread.call_done = EINA_FALSE;
+        _thread_notify(ty, 'f');
+     }
+   while ((!ty->thread.call_done) && (!ty->thread.quit))
+     eina_condition_wait(&ty->thread.cond);
+   eina_lock_release(&ty->thread.sync_lock);
+   for (i = 0; i < depth; i++)
+     termpty_backlog_lock(ty);
+}
+
+/* Tell termio the region between @start_y and @end_y scrolled.  This is
+ * queued, never waiting for the main loop, so that the screen operation
+ * calling it goes on with the pty as it was.  termio is told at the end of
+ * termpty_handle_buf(), or by the main loop for a threaded pty, and before
+ * any callback runs */
+void
+termpty_scroll_notify(Termpty *ty, int direction, int start_y, int end_y)
+{
+   unsigned int n = ty->scrolls.n;
+
+   if ((n > 0) &&
+       (ty->scrolls.runs[n - 1].direction == direction) &&
+       (ty->scrolls.runs[n - 1].start_y == start_y) &&
+       (ty->scrolls.runs[n - 1].end_y == end_y))
+     {
+        ty->scrolls.runs[n - 1].n++;
+        return;
+     }
+   if (n == ty->scrolls.size)
+     {
+        unsigned int size = n ? n * 2 : 8;
+        void *runs = realloc(ty->scrolls.runs,
+                             size * sizeof(ty->scrolls.runs[0]));
+
+        if (!runs)
+          {
+             ERR("could not queue a scroll: %s", strerror(errno));
+             return;
+          }
+        ty->scrolls.runs = runs;
+        ty->scrolls.size = size;
+     }
+   ty->scrolls.runs[n].n = 1;
+   ty->scrolls.runs[n].direction = direction;
+   ty->scrolls.runs[n].start_y = start_y;
+   ty->scrolls.runs[n].end_y = end_y;
+   ty->scrolls.n++;
+}
+/* }}} */
+
 static Eina_Bool
 _cb_exe_exit(void *data,
              int _type EINA_UNUSED,
@@ -425,13 +894,25 @@ _cb_exe_exit(void *data,
    Eina_Bool res;
 
    if (ev->pid != ty->pid) return ECORE_CALLBACK_PASS_ON;
+   termpty_backlog_lock(ty);
    ty->exit_code = ev->exit_code;
 
    ty->pid = -1;
+   termpty_backlog_unlock(ty);
 
    if (ty->hand_exe_exit) ecore_event_handler_del(ty->hand_exe_exit);
    ty->hand_exe_exit = NULL;
 
+   if (ty->thread.running)
+     {
+        /* the worker reads what is left, then _thread_exited() is called */
+        eina_lock_take(&ty->thread.sync_lock);
+        ty->thread.drain = EINA_TRUE;
+        eina_lock_release(&ty->thread.sync_lock);
+        _thread_wake(ty);
+        return ECORE_CALLBACK_PASS_ON;
+     }
+
    /* Read everything till the end */
    res = ECORE_CALLBACK_PASS_ON;
    while (ty->hand_fd && res != ECORE_CALLBACK_CANCEL)
@@ -531,183 +1012,118 @@ _is_shell_valid(const char *cmd)
    return EINA_TRUE;
 }
 
-Termpty *
-termpty_new(const char *cmd, Eina_Bool login_shell, const char *cd,
-            int w, int h, Config *config, const char *title,
-            Ecore_Window window_id)
+static const char *
+_shell_get(void)
 {
-   Termpty *ty;
-   const char *pty;
-   int mode;
-   struct termios t;
-   Eina_Bool needs_shell;
-   const char *shell = NULL;
-   const char *args[4] = {NULL, NULL, NULL, NULL};
-   const char *arg0;
-
-   ty = calloc(1, sizeof(Termpty));
-   if (!ty) return NULL;
-   ty->config = config;
-   ty->w = w;
-   ty->h = h;
-   ty->backsize = config->scrollback;
-
-   ty->screen = calloc(1, sizeof(Termcell) * ty->w * ty->h);
-   if (!ty->screen)
-     {
-        ERR("Allocation of term %s %ix%i failed: %s",
-            "screen", ty->w, ty->h, strerror(errno));
-        goto err;
-     }
-   ty->screen2 = calloc(1, sizeof(Termcell) * ty->w * ty->h);
-   if (!ty->screen2)
-     {
-        ERR("Allocation of term %s %ix%i failed: %s",
-            "screen2", ty->w, ty->h, strerror(errno));
-        goto err;
-     }
+   const char *shell;
 
-   ty->hl.bitmap = calloc(1, HL_LINKS_MAX / 8); /* bit map for 1 << 16 elements */
-   if (!ty->hl.bitmap)
+   shell = getenv("SHELL");
+   if (!_is_shell_valid(shell))
+     shell = NULL;
+   if (!shell)
      {
-        ERR("Allocation of %d bytes failed: %s",
-            HL_LINKS_MAX / 8, strerror(errno));
-        goto err;
+        uid_t uid = getuid();
+        struct passwd *pw = getpwuid(uid);
+        if (pw) shell = pw->pw_shell;
      }
-   /* Mark id 0 as set */
-   ty->hl.bitmap[0] = 1;
-
-   termpty_resize_tabs(ty, 0, w);
-
-   termpty_reset_state(ty);
-
-   ty->circular_offset = 0;
-
-#if defined(ENABLE_FUZZING) || defined(ENABLE_TESTS)
-   ty->fd = STDIN_FILENO;
-   ty->hand_fd = ecore_main_fd_handler_add(ty->fd,
-                                           ECORE_FD_READ | ECORE_FD_ERROR,
-                                           _cb_fd, ty,
-                                           NULL, NULL);
-   _pty_size(ty);
-   termpty_save_register(ty);
-   return ty;
-#endif
-
-   needs_shell = ((!cmd) ||
-                  (strpbrk(cmd, " |&;<>()$`\\\"'*?#") != NULL));
-   DBG("cmd='%s' needs_shell=%u", cmd ? cmd : "", needs_shell);
-
-   if (needs_shell)
+   if (!shell)
      {
-        shell = getenv("SHELL");
-        if (!_is_shell_valid(shell))
-          shell = NULL;
-        if (!shell)
-          {
-             uid_t uid = getuid();
-             struct passwd *pw = getpwuid(uid);
-             if (pw) shell = pw->pw_shell;
-          }
-        if (!shell)
-          {
-             WRN(_("Could not find shell, falling back to %s"), "/bin/sh");
-             shell = "/bin/sh";
-          }
+        WRN(_("Could not find shell, falling back to %s"), "/bin/sh");
+        shell = "/bin/sh";
      }
+   return shell;
+}
 
-   if (!needs_shell)
-     args[0] = cmd;
-   else
-     {
-        args[0] = shell;
-        if (cmd)
-          {
-             args[1] = "-c";
-             args[2] = cmd;
-          }
-     }
-   arg0 = strrchr(args[0], '/');
-   if (!arg0) arg0 = args[0];
-   else arg0++;
-   ty->prop.title = eina_stringshare_add(title? title : arg0);
+/* Open a pty of size @w x @h and run @args on it.
+ * Returns the pid of the child and sets @fdp to the master side of the pty,
+ * or returns -1 on error */
+static pid_t
+_pty_spawn(const char **args, Eina_Bool login_shell, const char *cd,
+           Eina_Bool xterm_256color, Eina_Bool erase_is_del,
+           Ecore_Window window_id, int w, int h, int *fdp)
+{
+   const char *pty;
+   int mode, fd, slavefd = -1;
+   struct termios t;
+   struct winsize sz;
+   pid_t pid;
 
-   ty->fd = posix_openpt(O_RDWR | O_NOCTTY);
-   if (ty->fd < 0)
+   fd = posix_openpt(O_RDWR | O_NOCTTY);
+   if (fd < 0)
      {
         ERR(_("Function %s failed: %s"), "posix_openpt()", strerror(errno));
-        goto err;
+        return -1;
      }
-   if (grantpt(ty->fd) != 0)
+   if (grantpt(fd) != 0)
      {
         WRN(_("Function %s failed: %s"), "grantpt()",  strerror(errno));
      }
-   if (unlockpt(ty->fd) != 0)
+   if (unlockpt(fd) != 0)
      {
         ERR(_("Function %s failed: %s"), "unlockpt()", strerror(errno));
         goto err;
      }
-   pty = ptsname(ty->fd);
-   ty->slavefd = open(pty, O_RDWR | O_NOCTTY);
-   if (ty->slavefd < 0)
+   pty = ptsname(fd);
+   slavefd = open(pty, O_RDWR | O_NOCTTY);
+   if (slavefd < 0)
      {
         ERR(_("open() of pty '%s' failed: %s"), pty, strerror(errno));
         goto err;
      }
 
-   mode = fcntl(ty->fd, F_GETFL, 0);
+   mode = fcntl(fd, F_GETFL, 0);
    if (mode < 0)
      {
         ERR(_("fcntl() on pty '%s' failed: %s"), pty, strerror(errno));
         goto err;
      }
    if (!(mode & O_NDELAY))
-     if (fcntl(ty->fd, F_SETFL, mode | O_NDELAY))
+     if (fcntl(fd, F_SETFL, mode | O_NDELAY))
        {
           ERR(_("fcntl() on pty '%s' failed: %s"), pty, strerror(errno));
           goto err;
        }
 
 #if defined (__sun) || defined (__sun__)
-   if (ioctl(ty->slavefd, I_PUSH, "ptem") < 0
-       || ioctl(ty->slavefd, I_PUSH, "ldterm") < 0
-       || ioctl(ty->slavefd, I_PUSH, "ttcompat") < 0)
+   if (ioctl(slavefd, I_PUSH, "ptem") < 0
+       || ioctl(slavefd, I_PUSH, "ldterm") < 0
+       || ioctl(slavefd, I_PUSH, "ttcompat") < 0)
      {
         ERR(_("ioctl() on pty '%s' failed: %s"), pty, strerror(errno));
         goto err;
      }
 # endif
 
-   if (tcgetattr(ty->slavefd, &t) < 0)
+   if (tcgetattr(slavefd, &t) < 0)
      {
         ERR("unable to tcgetattr: %s", strerror(errno));
         goto err;
      }
-   t.c_cc[VERASE] =  (config->erase_is_del) ? 0x7f : 0x8;
+   t.c_cc[VERASE] =  (erase_is_del) ? 0x7f : 0x8;
 #ifdef IUTF8
    t.c_iflag |= IUTF8;
 #endif
-   if (tcsetattr(ty->slavefd, TCSANOW, &t) < 0)
+   if (tcsetattr(slavefd, TCSANOW, &t) < 0)
      {
         ERR("unable to tcsetattr: %s", strerror(errno));
         goto err;
      }
 
-   ty->hand_exe_exit = ecore_event_handler_add(ECORE_EXE_EVENT_DEL,
-                                               _cb_exe_exit, ty);
-   if (!ty->hand_exe_exit)
-     {
-        ERR("event handler add failed");
-        goto err;
-     }
+   /* so that the child starts with the right size */
+   sz.ws_col = w;
+   sz.ws_row = h;
+   sz.ws_xpixel = 0;
+   sz.ws_ypixel = 0;
+   if (ioctl(fd, TIOCSWINSZ, &sz) < 0)
+     ERR(_("Size set ioctl failed: %s"), strerror(errno));
 
-   ty->pid = fork();
-   if (ty->pid < 0)
+   pid = fork();
+   if (pid < 0)
      {
         ERR("unable to fork: %s", strerror(errno));
         goto err;
      }
-   if (!ty->pid)
+   if (!pid)
      {
         if (cd)
           {
@@ -745,14 +1161,14 @@ termpty_new(const char *cmd, Eina_Bool login_shell, const char *cd,
 
         setsid();
 
-        dup2(ty->slavefd, 0);
-        dup2(ty->slavefd, 1);
-        dup2(ty->slavefd, 2);
+        dup2(slavefd, 0);
+        dup2(slavefd, 1);
+        dup2(slavefd, 2);
 
-        if (ioctl(ty->slavefd, TIOCSCTTY, NULL) < 0) exit(1);
+        if (ioctl(slavefd, TIOCSCTTY, NULL) < 0) exit(1);
 
-        close(ty->slavefd);
-        close(ty->fd);
+        close(slavefd);
+        close(fd);
 
         /* Unset env variables that no longer apply */
         unsetenv("TERMCAP");
@@ -760,7 +1176,7 @@ termpty_new(const char *cmd, Eina_Bool login_shell, const char *cd,
         unsetenv("LINES");
 
         /* pretend to be xterm */
-        if (config->xterm_256color)
+        if (xterm_256color)
           {
              putenv("TERM=xterm-256color");
           }
@@ -796,14 +1212,396 @@ termpty_new(const char *cmd, Eina_Bool login_shell, const char *cd,
           }
         exit(127); /* same as system() for failed commands */
      }
-   close(ty->slavefd);
-   ty->slavefd = -1;
+   close(slavefd);
+   *fdp = fd;
+   return pid;
+
+err:
+   if (slavefd >= 0) close(slavefd);
+   close(fd);
+   return -1;
+}
+
+/* Pool of shells {{{ */
+
+/* Shells started ahead of time on ptys of their own, so that a new
+ * terminal running the shell gets a prompt without waiting for the shell to
+ * start up.  Each is only handed to a terminal asking for a shell in the
+ * same directory and window, see _pool_take().  They are all started with
+ * the same settings, and dropped when those change */
+
+typedef struct _Pty_Pool_Entry
+{
+   int fd;
+   pid_t pid;
+   const char *cd; /* stringshare */
+   Ecore_Window window_id;
+} Pty_Pool_Entry;
+
+static struct {
+   Eina_List *entries; /* oldest first */
+   int size;
+   Ecore_Timer *timer;
+   Ecore_Event_Handler *hand_exe_exit;
+   struct {
+      Eina_Bool login_shell;
+      Eina_Bool xterm_256color;
+      Eina_Bool erase_is_del;
+   } key;
+   /* the last terminal asking for a shell, the next ones are started for */
+   struct {
+      const char *cd; /* stringshare */
+      Ecore_Window window_id;
+      int w, h;
+   } last;
+} _pool;
+
+/* Start filling the pool that many seconds after a shell was taken from it,
+ * not to compete with the shell that was just handed out */
+#define PTY_POOL_FILL_DELAY 0.5
+
+static void
+_pool_entry_free(Pty_Pool_Entry *pe)
+{
+   close(pe->fd);
+   eina_stringshare_del(pe->cd);
+   free(pe);
+}
+
+static void
+_pool_entry_kill(Pty_Pool_Entry *pe)
+{
+   /* reaped as any other child, see _cb_pool_exe_exit() */
+   kill(pe->pid, SIGHUP);
+   _pool_entry_free(pe);
+}
+
+static void
+_pool_flush(void)
+{
+   Pty_Pool_Entry *pe;
+
+   EINA_LIST_FREE(_pool.entries, pe)
+     _pool_entry_kill(pe);
+}
+
+static Eina_Bool
+_cb_pool_exe_exit(void *_data EINA_UNUSED,
+                  int _type EINA_UNUSED,
+                  void *event)
+{
+   Ecore_Exe_Event_Del *ev = event;
+   Pty_Pool_Entry *pe;
+   Eina_List *l;
+
+   EINA_LIST_FOREACH(_pool.entries, l, pe)
+     {
+        if (pe->pid == ev->pid)
+          {
+             /* do not restart it, it would likely die the same way */
+             DBG("shell pid %i of the pool exited", (int)pe->pid);
+             _pool.entries = eina_list_remove_list(_pool.entries, l);
+             _pool_entry_free(pe);
+             break;
+          }
+     }
+   return ECORE_CALLBACK_PASS_ON;
+}
+
+static Eina_Bool
+_cb_pool_fill(void *_data EINA_UNUSED)
+{
+   const char *args[2] = {NULL, NULL};
+   Pty_Pool_Entry *pe;
+
+   if ((int)eina_list_count(_pool.entries) >= _pool.size)
+     {
+        _pool.timer = NULL;
+        return ECORE_CALLBACK_CANCEL;
+     }
+   if (!_pool.hand_exe_exit)
+     {
+        _pool.hand_exe_exit = ecore_event_handler_add(ECORE_EXE_EVENT_DEL,
+                                                      _cb_pool_exe_exit,
+                                                      NULL);
+        if (!_pool.hand_exe_exit)
+          goto end;
+     }
+   pe = calloc(1, sizeof(*pe));
+   if (!pe)
+     goto end;
+   args[0] = _shell_get();
+   pe->pid = _pty_spawn(args, _pool.key.login_shell, _pool.last.cd,
+                        _pool.key.xterm_256color, _pool.key.erase_is_del,
+                        _pool.last.window_id, _pool.last.w, _pool.last.h,
+                        &pe->fd);
+   if (pe->pid < 0)
+     {
+        free(pe);
+        goto end;
+     }
+   pe->cd = eina_stringshare_ref(_pool.last.cd);
+   pe->window_id = _pool.last.window_id;
+   DBG("shell pid %i added to the pool", (int)pe->pid);
+   _pool.entries = eina_list_append(_pool.entries, pe);
+   /* one at a time, not to stall the main loop */
+   if ((int)eina_list_count(_pool.entries) < _pool.size)
+     return ECORE_CALLBACK_RENEW;
+
+end:
+   _pool.timer = NULL;
+   return ECORE_CALLBACK_CANCEL;
+}
+
+static void
+_pool_fill_schedule(void)
+{
+   if ((_pool.timer) ||
+       ((int)eina_list_count(_pool.entries) >= _pool.size))
+     return;
+   _pool.timer = ecore_timer_add(PTY_POOL_FILL_DELAY, _cb_pool_fill, NULL);
+}
+
+static void
+_pool_size_set(int size)
+{
+   if (size < 0)
+     size = 0;
+   else if (size > CONFIG_PTY_POOL_SIZE_MAX)
+     size = CONFIG_PTY_POOL_SIZE_MAX;
+   _pool.size = size;
+   while ((int)eina_list_count(_pool.entries) > size)
+     {
+        Pty_Pool_Entry *pe = eina_list_data_get(_pool.entries);
+
+        _pool.entries = eina_list_remove_list(_pool.entries, _pool.entries);
+        _pool_entry_kill(pe);
+     }
+}
+
+/* Drop the shells started with other settings than those */
+static void
+_pool_key_set(Eina_Bool login_shell, const Config *config)
+{
+   if ((_pool.key.login_shell == !!login_shell) &&
+       (_pool.key.xterm_256color == !!config->xterm_256color) &&
+       (_pool.key.erase_is_del == !!config->erase_is_del))
+     return;
+   _pool_flush();
+   _pool.key.login_shell = !!login_shell;
+   _pool.key.xterm_256color = !!config->xterm_256color;
+   _pool.key.erase_is_del = !!config->erase_is_del;
+}
+
+/* A shell started in @cd for the window @window_id, if any.  The shells to
+ * come are started for those, and @w x @h.  When there is none and the pool
+ * is full, its oldest shell makes room for one started for those, so that
+ * the pool follows where new terminals are opened without being restarted
+ * as a whole */
+static Pty_Pool_Entry *
+_pool_take(const char *cd, Ecore_Window window_id, int w, int h)
+{
+   Pty_Pool_Entry *pe;
+   Eina_List *l;
+
+   eina_stringshare_replace(&_pool.last.cd, cd);
+   _pool.last.window_id = window_id;
+   /* the size is only set after the shell is taken */
+   _pool.last.w = w;
+   _pool.last.h = h;
+   EINA_LIST_FOREACH(_pool.entries, l, pe)
+     {
+        /* both stringshares */
+        if ((pe->window_id == window_id) && (pe->cd == _pool.last.cd))
+          {
+             _pool.entries = eina_list_remove_list(_pool.entries, l);
+             return pe;
+          }
+     }
+   if ((_pool.size > 0) &&
+       ((int)eina_list_count(_pool.entries) >= _pool.size))
+     {
+        pe = eina_list_data_get(_pool.entries);
+        _pool.entries = eina_list_remove_list(_pool.entries, _pool.entries);
+        _pool_entry_kill(pe);
+     }
+   return NULL;
+}
+
+static void
+_pool_shutdown(void)
+{
+   _pool.size = 0;
+   _pool_flush();
+   if (_pool.timer)
+     ecore_timer_del(_pool.timer);
+   _pool.timer = NULL;
+   if (_pool.hand_exe_exit)
+     ecore_event_handler_del(_pool.hand_exe_exit);
+   _pool.hand_exe_exit = NULL;
+   eina_stringshare_replace(&_pool.last.cd, NULL);
+}
+/* }}} */
+
+Termpty *
+termpty_new(const char *cmd, Eina_Bool login_shell, const char *cd,
+            int w, int h, Config *config, const char *title,
+            Ecore_Window window_id)
+{
+   Termpty *ty;
+   Pty_Pool_Entry *pe = NULL;
+   Eina_Bool needs_shell;
+   const char *args[4] = {NULL, NULL, NULL, NULL};
+   const char *arg0;
+
+   ty = calloc(1, sizeof(Termpty));
+   if (!ty) return NULL;
+   ty->fd = -1;
+   ty->slavefd = -1;
+   ty->pid = -1;
+   ty->config = config;
+   ty->w = w;
+   ty->h = h;
+   ty->backsize = config->scrollback;
+   ty->read.budget = READ_BUDGET_DEFAULT;
+
+   ty->screen = calloc(1, sizeof(Termcell) * ty->w * ty->h);
+   if (!ty->screen)
+     {
+        ERR("Allocation of term %s %ix%i failed: %s",
+            "screen", ty->w, ty->h, strerror(errno));
+        goto err;
+     }
+   ty->screen2 = calloc(1, sizeof(Termcell) * ty->w * ty->h);
+   if (!ty->screen2)
+     {
+        ERR("Allocation of term %s %ix%i failed: %s",
+            "screen2", ty->w, ty->h, strerror(errno));
+        goto err;
+     }
+   ty->rows = malloc(sizeof(Termcell *) * ty->h);
+   ty->rows2 = malloc(sizeof(Termcell *) * ty->h);
+   if ((!ty->rows) || (!ty->rows2))
+     {
+        ERR("Allocation of term %s %ix%i failed: %s",
+            "rows", ty->w, ty->h, strerror(errno));
+        goto err;
+     }
+   termpty_screen_rows_set(ty->rows, ty->screen, ty->w, ty->h, 0);
+   termpty_screen_rows_set(ty->rows2, ty->screen2, ty->w, ty->h, 0);
+   ty->dirty.rows = calloc(1, ty->h);
+   if (!ty->dirty.rows)
+     {
+        ERR("Allocation of term %s %ix%i failed: %s",
+            "dirty rows", ty->w, ty->h, strerror(errno));
+        goto err;
+     }
+   ty->dirty.changed = calloc(ty->h, sizeof(unsigned int));
+   if (!ty->dirty.changed)
+     {
+        ERR("Allocation of term %s %ix%i failed: %s",
+            "changed rows", ty->w, ty->h, strerror(errno));
+        goto err;
+     }
+   ty->dirty.all = 1;
+
+   ty->hl.buckets = calloc(HL_BUCKETS, sizeof(uint16_t));
+   if (!ty->hl.buckets)
+     {
+        ERR("Allocation of %d bytes failed: %s",
+            (int)(HL_BUCKETS * sizeof(uint16_t)), strerror(errno));
+        goto err;
+     }
+   /* id 0 means no link */
+   ty->hl.fresh = 1;
+
+   if (!termpty_styles_init(ty))
+     {
+        ERR("Allocation of term %s failed: %s", "styles", strerror(errno));
+        goto err;
+     }
+
+   termpty_resize_tabs(ty, 0, w);
+
+   termpty_reset_state(ty);
+
+#if defined(ENABLE_FUZZING) || defined(ENABLE_TESTS)
+   ty->fd = STDIN_FILENO;
+   ty->hand_fd = ecore_main_fd_handler_add(ty->fd,
+                                           ECORE_FD_READ | ECORE_FD_ERROR,
+                                           _cb_fd, ty,
+                                           NULL, NULL);
+   _pty_size(ty);
+   termpty_save_register(ty);
+   return ty;
+#endif
+
+   needs_shell = ((!cmd) ||
+                  (strpbrk(cmd, " |&;<>()$`\\\"'*?#") != NULL));
+   DBG("cmd='%s' needs_shell=%u", cmd ? cmd : "", needs_shell);
+
+   if (!needs_shell)
+     args[0] = cmd;
+   else
+     {
+        args[0] = _shell_get();
+        if (cmd)
+          {
+             args[1] = "-c";
+             args[2] = cmd;
+          }
+     }
+   arg0 = strrchr(args[0], '/');
+   if (!arg0) arg0 = args[0];
+   else arg0++;
+   ty->prop.title = eina_stringshare_add(title? title : arg0);
+
+   ty->hand_exe_exit = ecore_event_handler_add(ECORE_EXE_EVENT_DEL,
+                                               _cb_exe_exit, ty);
+   if (!ty->hand_exe_exit)
+     {
+        ERR("event handler add failed");
+        goto err;
+     }
 
-   ty->hand_fd = ecore_main_fd_handler_add(ty->fd, ECORE_FD_READ,
-                                           _cb_fd, ty,
-                                           NULL, NULL);
-   /* ensure we're not missing a read */
-   _cb_fd(ty, ty->hand_fd);
+   if (!cmd)
+     {
+        _pool_size_set(config->pty_pool_size);
+        _pool_key_set(login_shell, config);
+        pe = _pool_take(cd, window_id, w, h);
+        _pool_fill_schedule();
+     }
+   if (pe)
+     {
+        DBG("shell pid %i taken from the pool", (int)pe->pid);
+        ty->fd = pe->fd;
+        ty->pid = pe->pid;
+        eina_stringshare_del(pe->cd);
+        free(pe);
+     }
+   else
+     {
+        ty->pid = _pty_spawn(args, login_shell, cd, config->xterm_256color,
+                             config->erase_is_del, window_id, w, h, &ty->fd);
+        if (ty->pid < 0)
+          goto err;
+     }
+
+   if ((config->threaded_pty) && (_thread_start(ty)))
+     {
+        /* only to write to the pty, the worker thread reads from it */
+        ty->hand_fd = ecore_main_fd_handler_add(ty->fd, ECORE_FD_ERROR,
+                                                _cb_fd, ty,
+                                                NULL, NULL);
+     }
+   else
+     {
+        ty->hand_fd = ecore_main_fd_handler_add(ty->fd, ECORE_FD_READ,
+                                                _cb_fd, ty,
+                                                NULL, NULL);
+        /* ensure we're not missing a read */
+        _cb_fd(ty, ty->hand_fd);
+     }
 
    _pty_size(ty);
    termpty_save_register(ty);
@@ -811,7 +1609,14 @@ termpty_new(const char *cmd, Eina_Bool login_shell, const char *cd,
 err:
    free(ty->screen);
    free(ty->screen2);
-   free(ty->hl.bitmap);
+   free(ty->rows);
+   free(ty->rows2);
+   free(ty->dirty.rows);
+   free(ty->dirty.changed);
+   free(ty->hl.buckets);
+   termpty_styles_shutdown(ty);
+   eina_stringshare_del(ty->prop.title);
+   if (ty->hand_exe_exit) ecore_event_handler_del(ty->hand_exe_exit);
    if (ty->fd >= 0) close(ty->fd);
    if (ty->slavefd >= 0) close(ty->slavefd);
    free(ty);
@@ -823,6 +1628,9 @@ termpty_free(Termpty *ty)
 {
    Termexp *ex;
 
+   /* stop the worker thread first, it could use anything below */
+   _thread_shutdown(ty);
+   _thread_blocks_dead_free(ty);
    termpty_save_unregister(ty);
    EINA_LIST_FREE(ty->block.expecting, ex) free(ex);
    if (ty->block.blocks) eina_hash_free(ty->block.blocks);
@@ -879,9 +1687,14 @@ termpty_free(Termpty *ty)
    termpty_backlog_free(ty);
    free(ty->screen);
    free(ty->screen2);
+   free(ty->rows);
+   free(ty->rows2);
+   free(ty->dirty.rows);
+   free(ty->dirty.changed);
+   free(ty->scrolls.runs);
    if (ty->hl.links)
      {
-        uint16_t i;
+        uint32_t i;
 
         for (i = 0; i < ty->hl.size; i++)
           {
@@ -891,7 +1704,10 @@ termpty_free(Termpty *ty)
           }
        free(ty->hl.links);
      }
-   free(ty->hl.bitmap);
+   free(ty->hl.buckets);
+   termio_link_spans_free(ty);
+   termpty_styles_shutdown(ty);
+   termpty_truecolor_lut_free(ty);
    free(ty->buf);
    free(ty->tabs);
    ty_sb_free(&ty->write_buffer);
@@ -903,19 +1719,23 @@ termpty_config_update(Termpty *ty, Config *config)
 {
    ty->config = config;
    termpty_backlog_size_set(ty, config->scrollback);
+   _pool_size_set(config->pty_pool_size);
 }
 
 static Eina_Bool
-_termpty_cell_is_empty(const Termcell *cell)
+_termpty_cell_is_empty(const Termpty *ty, const Termcell *cell)
 {
+   const Termatt *att = TERMPTY_CELL_STYLE(ty, *cell);
+
    return ((cell->codepoint == 0) ||
-           (cell->att.invisible) ||
-           (cell->att.fg == COL_INVIS)) &&
-      ((cell->att.bg == COL_INVIS) || (cell->att.bg == COL_DEF));
+           (att->invisible) ||
+           (att->fg == COL_INVIS)) &&
+      ((att->bg == COL_INVIS) || (att->bg == COL_DEF));
 }
 
 static Eina_Bool
-_termpty_line_is_empty(const Termcell *cells, ssize_t nb_cells)
+_termpty_line_is_empty(const Termpty *ty, const Termcell *cells,
+                       ssize_t nb_cells)
 {
    ssize_t len;
 
@@ -923,7 +1743,7 @@ _termpty_line_is_empty(const Termcell *cells, ssize_t nb_cells)
      {
         const Termcell *cell = cells + len;
 
-        if (!_termpty_cell_is_empty(cell))
+        if (!_termpty_cell_is_empty(ty, cell))
           return EINA_FALSE;
      }
 
@@ -932,7 +1752,8 @@ _termpty_line_is_empty(const Termcell *cells, ssize_t nb_cells)
 
 
 ssize_t
-termpty_line_length(const Termcell *cells, ssize_t nb_cells)
+termpty_line_length(const Termpty *ty, const Termcell *cells,
+                    ssize_t nb_cells)
 {
    ssize_t len;
 
@@ -943,7 +1764,7 @@ termpty_line_length(const Termcell *cells, ssize_t nb_cells)
      {
         const Termcell *cell = cells + len;
 
-        if (!_termpty_cell_is_empty(cell))
+        if (!_termpty_cell_is_empty(ty, cell))
           return len + 1;
      }
 
@@ -961,26 +1782,25 @@ termpty_text_save_top(Termpty *ty, Termcell *cells, ssize_t w_max)
      return;
    assert(ty->back);
 
-   termpty_backlog_lock();
+   termpty_backlog_lock(ty);
 
-   w = termpty_line_length(cells, w_max);
+   w = termpty_line_length(ty, cells, w_max);
    for (i = 0; i < w - 1; i++)
      {
-        cells[i].att.autowrapped = 1;
+        cells[i].autowrapped = 1;
      }
    if (ty->backsize > 0)
      {
         ts = BACKLOG_ROW_GET(ty, 1);
         if (!ts->cells)
           goto add_new_ts;
-        /* TODO: RESIZE uncompress ? */
-        if (ts->w && ts->cells[ts->w - 1].att.autowrapped)
+        ts = termpty_save_extract(ty, ts);
+        if (!ts)
+          goto add_new_ts;
+        if (ts->w && ts->cells[ts->w - 1].autowrapped)
           {
-             int old_len = ts->w;
              termpty_save_expand(ty, ts, cells, w);
-             ty->backlog_beacon.screen_y += (ts->w + ty->w - 1) / ty->w
-                                          - (old_len + ty->w - 1) / ty->w;
-             return;
+             goto end;
           }
      }
 
@@ -988,20 +1808,13 @@ add_new_ts:
    ts = BACKLOG_ROW_GET(ty, 0);
    ts = termpty_save_new(ty, ts, w);
    if (!ts)
-     return;
+     goto end;
    TERMPTY_CELL_COPY(ty, cells, ts->cells, w);
    ty->backpos++;
    if (ty->backpos >= ty->backsize)
      ty->backpos = 0;
-   termpty_backlog_unlock();
-
-   ty->backlog_beacon.screen_y++;
-   ty->backlog_beacon.backlog_y++;
-   if (ty->backlog_beacon.backlog_y >= (int)ty->backsize)
-     {
-        ty->backlog_beacon.screen_y = 0;
-        ty->backlog_beacon.backlog_y = 0;
-     }
+end:
+   termpty_backlog_unlock(ty);
 }
 
 
@@ -1014,127 +1827,40 @@ termpty_row_length(Termpty *ty, int y)
    if (!cells)
      return 0;
    if (y >= 0)
-     return termpty_line_length(cells, ty->w);
+     return termpty_line_length(ty, cells, ty->w);
    return wret;
 }
 
 void
 termpty_backscroll_adjust(Termpty *ty, int *scroll)
 {
-   int backlog_y = ty->backlog_beacon.backlog_y;
-   int screen_y = ty->backlog_beacon.screen_y;
+   ssize_t len;
 
    if ((ty->backsize == 0) || (*scroll <= 0))
      {
         *scroll = 0;
         return;
      }
-   if (*scroll < screen_y)
-     {
-        return;
-     }
-
-   backlog_y++;
-   while (42)
-     {
-        int nb_lines;
-        Termsave *ts;
-
-        ts = BACKLOG_ROW_GET(ty, backlog_y);
-        if (!ts->cells || backlog_y >= (int)ty->backsize)
-          {
-             *scroll = ty->backlog_beacon.screen_y;
-             return;
-          }
-        nb_lines = (ts->w == 0) ? 1 : (ts->w + ty->w - 1) / ty->w;
-        screen_y += nb_lines;
-        ty->backlog_beacon.screen_y = screen_y;
-        ty->backlog_beacon.backlog_y = backlog_y;
-        backlog_y++;
-        if (*scroll <= screen_y)
-          {
-             return;
-          }
-     }
+   len = termpty_backlog_length(ty);
+   if (*scroll > len)
+     *scroll = len;
 }
 
 /* @requested_y unit is in visual lines on the screen */
 static Termcell*
-_termpty_cellrow_from_beacon_get(Termpty *ty, int requested_y, ssize_t *wret)
+_termpty_cellrow_from_backlog_get(Termpty *ty, int requested_y, ssize_t *wret)
 {
-   int backlog_y = ty->backlog_beacon.backlog_y;
-   int screen_y = ty->backlog_beacon.screen_y;
    Termsave *ts;
-   int nb_lines;
-   int first_loop = EINA_TRUE;
-
-   requested_y = -requested_y;
-
-   /* check if going from 0,0 is faster than using the beacon */
-   if (screen_y - requested_y > requested_y)
-     {
-        ty->backlog_beacon.backlog_y = 0;
-        ty->backlog_beacon.screen_y = 0;
-     }
-
-   /* going upward */
-   while (requested_y >= screen_y)
-     {
-        ts = BACKLOG_ROW_GET(ty, backlog_y);
-        if (!ts->cells || backlog_y >= (int)ty->backsize)
-          {
-             return NULL;
-          }
-        nb_lines = (ts->w == 0) ? 1 : (ts->w + ty->w - 1) / ty->w;
-
-        /* Only update the beacon if working on different line than the one
-         * from the beacon */
-        if (!first_loop)
-          {
-             screen_y += nb_lines;
-             ty->backlog_beacon.screen_y = screen_y;
-             ty->backlog_beacon.backlog_y = backlog_y;
-          }
-
-        if ((screen_y - nb_lines < requested_y) && (requested_y <= screen_y))
-          {
-             /* found the line */
-             int delta = screen_y - requested_y;
-             *wret = ts->w - delta * ty->w;
-             if (*wret > ty->w)
-               *wret = ty->w;
-             return &ts->cells[delta * ty->w];
-          }
-        backlog_y++;
-        first_loop = EINA_FALSE;
-     }
-   /* else, going downward */
-   while (requested_y <= screen_y)
-     {
-        ts = BACKLOG_ROW_GET(ty, backlog_y);
-        if (!ts->cells)
-          {
-             return NULL;
-          }
-        nb_lines = (ts->w == 0) ? 1 : (ts->w + ty->w - 1) / ty->w;
-
-        ty->backlog_beacon.screen_y = screen_y;
-        ty->backlog_beacon.backlog_y = backlog_y;
-
-        if ((screen_y - nb_lines < requested_y) && (requested_y <= screen_y))
-          {
-             /* found the line */
-             int delta = screen_y - requested_y;
-             *wret = ts->w - delta * ty->w;
-             if (*wret > ty->w)
-               *wret = ty->w;
-             return &ts->cells[delta * ty->w];
-          }
-        screen_y -= nb_lines;
-        backlog_y--;
-     }
+   int row = 0;
 
-   return NULL;
+   ts = termpty_backlog_line_get(ty, -requested_y, &row);
+   ts = termpty_save_extract(ty, ts);
+   if (!ts)
+     return NULL;
+   *wret = ts->w - row * ty->w;
+   if (*wret > ty->w)
+     *wret = ty->w;
+   return &ts->cells[row * ty->w];
 }
 
 /* @requested_y unit is in visual lines on the screen */
@@ -1143,17 +1869,19 @@ termpty_cellrow_get(Termpty *ty, int y_requested, ssize_t *wret)
 {
    if (y_requested >= 0)
      {
-        Termcell *cells = &(TERMPTY_SCREEN(ty, 0, y_requested));
+        Termcell *cells;
+
+        /* the rows are pointers, not to be read past the last one */
         if (y_requested >= ty->h)
           return NULL;
-
-        *wret = termpty_line_length(cells, ty->w);
+        cells = &(TERMPTY_SCREEN(ty, 0, y_requested));
+        *wret = termpty_line_length(ty, cells, ty->w);
         return cells;
      }
    if (!ty->back)
      return NULL;
 
-   return _termpty_cellrow_from_beacon_get(ty, y_requested, wret);
+   return _termpty_cellrow_from_backlog_get(ty, y_requested, wret);
 }
 
 /* @requested_y unit is in visual lines on the screen */
@@ -1174,7 +1902,7 @@ termpty_cell_get(Termpty *ty, int y_requested, int x_requested)
    if (!ty->back)
      return NULL;
 
-   cells = _termpty_cellrow_from_beacon_get(ty, y_requested, &wret);
+   cells = _termpty_cellrow_from_backlog_get(ty, y_requested, &wret);
    if (!cells || x_requested >= wret)
      return NULL;
    return cells + x_requested;
@@ -1186,19 +1914,31 @@ termpty_write(Termpty *ty, const char *input, int len)
 #if defined(ENABLE_FUZZING)
    return;
 #endif
-   int res = ty_sb_add(&ty->write_buffer, input, len);
+   int res;
 
+   termpty_backlog_lock(ty);
+   res = ty_sb_add(&ty->write_buffer, input, len);
    if (res < 0)
      {
         ERR("failure to add %d characters to write buffer", len);
      }
+   else if ((ty->thread.on) && (!eina_main_loop_is()))
+     {
+        /* the fd handler can only be changed from the main loop */
+        if (!ty->thread.write)
+          {
+             ty->thread.write = EINA_TRUE;
+             _thread_notify(ty, 'w');
+          }
+     }
    else if (ty->hand_fd)
      {
         ecore_main_fd_handler_active_set(ty->hand_fd,
                                          ECORE_FD_ERROR |
-                                         ECORE_FD_READ |
+                                         (ty->thread.on ? 0 : ECORE_FD_READ) |
                                          ECORE_FD_WRITE);
      }
+   termpty_backlog_unlock(ty);
 }
 
 struct screen_info
@@ -1255,7 +1995,7 @@ _termpty_line_rewrap(Termpty *ty, Termcell *src_cells, int len,
         return;
      }
 
-   autowrapped = src_cells[len-1].att.autowrapped;
+   autowrapped = src_cells[len-1].autowrapped;
 
    while (len > 0)
      {
@@ -1286,7 +2026,7 @@ _termpty_line_rewrap(Termpty *ty, Termcell *src_cells, int len,
              if ((len > 0) || (len == 0 && autowrapped))
                {
                   dst_cells = &SCREEN_INFO_GET_CELLS(si, 0, si->y);
-                  dst_cells[si->w - 1].att.autowrapped = 1;
+                  dst_cells[si->w - 1].autowrapped = 1;
                }
              si->y++;
              si->x = 0;
@@ -1314,10 +2054,6 @@ _backlog_remove_latest_nolock(Termpty *ty)
    else
      ty->backpos--;
 
-   /* reset beacon */
-   ty->backlog_beacon.screen_y = 0;
-   ty->backlog_beacon.backlog_y = 0;
-
    termpty_save_free(ty, ts);
 }
 
@@ -1325,6 +2061,9 @@ void
 termpty_resize(Termpty *ty, int new_w, int new_h)
 {
    Termcell *new_screen = NULL;
+   Termcell **new_rows = NULL, **new_rows2 = NULL;
+   unsigned char *new_dirty = NULL;
+   unsigned int *new_changed = NULL;
    int old_y = 0,
        old_w = ty->w,
        old_h = ty->h,
@@ -1333,7 +2072,12 @@ termpty_resize(Termpty *ty, int new_w, int new_h)
    struct screen_info new_si = {.screen = NULL};
    if ((ty->w == new_w) && (ty->h == new_h)) return;
 
-   termpty_backlog_lock();
+   termpty_backlog_lock(ty);
+   /* what was queued is about the current size */
+   if ((!ty->thread.on) || (eina_main_loop_is()))
+     _scrolls_flush(ty);
+   ty->link_spans.gen++;
+   ty->backlog_changes.gen++;
 
    if (ty->altbuf)
      {
@@ -1348,6 +2092,14 @@ termpty_resize(Termpty *ty, int new_w, int new_h)
    ty->screen2 = calloc(1, sizeof(Termcell) * new_w * new_h);
    if (!ty->screen2)
      goto bad;
+   new_rows = malloc(sizeof(Termcell *) * new_h);
+   new_rows2 = malloc(sizeof(Termcell *) * new_h);
+   if ((!new_rows) || (!new_rows2))
+     goto bad;
+   new_dirty = calloc(1, new_h);
+   new_changed = calloc(new_h, sizeof(unsigned int));
+   if ((!new_dirty) || (!new_changed))
+     goto bad;
 
    new_si.screen = new_screen;
    new_si.w = new_w;
@@ -1358,7 +2110,7 @@ termpty_resize(Termpty *ty, int new_w, int new_h)
    for (old_y = old_h -1; old_y >= 0; old_y--)
      {
         Termcell *cells = &(TERMPTY_SCREEN(ty, 0, old_y));
-        if (!_termpty_line_is_empty(cells, old_w))
+        if (!_termpty_line_is_empty(ty, cells, old_w))
           {
              effective_old_h = old_y + 1;
              break;
@@ -1376,14 +2128,14 @@ termpty_resize(Termpty *ty, int new_w, int new_h)
      {
         Termsave *ts;
         ts = BACKLOG_ROW_GET(ty, 1);
-        ts = termpty_save_extract(ts);
-        if (ts->cells && ts->w && ts->cells[ts->w - 1].att.autowrapped)
+        ts = termpty_save_extract(ty, ts);
+        if (ts && ts->cells && ts->w && ts->cells[ts->w - 1].autowrapped)
           {
              Termcell *cells = &(TERMPTY_SCREEN(ty, 0, old_y)),
                       *new_cells;
              int len;
 
-             len = termpty_line_length(cells, old_w);
+             len = termpty_line_length(ty, cells, old_w);
 
              new_cells = malloc((ts->w + len) * sizeof(Termcell));
              if (!new_cells)
@@ -1409,22 +2161,32 @@ termpty_resize(Termpty *ty, int new_w, int new_h)
         Termcell *cells = &(TERMPTY_SCREEN(ty, 0, old_y));
         int len;
 
-        len = termpty_line_length(cells, old_w);
+        len = termpty_line_length(ty, cells, old_w);
         _termpty_line_rewrap(ty, cells, len, &new_si,
                              old_y == ty->cursor_state.cy);
      }
 
    free(ty->screen);
    ty->screen = new_screen;
+   free(ty->dirty.rows);
+   ty->dirty.rows = new_dirty;
+   free(ty->dirty.changed);
+   ty->dirty.changed = new_changed;
 
    ty->cursor_state.cy = (new_si.cy >= 0) ? new_si.cy : 0;
    ty->cursor_state.cx = (new_si.cx >= 0) ? new_si.cx : 0;
-   ty->circular_offset = new_si.circular_offset;
-   ty->circular_offset2 = 0;
+   termpty_screen_rows_set(new_rows, new_screen, new_w, new_h,
+                           new_si.circular_offset);
+   free(ty->rows);
+   ty->rows = new_rows;
+   termpty_screen_rows_set(new_rows2, ty->screen2, new_w, new_h, 0);
+   free(ty->rows2);
+   ty->rows2 = new_rows2;
 
    ty->w = new_w;
    ty->h = new_h;
    ty->termstate.wrapnext = 0;
+   termpty_screen_dirty_all(ty);
 
    if (altbuf)
      termpty_screen_swap(ty);
@@ -1433,16 +2195,17 @@ termpty_resize(Termpty *ty, int new_w, int new_h)
 
    _pty_size(ty);
 
-   termpty_backlog_unlock();
-
-   ty->backlog_beacon.backlog_y = 0;
-   ty->backlog_beacon.screen_y = 0;
+   termpty_backlog_unlock(ty);
 
    return;
 
 bad:
-   termpty_backlog_unlock();
+   termpty_backlog_unlock(ty);
    free(new_screen);
+   free(new_rows);
+   free(new_rows2);
+   free(new_dirty);
+   free(new_changed);
 }
 
 pid_t
@@ -1459,6 +2222,21 @@ termpty_block_free(Termblock *tb)
    if (!tb)
      return;
 
+   /* Evas is not thread safe */
+   if ((tb->obj) && (tb->pty) && (tb->pty->thread.on) &&
+       (!eina_main_loop_is()))
+     {
+        Termpty *ty = tb->pty;
+
+        ty->block.dead = eina_list_append(ty->block.dead, tb);
+        if (!ty->thread.change)
+          {
+             ty->thread.change = EINA_TRUE;
+             _thread_notify(ty, 'c');
+          }
+        return;
+     }
+
    eina_stringshare_del(tb->path);
    eina_stringshare_del(tb->link);
    eina_stringshare_del(tb->chid);
@@ -1592,24 +2370,78 @@ termpty_handle_block_codepoint_overwrite_heavy(Termpty *ty, int oldc, int newc)
      }
 }
 
+/* Point @rows at the @h rows of @w cells of @screen, the top one being the
+ * row @first in memory */
+void
+termpty_screen_rows_set(Termcell **rows, Termcell *screen, int w, int h,
+                        int first)
+{
+   int y;
+
+   for (y = 0; y < h; y++)
+     rows[y] = screen + (((y + first) % h) * w);
+}
+
+/* Rotate the rows from @start_y to @end_y included by one: up if
+ * @direction is negative, the top row becoming the bottom one, down
+ * otherwise.  No cell is moved */
+void
+termpty_screen_rows_rotate(Termpty *ty, int start_y, int end_y, int direction)
+{
+   Termcell *row;
+   int y;
+
+   if (end_y <= start_y)
+     return;
+   if (direction < 0)
+     {
+        row = ty->rows[start_y];
+        memmove(&ty->rows[start_y], &ty->rows[start_y + 1],
+                sizeof(Termcell *) * (end_y - start_y));
+        ty->rows[end_y] = row;
+     }
+   else
+     {
+        row = ty->rows[end_y];
+        memmove(&ty->rows[start_y + 1], &ty->rows[start_y],
+                sizeof(Termcell *) * (end_y - start_y));
+        ty->rows[start_y] = row;
+     }
+   for (y = start_y; y <= end_y; y++)
+     ty->dirty.rows[(ty->rows[y] - ty->screen) / ty->w] = 1;
+}
+
 void
 termpty_screen_swap(Termpty *ty)
 {
-   Termcell *tmp_screen;
-   int tmp_circular_offset;
+   Termcell *tmp_screen, **tmp_rows;
 
    tmp_screen = ty->screen;
    ty->screen = ty->screen2;
    ty->screen2 = tmp_screen;
 
-   tmp_circular_offset = ty->circular_offset;
-   ty->circular_offset = ty->circular_offset2;
-   ty->circular_offset2 = tmp_circular_offset;
+   tmp_rows = ty->rows;
+   ty->rows = ty->rows2;
+   ty->rows2 = tmp_rows;
 
    ty->altbuf = !ty->altbuf;
+   termpty_screen_dirty_all(ty);
+   ty->link_spans.gen++;
+
+   TERMPTY_CB_CALL(ty, cancel_sel);
+}
+
+void
+termpty_screen_dirty_all(Termpty *ty)
+{
+   ty->dirty.all = 1;
+}
 
-   if (ty->cb.cancel_sel.func)
-     ty->cb.cancel_sel.func(ty->cb.cancel_sel.data);
+void
+termpty_screen_dirty_clear(Termpty *ty)
+{
+   memset(ty->dirty.rows, 0, ty->h);
+   ty->dirty.all = 0;
 }
 
 void
@@ -1617,6 +2449,8 @@ termpty_cells_set_content(Termpty *ty, Termcell *cells,
                           Eina_Unicode codepoint, int count)
 {
    int i;
+
+   termpty_cells_dirty(ty, cells, count);
    for (i = 0; i < count; i++)
      {
         HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, cells[i].codepoint, codepoint);
@@ -1629,29 +2463,39 @@ termpty_cells_att_fill_preserve_colors(Termpty *ty, Termcell *cells,
                                        Eina_Unicode codepoint, int count)
 {
    int i;
-   Termcell local = { .codepoint = codepoint, .att = ty->termstate.att};
+   Eina_Bool preserve = (ty->termstate.att.fg == 0 &&
+                         ty->termstate.att.bg == 0);
+
+   if (!preserve)
+     {
+        termpty_cell_codepoint_att_fill(ty, codepoint, ty->termstate.att,
+                                        cells, count);
+        return;
+     }
 
-   if (EINA_UNLIKELY(local.att.link_id))
-     term_link_refcount_inc(ty, local.att.link_id, count);
+   termpty_cells_dirty(ty, cells, count);
+   if (EINA_UNLIKELY(ty->termstate.att.link_id))
+     term_link_refcount_inc(ty, ty->termstate.att.link_id, count);
 
    for (i = 0; i < count; i++)
      {
-        Termatt att = cells[i].att;
+        const Termatt *old = TERMPTY_CELL_STYLE(ty, cells[i]);
+        Termatt att = ty->termstate.att;
+
         HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, cells[i].codepoint, codepoint);
-        if (EINA_UNLIKELY(cells[i].att.link_id))
-          term_link_refcount_dec(ty, cells[i].att.link_id, 1);
+        if (EINA_UNLIKELY(old->link_id))
+          term_link_refcount_dec(ty, old->link_id, 1);
 
-        cells[i] = local;
-        if (ty->termstate.att.fg == 0 && ty->termstate.att.bg == 0)
-          {
-             cells[i].att.fg = att.fg;
-             cells[i].att.fg256 = att.fg256;
-             cells[i].att.fgintense = att.fgintense;
+        att.fg = old->fg;
+        att.fg256 = old->fg256;
+        att.fgintense = old->fgintense;
 
-             cells[i].att.bg = att.bg;
-             cells[i].att.bg256 = att.bg256;
-             cells[i].att.bgintense = att.bgintense;
-          }
+        att.bg = old->bg;
+        att.bg256 = old->bg256;
+        att.bgintense = old->bgintense;
+
+        cells[i].codepoint = codepoint;
+        termpty_cell_att_set(ty, &cells[i], &att);
      }
 }
 
@@ -1660,152 +2504,398 @@ void
 termpty_cell_codepoint_att_fill(Termpty *ty, Eina_Unicode codepoint,
                                 Termatt att, Termcell *dst, int n)
 {
-   Termcell local = { .codepoint = codepoint, .att = att };
+   Termcell local = { .codepoint = codepoint };
    int i;
 
-   if (EINA_UNLIKELY(local.att.link_id))
-     term_link_refcount_inc(ty, local.att.link_id, n);
+   termpty_cell_att_set(ty, &local, &att);
+   termpty_cells_dirty(ty, dst, n);
+   if (EINA_UNLIKELY(att.link_id))
+     term_link_refcount_inc(ty, att.link_id, n);
 
    for (i = 0; i < n; i++)
      {
         HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, dst[i].codepoint, codepoint);
-        if (EINA_UNLIKELY(dst[i].att.link_id))
-          term_link_refcount_dec(ty, dst[i].att.link_id, 1);
+        if (EINA_UNLIKELY(TERMPTY_CELL_STYLE(ty, dst[i])->link_id))
+          term_link_refcount_dec(ty, TERMPTY_CELL_STYLE(ty, dst[i])->link_id, 1);
 
         dst[i] = local;
      }
 }
 
-/* 0 means error here */
-static uint16_t
-_find_empty_slot(const Termpty *ty)
+/* Styles {{{ */
+
+static uint32_t
+_style_hash(const Termatt *att, uint32_t mask)
+{
+   uint64_t k;
+
+   /* a Termatt is 8 bytes long */
+   memcpy(&k, att, sizeof(k));
+   k *= 0x9e3779b97f4a7c15ULL;
+   return (uint32_t)(k >> 32) & mask;
+}
+
+static void
+_style_slot_insert(Termpty *ty, uint16_t style)
+{
+   uint32_t mask = ty->styles.slots_size - 1;
+   uint32_t h = _style_hash(&ty->styles.atts[style], mask);
+
+   while (ty->styles.slots[h])
+     h = (h + 1) & mask;
+   ty->styles.slots[h] = style + 1;
+}
+
+static Eina_Bool
+_styles_rehash(Termpty *ty, uint32_t slots_size)
+{
+   uint32_t *slots = calloc(slots_size, sizeof(uint32_t));
+   uint32_t i;
+
+   if (!slots)
+     return EINA_FALSE;
+   free(ty->styles.slots);
+   ty->styles.slots = slots;
+   ty->styles.slots_size = slots_size;
+   for (i = 0; i < ty->styles.count; i++)
+     _style_slot_insert(ty, i);
+   return EINA_TRUE;
+}
+
+static void
+_styles_cells_mark(uint16_t *map, const Termcell *cells, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; i++)
+     map[cells[i].style] = 1;
+}
+
+static void
+_styles_cells_remap(const uint16_t *map, Termcell *cells, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; i++)
+     cells[i].style = map[cells[i].style];
+}
+
+/* Drop the styles no cell uses anymore and renumber the other ones.
+ * Compressed backlog lines hold attributes, not styles, and are left as is */
+static void
+_styles_collect(Termpty *ty)
 {
-   int pos;
-   int max_pos = HL_LINKS_MAX / 8;
+   uint16_t *map;
+   size_t n = ty->w * ty->h, i;
+   uint32_t count = 0;
+
+   map = calloc(STYLES_MAX, sizeof(uint16_t));
+   if (!map)
+     return;
+   map[0] = 1;
+   _styles_cells_mark(map, ty->screen, n);
+   _styles_cells_mark(map, ty->screen2, n);
+   for (i = 0; i < ty->backsize; i++)
+     {
+        Termsave *ts = &ty->back[i];
+
+        if ((ts->cells) && (!ts->comp))
+          _styles_cells_mark(map, ts->cells, ts->w);
+     }
 
-   for (pos = 0; pos < max_pos && ty->hl.bitmap[pos] == 0xff; pos++)
+   for (i = 0; i < ty->styles.count; i++)
      {
+        if (!map[i])
+          continue;
+        ty->styles.atts[count] = ty->styles.atts[i];
+        map[i] = count++;
      }
+   DBG("styles: %u collected, %u left", ty->styles.count - count, count);
+   ty->styles.count = count;
+   ty->styles.last = 0;
+   ty->styles.gen++;
 
-   if (pos <= max_pos)
+   _styles_cells_remap(map, ty->screen, n);
+   _styles_cells_remap(map, ty->screen2, n);
+   for (i = 0; i < ty->backsize; i++)
      {
-        int bit;
-        for (bit = 0; bit < 8; bit++)
-          {
-             if (!(ty->hl.bitmap[pos] & (1<<bit)))
-               {
-                  return pos * 8 + bit;
-               }
-          }
+        Termsave *ts = &ty->back[i];
+
+        if ((ts->cells) && (!ts->comp))
+          _styles_cells_remap(map, ts->cells, ts->w);
      }
-   return 0;
+   free(map);
+   _styles_rehash(ty, ty->styles.slots_size);
 }
 
-static void
-hl_bitmap_set_bit(Termpty *ty, uint16_t id)
+Eina_Bool
+termpty_styles_init(Termpty *ty)
 {
-   uint8_t *pos = &ty->hl.bitmap[id / 8];
-   uint8_t bit = 1 << (id % 8);
+   ty->styles.size = 64;
+   ty->styles.atts = calloc(ty->styles.size, sizeof(Termatt));
+   if (!ty->styles.atts)
+     return EINA_FALSE;
+   /* style 0 is the default attributes, all zeros */
+   ty->styles.count = 1;
+   ty->styles.last = 0;
+   return _styles_rehash(ty, 2 * ty->styles.size);
+}
 
-   *pos |= bit;
+void
+termpty_styles_shutdown(Termpty *ty)
+{
+   free(ty->styles.atts);
+   ty->styles.atts = NULL;
+   free(ty->styles.slots);
+   ty->styles.slots = NULL;
+   ty->styles.count = ty->styles.size = ty->styles.slots_size = 0;
 }
 
-static void
-hl_bitmap_clear_bit(Termpty *ty, uint16_t id)
+/* Returns the style of @att, ignoring its per-cell bits. When there is no
+ * room for a new style, unused ones are collected, renumbering the styles
+ * of the cells */
+uint16_t
+termpty_style_intern(Termpty *ty, const Termatt *att)
 {
-   uint8_t *pos = &ty->hl.bitmap[id / 8];
-   uint8_t bit = 1 << (id % 8);
+   Termatt style = *att;
+   uint32_t mask, h, slot;
+
+   style.dblwidth = 0;
+   style.autowrapped = 0;
+   style.newline = 0;
+   style.tab_inserted = 0;
+   style.tab_last = 0;
+   style.bit_padding = 0;
+
+   if (!memcmp(&style, &ty->styles.atts[ty->styles.last], sizeof(Termatt)))
+     return ty->styles.last;
+
+   mask = ty->styles.slots_size - 1;
+   h = _style_hash(&style, mask);
+   while ((slot = ty->styles.slots[h]))
+     {
+        if (!memcmp(&style, &ty->styles.atts[slot - 1], sizeof(Termatt)))
+          {
+             ty->styles.last = slot - 1;
+             return ty->styles.last;
+          }
+        h = (h + 1) & mask;
+     }
+
+   if (ty->styles.count == STYLES_MAX)
+     {
+        _styles_collect(ty);
+        if (ty->styles.count == STYLES_MAX)
+          {
+             ERR("no room for a new style");
+             return 0;
+          }
+     }
+   if (ty->styles.count == ty->styles.size)
+     {
+        Termatt *atts = realloc(ty->styles.atts,
+                                2 * ty->styles.size * sizeof(Termatt));
+
+        if (!atts)
+          return 0;
+        ty->styles.atts = atts;
+        ty->styles.size *= 2;
+     }
+   if ((2 * (ty->styles.count + 1) > ty->styles.slots_size) &&
+       (!_styles_rehash(ty, 2 * ty->styles.slots_size)))
+     return 0;
 
-   *pos &= ~bit;
+   ty->styles.atts[ty->styles.count] = style;
+   _style_slot_insert(ty, ty->styles.count);
+   ty->styles.last = ty->styles.count++;
+   return ty->styles.last;
 }
+/* }}} */
 
-Term_Link *
-term_link_new(Termpty *ty)
+/* Hyperlinks {{{ */
+
+static uint32_t
+_link_hash(const char *key, const char *url)
+{
+   uint32_t h = 2166136261u;
+   const unsigned char *p;
+
+   for (p = (const unsigned char *)key; *p; p++)
+     h = (h ^ *p) * 16777619u;
+   h = (h ^ ';') * 16777619u;
+   for (p = (const unsigned char *)url; *p; p++)
+     h = (h ^ *p) * 16777619u;
+   return h & (HL_BUCKETS - 1);
+}
+
+/* 0 means error here */
+static uint16_t
+_link_id_new(Termpty *ty)
 {
    uint16_t id;
-   Term_Link *link;
 
-   /* 1st/ Find empty slot in bitmap */
-   id = _find_empty_slot(ty);
-   if (!id)
+   if (ty->hl.free)
      {
-        ERR("hyper links: can't find empty slot");
-        return NULL;
+        id = ty->hl.free;
+        ty->hl.free = ty->hl.links[id].next;
+        return id;
      }
-
-   /* 2nd/ Do we need to realloc? */
-   if (id >= ty->hl.size)
+   if (ty->hl.fresh >= HL_LINKS_MAX)
+     return 0;
+   if (ty->hl.fresh >= ty->hl.size)
      {
         Term_Link *links;
-        uint16_t old_size = ty->hl.size;
+        uint32_t old_size = ty->hl.size;
 
         if (!ty->hl.size)
           ty->hl.size = 256;
         links = realloc(ty->hl.links,
                         ty->hl.size * 2 * sizeof(Term_Link));
         if (!links)
-          return NULL;
+          {
+             ty->hl.size = old_size;
+             return 0;
+          }
         ty->hl.size *= 2;
         ty->hl.links = links;
         memset(ty->hl.links + old_size,
                0,
                (ty->hl.size - old_size) * sizeof(Term_Link));
      }
+   return ty->hl.fresh++;
+}
+
+/* Returns the live link with @key and @url if there is one, a new one
+ * otherwise.  Links without a key are only shared with the last one handed
+ * out.  Takes ownership of @key and @url */
+Term_Link *
+term_link_new(Termpty *ty, const char *key, const char *url)
+{
+   Term_Link *link;
+   uint32_t bucket = 0;
+   uint16_t id;
+
+   if (key)
+     {
+        bucket = _link_hash(key, url);
+        for (id = ty->hl.buckets[bucket]; id; id = link->next)
+          {
+             link = ty->hl.links + id;
+             if ((!strcmp(link->key, key)) && (!strcmp(link->url, url)))
+               goto found;
+          }
+     }
+   else if (ty->hl.last)
+     {
+        id = ty->hl.last;
+        link = ty->hl.links + id;
+        if ((link->url) && (!link->key) && (!strcmp(link->url, url)))
+          goto found;
+     }
 
+   id = _link_id_new(ty);
+   if (!id)
+     {
+        ERR("hyper links: can't find empty slot");
+        eina_stringshare_del(key);
+        eina_stringshare_del(url);
+        return NULL;
+     }
    link = ty->hl.links + id;
-   link->key = NULL;
-   link->url = NULL;
+   link->key = key;
+   link->url = url;
    link->refcount = 0;
+   link->next = 0;
+   if (key)
+     {
+        link->next = ty->hl.buckets[bucket];
+        ty->hl.buckets[bucket] = id;
+     }
+   ty->hl.last = id;
+   return link;
 
-   /* Mark in bitmap */
-   hl_bitmap_set_bit(ty, id);
-
+found:
+   eina_stringshare_del(key);
+   eina_stringshare_del(url);
+   ty->hl.last = id;
    return link;
 }
 
 void
 term_link_free(Termpty *ty, Term_Link *link)
 {
-   if (!link || !ty)
+   if (!link || !ty || !link->url)
      return;
    uint16_t id = (link - ty->hl.links);
 
+   if (link->key)
+     {
+        uint16_t *prev = &ty->hl.buckets[_link_hash(link->key, link->url)];
+
+        while (*prev != id)
+          prev = &ty->hl.links[*prev].next;
+        *prev = link->next;
+     }
    eina_stringshare_del(link->key);
    link->key = NULL;
    eina_stringshare_del(link->url);
    link->url = NULL;
+   link->refcount = 0;
 
-   /* Remove from bitmap */
-   hl_bitmap_clear_bit(ty, id);
+   link->next = ty->hl.free;
+   ty->hl.free = id;
+   if (ty->hl.last == id)
+     ty->hl.last = 0;
 }
+/* }}} */
+
 #if !defined(ENABLE_FUZZING) && !defined(ENABLE_TESTS)
-int
-termpty_color_class_get(Termpty *ty, const char *key,
-                        int *r, int *g, int *b, int *a)
+struct _Color_Class_Get {
+   Termpty *ty;
+   const char *key;
+   int *r, *g, *b, *a;
+   int ret;
+};
+
+static void
+_color_class_get_cb(void *data)
 {
+   struct _Color_Class_Get *ccg = data;
    Term *term;
 
-   term = termio_term_get(ty->obj);
+   term = termio_term_get(ccg->ty->obj);
    if (term)
      {
         Evas_Object *bg = term_bg_get(term);
-        if (!edje_object_color_class_get(bg, key,
-                                         r,
-                                         g,
-                                         b,
-                                         a,
+        if (!edje_object_color_class_get(bg, ccg->key,
+                                         ccg->r,
+                                         ccg->g,
+                                         ccg->b,
+                                         ccg->a,
                                          NULL, NULL, NULL, NULL,
                                          NULL, NULL, NULL, NULL))
           {
              ERR("color class BG not found in theme");
-             return -1;
+             ccg->ret = -1;
+             return;
           }
      }
    else
      {
         ERR("term not found");
-        return -1;
+        ccg->ret = -1;
+        return;
      }
-   return 0;
+   ccg->ret = 0;
+}
+
+int
+termpty_color_class_get(Termpty *ty, const char *key,
+                        int *r, int *g, int *b, int *a)
+{
+   struct _Color_Class_Get ccg = { ty, key, r, g, b, a, -1 };
+
+   termpty_main_loop_call(ty, _color_class_get_cb, &ccg);
+   return ccg.ret;
 }
 #endif
@@ -9,10 +9,13 @@ typedef struct _Termcell      Termcell;
 typedef struct _Termatt       Termatt;
 typedef struct _Termsave      Termsave;
 typedef struct _Termsavecomp  Termsavecomp;
+typedef struct _Backlog_Slab  Backlog_Slab;
+typedef struct _Truecolor_Lut Truecolor_Lut;
 typedef struct _Termblock     Termblock;
 typedef struct _Termexp       Termexp;
 typedef struct _Termpty       Termpty;
 typedef struct _Termlink      Term_Link;
+typedef struct _Term_Link_Span Term_Link_Span;
 typedef struct _TitleIconElem TitleIconElem;
 
 #define COL_DEF        0
@@ -48,12 +51,26 @@ typedef struct _TitleIconElem TitleIconElem;
 #define MOVIE_STATE_STOP   2
 
 #define HL_LINKS_MAX  (1 << 16)
+#define HL_BUCKETS    (1 << 12)
+#define STYLES_MAX    (1 << 16)
+#define LINK_SPAN_ROWS 64
+#define BACKLOG_LRU_SIZE 128
 
 struct _Termlink
 {
     const char *key;
     const char *url;
     unsigned int refcount;
+    uint16_t next; /* next free id, or next link with a key in the bucket */
+};
+
+/* What termio_link_find() gives when looking from cells @from to @to of a
+ * row.  @y1 and @y2 are relative to that row */
+struct _Term_Link_Span
+{
+   int from, to;
+   int x1, y1, x2, y2;
+   char *str; /* NULL if there is no link there */
 };
 
 
@@ -94,11 +111,6 @@ struct _Termatt
    uint16_t       link_id;
 };
 
-typedef struct _Backlog_Beacon{
-    int screen_y;
-    int backlog_y;
-} Backlog_Beacon;
-
 typedef struct _Term_State {
     Termatt       att;
     unsigned char charset;
@@ -154,19 +166,56 @@ struct _Termpty
    } prop;
    const char *cur_cmd;
    Termcell *screen, *screen2;
+   /* row Y of @screen starts at rows[Y], and likewise for @screen2.
+    * Scrolling moves those pointers rather than the cells */
+   Termcell **rows, **rows2;
    unsigned int *tabs;
-   int circular_offset;
-   int circular_offset2;
+   /* incomplete sequence waiting for more input */
    Eina_Unicode *buf;
-   size_t buflen;
+   size_t buflen, bufsize;
    Eina_Unicode last_char;
    Eina_Bool buf_have_zero;
    unsigned char oldbuf[4];
+   /* how much to read from the pty at once, see _read_budget_update() */
+   struct {
+      double input_time; /* when the user last sent some input */
+      double input_written; /* the last input_time logged as written */
+      unsigned int budget; /* number of reads allowed per wakeup */
+      Eina_Bool flood; /* the last wakeup could not read everything */
+   } read;
    Termsave *back;
    size_t backsize, backpos;
-   /* this beacon in the backlog tells about the top line in screen
-    * coordinates that maps to a line in the backlog */
-   Backlog_Beacon backlog_beacon;
+   /* Fenwick tree over the number of screen lines each backlog entry
+    * takes once wrapped, in ring order from the most recent entry.  It is
+    * only built once walking the entries would cost more, see backlog.c */
+   struct {
+      unsigned int *tree;
+      int w; /* screen width the tree was computed for, 0 if invalid */
+      size_t walked; /* entries walked at width @walk_w */
+      int walk_w;
+      /* number of entries per width, to get the number of lines at any
+       * width without looking at the entries: up to BACKLOG_HIST_MAX in
+       * @hist, the wider ones in @wide */
+      unsigned int *hist;
+      Eina_Hash *wide;
+      size_t total; /* number of lines at width @total_w */
+      int total_w; /* 0 if @total is invalid */
+   } backlog_index;
+   struct {
+      size_t pos; /* next backlog entry the compactor looks at */
+      size_t clean; /* entries looked at with nothing to compress */
+      /* entries of @back decompressed to be used, most recently used
+       * first, that the compactor leaves alone */
+      size_t lru[BACKLOG_LRU_SIZE];
+      unsigned int lru_n;
+   } backlog_compact;
+   /* what changed in the backlog, for its views to only draw that, see
+    * miniview.c */
+   struct {
+      unsigned int lines; /* lines added at the bottom, at the width w */
+      unsigned int gen; /* bumped when lines already there changed */
+   } backlog_changes;
+   Backlog_Slab *backlog_slab; /* where the backlog lines are stored */
    int w, h;
    int fd, slavefd;
    struct ty_sb write_buffer;
@@ -176,6 +225,8 @@ struct _Termpty
       Eina_Hash *chid_map;
       Eina_List *active;
       Eina_List *expecting;
+      /* freed by the worker thread, to delete from the main loop */
+      Eina_List *dead;
       unsigned char on : 1;
    } block;
    struct {
@@ -184,7 +235,8 @@ struct _Termpty
       struct {
          int x, y;
       } start, end, orig;
-      Eina_Unicode *codepoints;
+      uint32_t *row_hashes; /* of the text of each row, see termiointernals.c */
+      int row_hashes_count;
       time_t last_click;
       unsigned char is_box    : 1;
       unsigned char is_active : 1; // there is a visible selection
@@ -205,36 +257,116 @@ struct _Termpty
    unsigned int decoding_error : 1;
    struct {
        Term_Link *links;
-       uint8_t *bitmap;
+       /* first id of the links with a key, by hash of their key and url */
+       uint16_t *buckets;
        uint32_t size;
+       uint32_t fresh; /* ids from this one on were never handed out */
+       uint16_t free; /* first id given back, 0 if none */
+       uint16_t last; /* link handed out last */
    } hl;
+   /* links found in the text, by row, see termiolink.c */
+   struct {
+      struct {
+         Term_Link_Span *spans; /* sorted, not overlapping */
+         unsigned int row; /* backlog_changes.lines + y of the row */
+         unsigned int first, last; /* rows the text was read from */
+         unsigned int lines; /* backlog_changes.lines when first looked */
+         unsigned int n, size;
+         unsigned int gen, backlog_gen, stamp;
+      } rows[LINK_SPAN_ROWS];
+      /* stamps of the last rows of the screen saved to the backlog */
+      struct {
+         unsigned int row, stamp;
+      } saved[LINK_SPAN_ROWS];
+      unsigned int gen; /* bumped whenever all the text may have changed */
+      unsigned int stamp; /* bumped whenever links are looked for */
+   } link_spans;
+   struct {
+      /* interned attributes of the cells, without the per-cell bits
+       * (dblwidth, autowrapped, newline, tab_inserted, tab_last).
+       * Style 0 is the default one */
+      Termatt *atts;
+      uint32_t *slots; /* open addressing table of style ids + 1 */
+      uint32_t count, size, slots_size;
+      uint32_t gen; /* bumped whenever the styles get renumbered */
+      uint16_t last; /* last interned style */
+   } styles;
+   struct {
+      /* one flag per row of @screen, in memory order (not in the order of
+       * @rows), cleared by the renderer once it has been drawn */
+      unsigned char *rows;
+      /* per row of @screen, in memory order, link_spans.stamp when its text
+       * last changed */
+      unsigned int *changed;
+      unsigned int gen; /* bumped whenever text comes in */
+      unsigned char all : 1;
+   } dirty;
+   /* true color approximations, see termptyesc.c */
+   Truecolor_Lut *truecolor_lut;
+   /* scrolls termio has not been told about yet, in order, each run
+    * being @n times the same scroll, see termpty_scroll_notify() */
+   struct {
+      struct {
+         int n, direction, start_y, end_y;
+      } *runs;
+      unsigned int n, size;
+   } scrolls;
+   struct {
+      /* With config->threaded_pty, the pty is read and parsed from a
+       * worker thread.  The whole Termpty is then protected by @lock, see
+       * termpty_backlog_lock() */
+      Eina_Thread id;
+      Eina_Lock lock; /* recursive */
+      Ecore_Pipe *pipe; /* from the worker to the main loop */
+      int wake[2]; /* from the main loop to the worker */
+      /* the fields below are protected by @sync_lock */
+      Eina_Lock sync_lock;
+      Eina_Condition cond;
+      struct {
+         void (*func) (void *data);
+         void *data;
+      } call; /* to run from the main loop on behalf of the worker */
+      Eina_Bool call_done;
+      Eina_Bool quit;
+      Eina_Bool drain; /* the child exited, read what is left */
+      /* the fields below are protected by @lock */
+      int depth; /* times @lock is held by its holder */
+      Eina_Bool change; /* a change notification is pending */
+      Eina_Bool write; /* a write notification is pending */
+      /* the fields below are only used from the main loop */
+      Eina_Bool on;
+      Eina_Bool running;
+   } thread;
    TitleIconElem *title_icon_stack;
 };
 
 struct _Termcell
 {
    Eina_Unicode   codepoint;
-   Termatt        att;
+   uint16_t       style; // index in the styles of the Termpty
+   uint16_t       dblwidth : 1;
+   uint16_t       autowrapped : 1;
+   uint16_t       newline : 1;
+   uint16_t       tab_inserted : 1;
+   uint16_t       tab_last : 1;
+   uint16_t       bit_padding : 11;
 };
 
 struct _Termsave
 {
-   unsigned int   gen  : 8;
-   unsigned int   comp : 1;
-   unsigned int   z    : 1;
-   unsigned int   w    : 22;
-   /* TODO: union ? */
+   unsigned int   gen  : 8; // compactor generation it was last used at
+   unsigned int   comp : 1; // @cells is a Termsavecomp
+   unsigned int   lru  : 1; // in backlog_compact.lru
+   unsigned int   w    : 22; // width in Termcells
    Termcell       *cells;
 };
 
-/* TODO: RESIZE rewrite Termsavecomp */
+/* A compressed backlog line: this header followed by runs of cells sharing
+ * the same attributes, each made of the Termatt, the number of cells as a
+ * varint and the codepoints of these cells as varints */
 struct _Termsavecomp
 {
-   unsigned int   gen  : 8;
-   unsigned int   comp : 1;
-   unsigned int   z    : 1;
-   unsigned int   w    : 22; // compressed size in bytes
-   unsigned int   wout; // output width in Termcells
+   unsigned int   size; // size of the runs, in bytes
 };
 
 struct _Termblock
@@ -296,16 +428,31 @@ void       termpty_block_chid_update(Termpty *ty, Termblock *blk);
 Termblock *termpty_block_chid_get(const Termpty *ty, const char *chid);
 
 void       termpty_cell_codepoint_att_fill(Termpty *ty, Eina_Unicode codepoint, Termatt att, Termcell *dst, int n);
+Eina_Bool  termpty_styles_init(Termpty *ty);
+void       termpty_styles_shutdown(Termpty *ty);
+uint16_t   termpty_style_intern(Termpty *ty, const Termatt *att);
 void       termpty_cells_set_content(Termpty *ty, Termcell *cells,
                           Eina_Unicode codepoint, int count);
 void       termpty_screen_swap(Termpty *ty);
+void       termpty_screen_rows_set(Termcell **rows, Termcell *screen,
+                                   int w, int h, int first);
+void       termpty_screen_rows_rotate(Termpty *ty, int start_y, int end_y,
+                                      int direction);
+void       termpty_screen_dirty_all(Termpty *ty);
+void       termpty_screen_dirty_clear(Termpty *ty);
 
-ssize_t termpty_line_length(const Termcell *cells, ssize_t nb_cells);
+ssize_t termpty_line_length(const Termpty *ty, const Termcell *cells,
+                            ssize_t nb_cells);
 
 void termpty_handle_buf(Termpty *ty, const Eina_Unicode *codepoints, int len);
+void termpty_main_loop_call(Termpty *ty, void (*func) (void *data), void *data);
+void termpty_input_notify(Termpty *ty);
+Eina_Bool termpty_flood_get(const Termpty *ty);
+void termpty_scroll_notify(Termpty *ty, int direction, int start_y, int end_y);
+void termpty_truecolor_lut_free(Termpty *ty);
 void termpty_handle_block_codepoint_overwrite_heavy(Termpty *ty, int oldc, int newc);
 
-Term_Link * term_link_new(Termpty *ty);
+Term_Link * term_link_new(Termpty *ty, const char *key, const char *url);
 void term_link_free(Termpty *ty, Term_Link *link);
 
 int
@@ -315,7 +462,7 @@ termpty_color_class_get(Termpty *ty, const char *key,
 extern int _termpty_log_dom;
 
 #define TERMPTY_SCREEN(Tpty, X, Y) \
-  Tpty->screen[X + (((Y + Tpty->circular_offset) % Tpty->h) * Tpty->w)]
+  Tpty->rows[Y][X]
 
 #define TERMPTY_RESTRICT_FIELD(Field, Min, Max) \
    do {                                         \
@@ -325,6 +472,14 @@ extern int _termpty_log_dom;
      Field = Min;                               \
    } while (0)
 
+/* Callbacks touch the UI, so they are run from the main loop */
+#define TERMPTY_CB_CALL(Tpty, Name)                                          \
+do {                                                                         \
+   if ((Tpty)->cb.Name.func)                                                 \
+     termpty_main_loop_call(Tpty, (Tpty)->cb.Name.func,                      \
+                            (Tpty)->cb.Name.data);                           \
+} while (0)
+
 /* Try to trick the compiler into inlining the first test */
 #define HANDLE_BLOCK_CODEPOINT_OVERWRITE(Tpty, OLDC, NEWC)                   \
 do {                                                                         \
@@ -336,20 +491,85 @@ do {                                                                         \
 do {                                                                         \
    int __i;                                                                  \
                                                                              \
+   termpty_cells_dirty(Tpty, Tdst, N);                                       \
    for (__i = 0; __i < N; __i++)                                             \
      {                                                                       \
         HANDLE_BLOCK_CODEPOINT_OVERWRITE(Tpty,                               \
                                          (Tdst)[__i].codepoint,              \
                                          (Tsrc)[__i].codepoint);             \
-        if (EINA_UNLIKELY((Tdst)[__i].att.link_id))                          \
-          term_link_refcount_dec(ty, (Tdst)[__i].att.link_id, 1);            \
-        if (EINA_UNLIKELY((Tsrc)[__i].att.link_id))                          \
-          term_link_refcount_inc(ty, (Tsrc)[__i].att.link_id, 1);            \
+        if (EINA_UNLIKELY(TERMPTY_CELL_STYLE(Tpty, (Tdst)[__i])->link_id))   \
+          term_link_refcount_dec(Tpty,                                       \
+                   TERMPTY_CELL_STYLE(Tpty, (Tdst)[__i])->link_id, 1);       \
+        if (EINA_UNLIKELY(TERMPTY_CELL_STYLE(Tpty, (Tsrc)[__i])->link_id))   \
+          term_link_refcount_inc(Tpty,                                       \
+                   TERMPTY_CELL_STYLE(Tpty, (Tsrc)[__i])->link_id, 1);       \
      }                                                                       \
    memcpy(Tdst, Tsrc, N * sizeof(Termcell));                                 \
 } while (0)
 
 
+/* Mark the rows of the screen covered by @cells as needing a redraw.
+ * Cells that are not part of the current screen (backlog, alternate screen)
+ * are ignored */
+static inline void
+termpty_cells_dirty(Termpty *ty, const Termcell *cells, int n)
+{
+   int y, y_end;
+
+   if ((n <= 0) || (cells < ty->screen) ||
+       (cells >= ty->screen + (ty->w * ty->h)))
+     return;
+   y = (cells - ty->screen) / ty->w;
+   y_end = (cells + n - 1 - ty->screen) / ty->w;
+   if (y_end >= ty->h)
+     y_end = ty->h - 1;
+   for (; y <= y_end; y++)
+     {
+        ty->dirty.rows[y] = 1;
+        ty->dirty.changed[y] = ty->link_spans.stamp;
+     }
+}
+
+/* Whether row @y of the screen needs a redraw */
+static inline Eina_Bool
+termpty_row_is_dirty(const Termpty *ty, int y)
+{
+   return ty->dirty.rows[(ty->rows[y] - ty->screen) / ty->w];
+}
+
+/* Attributes shared by the cells of style @style. Per-cell bits are 0.
+ * The pointer is only valid until the next call to termpty_style_intern() */
+static inline const Termatt *
+termpty_style_get(const Termpty *ty, uint16_t style)
+{
+   return &ty->styles.atts[style];
+}
+
+#define TERMPTY_CELL_STYLE(Tpty, Cell) termpty_style_get(Tpty, (Cell).style)
+
+static inline void
+termpty_cell_att_get(const Termpty *ty, const Termcell *cell, Termatt *att)
+{
+   *att = ty->styles.atts[cell->style];
+   att->dblwidth = cell->dblwidth;
+   att->autowrapped = cell->autowrapped;
+   att->newline = cell->newline;
+   att->tab_inserted = cell->tab_inserted;
+   att->tab_last = cell->tab_last;
+}
+
+/* Does not change the refcount of the links */
+static inline void
+termpty_cell_att_set(Termpty *ty, Termcell *cell, const Termatt *att)
+{
+   cell->style = termpty_style_intern(ty, att);
+   cell->dblwidth = att->dblwidth;
+   cell->autowrapped = att->autowrapped;
+   cell->newline = att->newline;
+   cell->tab_inserted = att->tab_inserted;
+   cell->tab_last = att->tab_last;
+}
+
 static inline void
 term_link_refcount_inc(Termpty *ty, uint16_t link_id, uint16_t count)
 {
@@ -366,10 +586,23 @@ term_link_refcount_dec(Termpty *ty, uint16_t link_id, uint16_t count)
 
    link = &ty->hl.links[link_id];
    link->refcount -= count;
-   if (EINA_UNLIKELY(link->refcount == 0))
+   /* the link being written keeps living until it is closed */
+   if (EINA_UNLIKELY(link->refcount == 0) &&
+       (link_id != ty->termstate.att.link_id))
      term_link_free(ty, link);
 }
 
+/* Stop writing with the current link, forgetting it if no cell uses it */
+static inline void
+term_link_close(Termpty *ty)
+{
+   uint16_t link_id = ty->termstate.att.link_id;
+
+   ty->termstate.att.link_id = 0;
+   if ((link_id) && (ty->hl.links[link_id].refcount == 0))
+     term_link_free(ty, &ty->hl.links[link_id]);
+}
+
 static inline Eina_Bool
 term_link_eq(Termpty *ty, Term_Link *hl, uint16_t link_id)
 {
@@ -394,26 +627,27 @@ termpty_cell_fill(Termpty *ty, Termcell *src, Termcell *dst, int n)
 {
    int i;
 
+   termpty_cells_dirty(ty, dst, n);
    if (src)
      {
         for (i = 0; i < n; i++)
           {
              HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, dst[i].codepoint, src[0].codepoint);
-             if (EINA_UNLIKELY(dst[i].att.link_id))
-               term_link_refcount_dec(ty, dst[i].att.link_id, 1);
+             if (EINA_UNLIKELY(TERMPTY_CELL_STYLE(ty, dst[i])->link_id))
+               term_link_refcount_dec(ty, TERMPTY_CELL_STYLE(ty, dst[i])->link_id, 1);
 
              dst[i] = src[0];
           }
-        if (src[0].att.link_id)
-          term_link_refcount_inc(ty, src[0].att.link_id, n);
+        if (TERMPTY_CELL_STYLE(ty, src[0])->link_id)
+          term_link_refcount_inc(ty, TERMPTY_CELL_STYLE(ty, src[0])->link_id, n);
      }
    else
      {
         for (i = 0; i < n; i++)
           {
              HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, dst[i].codepoint, 0);
-             if (EINA_UNLIKELY(dst[i].att.link_id))
-               term_link_refcount_dec(ty, dst[i].att.link_id, 1);
+             if (EINA_UNLIKELY(TERMPTY_CELL_STYLE(ty, dst[i])->link_id))
+               term_link_refcount_dec(ty, TERMPTY_CELL_STYLE(ty, dst[i])->link_id, 1);
 
              memset(&(dst[i]), 0, sizeof(*dst));
           }
@@ -1,25 +1,56 @@
 #ifndef _TERMPTY_DBL_H__
 #define _TERMPTY_DBL_H__ 1
 
-Eina_Bool _termpty_is_dblwidth_slow_get(const Termpty *ty, int g);
+/* Properties of the codepoints, looked up in the tables generated by
+ * tools/gen_unicode_width.py from the Unicode Character Database */
+#define TERMPTY_CP_SHIFT      8
+#define TERMPTY_CP_WIDTH_MASK 3
+#define TERMPTY_CP_WIDE       1 /* East Asian Wide (W) or Fullwidth (F) */
+#define TERMPTY_CP_AMBIGUOUS  2 /* East Asian Ambiguous (A) */
+#define TERMPTY_CP_EMOJI      3 /* Emoji_Presentation */
+#define TERMPTY_CP_ZERO_WIDTH 4 /* zero width spaces, LTR/RTL marks */
+#define TERMPTY_CP_COMBINING  8 /* diacritics of 0300..036f, variation
+                                   selectors */
+
+extern const unsigned char _termpty_cp_blocks[];
+extern const unsigned char _termpty_cp_props[];
+
+static inline unsigned char
+_termpty_cp_props_get(Eina_Unicode g)
+{
+   unsigned int i;
+
+   if (EINA_UNLIKELY(g >= 0x110000))
+     return 0;
+   i = ((unsigned int)_termpty_cp_blocks[g >> TERMPTY_CP_SHIFT]
+        << TERMPTY_CP_SHIFT) | (g & ((1 << TERMPTY_CP_SHIFT) - 1));
+   return (_termpty_cp_props[i >> 1] >> ((i & 1) << 2)) & 0xf;
+}
 
 static inline Eina_Bool
-_termpty_is_dblwidth_get(const Termpty *ty, int g)
+_termpty_cp_props_dblwidth_get(const Termpty *ty, unsigned char props)
 {
-   // check for east asian full-width (F), half-width (H), wide (W),
-   // narrow (Na) or ambiguous (A) codepoints
-   // ftp://ftp.unicode.org/Public/UNIDATA/EastAsianWidth.txt
+   switch (props & TERMPTY_CP_WIDTH_MASK)
+     {
+      case TERMPTY_CP_WIDE:
+         return EINA_TRUE;
+      case TERMPTY_CP_AMBIGUOUS:
+         return ty->termstate.cjk_ambiguous_wide;
+      case TERMPTY_CP_EMOJI:
+         // emoji should be double since unicode 9 (was single before)
+         return ty->config->emoji_dbl_width;
+      default:
+         return EINA_FALSE;
+     }
+}
 
+static inline Eina_Bool
+_termpty_is_dblwidth_get(const Termpty *ty, int g)
+{
    // optimize for latin1 non-ambiguous
    if (g <= 0xa0)
      return EINA_FALSE;
-   // (F)
-   if ((g == 0x3000) ||
-       ((g >= 0xff01) && (g <= 0xff60)) ||
-       ((g >= 0xffe0) && (g <= 0xffe6)))
-     return EINA_TRUE;
-
-   return _termpty_is_dblwidth_slow_get(ty, g);
+   return _termpty_cp_props_dblwidth_get(ty, _termpty_cp_props_get(g));
 }
 
 #endif
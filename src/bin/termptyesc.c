@@ -214,7 +214,7 @@ _handle_cursor_control(Termpty *ty, const Eina_Unicode *cc)
      {
       case 0x07: // BEL '\a' (bell)
         DBG("->BEL");
-         if (ty->cb.bell.func) ty->cb.bell.func(ty->cb.bell.data);
+         TERMPTY_CB_CALL(ty, bell);
          return;
       case 0x08: // BS  '\b' (backspace)
          DBG("->BS");
@@ -225,10 +225,12 @@ _handle_cursor_control(Termpty *ty, const Eina_Unicode *cc)
       case 0x09: // HT  '\t' (horizontal tab)
          DBG("->HT");
          cell = &(TERMPTY_SCREEN(ty, ty->cursor_state.cx, ty->cursor_state.cy));
-         cell->att.tab_inserted = 1;
+         cell->tab_inserted = 1;
+         termpty_cells_dirty(ty, cell, 1);
          _tab_forward(ty, 1);
          cell = &(TERMPTY_SCREEN(ty, ty->cursor_state.cx -1, ty->cursor_state.cy));
-         cell->att.tab_last = 1;
+         cell->tab_last = 1;
+         termpty_cells_dirty(ty, cell, 1);
          return;
       case 0x0a: // LF  '\n' (new line)
       case 0x0b: // VT  '\v' (vertical tab)
@@ -654,70 +656,189 @@ _csi_truecolor_arg_get(Termpty *ty, Eina_Unicode **ptr)
    return sum;
 }
 
-#if !defined(ENABLE_FUZZING)
-/*********************************
- * cache true color approximations
- *********************************
- * Approximating true colors is costly since it needs to compare 256 colors.
- * The following considers that a few colors are used a lot.  For example, one
- * can consider that a text editor with syntax highlighting would only use a
- * small palette.
- * Given that, using the cache needs to be efficient: it needs to speed up the
- * approximation when the color is already in the cache but not knowing the
- * color requested is not in the cache needs to be efficient too.
- *
- * The cache is an array of @TCC_LEN uint32_t.
- * Each entry has on the MSB the color as 3 uint8_t (R,G,B) and the LSB is
- * the approximated color.
- * Searching a color is simply going through the array and testing the mask on
- * the 3 most significant bytes.
- * When a color is found, it is bubbled up towards the start of the array by
- * swapping this entry with the one above.  This way the array is ordered to
- * get most used colors as fast as possible.
- * When a color is not found, the slow process of comparing it with the 256
- * colors is used.  Then the result is inserted in the lower half of the
- * array.  This ensures that new entries can live a bit and not be removed by
- * the next new color.  Using a modulo with a prime number makes for a
- * nice-enough random generator to figure out where to insert.
+/***********************************
+ * approximate true colors, quickly
+ ***********************************
+ * Approximating a true color means finding the closest of the 256 colors of
+ * the extended palette, which is costly.  The RGB cube is cut into
+ * TCL_BUCKETS^3 boxes and, the first time a color of a box is approximated,
+ * the colors of the palette that can be the closest to any color of that
+ * box are listed, using bounds of the distance below.  Approximating then
+ * only compares the few colors of that list, giving the very same result as
+ * comparing all of them.
+ * The palette is fetched once, and everything is forgotten by
+ * termpty_truecolor_lut_free() when it changes.
  */
-#define TCC_LEN 32
-#define TCC_PRIME 17 /* smallest prime number larger than @TCC_LEN/2 */
-static struct {
-     uint32_t colors[TCC_LEN];
-} _truecolor_cache;
-static int _tcc_random_pos = 0;
+#define TCL_SHIFT 4
+#define TCL_BUCKETS (256 >> TCL_SHIFT)
+#define TCL_NONE 0xffffffff
 
-static Eina_Bool
-_tcc_find(const uint32_t color_msb, uint8_t *chosen_color)
+struct _Truecolor_Lut
 {
-   int i;
-   for (i = 0; i < TCC_LEN; i++)
+   int palette[256][3];
+   /* where the candidates of each box start in @candidates */
+   uint32_t offset[TCL_BUCKETS * TCL_BUCKETS * TCL_BUCKETS];
+   uint16_t count[TCL_BUCKETS * TCL_BUCKETS * TCL_BUCKETS];
+   uint8_t *candidates;
+   size_t len, size;
+};
+
+void
+termpty_truecolor_lut_free(Termpty *ty)
+{
+   termpty_backlog_lock(ty);
+   if (ty->truecolor_lut)
      {
-        if ((_truecolor_cache.colors[i] & 0xffffff00) == color_msb)
-          {
-             *chosen_color = _truecolor_cache.colors[i] & 0xff;
-             /* bubble up this result */
-             if (i > 0)
-               {
-                  uint32_t prev = _truecolor_cache.colors[i - 1];
-                  _truecolor_cache.colors[i - 1] = _truecolor_cache.colors[i];
-                  _truecolor_cache.colors[i] = prev;
-               }
-             return EINA_TRUE;
-          }
+        free(ty->truecolor_lut->candidates);
+        free(ty->truecolor_lut);
+        ty->truecolor_lut = NULL;
      }
-   return EINA_FALSE;
+   termpty_backlog_unlock(ty);
 }
 
+#if !defined(ENABLE_FUZZING)
+struct _Palette_Get {
+   Termpty *ty;
+   int (*colors)[3];
+};
+
 static void
-_tcc_insert(const uint32_t color_msb, const uint8_t approximated)
+_palette_get_cb(void *data)
 {
-   uint32_t c = color_msb | approximated;
-   int i;
+   struct _Palette_Get *pg = data;
+   Evas_Object *textgrid;
+   int c;
 
-   i = (TCC_LEN / 2) + ((_tcc_random_pos + TCC_PRIME) % (TCC_LEN / 2));
+   textgrid = termio_textgrid_get(pg->ty->obj);
+   for (c = 0; c < 256; c++)
+     {
+        int a = 0;
 
-  _truecolor_cache.colors[i] = c;
+        pg->colors[c][0] = pg->colors[c][1] = pg->colors[c][2] = 0;
+        evas_object_textgrid_palette_get(textgrid,
+                                         EVAS_TEXTGRID_PALETTE_EXTENDED,
+                                         c, &pg->colors[c][0],
+                                         &pg->colors[c][1],
+                                         &pg->colors[c][2], &a);
+     }
+}
+
+static int
+_color_distance(int r0, int g0, int b0, const int rgb1[3])
+{
+   int r1 = rgb1[0], g1 = rgb1[1], b1 = rgb1[2];
+   int delta_red_sq, delta_green_sq, delta_blue_sq, red_mean;
+   int distance;
+
+   /* Compute the color distance
+    * XXX: this is inacurate but should give good enough results.
+    * See https://en.wikipedia.org/wiki/Color_difference
+    */
+   red_mean = (r0 + r1) / 2;
+   delta_red_sq = (r0 - r1) * (r0 - r1);
+   delta_green_sq = (g0 - g1) * (g0 - g1);
+   delta_blue_sq = (b0 - b1) * (b0 - b1);
+
+#if 1
+   distance = 2 * delta_red_sq
+      + 4 * delta_green_sq
+      + 3 * delta_blue_sq
+      + ((red_mean) * (delta_red_sq - delta_blue_sq) / 256);
+#else
+   /* from https://www.compuphase.com/cmetric.htm */
+   distance = (((512 + red_mean) * delta_red_sq) >> 8)
+      + 4 * delta_green_sq
+      + (((767 - red_mean) * delta_blue_sq) >> 8);
+   /* euclidian distance */
+   distance = delta_red_sq + delta_green_sq + delta_blue_sq;
+   (void)red_mean;
+#endif
+   return distance;
+}
+
+/* Smallest and largest squared distance between @v and [@lo, @lo + box] */
+static void
+_box_delta_sq(int v, int lo, int *min_sq, int *max_sq)
+{
+   int hi = lo + (1 << TCL_SHIFT) - 1;
+   int d_lo = abs(v - lo), d_hi = abs(v - hi);
+   int d_min = ((v >= lo) && (v <= hi)) ? 0 : MIN(d_lo, d_hi);
+   int d_max = MAX(d_lo, d_hi);
+
+   *min_sq = d_min * d_min;
+   *max_sq = d_max * d_max;
+}
+
+/* List the colors of the palette that can be the closest to a color of box
+ * @i.  With red_mean in [0, 255], the distance above is between
+ * 2*dr² + 4*dg² + 2*db² and 3*dr² + 4*dg² + 3*db², give or take 1 for
+ * the rounding.  A color whose lower bound is above the smallest upper
+ * bound can not be the closest one */
+static Eina_Bool
+_tcl_box_fill(Truecolor_Lut *lut, unsigned int i)
+{
+   int lower[256];
+   int r = (i / (TCL_BUCKETS * TCL_BUCKETS)) << TCL_SHIFT,
+       g = ((i / TCL_BUCKETS) % TCL_BUCKETS) << TCL_SHIFT,
+       b = (i % TCL_BUCKETS) << TCL_SHIFT;
+   int upper_min = INT_MAX;
+   int c;
+
+   if (lut->size - lut->len < 256)
+     {
+        size_t size = lut->size ? lut->size * 2 : 4096;
+        uint8_t *candidates = realloc(lut->candidates, size);
+
+        if (!candidates)
+          return EINA_FALSE;
+        lut->candidates = candidates;
+        lut->size = size;
+     }
+   for (c = 0; c < 256; c++)
+     {
+        int dr_min, dr_max, dg_min, dg_max, db_min, db_max, upper;
+
+        _box_delta_sq(lut->palette[c][0], r, &dr_min, &dr_max);
+        _box_delta_sq(lut->palette[c][1], g, &dg_min, &dg_max);
+        _box_delta_sq(lut->palette[c][2], b, &db_min, &db_max);
+        lower[c] = 2 * dr_min + 4 * dg_min + 2 * db_min - 1;
+        upper = 3 * dr_max + 4 * dg_max + 3 * db_max + 1;
+        if (upper < upper_min)
+          upper_min = upper;
+     }
+   lut->offset[i] = lut->len;
+   lut->count[i] = 0;
+   /* in the order of the palette, to pick the same color on ties */
+   for (c = 0; c < 256; c++)
+     {
+        if (lower[c] <= upper_min)
+          {
+             lut->candidates[lut->len++] = c;
+             lut->count[i]++;
+          }
+     }
+   return EINA_TRUE;
+}
+
+static Truecolor_Lut *
+_tcl_get(Termpty *ty)
+{
+   struct _Palette_Get pg;
+   Truecolor_Lut *lut = ty->truecolor_lut;
+
+   if (lut)
+     return lut;
+   lut = malloc(sizeof(*lut));
+   if (!lut)
+     return NULL;
+   memset(lut->offset, 0xff, sizeof(lut->offset));
+   lut->candidates = NULL;
+   lut->len = lut->size = 0;
+   pg.ty = ty;
+   pg.colors = lut->palette;
+   termpty_main_loop_call(ty, _palette_get_cb, &pg);
+   ty->truecolor_lut = lut;
+   return lut;
 }
 #endif
 
@@ -731,57 +852,30 @@ _approximate_truecolor_rgb(Termpty *ty, uint8_t r0, uint8_t g0, uint8_t b0)
    (void) g0;
    (void) b0;
 #else
-   int c;
+   Truecolor_Lut *lut;
+   const uint8_t *candidates;
    int distance_min = INT_MAX;
-   Evas_Object *textgrid;
-   const uint32_t color_msb = 0
-      | (((uint32_t)r0) << 24)
-      | (((uint32_t)g0) << 16)
-      | (((uint32_t)b0) << 8);
+   unsigned int i, k;
 
-   if (_tcc_find(color_msb, &chosen_color))
+   lut = _tcl_get(ty);
+   if (!lut)
      return chosen_color;
-
-   textgrid = termio_textgrid_get(ty->obj);
-   for (c = 0; c < 256; c++)
+   i = (((r0 >> TCL_SHIFT) * TCL_BUCKETS) + (g0 >> TCL_SHIFT)) * TCL_BUCKETS
+      + (b0 >> TCL_SHIFT);
+   if ((lut->offset[i] == TCL_NONE) && (!_tcl_box_fill(lut, i)))
+     return chosen_color;
+   candidates = lut->candidates + lut->offset[i];
+   for (k = 0; k < lut->count[i]; k++)
      {
-        int r1 = 0, g1 = 0, b1 = 0, a1 = 0;
-        int delta_red_sq, delta_green_sq, delta_blue_sq, red_mean;
-        int distance;
-
-        evas_object_textgrid_palette_get(textgrid,
-                                         EVAS_TEXTGRID_PALETTE_EXTENDED,
-                                         c, &r1, &g1, &b1, &a1);
-        /* Compute the color distance
-         * XXX: this is inacurate but should give good enough results.
-         * See https://en.wikipedia.org/wiki/Color_difference
-         */
-        red_mean = (r0 + r1) / 2;
-        delta_red_sq = (r0 - r1) * (r0 - r1);
-        delta_green_sq = (g0 - g1) * (g0 - g1);
-        delta_blue_sq = (b0 - b1) * (b0 - b1);
+        int distance = _color_distance(r0, g0, b0,
+                                       lut->palette[candidates[k]]);
 
-#if 1
-        distance = 2 * delta_red_sq
-           + 4 * delta_green_sq
-           + 3 * delta_blue_sq
-           + ((red_mean) * (delta_red_sq - delta_blue_sq) / 256);
-#else
-        /* from https://www.compuphase.com/cmetric.htm */
-        distance = (((512 + red_mean) * delta_red_sq) >> 8)
-                 + 4 * delta_green_sq
-                 + (((767 - red_mean) * delta_blue_sq) >> 8);
-        /* euclidian distance */
-        distance = delta_red_sq + delta_green_sq + delta_blue_sq;
-        (void)red_mean;
-#endif
         if (distance < distance_min)
           {
              distance_min = distance;
-             chosen_color = c;
+             chosen_color = candidates[k];
           }
      }
-   _tcc_insert(color_msb, chosen_color);
 #endif
    return chosen_color;
 }
@@ -1330,12 +1424,16 @@ _handle_esc_csi_dch(Termpty *ty, Eina_Unicode **ptr)
           TERMPTY_CELL_COPY(ty, &(cells[x + arg]), &(cells[x]), 1);
         else
           {
+             Termatt att = ty->termstate.att;
+
+             termpty_cells_dirty(ty, &(cells[x]), 1);
              cells[x].codepoint = ' ';
-             if (EINA_UNLIKELY(cells[x].att.link_id))
-               term_link_refcount_dec(ty, cells[x].att.link_id, 1);
-             cells[x].att = ty->termstate.att;
-             cells[x].att.link_id = 0;
-             cells[x].att.dblwidth = 0;
+             if (EINA_UNLIKELY(TERMPTY_CELL_STYLE(ty, cells[x])->link_id))
+               term_link_refcount_dec(ty,
+                                      TERMPTY_CELL_STYLE(ty, cells[x])->link_id, 1);
+             att.link_id = 0;
+             att.dblwidth = 0;
+             termpty_cell_att_set(ty, &cells[x], &att);
           }
      }
 }
@@ -1619,7 +1717,7 @@ _clean_up_rect_coordinates(Termpty *ty,
           bottom = ty->termstate.bottom_margin;
      }
    bottom--;
-   if (bottom > ty->h)
+   if (bottom >= ty->h)
      bottom = ty->h - 1;
 
    if ((bottom < top) || (right < left))
@@ -1744,7 +1842,7 @@ _handle_esc_csi_decfra(Termpty *ty, Eina_Unicode **b)
 }
 
 static void
-_deccara(Termcell *cells, int len,
+_deccara(Termpty *ty, Termcell *cells, int len,
          Eina_Bool set_bold, Eina_Bool reset_bold,
          Eina_Bool set_underline, Eina_Bool reset_underline,
          Eina_Bool set_blink, Eina_Bool reset_blink,
@@ -1752,25 +1850,29 @@ _deccara(Termcell *cells, int len,
 {
    int i;
 
+   termpty_cells_dirty(ty, cells, len);
    for (i = 0; i < len; i++)
      {
-        Termatt * att = &cells[i].att;
+        Termatt att;
+
+        termpty_cell_att_get(ty, &cells[i], &att);
         if (set_bold)
-          att->bold = 1;
+          att.bold = 1;
         if (set_underline)
-          att->underline = 1;
+          att.underline = 1;
         if (set_blink)
-          att->blink = 1;
+          att.blink = 1;
         if (set_inverse)
-          att->inverse = 1;
+          att.inverse = 1;
         if (reset_bold)
-          att->bold = 0;
+          att.bold = 0;
         if (reset_underline)
-          att->underline = 0;
+          att.underline = 0;
         if (reset_blink)
-          att->blink = 0;
+          att.blink = 0;
         if (reset_inverse)
-          att->inverse = 0;
+          att.inverse = 0;
+        termpty_cell_att_set(ty, &cells[i], &att);
      }
 }
 
@@ -1865,7 +1967,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
         for (; top <= bottom; top++)
           {
              cells = &(TERMPTY_SCREEN(ty, left, top));
-             _deccara(cells, len, set_bold, reset_bold, set_underline,
+             _deccara(ty, cells, len, set_bold, reset_bold, set_underline,
                       reset_underline, set_blink, reset_blink, set_inverse,
                       reset_inverse);
           }
@@ -1882,7 +1984,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
           {
              cells = &(TERMPTY_SCREEN(ty, left, top));
              len = right - left;
-             _deccara(cells, len, set_bold, reset_bold,
+             _deccara(ty, cells, len, set_bold, reset_bold,
                       set_underline, reset_underline,
                       set_blink, reset_blink,
                       set_inverse, reset_inverse);
@@ -1892,7 +1994,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
              /* First line */
              cells = &(TERMPTY_SCREEN(ty, left, top));
              len = right_border - left;
-             _deccara(cells, len, set_bold, reset_bold,
+             _deccara(ty, cells, len, set_bold, reset_bold,
                       set_underline, reset_underline,
                       set_blink, reset_blink,
                       set_inverse, reset_inverse);
@@ -1902,7 +2004,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
              for (top = top + 1; top < bottom; top++)
                {
                   cells = &(TERMPTY_SCREEN(ty, left_border, top));
-                  _deccara(cells, len, set_bold, reset_bold,
+                  _deccara(ty, cells, len, set_bold, reset_bold,
                            set_underline, reset_underline,
                            set_blink, reset_blink,
                            set_inverse, reset_inverse);
@@ -1911,7 +2013,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
              /* Last line */
              cells = &(TERMPTY_SCREEN(ty, left_border, bottom));
              len = right - left_border;
-             _deccara(cells, len, set_bold, reset_bold,
+             _deccara(ty, cells, len, set_bold, reset_bold,
                       set_underline, reset_underline,
                       set_blink, reset_blink,
                       set_inverse, reset_inverse);
@@ -1920,7 +2022,7 @@ _handle_esc_csi_deccara(Termpty *ty, Eina_Unicode **ptr,
 }
 
 static void
-_decrara(Termcell *cells, int len,
+_decrara(Termpty *ty, Termcell *cells, int len,
          Eina_Bool reverse_bold,
          Eina_Bool reverse_underline,
          Eina_Bool reverse_blink,
@@ -1928,17 +2030,21 @@ _decrara(Termcell *cells, int len,
 {
    int i;
 
+   termpty_cells_dirty(ty, cells, len);
    for (i = 0; i < len; i++)
      {
-        Termatt * att = &cells[i].att;
+        Termatt att;
+
+        termpty_cell_att_get(ty, &cells[i], &att);
         if (reverse_bold)
-          att->bold = !att->bold;
+          att.bold = !att.bold;
         if (reverse_underline)
-          att->underline = !att->underline;
+          att.underline = !att.underline;
         if (reverse_blink)
-          att->blink = !att->blink;
+          att.blink = !att.blink;
         if (reverse_inverse)
-          att->inverse = !att->inverse;
+          att.inverse = !att.inverse;
+        termpty_cell_att_set(ty, &cells[i], &att);
      }
 }
 
@@ -2012,7 +2118,7 @@ _handle_esc_csi_decrara(Termpty *ty, Eina_Unicode **ptr,
         for (; top <= bottom; top++)
           {
              cells = &(TERMPTY_SCREEN(ty, left, top));
-             _decrara(cells, len, reverse_bold, reverse_underline,
+             _decrara(ty, cells, len, reverse_bold, reverse_underline,
                       reverse_blink, reverse_inverse);
           }
      }
@@ -2028,7 +2134,7 @@ _handle_esc_csi_decrara(Termpty *ty, Eina_Unicode **ptr,
           {
              cells = &(TERMPTY_SCREEN(ty, left, top));
              len = right - left;
-             _decrara(cells, len, reverse_bold, reverse_underline,
+             _decrara(ty, cells, len, reverse_bold, reverse_underline,
                       reverse_blink, reverse_inverse);
           }
         else
@@ -2036,7 +2142,7 @@ _handle_esc_csi_decrara(Termpty *ty, Eina_Unicode **ptr,
              /* First line */
              cells = &(TERMPTY_SCREEN(ty, left, top));
              len = right_border - left;
-             _decrara(cells, len, reverse_bold, reverse_underline,
+             _decrara(ty, cells, len, reverse_bold, reverse_underline,
                       reverse_blink, reverse_inverse);
 
              /* Middle */
@@ -2044,14 +2150,14 @@ _handle_esc_csi_decrara(Termpty *ty, Eina_Unicode **ptr,
              for (top = top + 1; top < bottom; top++)
                {
                   cells = &(TERMPTY_SCREEN(ty, left_border, top));
-                  _decrara(cells, len, reverse_bold, reverse_underline,
+                  _decrara(ty, cells, len, reverse_bold, reverse_underline,
                            reverse_blink, reverse_inverse);
                }
 
              /* Last line */
              cells = &(TERMPTY_SCREEN(ty, left_border, bottom));
              len = right - left_border;
-             _decrara(cells, len, reverse_bold, reverse_underline,
+             _decrara(ty, cells, len, reverse_bold, reverse_underline,
                       reverse_blink, reverse_inverse);
           }
      }
@@ -2290,7 +2396,7 @@ _handle_esc_csi_decscusr(Termpty *ty, Eina_Unicode **b)
         return;
     }
 
-  termio_set_cursor_shape(ty->obj, shape);
+  termpty_cursor_shape_set(ty, shape);
 }
 
 static void
@@ -2449,12 +2555,16 @@ _handle_esc_csi_decdc(Termpty *ty, Eina_Unicode **b)
                TERMPTY_CELL_COPY(ty, &(cells[x + arg]), &(cells[x]), 1);
              else
                {
+                  Termatt att = ty->termstate.att;
+
+                  termpty_cells_dirty(ty, &(cells[x]), 1);
                   cells[x].codepoint = ' ';
-                  if (EINA_UNLIKELY(cells[x].att.link_id))
-                    term_link_refcount_dec(ty, cells[x].att.link_id, 1);
-                  cells[x].att = ty->termstate.att;
-                  cells[x].att.link_id = 0;
-                  cells[x].att.dblwidth = 0;
+                  if (EINA_UNLIKELY(TERMPTY_CELL_STYLE(ty, cells[x])->link_id))
+                    term_link_refcount_dec(ty,
+                                           TERMPTY_CELL_STYLE(ty, cells[x])->link_id, 1);
+                  att.link_id = 0;
+                  att.dblwidth = 0;
+                  termpty_cell_att_set(ty, &cells[x], &att);
                }
           }
      }
@@ -3247,24 +3357,20 @@ _title_icon_stack_pop(Termpty *ty, Eina_Unicode **p)
       case 0:
          eina_stringshare_del(ty->prop.icon);
          ty->prop.icon = eina_stringshare_ref(elem->icon);
-         if (ty->cb.set_icon.func)
-           ty->cb.set_icon.func(ty->cb.set_icon.data);
+         TERMPTY_CB_CALL(ty, set_icon);
          eina_stringshare_del(ty->prop.title);
          ty->prop.title = eina_stringshare_ref(elem->title);
-         if (ty->cb.set_title.func)
-           ty->cb.set_title.func(ty->cb.set_title.data);
+         TERMPTY_CB_CALL(ty, set_title);
          break;
       case 1:
          eina_stringshare_del(ty->prop.icon);
          ty->prop.icon = eina_stringshare_ref(elem->icon);
-         if (ty->cb.set_icon.func)
-           ty->cb.set_icon.func(ty->cb.set_icon.data);
+         TERMPTY_CB_CALL(ty, set_icon);
          break;
       case 2:
          eina_stringshare_del(ty->prop.title);
          ty->prop.title = eina_stringshare_ref(elem->title);
-         if (ty->cb.set_title.func)
-           ty->cb.set_title.func(ty->cb.set_title.data);
+         TERMPTY_CB_CALL(ty, set_title);
          break;
       default:
          break;
@@ -3715,6 +3821,18 @@ err:
    return -1;
 }
 
+/* Stop writing with the current hyperlink, if any, forgetting it if no
+ * cell uses it */
+static void
+_hyperlink_close(Termpty *ty, uint16_t new_id)
+{
+    uint16_t id = ty->termstate.att.link_id;
+
+    ty->termstate.att.link_id = new_id;
+    if ((id) && (id != new_id) && (ty->hl.links[id].refcount == 0))
+      term_link_free(ty, &ty->hl.links[id]);
+}
+
 static void
 _handle_hyperlink(Termpty *ty,
                   char *s,
@@ -3737,7 +3855,7 @@ _handle_hyperlink(Termpty *ty,
          /* Closing escape code */
          if (ty->termstate.att.link_id)
            {
-              ty->termstate.att.link_id = 0;
+              _hyperlink_close(ty, 0);
            }
          else
            {
@@ -3795,23 +3913,32 @@ _handle_hyperlink(Termpty *ty,
     if (!url)
       goto end;
 
-    hl = term_link_new(ty);
-    if (!hl)
-      goto end;
-    hl->key = key;
-    hl->url = url;
+    hl = term_link_new(ty, key, url);
     key = NULL;
     url = NULL;
+    if (!hl)
+      goto end;
 
-    ty->termstate.att.link_id = hl - ty->hl.links;
-    hl = NULL;
+    _hyperlink_close(ty, hl - ty->hl.links);
 
 end:
-    term_link_free(ty, hl);
     eina_stringshare_del(url);
     eina_stringshare_del(key);
 }
 
+struct _Font_Size_Set {
+   Termpty *ty;
+   int size;
+};
+
+static void
+_font_size_set_cb(void *data)
+{
+   struct _Font_Size_Set *fss = data;
+
+   termio_font_size_set(fss->ty->obj, fss->size);
+}
+
 static void
 _handle_xterm_50_command(Termpty *ty,
                          char *s,
@@ -3829,7 +3956,11 @@ _handle_xterm_50_command(Termpty *ty,
             errno = 0;
             size = strtol(s, &endptr, 10);
             if (endptr != s && errno == 0)
-               termio_font_size_set(ty->obj, size);
+              {
+                 struct _Font_Size_Set fss = { ty, size };
+
+                 termpty_main_loop_call(ty, _font_size_set_cb, &fss);
+              }
          }
        len--;
        s++;
@@ -3837,21 +3968,14 @@ _handle_xterm_50_command(Termpty *ty,
 }
 
 static void
-_handle_xterm_777_command(Termpty *ty,
-                          char *s, int _len EINA_UNUSED)
+_xterm_777_notify_cb(void *data)
 {
+   char *s = data;
    char *cmd_end = NULL,
         *title = NULL,
         *title_end = NULL,
         *message = NULL;
 
-   if (strncmp(s, "notify;", strlen("notify;")))
-     {
-        WRN("unrecognized xterm 777 command %s", s);
-        ty->decoding_error = EINA_TRUE;
-        return;
-     }
-
    if (!elm_need_sys_notify())
      {
         WRN("no elementary system notification support");
@@ -3878,6 +4002,19 @@ _handle_xterm_777_command(Termpty *ty,
    *title_end = ';';
 }
 
+static void
+_handle_xterm_777_command(Termpty *ty,
+                          char *s, int _len EINA_UNUSED)
+{
+   if (strncmp(s, "notify;", strlen("notify;")))
+     {
+        WRN("unrecognized xterm 777 command %s", s);
+        ty->decoding_error = EINA_TRUE;
+        return;
+     }
+   termpty_main_loop_call(ty, _xterm_777_notify_cb, s);
+}
+
 static void
 _handle_xterm_11_command(Termpty *ty, Eina_Unicode *p)
 {
@@ -3907,6 +4044,23 @@ err:
    ty->decoding_error = EINA_TRUE;
 }
 
+#if !defined(ENABLE_FUZZING) && !defined(ENABLE_TESTS)
+struct _Palette_Set {
+   Termpty *ty;
+   unsigned char r, g, b;
+};
+
+static void
+_palette_set_cb(void *data)
+{
+   struct _Palette_Set *ps = data;
+
+   evas_object_textgrid_palette_set(termio_textgrid_get(ps->ty->obj),
+                                    EVAS_TEXTGRID_PALETTE_STANDARD, 0,
+                                    ps->r, ps->g, ps->b, 0xff);
+}
+#endif
+
 static int
 _handle_esc_osc(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
 {
@@ -3969,10 +4123,8 @@ _handle_esc_osc(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
              ty->prop.title = NULL;
              ty->prop.icon = NULL;
           }
-        if (ty->cb.set_title.func)
-          ty->cb.set_title.func(ty->cb.set_title.data);
-        if (ty->cb.set_icon.func)
-          ty->cb.set_icon.func(ty->cb.set_icon.data);
+        TERMPTY_CB_CALL(ty, set_title);
+        TERMPTY_CB_CALL(ty, set_icon);
         break;
       case 1:
         // icon name
@@ -3989,7 +4141,7 @@ _handle_esc_osc(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
           {
              ty->prop.icon = NULL;
           }
-        if (ty->cb.set_icon.func) ty->cb.set_icon.func(ty->cb.set_icon.data);
+        TERMPTY_CB_CALL(ty, set_icon);
         break;
       case 2:
         // Title
@@ -4006,7 +4158,7 @@ _handle_esc_osc(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
           {
              ty->prop.title = NULL;
           }
-        if (ty->cb.set_title.func) ty->cb.set_title.func(ty->cb.set_title.data);
+        TERMPTY_CB_CALL(ty, set_title);
         break;
       case 4:
         if (!*p)
@@ -4021,6 +4173,7 @@ _handle_esc_osc(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
         DBG("hyperlink");
         s = eina_unicode_unicode_to_utf8(p, &len);
         _handle_hyperlink(ty, s, len);
+        free(s);
         break;
       case 10:
         if (!*p)
@@ -4044,10 +4197,11 @@ _handle_esc_osc(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
              if (_xterm_parse_color(ty, &p, &r, &g, &b, len) < 0)
                goto err;
 #if !defined(ENABLE_FUZZING) && !defined(ENABLE_TESTS)
-             evas_object_textgrid_palette_set(
-                termio_textgrid_get(ty->obj),
-                EVAS_TEXTGRID_PALETTE_STANDARD, 0,
-                r, g, b, 0xff);
+               {
+                  struct _Palette_Set ps = { ty, r, g, b };
+
+                  termpty_main_loop_call(ty, _palette_set_cb, &ps);
+               }
 #endif
           }
         break;
@@ -4147,17 +4301,19 @@ _handle_esc_terminology(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *
    buf = (Eina_Unicode *)c;
    cc = cc_zero;
 
+   /* handled from the codepoints, without the copy as a string below */
+   if ((config->ty_escapes) && (termpty_ext_handle(ty, buf, blen)))
+     goto end;
+
    // commands are stored in the buffer, 0 bytes not allowed (end marker)
    cmd = eina_unicode_unicode_to_utf8(buf, NULL);
    ty->cur_cmd = cmd;
-   if ((!config->ty_escapes) || (!termpty_ext_handle(ty, buf, blen)))
-     {
-        if (ty->cb.command.func)
-          ty->cb.command.func(ty->cb.command.data);
-     }
+   TERMPTY_CB_CALL(ty, command);
    ty->cur_cmd = NULL;
    free(cmd);
 
+end:
+
    assert((size_t)(cc - c) == blen);
 
    return cc - c;
@@ -4290,11 +4446,10 @@ _handle_decaln(Termpty *ty)
    ty->termstate.had_cr_y = 0;
    ty->cursor_state.cx = 0;
    ty->cursor_state.cy = 0;
-   ty->termstate.att.link_id = 0;
+   term_link_close(ty);
 
    termpty_clear_screen(ty, TERMPTY_CLR_ALL);
-   if (ty->cb.cancel_sel.func)
-     ty->cb.cancel_sel.func(ty->cb.cancel_sel.data);
+   TERMPTY_CB_CALL(ty, cancel_sel);
    cells = ty->screen;
    size = ty->w * ty->h;
    if (cells)
@@ -4388,12 +4543,16 @@ _handle_decfi(Termpty *ty)
                     TERMPTY_CELL_COPY(ty, &(cells[x + 1]), &(cells[x]), 1);
                   else
                     {
+                       Termatt att = ty->termstate.att;
+
+                       termpty_cells_dirty(ty, &(cells[x]), 1);
                        cells[x].codepoint = ' ';
-                       if (EINA_UNLIKELY(cells[x].att.link_id))
-                         term_link_refcount_dec(ty, cells[x].att.link_id, 1);
-                       cells[x].att = ty->termstate.att;
-                       cells[x].att.link_id = 0;
-                       cells[x].att.dblwidth = 0;
+                       if (EINA_UNLIKELY(TERMPTY_CELL_STYLE(ty, cells[x])->link_id))
+                         term_link_refcount_dec(ty,
+                                                TERMPTY_CELL_STYLE(ty, cells[x])->link_id, 1);
+                       att.link_id = 0;
+                       att.dblwidth = 0;
+                       termpty_cell_att_set(ty, &cells[x], &att);
                     }
                }
           }
@@ -4465,8 +4624,7 @@ _handle_esc(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
         DBG("reset to init mode and clear");
         termpty_reset_state(ty);
         termpty_clear_screen(ty, TERMPTY_CLR_ALL);
-        if (ty->cb.cancel_sel.func)
-          ty->cb.cancel_sel.func(ty->cb.cancel_sel.data);
+        TERMPTY_CB_CALL(ty, cancel_sel);
         return 1;
       case '"':
         if (len < 2)
@@ -4546,6 +4704,54 @@ _handle_esc(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
 
 
 /* XXX: ce is excluded */
+/* @c to @ce holds a sequence termpty_handle_seq() found incomplete, to which
+ * the codepoints from @added have just been appended.  Tell whether parsing
+ * it again may succeed, so that string sequences (OSC, DCS, terminology
+ * escapes) arriving over many reads are not re-parsed from the start on
+ * every read */
+Eina_Bool
+termpty_seq_can_complete(const Eina_Unicode *c, const Eina_Unicode *ce,
+                         const Eina_Unicode *added)
+{
+   const Eina_Unicode *cc;
+   Eina_Bool is_osc;
+
+   if (c[0] == OSC)
+     {
+        is_osc = EINA_TRUE;
+        c += 1;
+     }
+   else if ((c[0] == ESC) && (c + 1 < added) && ((c[1] == ']') || (c[1] == 'P')))
+     {
+        is_osc = (c[1] == ']');
+        c += 2;
+     }
+   else if ((c[0] == ESC) && (c + 1 < added) && (c[1] == '}'))
+     {
+        for (cc = added; cc < ce; cc++)
+          {
+             if (*cc == 0x0)
+               return EINA_TRUE;
+          }
+        return EINA_FALSE;
+     }
+   else
+     return EINA_TRUE;
+
+   /* the parsers give up on payloads larger than their 4096 codepoints
+    * buffer */
+   if (ce - c >= 4096)
+     return EINA_TRUE;
+   cc = (added > c) ? added - 1 : c;
+   for (; cc < ce; cc++)
+     {
+        if ((*cc == ST) || ((is_osc) && (*cc == BEL)) ||
+            ((*cc == ESC) && (cc + 1 < ce) && (cc[1] == '\\')))
+          return EINA_TRUE;
+     }
+   return EINA_FALSE;
+}
+
 int
 termpty_handle_seq(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
 {
@@ -4654,15 +4860,11 @@ termpty_handle_seq(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce)
      }
    cc = (Eina_Unicode *)c;
 
-   DBG("txt: [");
    while ((cc < ce) && (*cc >= 0x20) && (*cc != DEL) && (*cc != CSI)
           && (*cc != OSC))
-     {
-        DBG("%s", _safechar(*cc));
-        cc++;
-        len++;
-     }
-   DBG("]");
+     cc++;
+   len = cc - c;
+   DBG("txt: %d codepoints", len);
    termpty_text_append(ty, c, len);
    if (len > 0)
        last_char = c[len-1];
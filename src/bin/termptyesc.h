@@ -2,5 +2,8 @@
 #define _TERMPTY_ESC_H__ 1
 
 int termpty_handle_seq(Termpty *ty, const Eina_Unicode *c, const Eina_Unicode *ce);
+Eina_Bool termpty_seq_can_complete(const Eina_Unicode *c,
+                                   const Eina_Unicode *ce,
+                                   const Eina_Unicode *added);
 
 #endif
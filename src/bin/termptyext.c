@@ -5,6 +5,7 @@
 #include "termpty.h"
 #include "termptyops.h"
 #include "termiointernals.h"
+#include "termiosearch.h"
 #include "tytest.h"
 #include <assert.h>
 
@@ -255,17 +256,33 @@ _handle_link(Termpty *ty, const Eina_Unicode *buf)
         Termcell *cells = NULL;
         ssize_t w;
 
+        Termatt att;
+
         cells = termpty_cellrow_get(ty, sd->mouse.cy, &w);
-        termpty_reset_att(&cells[sd->mouse.cx].att);
-        cells[sd->mouse.cx].att.bold = 1;
-        cells[sd->mouse.cx].att.fg = COL_WHITE;
-        cells[sd->mouse.cx].att.bg = COL_RED;
+        termpty_cell_att_get(ty, &cells[sd->mouse.cx], &att);
+        termpty_reset_att(&att);
+        att.bold = 1;
+        att.fg = COL_WHITE;
+        att.bg = COL_RED;
+        termpty_cell_att_set(ty, &cells[sd->mouse.cx], &att);
+        termpty_cells_dirty(ty, &cells[sd->mouse.cx], 1);
      }
 
    link = termio_link_find(ty->obj, sd->mouse.cx, sd->mouse.cy,
                            &x1, &y1, &x2, &y2);
 
    ERR("x1:%d y1:%d x2:%d y2:%d link:'%s'", x1, y1, x2, y2, link);
+   /* the second time, it comes from what was found */
+     {
+        int cx1 = -1, cy1 = -1, cx2 = -1, cy2 = -1;
+        char *cached = termio_link_find(ty->obj, sd->mouse.cx, sd->mouse.cy,
+                                        &cx1, &cy1, &cx2, &cy2);
+
+        assert((!link) == (!cached));
+        assert((!link) || (!strcmp(link, cached)));
+        assert((x1 == cx1) && (y1 == cy1) && (x2 == cx2) && (y2 == cy2));
+        free(cached);
+     }
    if (type == 'n')
      {
         assert (link == NULL);
@@ -394,10 +411,35 @@ _handle_corner(Termpty *ty, const Eina_Unicode *buf)
      }
 }
 
+/*
+ * Format is tf;R;N;PATTERN
+ * where R is 1 if PATTERN is a regular expression, 0 otherwise,
+ * and N is the number of matches once the backlog has been searched
+ */
+static void
+_handle_search(Termpty *ty, const Eina_Unicode *buf)
+{
+   Termio *sd = termio_get_from_obj(ty->obj);
+   int regex = 0, count = 0;
+   char *pattern;
+
+   buf += _tytest_arg_get(buf, &regex);
+   buf += _tytest_arg_get(buf, &count);
+   if (*buf == ';')
+     buf++;
+   pattern = eina_unicode_unicode_to_utf8(buf, NULL);
+   termio_search_set(sd->self, pattern, regex);
+   while (termio_search_run(sd, 1.0))
+     ;
+   assert(termio_search_count(sd) == (unsigned int)count);
+   free(pattern);
+}
+
 /* Testing escape codes that start with '\033}t' and end with '\0'
  * Then,
  * - 'c': set/unset top-left/down-right
  * - 'd': mouse down:
+ * - 'f': search the backlog and assert the number of matches;
  * - 'u': mouse up;
  * - 'm': mouse move;
  * - 'l': assert mouse is over a link
@@ -417,6 +459,9 @@ tytest_handle_escape_codes(Termpty *ty,
       case 'd':
         _handle_mouse_down(ty, buf + 1);
         break;
+      case 'f':
+        _handle_search(ty, buf + 1);
+        break;
       case 'l':
         _handle_link(ty, buf + 1);
         break;
@@ -445,21 +490,24 @@ tytest_handle_escape_codes(Termpty *ty,
 }
 #endif
 
-#if defined(ENABLE_TESTS) || defined(ENABLE_TEST_UI)
-#define ARG_USED_FOR_TESTS
-#else
-#define ARG_USED_FOR_TESTS EINA_UNUSED
-#endif
-
 Eina_Bool
-termpty_ext_handle(Termpty *ty ARG_USED_FOR_TESTS,
-                   const Eina_Unicode *buf ARG_USED_FOR_TESTS,
-                   size_t blen EINA_UNUSED)
+termpty_ext_handle(Termpty *ty, const Eina_Unicode *buf, size_t blen)
 {
    switch (buf[0]) // major opcode
      {
+      case 'f':
+        /* data packets of tysend, that do not need a copy as a string */
+        if ((blen > 1) && (buf[1] == 'D'))
+          {
+             termio_file_send_data(ty->obj, buf + 2, blen - 2);
+             return EINA_TRUE;
+          }
+        break;
 #if defined(ENABLE_TESTS) || defined(ENABLE_TEST_UI)
       case 't':
+        /* what is checked may depend on the scrolls termio was not told
+         * about yet */
+        termpty_main_loop_call(ty, NULL, NULL);
         tytest_handle_escape_codes(ty, buf + 1);
         return EINA_TRUE;
         break;
@@ -469,4 +517,3 @@ termpty_ext_handle(Termpty *ty ARG_USED_FOR_TESTS,
      }
    return EINA_FALSE;
 }
-#undef ARG_USED_FOR_TESTS
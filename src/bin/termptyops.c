@@ -5,6 +5,7 @@
 #include "termptydbl.h"
 #include "termptyops.h"
 #include "termptygfx.h"
+#include "termiolink.h"
 #include "backlog.h"
 #include "miniview.h"
 #include <assert.h>
@@ -25,11 +26,12 @@ void
 termpty_cells_clear(Termpty *ty, Termcell *cells, int count)
 {
    Termcell src;
+   Termatt att = ty->termstate.att;
 
    memset(&src, 0, sizeof(src));
    src.codepoint = 0;
-   src.att = ty->termstate.att;
-   src.att.link_id = 0;
+   att.link_id = 0;
+   termpty_cell_att_set(ty, &src, &att);
 
    termpty_cell_fill(ty, &src, cells, count);
 }
@@ -40,6 +42,7 @@ termpty_text_scroll(Termpty *ty, Eina_Bool clear)
 {
    Termcell *cells = NULL;
    int start_y = 0, end_y = ty->h - 1;
+   unsigned int lines = ty->backlog_changes.lines;
 
    start_y = ty->termstate.top_margin;
    if (ty->termstate.bottom_margin != 0)
@@ -49,21 +52,22 @@ termpty_text_scroll(Termpty *ty, Eina_Bool clear)
        (!ty->altbuf))
      termpty_text_save_top(ty, &(TERMPTY_SCREEN(ty, 0, 0)), ty->w);
 
-   termio_scroll(ty->obj, -1, start_y, end_y);
+   termpty_scroll_notify(ty, -1, start_y, end_y);
    DBG("... scroll!!!!! [%i->%i]", start_y, end_y);
 
-   if ((start_y == 0 && end_y == ty->h - 1) &&
-       (ty->termstate.left_margin == 0) &&
+   if ((ty->termstate.left_margin == 0) &&
        (ty->termstate.right_margin == 0))
      {
-        // screen is a circular buffer now
-        cells = &(ty->screen[ty->circular_offset * ty->w]);
+        // full rows: rotate the row pointers, the top row becomes the
+        // bottom one
+        termpty_screen_rows_rotate(ty, start_y, end_y, -1);
+        termio_link_spans_scroll(ty, start_y, end_y, lines);
+        cells = ty->rows[end_y];
         if (clear)
           termpty_cells_clear(ty, cells, ty->w);
-
-        ty->circular_offset++;
-        if (ty->circular_offset >= ty->h)
-          ty->circular_offset = 0;
+        else if ((end_y > start_y) && ((start_y != 0) || (end_y != ty->h - 1)))
+          // like a copy of the rows would, leave the last one duplicated
+          TERMPTY_CELL_COPY(ty, ty->rows[end_y - 1], cells, ty->w);
      }
    else
      {
@@ -100,20 +104,22 @@ termpty_text_scroll_rev(Termpty *ty, Eina_Bool clear)
         end_y = ty->termstate.bottom_margin - 1;
      }
    DBG("... scroll rev!!!!! [%i->%i]", start_y, end_y);
-   termio_scroll(ty->obj, 1, start_y, end_y);
+   termpty_scroll_notify(ty, 1, start_y, end_y);
 
-   if ((start_y == 0 && end_y == (ty->h - 1)) &&
-       (ty->termstate.left_margin == 0) &&
+   if ((ty->termstate.left_margin == 0) &&
        (ty->termstate.right_margin == 0))
      {
-        // screen is a circular buffer now
-        ty->circular_offset--;
-        if (ty->circular_offset < 0)
-          ty->circular_offset = ty->h - 1;
-
-        cells = &(ty->screen[ty->circular_offset * ty->w]);
+        // full rows: rotate the row pointers, the bottom row becomes the
+        // top one
+        termpty_screen_rows_rotate(ty, start_y, end_y, 1);
+        termio_link_spans_scroll(ty, start_y, end_y,
+                                 ty->backlog_changes.lines);
+        cells = ty->rows[start_y];
         if (clear)
           termpty_cells_clear(ty, cells, ty->w);
+        else if ((end_y > start_y) && ((start_y != 0) || (end_y != ty->h - 1)))
+          // like a copy of the rows would, leave the first one duplicated
+          TERMPTY_CELL_COPY(ty, ty->rows[start_y + 1], cells, ty->w);
      }
    else
      {
@@ -177,18 +183,76 @@ termpty_text_scroll_rev_test(Termpty *ty, Eina_Bool clear)
      }
 }
 
+/* Write a run of printable ASCII codepoints from the cursor, stopping at
+ * the first other codepoint or at @max_right.  Such codepoints are neither
+ * translated nor double-width, so the run is written with a single
+ * attribute and the cursor moved as the per-codepoint path would.
+ * Returns the number of codepoints consumed, at least 1 */
+static int
+_text_append_ascii_run(Termpty *ty, Termcell *cells,
+                       const Eina_Unicode *codepoints, int len,
+                       int max_right)
+{
+   Termatt att = ty->termstate.att;
+   Termcell local = { .codepoint = 0 };
+   int x = ty->cursor_state.cx;
+   int n, i;
+
+   if (len > max_right - x)
+     len = max_right - x;
+   for (n = 1; n < len; n++)
+     {
+        if ((codepoints[n] < 0x20) || (codepoints[n] >= 0x7f))
+          break;
+     }
+
+   att.dblwidth = 0;
+   termpty_cell_att_set(ty, &local, &att);
+   termpty_cells_dirty(ty, &(cells[x]), n);
+   for (i = 0; i < n; i++)
+     {
+        Termcell *cell = &(cells[x + i]);
+
+        HANDLE_BLOCK_CODEPOINT_OVERWRITE(ty, cell->codepoint, codepoints[i]);
+        if (EINA_UNLIKELY(TERMPTY_CELL_STYLE(ty, *cell)->link_id))
+          term_link_refcount_dec(ty, TERMPTY_CELL_STYLE(ty, *cell)->link_id, 1);
+        local.codepoint = codepoints[i];
+        *cell = local;
+     }
+   if (EINA_UNLIKELY(att.link_id))
+     term_link_refcount_inc(ty, att.link_id, n);
+
+   if (x + n >= max_right)
+     {
+        ty->cursor_state.cx = max_right - 1;
+        ty->termstate.wrapnext = 1;
+     }
+   else
+     ty->cursor_state.cx = x + n;
+   return n;
+}
+
 void
 termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
 {
    Termcell *cells;
    int i, j;
    int origin = ty->termstate.left_margin;
+   Eina_Bool ascii_runs;
+
+   /* whether printable ASCII can be written as is, in bulk */
+   ascii_runs = ((ty->termstate.wrap) && (!ty->termstate.insert) &&
+                 (ty->termstate.charsetch != '0') &&
+                 (ty->termstate.charsetch != 'A') &&
+                 (!ty->termstate.att.fraktur) &&
+                 (!ty->termstate.att.encircled));
 
    cells = &(TERMPTY_SCREEN(ty, 0, ty->cursor_state.cy));
    for (i = 0; i < len; i++)
      {
         int max_right = ty->w;
         Eina_Unicode g;
+        unsigned char props;
 
         if (ty->termstate.right_margin &&
             (ty->cursor_state.cx < ty->termstate.right_margin))
@@ -196,9 +260,18 @@ termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
              max_right = ty->termstate.right_margin;
           }
 
+        if ((ascii_runs) && (!ty->termstate.wrapnext) &&
+            (!ty->termstate.combining_strike) &&
+            (codepoints[i] >= 0x20) && (codepoints[i] < 0x7f))
+          {
+             i += _text_append_ascii_run(ty, cells, codepoints + i, len - i,
+                                         max_right) - 1;
+             continue;
+          }
+
         if (ty->termstate.wrapnext)
           {
-             cells[max_right-1].att.autowrapped = 1;
+             cells[max_right-1].autowrapped = 1;
              ty->termstate.wrapnext = 0;
              ty->cursor_state.cx = origin;
              ty->cursor_state.cy++;
@@ -212,19 +285,15 @@ termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
           }
 
         g = _termpty_charset_trans(ty, codepoints[i]);
-        /* Skip 0-width space or RTL/LTR marks */
-        if (EINA_UNLIKELY(g >= 0x200b && g <= 0x200f))
-          {
-             continue;
-          }
-        /* Skip variation selectors */
-        if (EINA_UNLIKELY(g >= 0xfe00 && g <= 0xfe0f))
+        props = _termpty_cp_props_get(g);
+        /* Skip 0-width space, RTL/LTR marks and other format characters */
+        if (EINA_UNLIKELY(props & TERMPTY_CP_ZERO_WIDTH))
           {
              continue;
           }
-        if (EINA_UNLIKELY(g >= 0x300 && g <=0x36f))
+        /* Skip combining chars, variation selectors included */
+        if (EINA_UNLIKELY(props & TERMPTY_CP_COMBINING))
           {
-             /* combining chars */
              if (EINA_UNLIKELY(g == 0x336))
                {
                   ty->termstate.combining_strike = 1;
@@ -236,15 +305,23 @@ termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
                                         &(cells[ty->cursor_state.cx]), 1);
         if (EINA_UNLIKELY(ty->termstate.combining_strike))
           {
+             Termatt att;
+
              ty->termstate.combining_strike = 0;
-             cells[ty->cursor_state.cx].att.strike = 1;
+             termpty_cell_att_get(ty, &cells[ty->cursor_state.cx], &att);
+             att.strike = 1;
+             termpty_cell_att_set(ty, &cells[ty->cursor_state.cx], &att);
           }
 
-        cells[ty->cursor_state.cx].att.dblwidth = _termpty_is_dblwidth_get(ty, g);
-        if (EINA_UNLIKELY((cells[ty->cursor_state.cx].att.dblwidth) && (ty->cursor_state.cx < (max_right - 1))))
+        cells[ty->cursor_state.cx].dblwidth =
+           _termpty_cp_props_dblwidth_get(ty, props);
+        if (EINA_UNLIKELY((cells[ty->cursor_state.cx].dblwidth) && (ty->cursor_state.cx < (max_right - 1))))
           {
-             cells[ty->cursor_state.cx].att.newline = 0;
-             termpty_cell_codepoint_att_fill(ty, 0, cells[ty->cursor_state.cx].att,
+             Termatt att;
+
+             cells[ty->cursor_state.cx].newline = 0;
+             termpty_cell_att_get(ty, &cells[ty->cursor_state.cx], &att);
+             termpty_cell_codepoint_att_fill(ty, 0, att,
                                              &(cells[ty->cursor_state.cx + 1]), 1);
           }
 
@@ -253,7 +330,7 @@ termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
              unsigned char offset = 1;
 
              ty->termstate.wrapnext = 0;
-             if (EINA_UNLIKELY(cells[ty->cursor_state.cx].att.dblwidth))
+             if (EINA_UNLIKELY(cells[ty->cursor_state.cx].dblwidth))
                offset = 2;
              if (EINA_UNLIKELY(ty->cursor_state.cx >= (max_right - offset)))
                ty->termstate.wrapnext = 1;
@@ -268,7 +345,7 @@ termpty_text_append(Termpty *ty, const Eina_Unicode *codepoints, int len)
              unsigned char offset = 1;
 
              ty->termstate.wrapnext = 0;
-             if (EINA_UNLIKELY(cells[ty->cursor_state.cx].att.dblwidth))
+             if (EINA_UNLIKELY(cells[ty->cursor_state.cx].dblwidth))
                offset = 2;
              ty->cursor_state.cx += offset;
              if (ty->cursor_state.cx > (max_right - offset))
@@ -346,31 +423,16 @@ termpty_clear_screen(Termpty *ty, Termpty_Clear mode)
       case TERMPTY_CLR_BEGIN:
         if (ty->cursor_state.cy > 0)
           {
-             // First clear from circular > height, then from 0 to circular
-             int y = ty->cursor_state.cy + ty->circular_offset;
-
-             cells = &(TERMPTY_SCREEN(ty, 0, 0));
+             int y;
 
-             if (y < ty->h)
-               {
-                  termpty_cells_clear(ty, cells, ty->w * ty->cursor_state.cy);
-               }
-             else
-               {
-                  int yt = y % ty->h;
-                  int yb = ty->h - ty->circular_offset;
-
-                  termpty_cells_clear(ty, cells, ty->w * yb);
-                  termpty_cells_clear(ty, ty->screen, ty->w * yt);
-               }
+             for (y = 0; y < ty->cursor_state.cy; y++)
+               termpty_cells_clear(ty, ty->rows[y], ty->w);
           }
         termpty_clear_line(ty, mode, ty->w);
         break;
       case TERMPTY_CLR_ALL:
-        ty->circular_offset = 0;
         termpty_cells_clear(ty, ty->screen, ty->w * ty->h);
-        if (ty->cb.cancel_sel.func)
-          ty->cb.cancel_sel.func(ty->cb.cancel_sel.data);
+        TERMPTY_CB_CALL(ty, cancel_sel);
         break;
       default:
         break;
@@ -431,7 +493,7 @@ termpty_soft_reset_state(Termpty *ty)
    ty->termstate.had_cr_y = 0;
    ty->termstate.restrict_cursor = 0;
    termpty_reset_att(&(ty->termstate.att));
-   ty->termstate.att.link_id = 0;
+   term_link_close(ty);
    ty->termstate.charset = 0;
    ty->termstate.charsetch = 'B';
    ty->termstate.chset[0] = 'B';
@@ -461,7 +523,28 @@ termpty_soft_reset_state(Termpty *ty)
         TAB_SET(ty, i);
      }
    if (config && ty->obj)
-     termio_set_cursor_shape(ty->obj, config->cursor_shape);
+     termpty_cursor_shape_set(ty, config->cursor_shape);
+}
+
+struct _Cursor_Shape_Set {
+   Termpty *ty;
+   Cursor_Shape shape;
+};
+
+static void
+_cursor_shape_set_cb(void *data)
+{
+   struct _Cursor_Shape_Set *css = data;
+
+   termio_set_cursor_shape(css->ty->obj, css->shape);
+}
+
+void
+termpty_cursor_shape_set(Termpty *ty, Cursor_Shape shape)
+{
+   struct _Cursor_Shape_Set css = { ty, shape };
+
+   termpty_main_loop_call(ty, _cursor_shape_set_cb, &css);
 }
 
 void
@@ -509,7 +592,7 @@ termpty_move_cursor(Termpty *ty, int cx, int cy)
              /* go down */
              cells = termpty_cellrow_get(ty, cur_cy, &wlen);
              assert(cells);
-             if (cells[wlen-1].att.autowrapped)
+             if (cells[wlen-1].autowrapped)
                {
                   n_to_right += ty->w;
                }
@@ -524,7 +607,7 @@ termpty_move_cursor(Termpty *ty, int cx, int cy)
              /* go up */
              cells = termpty_cellrow_get(ty, cur_cy - 1, &wlen);
              assert(cells);
-             if (cells[wlen-1].att.autowrapped)
+             if (cells[wlen-1].autowrapped)
                {
                   n_to_right -= ty->w;
                }
@@ -0,0 +1,367 @@
+#include "private.h"
+#if defined(ENABLE_TESTS)
+#define TYBENCH 1
+#include "tytest.c"
+#include <time.h>
+#include "backlog.h"
+
+/* Replays files through the decoder, the parser and the render diff of
+ * termio, without any UI, and reports one JSON object per file and grid
+ * size on stdout */
+
+#define BENCH_GRIDS_MAX 16
+/* Render a frame every that many bytes by default */
+#define BENCH_FRAME_BYTES 65536
+
+typedef struct _Bench_Result
+{
+   size_t bytes;
+   double parse_time;
+   double render_time;
+   unsigned int frames;
+   long long allocs; /* -1 if not counted */
+   int64_t backlog_peak;
+} Bench_Result;
+
+/* {{{ Allocation counting */
+static unsigned long long _allocs = 0;
+
+#if defined(__GLIBC__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *
+malloc(size_t size)
+{
+   _allocs++;
+   return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+   _allocs++;
+   return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+   _allocs++;
+   return __libc_realloc(ptr, size);
+}
+#define BENCH_ALLOCS() ((long long)_allocs)
+#else
+/* not counted */
+#define BENCH_ALLOCS() (-1LL)
+#endif
+/* }}} */
+
+static double
+_bench_time_get(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + (ts.tv_nsec / 1000000000.0);
+}
+
+static void
+_bench_termpty_shutdown(Termpty *ty)
+{
+   termpty_backlog_free(ty);
+   eina_stringshare_del(ty->prop.title);
+   eina_stringshare_del(ty->prop.user_title);
+   eina_stringshare_del(ty->prop.icon);
+   free(ty->screen);
+   free(ty->screen2);
+   free(ty->rows);
+   free(ty->rows2);
+   free(ty->dirty.rows);
+   free(ty->dirty.changed);
+   if (ty->hl.links)
+     {
+        uint32_t i;
+
+        for (i = 0; i < ty->hl.size; i++)
+          term_link_free(ty, ty->hl.links + i);
+        free(ty->hl.links);
+     }
+   free(ty->hl.buckets);
+   termio_link_spans_free(ty);
+   termpty_styles_shutdown(ty);
+   termpty_truecolor_lut_free(ty);
+   free(ty->buf);
+   free(ty->tabs);
+   free(ty->scrolls.runs);
+   ty_sb_free(&ty->write_buffer);
+}
+
+/* Same decoding as _read_once() in termpty.c, from memory */
+static size_t
+_bench_chunk_handle(Termpty *ty, const char *data, size_t size)
+{
+   char buf[4097];
+   Eina_Unicode codepoint[4097];
+   char *rbuf = buf;
+   int i, j, len = sizeof(buf) - 1;
+
+   for (i = 0; i < (int)sizeof(ty->oldbuf) && ty->oldbuf[i] & 0x80; i++)
+     {
+        *rbuf = ty->oldbuf[i];
+        rbuf++;
+        len--;
+     }
+   if ((size_t)len > size)
+     len = size;
+   memcpy(rbuf, data, len);
+   for (i = 0; i < (int)sizeof(ty->oldbuf); i++)
+     ty->oldbuf[i] = 0;
+   size = len;
+   len += rbuf - buf;
+   buf[len] = 0;
+
+   j = utf8_to_codepoints(buf, len, codepoint,
+                          (int)sizeof(ty->oldbuf), &i);
+   if (i < len)
+     {
+        int k;
+
+        for (k = 0; k < (len - i); k++)
+          ty->oldbuf[k] = buf[i + k];
+     }
+   codepoint[j] = 0;
+   termpty_handle_buf(ty, codepoint, j);
+   return size;
+}
+
+static void
+_bench_run(const char *data, size_t size, int w, int h, size_t frame_bytes,
+           Bench_Result *res)
+{
+   size_t pos = 0, next_frame = frame_bytes;
+   int preedit_x, preedit_y;
+
+   memset(res, 0, sizeof(*res));
+   _termpty_init(&_ty, _config);
+   tytest_termio_resize(w, h);
+   termpty_resize(&_ty, w, h);
+   termpty_backlog_size_set(&_ty, _config->scrollback);
+   _sd.scroll = 0;
+
+   _allocs = 0;
+   while (pos < size)
+     {
+        double t;
+        int64_t mem;
+
+        t = _bench_time_get();
+        pos += _bench_chunk_handle(&_ty, data + pos, size - pos);
+        res->parse_time += _bench_time_get() - t;
+
+        mem = termpty_backlog_memory_get();
+        if (mem > res->backlog_peak)
+          res->backlog_peak = mem;
+
+        if ((frame_bytes) && ((pos >= next_frame) || (pos == size)))
+          {
+             t = _bench_time_get();
+             termio_internal_render(&_sd, 0, 0, &preedit_x, &preedit_y);
+             res->render_time += _bench_time_get() - t;
+             res->frames++;
+             next_frame = pos + frame_bytes;
+          }
+     }
+   res->allocs = BENCH_ALLOCS();
+   res->bytes = size;
+}
+
+static void
+_bench_json_string_print(const char *s)
+{
+   putchar('"');
+   for (; *s; s++)
+     {
+        if ((*s == '"') || (*s == '\\'))
+          printf("\\%c", *s);
+        else if ((unsigned char)*s < ' ')
+          printf("\\u%04x", (unsigned char)*s);
+        else
+          putchar(*s);
+     }
+   putchar('"');
+}
+
+static void
+_bench_result_print(const char *path, int w, int h, const Bench_Result *res)
+{
+   double cells = (double)res->frames * w * h;
+
+   printf("{\"file\":");
+   _bench_json_string_print(path);
+   printf(",\"grid\":\"%dx%d\",\"bytes\":%zu"
+          ",\"parse_seconds\":%.6f,\"parse_mb_s\":%.2f"
+          ",\"frames\":%u,\"render_seconds\":%.6f"
+          ",\"render_ns_per_cell\":%.3f"
+          ",\"allocs\":%lld,\"backlog_peak_bytes\":%lld"
+          ",\"checksum\":\"",
+          w, h, res->bytes,
+          res->parse_time,
+          (res->parse_time > 0.0) ?
+          (res->bytes / (1024.0 * 1024.0)) / res->parse_time : 0.0,
+          res->frames, res->render_time,
+          (cells > 0.0) ? (res->render_time * 1000000000.0) / cells : 0.0,
+          (long long)res->allocs, (long long)res->backlog_peak);
+   _tytest_checksum(&_ty);
+   printf("\"}\n");
+}
+
+static char *
+_bench_file_load(const char *path, size_t *sizep)
+{
+   FILE *f;
+   char *data = NULL;
+   size_t size = 0, alloc = 0, len;
+
+   f = fopen(path, "rb");
+   if (!f)
+     {
+        ERR("can not open %s: %s", path, strerror(errno));
+        return NULL;
+     }
+   do
+     {
+        if (size == alloc)
+          {
+             char *tmp;
+
+             alloc = alloc ? alloc * 2 : 1 << 20;
+             tmp = realloc(data, alloc);
+             if (!tmp)
+               {
+                  free(data);
+                  fclose(f);
+                  return NULL;
+               }
+             data = tmp;
+          }
+        len = fread(data + size, 1, alloc - size, f);
+        size += len;
+     }
+   while (len > 0);
+   fclose(f);
+   *sizep = size;
+   return data;
+}
+
+static void
+_bench_usage(const char *argv0)
+{
+   printf("Usage: %s [-g <width>x<height>]... [-f <bytes>] [-b <lines>] FILE1 [FILE2 ...]\n"
+          "\n"
+          "  -g <width>x<height>  Grid size to run the files at, can be repeated\n"
+          "                       (default: 80x24, 132x43 and 240x67)\n"
+          "  -f <bytes>  Render a frame every that many bytes, 0 to not render\n"
+          "              (default: %d)\n"
+          "  -b <lines>  Size of the backlog (default: %d)\n",
+          argv0, BENCH_FRAME_BYTES, _config->scrollback);
+}
+
+int
+main(int argc, char **argv)
+{
+   int grids[BENCH_GRIDS_MAX][2];
+   int n_grids = 0, i, ret = 0;
+   size_t frame_bytes = BENCH_FRAME_BYTES;
+   Eina_Bool has_files = EINA_FALSE;
+
+   eina_init();
+   tytest_init();
+   _log_domain = eina_log_domain_register("tybench", NULL);
+
+   _config = config_new();
+   _sd.config = _config;
+
+   for (i = 1; i < argc; i++)
+     {
+        if ((!strcmp(argv[i], "-h")) || (!strcmp(argv[i], "--help")))
+          {
+             _bench_usage(argv[0]);
+             goto end;
+          }
+        else if ((!strcmp(argv[i], "-g")) && (i + 1 < argc))
+          {
+             unsigned int w = 0, h = 0;
+
+             i++;
+             if ((sscanf(argv[i], "%ux%u", &w, &h) != 2) ||
+                 (w < 1) || (h < 1) || (n_grids >= BENCH_GRIDS_MAX))
+               {
+                  _bench_usage(argv[0]);
+                  ret = 1;
+                  goto end;
+               }
+             grids[n_grids][0] = w;
+             grids[n_grids][1] = h;
+             n_grids++;
+          }
+        else if ((!strcmp(argv[i], "-f")) && (i + 1 < argc))
+          frame_bytes = strtoul(argv[++i], NULL, 10);
+        else if ((!strcmp(argv[i], "-b")) && (i + 1 < argc))
+          _config->scrollback = atoi(argv[++i]);
+        else
+          has_files = EINA_TRUE;
+     }
+   if (!has_files)
+     {
+        _bench_usage(argv[0]);
+        ret = 1;
+        goto end;
+     }
+   if (!n_grids)
+     {
+        grids[0][0] = 80;  grids[0][1] = 24;
+        grids[1][0] = 132; grids[1][1] = 43;
+        grids[2][0] = 240; grids[2][1] = 67;
+        n_grids = 3;
+     }
+
+   for (i = 1; i < argc; i++)
+     {
+        char *data;
+        size_t size = 0;
+        int g;
+
+        if ((!strcmp(argv[i], "-g")) || (!strcmp(argv[i], "-f")) ||
+            (!strcmp(argv[i], "-b")))
+          {
+             i++;
+             continue;
+          }
+        data = _bench_file_load(argv[i], &size);
+        if (!data)
+          {
+             ret = 1;
+             continue;
+          }
+        for (g = 0; g < n_grids; g++)
+          {
+             Bench_Result res;
+
+             _bench_run(data, size, grids[g][0], grids[g][1], frame_bytes,
+                        &res);
+             _bench_result_print(argv[i], grids[g][0], grids[g][1], &res);
+             _bench_termpty_shutdown(&_ty);
+          }
+        free(data);
+     }
+
+end:
+   tytest_shutdown();
+   config_del(_config);
+   eina_shutdown();
+
+   return ret;
+}
+#endif
@@ -10,6 +10,7 @@
 #include "termpty.h"
 #include "termptyops.h"
 #include "termiointernals.h"
+#include "utf8.h"
 #include <assert.h>
 
 #ifdef TYTEST
@@ -126,6 +127,12 @@ termio_scroll_get(const Evas_Object *obj EINA_UNUSED)
    return _sd.scroll;
 }
 
+void
+termio_scroll_set(Evas_Object *obj EINA_UNUSED, int scroll)
+{
+   _sd.scroll = scroll;
+}
+
 void
 termio_size_get(const Evas_Object *obj EINA_UNUSED,
                 int *w, int *h)
@@ -161,8 +168,9 @@ termio_sel_set(Termio *sd, Eina_Bool enable)
      {
         sd->pty->selection.by_word = EINA_FALSE;
         sd->pty->selection.by_line = EINA_FALSE;
-        free(sd->pty->selection.codepoints);
-        sd->pty->selection.codepoints = NULL;
+        free(sd->pty->selection.row_hashes);
+        sd->pty->selection.row_hashes = NULL;
+        sd->pty->selection.row_hashes_count = 0;
      }
 }
 void
@@ -199,6 +207,13 @@ termio_block_activate(Evas_Object *obj EINA_UNUSED,
 {
 }
 
+void
+termio_file_send_data(Evas_Object *obj EINA_UNUSED,
+                      const Eina_Unicode *buf EINA_UNUSED,
+                      size_t blen EINA_UNUSED)
+{
+}
+
 Eina_Bool
 termio_take_selection(Evas_Object *obj,
                       Elm_Sel_Type type EINA_UNUSED)
@@ -263,6 +278,8 @@ termpty_color_class_get(Termpty *ty EINA_UNUSED, const char *key,
 static void
 _termpty_init(Termpty *ty, Config *config)
 {
+   Eina_Bool ok;
+
    memset(ty, '\0', sizeof(*ty));
    ty->config = config;
    ty->w = TY_W;
@@ -274,16 +291,28 @@ _termpty_init(Termpty *ty, Config *config)
    ty->screen2 = calloc(1, sizeof(Termcell) * ty->w * ty->h);
    assert(ty->screen);
    assert(ty->screen2);
-   ty->circular_offset = 0;
+   ty->rows = calloc(ty->h, sizeof(Termcell *));
+   ty->rows2 = calloc(ty->h, sizeof(Termcell *));
+   assert(ty->rows);
+   assert(ty->rows2);
+   termpty_screen_rows_set(ty->rows, ty->screen, ty->w, ty->h, 0);
+   termpty_screen_rows_set(ty->rows2, ty->screen2, ty->w, ty->h, 0);
+   ty->dirty.rows = calloc(1, ty->h);
+   assert(ty->dirty.rows);
+   ty->dirty.changed = calloc(ty->h, sizeof(unsigned int));
+   assert(ty->dirty.changed);
+   ty->dirty.all = 1;
    ty->fd = STDIN_FILENO;
-   ty->hl.bitmap = calloc(1, HL_LINKS_MAX / 8); /* bit map for 1 << 16 elements */
-   assert(ty->hl.bitmap);
-   /* Mark id 0 as set */
-   ty->hl.bitmap[0] = 1;
-   ty->backlog_beacon.backlog_y = 0;
-   ty->backlog_beacon.screen_y = 0;
+   ty->hl.buckets = calloc(HL_BUCKETS, sizeof(uint16_t));
+   assert(ty->hl.buckets);
+   /* id 0 means no link */
+   ty->hl.fresh = 1;
+   ok = termpty_styles_init(ty);
+   assert(ok);
+   (void)ok;
 }
 
+#ifndef TYBENCH
 int
 main(int argc EINA_UNUSED, char **argv EINA_UNUSED)
 {
@@ -342,36 +371,16 @@ main(int argc EINA_UNUSED, char **argv EINA_UNUSED)
 
         buf[len] = 0;
         // convert UTF8 to codepoint integers
-        j = 0;
-        for (i = 0; i < len;)
+        j = utf8_to_codepoints(buf, len, codepoint,
+                               (int)sizeof(_ty.oldbuf), &i);
+        if (i < len)
           {
-             int g = 0, prev_i = i;
-
-             if (buf[i])
-               {
-                  g = eina_unicode_utf8_next_get(buf, &i);
-                  if ((0xdc80 <= g) && (g <= 0xdcff) &&
-                      (len - prev_i) <= (int)sizeof(_ty.oldbuf))
-                    {
-                       int k;
-                       for (k = 0;
-                            (k < (int)sizeof(_ty.oldbuf)) &&
-                            (k < (len - prev_i));
-                            k++)
-                         {
-                            _ty.oldbuf[k] = buf[prev_i+k];
-                         }
-                       DBG("failure at %d/%d/%d", prev_i, i, len);
-                       break;
-                    }
-               }
-             else
-               {
-                  g = 0;
-                  i++;
-               }
-             codepoint[j] = g;
-             j++;
+             int k;
+
+             /* keep the incomplete sequence for the next read */
+             for (k = 0; k < (len - i); k++)
+               _ty.oldbuf[k] = buf[i + k];
+             DBG("failure at %d/%d", i, len);
           }
         codepoint[j] = 0;
         termpty_handle_buf(&_ty, codepoint, j);
@@ -391,3 +400,4 @@ main(int argc EINA_UNUSED, char **argv EINA_UNUSED)
 
    return 0;
 }
+#endif
@@ -8,9 +8,30 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <Eina.h>
 
 #include "tycommon.h"
 
+/* The file is sent through terminology escapes (ESC } ... NUL):
+ *   fr<path>  file to receive, the user picks where to save it
+ *   fv2       the sender knows version 2 of the data packets
+ *   fs<size>  size of the file
+ * The terminal answers "n\n" to refuse the file, "k\n" to get version 1
+ * of the data packets, "K\n" to get version 2:
+ *   fd<sum> <data>            version 1: 2 characters per byte, one for
+ *                             each nibble, and the sum of those
+ *                             characters.  The next packet is only sent
+ *                             once the terminal answered "k\n"
+ *   fD<seq> <crc32> <base64>  version 2: up to WINDOW packets are sent
+ *                             before waiting for an answer
+ * then fx once the whole file is sent */
+
+#define BUFSZ 37268
+/* Raw size of the data packets of version 2, a multiple of 3 not to pad
+ * the base64 */
+#define BUFSZ2 (48 * 1024)
+#define WINDOW 8
+
 static void
 print_usage(const char *argv0)
 {
@@ -45,6 +66,128 @@ echo_on(void)
    return tcsetattr(0, TCSAFLUSH, &told);
 }
 
+/* Wait for the 2 bytes of an answer of the terminal */
+static int
+answer_get(void)
+{
+   char buf[2];
+   int len = 0;
+
+   while (len < 2)
+     {
+        ssize_t res = read(0, buf + len, 2 - len);
+
+        if (res <= 0)
+          return -1;
+        len += res;
+     }
+   return buf[0];
+}
+
+static int
+send_v1(int file_fd)
+{
+   char tbuf[64];
+   unsigned char rawbuf[(BUFSZ * 2) + 128], rawbuf2[(BUFSZ * 2) + 128];
+   int pksize, pksum, bin, bout;
+
+   for (;;)
+     {
+        pksize = read(file_fd, rawbuf, BUFSZ);
+        if (pksize <= 0)
+          return 0;
+        bout = 0;
+        for (bin = 0; bin < pksize; bin++)
+          {
+             rawbuf2[bout++] = (rawbuf[bin] >> 4 ) + '@';
+             rawbuf2[bout++] = (rawbuf[bin] & 0xf) + '@';
+          }
+        rawbuf2[bout] = 0;
+        pksum = 0;
+        for (bin = 0; bin < bout; bin++)
+          {
+             pksum += rawbuf2[bin];
+          }
+        snprintf(tbuf, sizeof(tbuf), "%c}fd%i ", 0x1b, pksum);
+        if (ty_write(1, tbuf, strlen(tbuf)) != (signed)(strlen(tbuf)))
+          return -1;
+        if (ty_write(1, rawbuf2, bout + 1) != bout + 1)
+          return -1;
+        if (answer_get() != 'k')
+          return -1;
+     }
+}
+
+static size_t
+base64_encode(const unsigned char *in, size_t len, char *out)
+{
+   static const char b64[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+   char *o = out;
+   size_t i;
+
+   for (i = 0; i + 2 < len; i += 3)
+     {
+        *o++ = b64[in[i] >> 2];
+        *o++ = b64[((in[i] & 0x3) << 4) | (in[i + 1] >> 4)];
+        *o++ = b64[((in[i + 1] & 0xf) << 2) | (in[i + 2] >> 6)];
+        *o++ = b64[in[i + 2] & 0x3f];
+     }
+   if (i < len)
+     {
+        *o++ = b64[in[i] >> 2];
+        if (i + 1 < len)
+          {
+             *o++ = b64[((in[i] & 0x3) << 4) | (in[i + 1] >> 4)];
+             *o++ = b64[(in[i + 1] & 0xf) << 2];
+          }
+        else
+          {
+             *o++ = b64[(in[i] & 0x3) << 4];
+             *o++ = '=';
+          }
+        *o++ = '=';
+     }
+   return o - out;
+}
+
+static int
+send_v2(int file_fd)
+{
+   static unsigned char rawbuf[BUFSZ2];
+   static char encbuf[(BUFSZ2 / 3) * 4 + 64];
+   unsigned int seq = 0, in_flight = 0;
+   int pksize, len;
+
+   for (;;)
+     {
+        pksize = read(file_fd, rawbuf, BUFSZ2);
+        if (pksize <= 0)
+          break;
+        len = snprintf(encbuf, sizeof(encbuf), "%c}fD%u %08x ", 0x1b, seq++,
+                       eina_crc((const char *)rawbuf, pksize,
+                                0xffffffff, EINA_TRUE));
+        len += base64_encode(rawbuf, pksize, encbuf + len);
+        encbuf[len++] = 0;
+        if (ty_write(1, encbuf, len) != len)
+          return -1;
+        in_flight++;
+        /* the answers of the terminal come in order */
+        if (in_flight >= WINDOW)
+          {
+             if (answer_get() != 'k')
+               return -1;
+             in_flight--;
+          }
+     }
+   for (; in_flight > 0; in_flight--)
+     {
+        if (answer_get() != 'k')
+          return -1;
+     }
+   return 0;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -61,11 +204,8 @@ main(int argc, char **argv)
    echo_off();
    for (i = 1; i < argc; i++)
      {
-#define BUFSZ 37268
         char *path, tbuf[PATH_MAX * 3];
-        unsigned char rawbuf[(BUFSZ * 2) + 128], rawbuf2[(BUFSZ * 2) + 128];
-        char buf[4];
-        int file_fd, pksize, pksum, bin, bout;
+        int file_fd, res = -1;
 
         path = argv[i];
         snprintf(tbuf, sizeof(tbuf), "%c}fr%s", 0x1b, path);
@@ -76,51 +216,31 @@ main(int argc, char **argv)
           {
              off_t off;
 
+             snprintf(tbuf, sizeof(tbuf), "%c}fv2", 0x1b);
+             if (ty_write(1, tbuf, strlen(tbuf) + 1) != (signed)(strlen(tbuf) + 1))
+               goto err;
              off = lseek(file_fd, 0, SEEK_END);
              lseek(file_fd, 0, SEEK_SET);
              snprintf(tbuf, sizeof(tbuf), "%c}fs%llu", 0x1b, (unsigned long long)off);
              if (ty_write(1, tbuf, strlen(tbuf) + 1) != (signed)(strlen(tbuf) + 1))
                goto err;
-             for (;;)
+             /* terminals not knowing of version 2 answer "k" */
+             switch (answer_get())
                {
-                  if (read(0, buf, 2) == 2)
-                    {
-                       if (buf[0] == 'k')
-                         {
-                            pksize = read(file_fd, rawbuf, BUFSZ);
-
-                            if (pksize > 0)
-                              {
-                                 bout = 0;
-                                 for (bin = 0; bin < pksize; bin++)
-                                   {
-                                      rawbuf2[bout++] = (rawbuf[bin] >> 4 ) + '@';
-                                      rawbuf2[bout++] = (rawbuf[bin] & 0xf) + '@';
-                                   }
-                                 rawbuf2[bout] = 0;
-                                 pksum = 0;
-                                 for (bin = 0; bin < bout; bin++)
-                                   {
-                                      pksum += rawbuf2[bin];
-                                   }
-                                 snprintf(tbuf, sizeof(tbuf), "%c}fd%i ", 0x1b, pksum);
-                                 if (ty_write(1, tbuf, strlen(tbuf)) != (signed)(strlen(tbuf)))
-                                   goto err;
-                                 if (ty_write(1, rawbuf2, bout + 1) != bout + 1)
-                                   goto err;
-                              }
-                            else break;
-                         }
-                       else
-                         {
-                            echo_on();
-                            fprintf(stderr, "Send Fail\n");
-                            goto err;
-                         }
-                    }
-                  else goto err;
+                case 'k':
+                  res = send_v1(file_fd);
+                  break;
+                case 'K':
+                  res = send_v2(file_fd);
+                  break;
                }
              close(file_fd);
+             if (res < 0)
+               {
+                  echo_on();
+                  fprintf(stderr, "Send Fail\n");
+                  goto err;
+               }
           }
         snprintf(tbuf, sizeof(tbuf), "%c}fx", 0x1b);
         if (ty_write(1, tbuf, strlen(tbuf) + 1) != (signed)(strlen(tbuf) + 1))
@@ -16,6 +16,15 @@ test_textgrid_palette_get(const Evas_Object *obj,
 Evas_Textgrid_Cell *
 test_textgrid_cellrow_get(Evas_Object *obj, int y);
 
+#define evas_object_textgrid_cellrow_set  test_textgrid_cellrow_set
+void
+test_textgrid_cellrow_set(Evas_Object *obj, int y,
+                          const Evas_Textgrid_Cell *row);
+
+#define evas_object_textgrid_update_add  test_textgrid_update_add
+void
+test_textgrid_update_add(Evas_Object *obj, int x, int y, int w, int h);
+
 
 void
 tytest_termio_resize(int w, int h);
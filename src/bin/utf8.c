@@ -1,4 +1,9 @@
 #include "private.h"
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
 #include "utf8.h"
 
 int
@@ -40,3 +45,98 @@ codepoint_to_utf8(Eina_Unicode g, char *txt)
         return 0;
      }
 }
+
+/* Length of the run of bytes without the high bit set at the start of @s,
+ * looking at no more than @len bytes */
+static int
+_ascii_run_length(const unsigned char *s, int len)
+{
+   int i = 0;
+
+#ifdef __SSE2__
+   for (; i + 16 <= len; i += 16)
+     {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        int mask = _mm_movemask_epi8(v);
+
+        if (mask)
+          return i + __builtin_ctz(mask);
+     }
+#else
+   for (; i + 8 <= len; i += 8)
+     {
+        uint64_t v;
+
+        memcpy(&v, s + i, sizeof(v));
+        if (v & 0x8080808080808080ULL)
+          break;
+     }
+#endif
+   while ((i < len) && !(s[i] & 0x80))
+     i++;
+   return i;
+}
+
+#define IS_CONT(_c) (((_c) & 0xc0) == 0x80)
+
+/* Decode @len bytes of @buf into @codepoints, which must have room for @len
+ * elements. @buf must be nul-terminated at @len.
+ * Nul bytes are decoded as 0 and invalid sequences as 0xdc80 | byte, like
+ * eina_unicode_utf8_next_get() does.
+ * If such an invalid sequence starts within the last @tail bytes, it may be
+ * a sequence cut by the end of the buffer: decoding stops there and its
+ * offset is stored in @stop. Otherwise @stop is set to @len.
+ * Returns the number of codepoints written */
+int
+utf8_to_codepoints(const char *buf, int len, Eina_Unicode *codepoints,
+                   int tail, int *stop)
+{
+   const unsigned char *s = (const unsigned char *)buf;
+   int i = 0, j = 0;
+
+   while (i < len)
+     {
+        Eina_Unicode g;
+        unsigned char c = s[i];
+        int prev_i = i;
+
+        if (!(c & 0x80))
+          {
+             int n = _ascii_run_length(s + i, len - i);
+             int k;
+
+             for (k = 0; k < n; k++)
+               codepoints[j + k] = s[i + k];
+             i += n;
+             j += n;
+             continue;
+          }
+
+        /* well-formed 2 and 3 bytes sequences, anything else is left to
+         * eina */
+        if ((c >= 0xc2) && (c <= 0xdf) && IS_CONT(s[i + 1]))
+          {
+             g = ((c & 0x1f) << 6) | (s[i + 1] & 0x3f);
+             i += 2;
+          }
+        else if (((c & 0xf0) == 0xe0) &&
+                 IS_CONT(s[i + 1]) && IS_CONT(s[i + 2]) &&
+                 ((c != 0xe0) || (s[i + 1] >= 0xa0)))
+          {
+             g = ((c & 0x0f) << 12) | ((s[i + 1] & 0x3f) << 6) |
+                 (s[i + 2] & 0x3f);
+             i += 3;
+          }
+        else
+          g = eina_unicode_utf8_next_get(buf, &i);
+
+        if ((0xdc80 <= g) && (g <= 0xdcff) && ((len - prev_i) <= tail))
+          {
+             *stop = prev_i;
+             return j;
+          }
+        codepoints[j++] = g;
+     }
+   *stop = len;
+   return j;
+}
@@ -2,5 +2,7 @@
 #define _UTF8_H__ 1
 #include <Eina.h>
 int codepoint_to_utf8(Eina_Unicode g, char *txt);
+int utf8_to_codepoints(const char *buf, int len, Eina_Unicode *codepoints,
+                       int tail, int *stop);
 
 #endif
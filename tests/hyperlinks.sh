@@ -0,0 +1,29 @@
+#!/bin/sh
+
+# clear screen
+printf '\033[2J\033[H'
+
+# the same link with an id, written several times
+for i in 1 2 3; do
+   printf '\033]8;id=foo;http://example.com/\033\\foo\033]8;;\033\\ '
+done
+printf '\r\n'
+
+# same url, other id
+printf '\033]8;id=bar;http://example.com/\033\\bar\033]8;;\033\\\r\n'
+
+# the same link without an id, opened again right away
+printf '\033]8;;http://example.com/\033\\ano\033]8;;\033\\'
+printf '\033]8;;http://example.com/\033\\nymous\033]8;;\033\\\r\n'
+
+# a link that is never written with
+printf '\033]8;;http://example.com/unused\033\\\033]8;;\033\\'
+
+# more links than ids, going through the backlog
+for i in $(seq 70000); do
+   printf '\033]8;id=%s;http://example.com/%s\033\\%s\033]8;;\033\\\r\n' \
+      "$i" "$i" "$i"
+done
+
+# the first links are still known
+printf '\033]8;id=foo;http://example.com/\033\\foo\033]8;;\033\\\r\n'
@@ -0,0 +1,163 @@
+#!/bin/sh
+set -e
+set -u
+
+TYBENCH="../build/src/bin/tybench"
+CORPUSDIR=""
+UTF8TEST="../tools/UTF-8-test.txt"
+KEEP=0
+TYBENCH_ARGS=""
+
+die()
+{
+    echo "$*" 1>&2
+    exit 1
+}
+
+show_help()
+{
+    cat <<HELP_EOF
+Usage:
+
+   $0 [options] [-- tybench options] [FILE...]
+
+Generate a few corpora and replay them, along with the given files (for
+example recorded with 'script'), through tybench.  tybench outputs one JSON
+object per file and grid size.
+
+where options are:
+
+  -b, --tybench=PATH       Path to the tybench binary
+  -c, --corpusdir=PATH     Where to generate the corpora (default: a
+                           temporary directory, removed afterwards)
+  -k, --keep               Keep the generated corpora
+  -h, --help               Show this help.
+HELP_EOF
+}
+
+# Compiler output with colored diagnostics
+gen_compiler_log()
+{
+    awk 'BEGIN {
+        for (i = 0; i < 20000; i++) {
+            printf("src/bin/file%d.c:%d:%d: \033[1;31merror:\033[0m ", i % 97, i, i % 80);
+            printf("expected \033[1m\047;\047\033[0m before \033[1m\047}\047\033[0m token\n");
+            printf("  %5d |   foo_bar(baz, %d)\n        |                  \033[1;32m^\033[0m\n", i, i);
+        }
+    }'
+}
+
+# Full screen redraws with scrolling regions and cursor moves, like htop
+# or vim do
+gen_fullscreen()
+{
+    awk 'BEGIN {
+        printf("\033[?1049h\033[H\033[2J");
+        for (f = 0; f < 2000; f++) {
+            printf("\033[1;1H\033[7m  PID USER      PRI  NI  VIRT   RES  CPU%%\033[K\033[0m");
+            for (y = 2; y <= 24; y++)
+                printf("\033[%d;1H%5d \033[32mroot\033[0m      20   0 %5dM %5dK \033[1m%4.1f\033[0m\033[K",
+                       y, (f * 7 + y) % 32768, y * 13, f % 9999, (f * y) % 1000 / 10.0);
+            printf("\033[2;20r\033[20;1H\n\033[r");
+        }
+        printf("\033[?1049l");
+    }'
+}
+
+# 24-bit colored blocks
+gen_truecolor()
+{
+    awk 'BEGIN {
+        for (y = 0; y < 3000; y++) {
+            for (x = 0; x < 80; x++)
+                printf("\033[38;2;%d;%d;%dm\033[48;2;%d;%d;%dm\342\226\200",
+                       (x * 3) % 256, (y * 5) % 256, (x + y) % 256,
+                       (y * 3) % 256, (x * 5) % 256, (x * y) % 256);
+            printf("\033[0m\n");
+        }
+    }'
+}
+
+# Double width text
+gen_cjk()
+{
+    awk 'BEGIN {
+        for (y = 0; y < 20000; y++) {
+            for (x = 0; x < 30; x++)
+                printf("\344\270%c", 128 + (x + y) % 64);
+            printf(" \343\201\202\343\201\204 %d\n", y);
+        }
+    }'
+}
+
+FILES=""
+while [ $# -gt 0 ]; do
+    arg=$1
+    shift
+    option=$(echo "'$arg'" | cut -d'=' -f1 | tr -d "'")
+    value=$(echo "'$arg'" | cut -d'=' -f2- | tr -d "'")
+    if [ x"$value" = x"$option" ]; then
+        value=""
+    fi
+
+    case $option in
+        -h|-help|--help)
+            show_help
+            exit 0
+            ;;
+        -b|-tybench|--tybench)
+            if [ -z "$value" ]; then
+                value=$1
+                shift
+            fi
+            TYBENCH=$value
+            ;;
+        -c|-corpusdir|--corpusdir)
+            if [ -z "$value" ]; then
+                value=$1
+                shift
+            fi
+            CORPUSDIR=$value
+            ;;
+        -k|-keep|--keep)
+            KEEP=1
+            ;;
+        --)
+            while [ $# -gt 0 ] && [ x"${1#-}" != x"$1" ]; do
+                TYBENCH_ARGS="$TYBENCH_ARGS $1 $2"
+                shift 2
+            done
+            ;;
+        *)
+            FILES="$FILES $arg"
+            ;;
+    esac
+done
+
+if [ ! -x "$TYBENCH" ]; then
+    die "Invalid tybench binary file: $TYBENCH"
+fi
+if [ -z "$CORPUSDIR" ]; then
+    CORPUSDIR=$(mktemp -d)
+    if [ $KEEP -eq 0 ]; then
+        trap 'rm -rf "$CORPUSDIR"' EXIT
+    fi
+else
+    mkdir -p "$CORPUSDIR"
+fi
+
+gen_compiler_log > "$CORPUSDIR/compiler.log"
+gen_fullscreen > "$CORPUSDIR/fullscreen.txt"
+gen_truecolor > "$CORPUSDIR/truecolor.txt"
+gen_cjk > "$CORPUSDIR/cjk.txt"
+if [ -r "$UTF8TEST" ]; then
+    FILES="$UTF8TEST $FILES"
+fi
+
+# shellcheck disable=SC2086
+"$TYBENCH" $TYBENCH_ARGS \
+    "$CORPUSDIR/compiler.log" \
+    "$CORPUSDIR/fullscreen.txt" \
+    "$CORPUSDIR/truecolor.txt" \
+    "$CORPUSDIR/cjk.txt" \
+    $FILES
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+# clear screen
+printf '\033[2J'
+
+TEXT="The path of the righteous man is beset on all sides by the iniquities of the selfish and the tyranny of evil men. Blessed is he who, in the name of charity and good will, shepherds the weak through the valley of darkness, for he is truly his brother's keeper and the finder of lost children. And I will strike down upon thee with great vengeance and furious anger those who would attempt to poison and destroy My brothers. And you will know My name is the Lord when I lay My vengeance upon thee."
+
+# display text, autowrapped over several lines
+printf "%s\r\n%s\r\n%s\r\n" "$TEXT" "$TEXT" "$TEXT"
+# double width characters
+printf '\346\227\245\346\234\254\350\252\236 \346\227\245\346\234\254\r\n'
+# force render
+printf '\033}tr\0'
+
+## literal, case is ignored unless there is some uppercase
+printf '\033}tf;0;6;vengeance\0'
+printf '\033}tf;0;9;My\0'
+printf '\033}tf;0;9;my \0'
+printf '\033}tf;0;3;lord when\0'
+printf '\033}tf;0;0;Vengeance\0'
+printf '\033}tf;0;2;\346\227\245\346\234\254\0'
+# force render, with matches highlighted
+printf '\033}tr\0'
+
+## regular expressions
+printf '\033}tf;1;6;(great|my) vengeance\0'
+printf '\033}tf;1;3;^the path\0'
+printf '\033}tf;1;3;thee\.$\0'
+printf '\033}tf;1;0;^And\0'
+printf '\033}tf;1;1;\346\234\254.\0'
+
+# scroll the text to the backlog
+for L in $(seq 30); do
+   printf '\r\n%s' "$L"
+done
+
+# same search, looked at again
+printf '\033}tf;1;1;\346\234\254.\0'
+printf '\033}tf;0;6;vengeance\0'
+printf '\033}tr\0'
+
+# the matches in the backlog are kept while more text comes
+printf "%s\r\n" "$TEXT"
+printf '\033}tf;0;8;vengeance\0'
+for L in $(seq 30); do
+   printf '\r\n%s' "$L"
+done
+printf '\033}tf;0;8;vengeance\0'
+printf '\033}tr\0'
+
+# clear the search
+printf '\033}tf;0;0;\0'
+printf '\033}tr\0'
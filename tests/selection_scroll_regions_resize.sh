@@ -0,0 +1,49 @@
+#!/bin/sh
+
+# char width: 7
+# char height: 15
+
+# clear screen
+printf '\033[2J'
+
+# set color
+printf '\033[46;31;3m'
+
+#move to 2,0
+printf '\033[2H'
+
+# set text
+TEXT="The path of the righteous man is beset on all sides by the iniquities of the selfish and the tyranny of evil men. Blessed is he who, in the name of charity and good will, shepherds the weak through the valley of darkness, for he is truly his brother's keeper and the finder of lost children. And I will strike down upon thee with great vengeance and furious anger those who would attempt to poison and destroy My brothers. And you will know My name is the Lord when I lay My vengeance upon thee."
+
+# display text
+printf "%s\r\n%s\r\n%s" "$TEXT" "$TEXT" "$TEXT"
+
+# mouse down to start selection
+printf '\033}td;395;148;1;0;0\0'
+# mouse move
+printf '\033}tm;525;148;0\0'
+# mouse up
+printf '\033}tu;525;148;1;0;0\0'
+# force render
+printf '\033}tr\0'
+# selection is
+printf '\033}tsthe name of charity\0'
+
+# scrolls in changing regions, then a resize shrinking the screen below
+# them, with nothing telling termio about the scrolls in between
+
+# scroll region from line 12 to 20, scroll 5 lines up
+printf '\033[12;20r\033[20H\n\n\n\n\n'
+# scroll region from line 14 to 24, scroll 3 lines down
+printf '\033[14;24r\033[14H\033M\033M\033M'
+# scroll region from line 15 to 24, scroll 4 lines up
+printf '\033[15;24r\033[24H\n\n\n\n'
+# resize to 40x10
+printf '\033[8;10;40t'
+# scroll region from line 2 to 9, scroll 2 lines up
+printf '\033[2;9r\033[9H\n\n'
+# reset the scroll region
+printf '\033[r'
+
+# force render
+printf '\033}tr\0'
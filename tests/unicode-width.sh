@@ -0,0 +1,24 @@
+#!/bin/sh
+
+# fill space with E
+printf '\033#8'
+#set color
+printf '\033[46;31;3m'
+
+# combining marks of 0300..036f are skipped, others keep a cell: thai,
+# hebrew, devanagari
+printf 'a\xcc\x81a\xe0\xb8\xb1a\xd6\xb0a\xe0\xa5\x81a\n'
+# variation selectors, supplement included
+printf 'b\xef\xb8\x8fb\xf3\xa0\x84\x80b\n'
+# zero width spaces and LTR/RTL marks are skipped, other format
+# characters and the soft hyphen are shown
+printf 'c\xe2\x80\x8bc\xe2\x80\x8fc\xd8\x80c\xc2\xadc\n'
+# combining long stroke overlay
+printf 'd\xcc\xb6dd\n'
+# wide: CJK, Hangul, Tangut, fullwidth forms, enclosed ideographic
+# supplement, unassigned codepoints included
+printf '\xe4\xb8\x80\xea\xb0\x80\xf0\x97\x80\x80\xef\xbc\xa1\xf0\x9f\x89\x89e\n'
+# narrow: halfwidth forms, private use of the BMP, ambiguous
+printf '\xef\xbd\xb1\xee\x82\xa0\xc2\xa1\xe2\x88\x80f\n'
+# emoji, regional indicators included
+printf '\xf0\x9f\x98\x80\xe2\x8c\x9a\xf0\x9f\x87\xab\xf0\x9f\x87\xb7g\n'
@@ -1,11 +1,21 @@
 #!/bin/bash
 
-if [ -z "$(type -p xdotool)" ]; then
+# With --hash FILE, only regenerate the hash tables of the key names found
+# in an existing tty_keys.h, to be pasted after its "#undef KH"
+if [ "$1" = '--hash' ]; then
+	HASH_ONLY="$2"
+	if [ ! -r "$HASH_ONLY" ]; then
+		echo "Usage: $0 --hash tty_keys.h" >&2
+		exit 1
+	fi
+fi
+
+if [ -z "$HASH_ONLY" ] && [ -z "$(type -p xdotool)" ]; then
 	echo 'Install xdotool!' >&2
 	exit 1
 fi
 
-if [ -z "$(type -p numlockx)" ]; then
+if [ -z "$HASH_ONLY" ] && [ -z "$(type -p numlockx)" ]; then
 	echo 'Install numlockx!' >&2
 	exit 1
 fi
@@ -98,10 +108,68 @@ do_key() {
    fi
 }
 
+# FNV-1a of the key name $1, starting from $2, as done by _tty_key_hash()
+# in keyin.c.  The result is in $hash
+key_hash() {
+   local key="$1"
+   local i c
+
+   hash=$(( ($2 ^ ${#key}) & 0xffffffff ))
+   for (( i = 0; i < ${#key}; i++ )); do
+      printf -v c '%d' "'${key:i:1}"
+      hash=$(( ((hash ^ c) * 16777619) & 0xffffffff ))
+   done
+}
+
+# Emit a perfect hash of the key names $3..., as the seed $1_SEED, the mask
+# $1_MASK and the table $2 giving the index in the key table plus one, or 0
+do_keys_hash() {
+   local define="$1"
+   local table="$2"
+   shift 2
+   local keys=("$@")
+   local size=1 seed i slot hash
+   local -a slots
+
+   # sparse enough for a seed to be found quickly
+   while (( size < 8 * ${#keys[@]} )); do
+      size=$(( size * 2 ))
+   done
+   for (( seed = 0; ; seed++ )); do
+      slots=()
+      for (( i = 0; i < ${#keys[@]}; i++ )); do
+         key_hash "${keys[i]}" $seed
+         slot=$(( hash & (size - 1) ))
+         if [ -n "${slots[slot]}" ]; then
+            continue 2
+         fi
+         slots[slot]=$(( i + 1 ))
+      done
+      break
+   done
+
+   echo "#define ${define}_SEED $seed"
+   echo "#define ${define}_MASK $(( size - 1 ))"
+   echo "static const unsigned char ${table}[$size] = {"
+   for (( i = 0; i < size; i++ )); do
+      if (( i % 16 == 0 )); then
+         echo -n "  "
+      fi
+      echo -n "${slots[i]:-0},"
+      if (( i % 16 == 15 || i == size - 1 )); then
+         echo
+      else
+         echo -n " "
+      fi
+   done
+   echo "};"
+}
+
 do_keys_mode() {
 
 
-   local keys='F1 F2 F3 F4 F5 F6 F7 F8 F9 F10 F11 F12 Left Right Up Down Home End Insert Delete Prior Next Tab minus space Menu Find Help Select '
+   local keys='F1 F2 F3 F4 F5 F6 F7 F8 F9 F10 F11 F12 Left Right Up Down Home End Insert Delete Prior Next ISO_Left_Tab Tab minus underscore space Menu Find Help Execute Select '
+   local main_keys="$keys"
 
    echo "#define KH(in) { in, sizeof(in) - 1 }"
 
@@ -238,8 +306,26 @@ do_keys_mode() {
    #do_one_cursor_and_keypad_mode
 
    echo "#undef KH"
+
+   # shellcheck disable=SC2086
+   do_keys_hash TTY_KEYS tty_keys_slots $main_keys
+   # shellcheck disable=SC2086
+   do_keys_hash TTY_KEYS_KP tty_keys_kp_slots $keys
 }
 
+if [ -n "$HASH_ONLY" ]; then
+   # key names of the first and of the keypad tables, in order
+   # shellcheck disable=SC2046
+   do_keys_hash TTY_KEYS tty_keys_slots \
+      $(sed -n '/^static const Tty_Key tty_keys\[/,/^};/s/^  "\(.*\)",$/\1/p' \
+        "$HASH_ONLY")
+   # shellcheck disable=SC2046
+   do_keys_hash TTY_KEYS_KP tty_keys_kp_slots \
+      $(sed -n '/^static const Tty_Key tty_keys_kp_plain\[/,/^};/s/^  "\(.*\)",$/\1/p' \
+        "$HASH_ONLY")
+   exit 0
+fi
+
 cat <<END >&2
 
 Don't do anything!
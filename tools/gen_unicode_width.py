@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""
+Generate src/bin/termptydbl_data.h, the two-stage table giving the width
+class of every codepoint, and whether the terminal skips it, from the files
+of the Unicode Character Database:
+
+  https://www.unicode.org/Public/UCD/latest/ucd/EastAsianWidth.txt
+  https://www.unicode.org/Public/UCD/latest/ucd/emoji/emoji-data.txt
+  https://www.unicode.org/Public/UCD/latest/ucd/extracted/DerivedGeneralCategory.txt
+
+Usage:
+  gen_unicode_width.py EastAsianWidth.txt emoji-data.txt \\
+      DerivedGeneralCategory.txt > src/bin/termptydbl_data.h
+"""
+
+import re
+import sys
+
+# Keep in sync with termptydbl.h
+CP_WIDE = 1
+CP_AMBIGUOUS = 2
+CP_EMOJI = 3
+CP_ZERO_WIDTH = 4
+CP_COMBINING = 8
+SHIFT = 8
+
+MAX_CP = 0x110000
+
+# Codepoints skipped by termpty_text_append().  Other marks keep a cell of
+# their own, as the terminal can not draw them over the previous one
+ZERO_WIDTH_RANGES = [
+    (0x200b, 0x200f),  # zero width space and joiners, LTR/RTL marks
+]
+COMBINING_RANGES = [
+    (0x0300, 0x036f),  # combining diacritical marks
+    (0xfe00, 0xfe0f),  # variation selectors
+    (0xe0100, 0xe01ef),  # variation selectors supplement
+]
+# Blocks of ideographs where unassigned codepoints are wide, as the
+# codepoints to come
+WIDE_UNASSIGNED_RANGES = [
+    (0x1f200, 0x1f2ff),  # enclosed ideographic supplement
+]
+
+LINE_RE = re.compile(r'^([0-9A-Fa-f]+)(?:\.\.([0-9A-Fa-f]+))?\s*;\s*([\w ]+?)\s*(?:#|$)')
+MISSING_RE = re.compile(r'^#\s*@missing:\s*(.*)$')
+
+
+def ranges_get(path):
+    """Yield (first, last, value) for each line of a UCD file, the
+    @missing defaults first"""
+    missing = []
+    explicit = []
+    with open(path, encoding='utf-8') as f:
+        for line in f:
+            m = MISSING_RE.match(line)
+            if m:
+                m = LINE_RE.match(m.group(1))
+                if m:
+                    missing.append(m)
+                continue
+            m = LINE_RE.match(line)
+            if m:
+                explicit.append(m)
+    for m in missing + explicit:
+        first = int(m.group(1), 16)
+        last = int(m.group(2), 16) if m.group(2) else first
+        yield first, last, m.group(3)
+
+
+def version_get(path):
+    with open(path, encoding='utf-8') as f:
+        m = re.search(r'-(\d+\.\d+\.\d+)\.txt', f.readline())
+    return m.group(1) if m else 'unknown'
+
+
+def main(argv):
+    if len(argv) != 4 or sys.stdout.isatty():
+        sys.stderr.write(__doc__)
+        return 1
+    eaw_path, emoji_path, gc_path = argv[1:]
+
+    props = bytearray(MAX_CP)
+
+    for first, last, value in ranges_get(eaw_path):
+        if value in ('W', 'F'):
+            width = CP_WIDE
+        elif value == 'A':
+            width = CP_AMBIGUOUS
+        else:
+            width = 0
+        for cp in range(first, last + 1):
+            props[cp] = width
+    # The private use area of the BMP is ambiguous but is where powerline
+    # and icon fonts put their symbols, meant to be single width
+    for cp in range(0xe000, 0xf8ff + 1):
+        props[cp] = 0
+
+    for first, last, value in ranges_get(emoji_path):
+        if value == 'Emoji_Presentation':
+            for cp in range(first, last + 1):
+                props[cp] = CP_EMOJI
+
+    for first, last, value in ranges_get(gc_path):
+        if value != 'Cn':
+            continue
+        for wfirst, wlast in WIDE_UNASSIGNED_RANGES:
+            for cp in range(max(first, wfirst), min(last, wlast) + 1):
+                props[cp] = CP_WIDE
+
+    for ranges, flag in ((ZERO_WIDTH_RANGES, CP_ZERO_WIDTH),
+                         (COMBINING_RANGES, CP_COMBINING)):
+        for first, last in ranges:
+            for cp in range(first, last + 1):
+                props[cp] = flag
+
+    # Stage 1 gives, for each block of 1 << SHIFT codepoints, the index of
+    # its properties in stage 2, where identical blocks are shared.  Two
+    # codepoints per byte in stage 2, as the properties fit in 4 bits
+    size = 1 << SHIFT
+    blocks = []
+    index = {}
+    stage1 = []
+    for i in range(0, MAX_CP, size):
+        block = bytes(props[i:i + size])
+        if block not in index:
+            index[block] = len(blocks)
+            blocks.append(block)
+        stage1.append(index[block])
+    if len(blocks) > 256:
+        sys.stderr.write('too many blocks: %d\n' % len(blocks))
+        return 1
+
+    out = sys.stdout
+    out.write('/* /!\\ This file was generated by tools/gen_unicode_width.py\n'
+              ' * from the Unicode Character Database %s */\n'
+              % version_get(eaw_path))
+    out.write('\nconst unsigned char _termpty_cp_blocks[%#x] = {\n'
+              % len(stage1))
+    for i in range(0, len(stage1), 16):
+        out.write('   %s,\n' % ', '.join('%d' % b for b in stage1[i:i + 16]))
+    out.write('};\n\n')
+    out.write('const unsigned char _termpty_cp_props[%d << (TERMPTY_CP_SHIFT - 1)] = {\n'
+              % len(blocks))
+    for n, block in enumerate(blocks):
+        out.write('   /* %d */\n' % n)
+        packed = [block[i] | (block[i + 1] << 4) for i in range(0, size, 2)]
+        for i in range(0, len(packed), 16):
+            out.write('   %s,\n'
+                      % ', '.join('0x%02x' % b for b in packed[i:i + 16]))
+    out.write('};\n')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))